@@ -21,10 +21,34 @@
 #include <icuid/icuid_limits.h>
 #include <icuid/icuid_types.h>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#if defined(_MSC_VER)
+#define ICUID_INLINE static __inline
+#else
+#define ICUID_INLINE static __inline__
+#endif
+
+/* Users of libicuid.dll define ICUID_SHARED, static users must not */
+#if defined(_WIN32) && defined(ICUID_SHARED) && !defined(LIBICUID_INTERNAL)
+#define ICUID_DATA extern __declspec(dllimport)
+#else
+#define ICUID_DATA extern
+#endif
+
+/* Loads a pointer published by another thread */
+#if defined(__GNUC__)
+#define ICUID_LOAD_ACQUIRE(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#else
+#define ICUID_LOAD_ACQUIRE(p) (*(const void *volatile *)&(p))
+#endif
+
 /** @mainpage libicuid
  *
  * libicuid is a library that provides a C interface for the CPUID opcode
@@ -36,7 +60,16 @@ extern "C" {
  * To run the CPUID instruction, use \ref cpuid <br>
  * To get the raw CPUID info needed for CPU identification, use
  *   \ref cpuid_get_raw_data <br>
+ * To only execute the leaves that are actually needed, use
+ *   \ref cpuid_get_raw_data_lazy <br>
  * To decode that raw info use \ref icuid_identify <br>
+ * To get the raw CPUID info of every logical CPU, use
+ *   \ref cpuid_get_system_raw_data <br>
+ * To get the identification of the current CPU, cached for the lifetime
+ *   of the process, use \ref icuid_get or \ref icuid_has <br>
+ * To time code with the TSC, use \ref icuid_clock_init <br>
+ * To find out which vector width is worth using, use
+ *   \ref icuid_probe_vector_width <br>
  * </p>
  */
 
@@ -74,6 +107,34 @@ int cpuid_is_supported(void);
  */
 uint64_t icuid_xgetbv(const uint32_t xcr);
 
+/**
+ * @brief Reads the TSC with rdtscp followed by lfence
+ * @note rdtscp waits for every earlier instruction to execute, the lfence
+ *       keeps later ones from starting before the read.
+ * @warning Requires CPU_FEATURE_RDTSCP.
+ * @returns the time stamp counter
+ */
+uint64_t icuid_rdtscp(void);
+
+/**
+ * @brief Reads the TSC with rdtsc between two lfence instructions
+ * @note Serializing on Intel, and on AMD where lfence is dispatch
+ *       serializing (family 0x17 and later).
+ * @warning Requires CPU_FEATURE_SSE2.
+ * @returns the time stamp counter
+ */
+uint64_t icuid_rdtsc_lfence(void);
+
+/**
+ * @brief Reads the TSC with rdtsc between two mfence instructions
+ * @note Serializing on older AMD CPUs, where lfence isn't. The second
+ *       mfence keeps later instructions from starting before the read,
+ *       which lfence wouldn't guarantee on those CPUs.
+ * @warning Requires CPU_FEATURE_SSE2.
+ * @returns the time stamp counter
+ */
+uint64_t icuid_rdtsc_mfence(void);
+
 /**
  * @brief CPU feature bits
  *
@@ -84,7 +145,8 @@ uint64_t icuid_xgetbv(const uint32_t xcr);
  * ...
  * ret = icuid_identify(NULL, &data)
  * if (ret == ICUID_OK) {
- *     if (data->flags[CPU_FEATURE_AVX2] && data->xfeatures[XFEATURE_AVX]) {
+ *     if (icuid_flags_test(&data->flags, CPU_FEATURE_AVX2) &&
+ *         data->xfeatures[XFEATURE_AVX]) {
  *         // The CPU has AVX2 and AVX (YMM) registers are supported by the OS
  *     } else {
  *         // AVX2 unsupported
@@ -242,7 +304,7 @@ typedef enum {
     /* 12 Reserved */
     CPU_FEATURE_TSX_FORCE_ABORT,     /*!< TSX_FORCE_ABORT */
     CPU_FEATURE_SERIALIZE,           /*!< SERIALIZE instruction */
-    /* 15 Reserved */
+    CPU_FEATURE_HYBRID,              /*!< Hybrid part, see leaf 0x1A for the core type */
     CPU_FEATURE_TSXLDTRK,            /*!< TSX Suspend Load Address Tracking */
     /* 17 Reserved */
     CPU_FEATURE_PCONFIG,             /*!< Intel PCONFIG */
@@ -266,7 +328,7 @@ typedef enum {
     CPU_FEATURE_SVM,           /*!< AMD Secure Virtual Machine (AMD Only) */
     CPU_FEATURE_EXTAPIC,       /*!< Extended APIC space (AMD Only) */
     CPU_FEATURE_CR8_LEGACY,    /*!< CR8 in 32-bit mode (AMD Only) */
-    CPU_FEATURE_ABM,           /*!< Advanced Bit Manipulation (AMD Only) */
+    CPU_FEATURE_ABM,           /*!< Advanced Bit Manipulation (LZCNT) */
     CPU_FEATURE_SSE4A,         /*!< SSE 4A (AMD Only) */
     CPU_FEATURE_MISALIGNSSE,   /*!< Misaligned SSE Supported (AMD Only) */
     CPU_FEATURE_3DNOWPREFETCH, /*!< PREFETCH/PREFETCHW Support (AMD Only) */
@@ -336,9 +398,210 @@ typedef enum {
     CPU_FEATURE_SEV_ES,        /*!< SEV Encrypted State (AMD Only) */
     /* 4-31 Reserved */
 
+    /* cpuid 0x40000001, eax (KVM) */
+    CPU_FEATURE_KVM_CLOCK,          /*!< kvmclock at MSRs 0x11/0x12 */
+    CPU_FEATURE_KVM_NOP_IO_DELAY,   /*!< No delay needed on port I/O */
+    CPU_FEATURE_KVM_CLOCK2,         /*!< kvmclock at MSRs 0x4b564d00/01 */
+    CPU_FEATURE_KVM_ASYNC_PF,       /*!< Asynchronous page faults */
+    CPU_FEATURE_KVM_STEAL_TIME,     /*!< Steal time accounting */
+    CPU_FEATURE_KVM_PV_EOI,         /*!< Paravirtualized end of interrupt */
+    CPU_FEATURE_KVM_PV_UNHALT,      /*!< Paravirtualized spinlocks (vCPU kick) */
+    CPU_FEATURE_KVM_PV_TLB_FLUSH,   /*!< Paravirtualized remote TLB flush */
+    CPU_FEATURE_KVM_ASYNC_PF_VMEXIT, /*!< Async page faults delivered as #PF vmexits */
+    CPU_FEATURE_KVM_PV_SEND_IPI,    /*!< Paravirtualized send IPIs */
+    CPU_FEATURE_KVM_POLL_CONTROL,   /*!< Host-side halt polling can be disabled */
+    CPU_FEATURE_KVM_PV_SCHED_YIELD, /*!< Paravirtualized yield to a preempted vCPU */
+    CPU_FEATURE_KVM_ASYNC_PF_INT,   /*!< Async page faults delivered as interrupts */
+    CPU_FEATURE_KVM_MSI_EXT_DEST_ID, /*!< Extended destination ID in MSIs */
+    CPU_FEATURE_KVM_CLOCK_STABLE,   /*!< kvmclock is stable across vCPUs */
+
+    /* cpuid 0x40000001, edx (KVM) */
+    CPU_FEATURE_KVM_HINTS_REALTIME, /*!< vCPUs are never preempted */
+
+    /* cpuid 0x40000003, eax (Hyper-V) */
+    CPU_FEATURE_HV_TIME_REF_COUNT,  /*!< Partition reference counter MSR */
+    CPU_FEATURE_HV_SYNIC,           /*!< Synthetic interrupt controller */
+    CPU_FEATURE_HV_STIMER,          /*!< Synthetic timers */
+    CPU_FEATURE_HV_REF_TSC,         /*!< Reference TSC page (stable paravirt clock) */
+    CPU_FEATURE_HV_FREQ_MSRS,       /*!< TSC and APIC frequency MSRs */
+    CPU_FEATURE_HV_TSC_INVARIANT,   /*!< Invariant TSC across migrations */
+
+    /* cpuid 0x40000004, eax (Hyper-V recommendations) */
+    CPU_FEATURE_HV_REMOTE_TLB_FLUSH, /*!< Flush remote TLBs with a hypercall */
+    CPU_FEATURE_HV_RELAXED_TIMING,  /*!< Don't rely on watchdog timeouts */
+    CPU_FEATURE_HV_EX_PROCESSOR_MASKS, /*!< Sparse vCPU sets in hypercalls */
+
+    /* cpuid 0x40000004, ebx != 0xFFFFFFFF (Hyper-V) */
+    CPU_FEATURE_HV_SPINLOCKS,       /*!< Notify the hypervisor of long spins */
+
+    /* cpuid 0x0000000D subleaf 1, eax */
+    CPU_FEATURE_XSAVEOPT,           /*!< XSAVEOPT Instruction Supported */
+    CPU_FEATURE_XSAVEC,             /*!< XSAVEC (compacted format) Supported */
+    CPU_FEATURE_XGETBV1,            /*!< XGETBV with ECX = 1 Supported */
+    CPU_FEATURE_XSAVES,             /*!< XSAVES/XRSTORS and IA32_XSS Supported */
+    CPU_FEATURE_XFD,                /*!< Extended Feature Disable (IA32_XFD) */
+
     NUM_CPU_FEATURES,
 } cpuid_feature_t;
 
+/**
+ * @brief A set of CPU features, one bit per cpuid_feature_t packed
+ *        into 64-bit words.
+ *
+ * Usage:
+ * @code
+ * cpuid_flags_t need;
+ * int f;
+ * ...
+ * memset(&need, 0, sizeof(need));
+ * icuid_flags_set(&need, CPU_FEATURE_AVX2);
+ * icuid_flags_set(&need, CPU_FEATURE_BMI2);
+ * if (icuid_flags_subset(&need, &data->flags)) {
+ *     // The CPU has both AVX2 and BMI2
+ * }
+ * for (f = icuid_flags_next(&data->flags, 0); f < NUM_CPU_FEATURES;
+ *      f = icuid_flags_next(&data->flags, f + 1)) {
+ *     // Feature f is set
+ * }
+ * @endcode
+ */
+typedef struct {
+    uint64_t words[CPU_FLAGS_WORDS];
+} cpuid_flags_t;
+
+/** @brief Index of the lowest set bit of |x|, which must be non-zero */
+ICUID_INLINE int icuid_ctz64(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+#elif defined(_MSC_VER)
+    unsigned long i;
+    if (_BitScanForward(&i, (unsigned long)x))
+        return (int)i;
+    _BitScanForward(&i, (unsigned long)(x >> 32));
+    return (int)i + 32;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+/** @brief Returns non-zero if |feature| is in |flags| */
+ICUID_INLINE int icuid_flags_test(const cpuid_flags_t *flags,
+                                  cpuid_feature_t feature)
+{
+    return (int)((flags->words[feature >> 6] >> (feature & 63)) & 1);
+}
+
+/** @brief Adds |feature| to |flags| */
+ICUID_INLINE void icuid_flags_set(cpuid_flags_t *flags, cpuid_feature_t feature)
+{
+    flags->words[feature >> 6] |= (uint64_t)1 << (feature & 63);
+}
+
+/** @brief Removes |feature| from |flags| */
+ICUID_INLINE void icuid_flags_clear(cpuid_flags_t *flags, cpuid_feature_t feature)
+{
+    flags->words[feature >> 6] &= ~((uint64_t)1 << (feature & 63));
+}
+
+/** @brief Returns non-zero if every feature of |sub| is also in |flags| */
+ICUID_INLINE int icuid_flags_subset(const cpuid_flags_t *sub,
+                                    const cpuid_flags_t *flags)
+{
+    uint64_t missing = 0;
+    int i;
+
+    for (i = 0; i < CPU_FLAGS_WORDS; i++)
+        missing |= sub->words[i] & ~flags->words[i];
+
+    return missing == 0;
+}
+
+/** @brief Stores the features that are in both |a| and |b| in |dst| */
+ICUID_INLINE void icuid_flags_and(cpuid_flags_t *dst, const cpuid_flags_t *a,
+                                  const cpuid_flags_t *b)
+{
+    int i;
+
+    for (i = 0; i < CPU_FLAGS_WORDS; i++)
+        dst->words[i] = a->words[i] & b->words[i];
+}
+
+/** @brief Stores the features that are in |a| but not in |b| in |dst| */
+ICUID_INLINE void icuid_flags_andnot(cpuid_flags_t *dst, const cpuid_flags_t *a,
+                                     const cpuid_flags_t *b)
+{
+    int i;
+
+    for (i = 0; i < CPU_FLAGS_WORDS; i++)
+        dst->words[i] = a->words[i] & ~b->words[i];
+}
+
+/**
+ * @brief Finds the first feature in |flags| that is >= |from|
+ * @returns the feature, or NUM_CPU_FEATURES if there is none.
+ */
+ICUID_INLINE int icuid_flags_next(const cpuid_flags_t *flags, int from)
+{
+    int w = from >> 6;
+    uint64_t bits;
+
+    if (from >= NUM_CPU_FEATURES)
+        return NUM_CPU_FEATURES;
+
+    bits = flags->words[w] & (~(uint64_t)0 << (from & 63));
+    for (;;) {
+        if (bits != 0)
+            return (w << 6) + icuid_ctz64(bits);
+        if (++w >= CPU_FLAGS_WORDS)
+            return NUM_CPU_FEATURES;
+        bits = flags->words[w];
+    }
+}
+
+/**
+ * @brief A set of logical CPUs, by OS CPU number
+ */
+typedef struct {
+    uint64_t words[CPUSET_WORDS];
+} cpuid_cpuset_t;
+
+/** @brief Returns non-zero if |cpu| is in |set| */
+ICUID_INLINE int icuid_cpuset_test(const cpuid_cpuset_t *set, uint32_t cpu)
+{
+    return (int)((set->words[cpu >> 6] >> (cpu & 63)) & 1);
+}
+
+/** @brief Adds |cpu| to |set| */
+ICUID_INLINE void icuid_cpuset_set(cpuid_cpuset_t *set, uint32_t cpu)
+{
+    set->words[cpu >> 6] |= (uint64_t)1 << (cpu & 63);
+}
+
+/**
+ * @brief Finds the first CPU in |set| that is >= |from|
+ * @returns the CPU, or MAX_LOGICAL_CPUS if there is none.
+ */
+ICUID_INLINE uint32_t icuid_cpuset_next(const cpuid_cpuset_t *set, uint32_t from)
+{
+    uint32_t w = from >> 6;
+    uint64_t bits;
+
+    if (from >= MAX_LOGICAL_CPUS)
+        return MAX_LOGICAL_CPUS;
+
+    bits = set->words[w] & (~(uint64_t)0 << (from & 63));
+    for (;;) {
+        if (bits != 0)
+            return (w << 6) + (uint32_t)icuid_ctz64(bits);
+        if (++w >= CPUSET_WORDS)
+            return MAX_LOGICAL_CPUS;
+        bits = set->words[w];
+    }
+}
+
 /**
  * @brief CPU vendor, as we determined from the Vendor String
  * @note HVs such as KVM don't usually report their own
@@ -359,6 +622,20 @@ typedef enum {
     NUM_CPU_VENDORS,
 } cpu_vendor_t;
 
+/**
+ * @brief Hypervisors, as identified by the signature of leaf 0x40000000
+ */
+typedef enum {
+    HYPERVISOR_NONE = 0,  /*!< Not running on a hypervisor */
+    HYPERVISOR_UNKNOWN,   /*!< HYPERVISOR is set, but the signature is unknown */
+    HYPERVISOR_KVM,       /*!< KVM */
+    HYPERVISOR_HYPERV,    /*!< Microsoft Hyper-V, or its interface */
+    HYPERVISOR_XEN,       /*!< Xen HVM */
+    HYPERVISOR_VMWARE,    /*!< VMware */
+    HYPERVISOR_BHYVE,     /*!< FreeBSD bhyve */
+    NUM_HYPERVISORS,
+} cpu_hypervisor_t;
+
 /**
  * @brief XSAVE Features, used to determine if a particular feature is
  *        supported and enabled by the OS.
@@ -374,9 +651,46 @@ typedef enum {
     XFEATURE_Hi16_ZMM,  /*!< AVX-512: ZMM16-ZMM31 Regs State */
     XFEATURE_IA32_XSS,  /*!< Extended Supervisor State Mask (R/W) MSR State */
     XFEATURE_PKRU,      /*!< Protection Key Rights register for User pages State */
+    XFEATURE_PASID,     /*!< PASID State (supervisor) */
+    XFEATURE_CET_U,     /*!< CET: User State */
+    XFEATURE_CET_S,     /*!< CET: Supervisor State (supervisor) */
+    XFEATURE_HDC,       /*!< Hardware Duty Cycling State (supervisor) */
+    XFEATURE_UINTR,     /*!< User Interrupts State (supervisor) */
+    XFEATURE_LBR,       /*!< Last Branch Record State (supervisor) */
+    XFEATURE_HWP,       /*!< Hardware P-States State (supervisor) */
+    XFEATURE_XTILECFG,  /*!< AMX: TILECFG Register State */
+    XFEATURE_XTILEDATA, /*!< AMX: TMM0-TMM7 Regs State */
+    XFEATURE_APX,       /*!< APX: Extended GPRs R16-R31 State */
     NUM_XFEATURES,
 } xfeature_t;
 
+/**
+ * @brief x86-64 psABI microarchitecture levels
+ * @note Each level includes the ones below it. Levels v3 and v4 also
+ *       require the OS to have enabled the matching XSAVE state.
+ */
+typedef enum {
+    X86_64_LEVEL_NONE = 0, /*!< Not an x86-64 CPU */
+    X86_64_V1,             /*!< Baseline: CMOV, CX8, FPU, FXSR, MMX, SSE, SSE2, LM */
+    X86_64_V2,             /*!< v1 + CX16, LAHF, POPCNT, SSE3, SSE4.1, SSE4.2, SSSE3 */
+    X86_64_V3,             /*!< v2 + AVX, AVX2, BMI1, BMI2, F16C, FMA, LZCNT, MOVBE, OSXSAVE */
+    X86_64_V4,             /*!< v3 + AVX512F, AVX512BW, AVX512CD, AVX512DQ, AVX512VL */
+    NUM_X86_64_LEVELS,
+} x86_64_level_t;
+
+/**
+ * @brief Where a frequency in \ref cpuid_data_t was obtained from
+ */
+typedef enum {
+    FREQ_SOURCE_NONE = 0,   /*!< Unknown, the frequency is 0 */
+    FREQ_SOURCE_CPUID_15H,  /*!< Leaf 0x15 TSC ratio and crystal frequency */
+    FREQ_SOURCE_CRYSTAL,    /*!< Leaf 0x15 TSC ratio, crystal known per model */
+    FREQ_SOURCE_CPUID_16H,  /*!< Leaf 0x16 processor frequency information */
+    FREQ_SOURCE_HYPERVISOR, /*!< Hypervisor timing leaf 0x40000010 */
+    FREQ_SOURCE_BRAND,      /*!< Nominal frequency in the brand string */
+    NUM_FREQ_SOURCES,
+} cpu_freq_source_t;
+
 typedef struct {
     /**
      * Basic CPUID Information
@@ -390,6 +704,13 @@ typedef struct {
     uint32_t cpuid_ext[MAX_EXT_CPUID_LEVEL][4];
     uint32_t max_cpuid_ext_level;
 
+    /**
+     * Hypervisor CPUID Information (0x400000xx), only read if the
+     * HYPERVISOR bit is set
+     */
+    uint32_t cpuid_hv[MAX_HV_CPUID_LEVEL][4];
+    uint32_t max_cpuid_hv_level;
+
     /**
      * Intel Deterministic Cache
      */
@@ -401,8 +722,173 @@ typedef struct {
      */
     uint32_t intel_et[MAX_INTEL_ET_LEVEL][4];
     uint32_t max_intel_et_level;
+
+    /**
+     * Intel V2 Extended Topology (leaf 0x1F)
+     */
+    uint32_t intel_v2et[MAX_INTEL_V2ET_LEVEL][4];
+    uint32_t max_intel_v2et_level;
+
+    /**
+     * AMD Cache Topology (leaf 0x8000001D), only valid if TOPOEXT is set
+     */
+    uint32_t amd_dc[MAX_AMD_DC_LEVEL][4];
+    uint32_t max_amd_dc_level;
+
+    /**
+     * XSAVE State Components (leaf 0xD), xsave[i] is subleaf i
+     */
+    uint32_t xsave[MAX_XSAVE_LEVEL][4];
+    uint32_t max_xsave_level;
+
+    /**
+     * Extended Control Registers, only read if OSXSAVE is set.
+     * xgetbv[0] is XCR0: xgetbv[0][0] = EAX (low half), xgetbv[0][1] = EDX
+     */
+    uint32_t xgetbv[MAX_XGETBV_LEVEL][4];
+    uint32_t max_xgetbv_level;
+
+    /**
+     * Lazy fetching state, see \ref cpuid_get_raw_data_lazy.
+     * While lazy is set only the leaves marked in the fetched
+     * bitmaps have been executed, the rest are executed on first use.
+     */
+    uint32_t lazy;
+    uint32_t cpuid_fetched[(MAX_CPUID_LEVEL + 31) / 32];
+    uint32_t cpuid_ext_fetched[(MAX_EXT_CPUID_LEVEL + 31) / 32];
+    uint32_t cpuid_hv_fetched[(MAX_HV_CPUID_LEVEL + 31) / 32];
+    uint32_t subleaf_fetched;
 } cpuid_raw_data_t;
 
+/**
+ * @brief Core types of hybrid CPUs, as reported by leaf 0x1A
+ */
+typedef enum {
+    CORE_TYPE_UNKNOWN = 0,    /*!< Not a hybrid CPU */
+    CORE_TYPE_ATOM = 0x20,    /*!< Efficient core (E-core) */
+    CORE_TYPE_CORE = 0x40,    /*!< Performance core (P-core) */
+} cpu_core_type_t;
+
+/**
+ * @brief Cache types, as reported by the deterministic cache leaves
+ */
+typedef enum {
+    CACHE_TYPE_NULL = 0,        /*!< No more caches */
+    CACHE_TYPE_DATA,            /*!< Data cache */
+    CACHE_TYPE_INSTRUCTION,     /*!< Instruction cache */
+    CACHE_TYPE_UNIFIED,         /*!< Unified cache */
+} cpu_cache_type_t;
+
+/**
+ * @brief Levels of the CPU topology, from a hardware thread up to the package
+ */
+typedef enum {
+    TOPO_LEVEL_SMT = 0,  /*!< Logical CPU (hardware thread) of a core */
+    TOPO_LEVEL_CORE,     /*!< Core of a module */
+    TOPO_LEVEL_MODULE,   /*!< Module of a tile */
+    TOPO_LEVEL_TILE,     /*!< Tile of a die */
+    TOPO_LEVEL_DIE,      /*!< Die of a package, including any die group */
+    TOPO_LEVEL_PACKAGE,  /*!< Package (socket) */
+    NUM_TOPO_LEVELS,
+} topo_level_t;
+
+/**
+ * @brief How \ref cpuid_get_system_raw_data reaches every logical CPU
+ */
+typedef enum {
+    ICUID_ENUM_AUTO = 0, /*!< Pinned threads, falling back to the CPUID device */
+    ICUID_ENUM_THREADS,  /*!< Pin a worker thread to each logical CPU in parallel */
+    ICUID_ENUM_DEVICE,   /*!< Read /dev/cpu/N/cpuid (Linux, usually needs root) */
+} cpuid_enum_method_t;
+
+/**
+ * @brief Thread placement policies of \ref icuid_plan_affinity
+ *
+ * Except for ICUID_AFFINITY_COMPACT_LLC, every policy places one thread on
+ * each physical core before it uses a second SMT sibling of any core.
+ */
+typedef enum {
+    /** Round-robin over the last level caches, e.g. the CCXs of Zen */
+    ICUID_AFFINITY_SPREAD_LLC = 0,
+    /**
+     * Fill one last level cache, its cores first and then their SMT
+     * siblings, before moving to the next
+     */
+    ICUID_AFFINITY_COMPACT_LLC,
+    /** One thread per physical core in topology order */
+    ICUID_AFFINITY_PHYSICAL_CORES,
+    /** Performance cores first, then efficiency cores on hybrid parts */
+    ICUID_AFFINITY_PCORES_FIRST,
+    NUM_AFFINITY_POLICIES,
+} cpuid_affinity_policy_t;
+
+/**
+ * @brief Raw CPUID info of a single logical CPU
+ */
+typedef struct {
+    /** Logical CPU number, as used by the OS */
+    uint32_t cpu;
+
+    /** x2APIC ID if leaf 0xB is supported, the initial APIC ID otherwise */
+    uint32_t apic_id;
+
+    /** Raw CPUID info collected on this CPU */
+    cpuid_raw_data_t raw;
+} cpuid_cpu_raw_t;
+
+/**
+ * @brief A CPUID register whose value isn't the same on every logical CPU.
+ *        Per-CPU fields, e.g. APIC IDs, are not compared.
+ */
+typedef struct {
+    uint32_t leaf;      /*!< CPUID leaf */
+    uint32_t subleaf;   /*!< CPUID subleaf, 0 for leaves without subleaves */
+    uint32_t reg;       /*!< Register: 0 = EAX, 1 = EBX, 2 = ECX, 3 = EDX */
+    uint32_t mask;      /*!< Bits that differ from the first CPU */
+    uint32_t num_cpus;  /*!< Number of CPUs that differ from the first CPU */
+    uint32_t first_cpu; /*!< Index in cpus[] of the first CPU that differs */
+} cpuid_raw_diff_t;
+
+/**
+ * @brief Raw CPUID info of every logical CPU the process may run on
+ */
+typedef struct {
+    /** Number of logical CPUs in cpus[] */
+    uint32_t num_cpus;
+
+    /** Raw CPUID info of every CPU, ordered by OS CPU number */
+    cpuid_cpu_raw_t *cpus;
+
+    /** Number of registers in diffs[] */
+    uint32_t num_diffs;
+
+    /** Registers that differ between CPUs, empty on a homogeneous system */
+    cpuid_raw_diff_t *diffs;
+} cpuid_system_raw_t;
+
+/**
+ * @brief Size and location of an XSAVE state component (leaf 0xD)
+ */
+typedef struct {
+    /** Size in bytes, 0 if the CPU doesn't support the component */
+    uint32_t size;
+
+    /**
+     * Offset in the standard (XSAVE) format area, 0 for supervisor
+     * components, which only XSAVES saves
+     */
+    uint32_t offset;
+
+    /** Managed through IA32_XSS rather than XCR0 */
+    uint8_t supervisor;
+
+    /** Starts on a 64 byte boundary in the compacted (XSAVEC/XSAVES) format */
+    uint8_t align64;
+
+    /** Can be disabled through IA32_XFD, see CPU_FEATURE_XFD */
+    uint8_t xfd;
+} cpuid_xsave_component_t;
+
 typedef struct {
     /** Contains the vendor string */
     char vendor_str[VENDOR_STR_MAX];
@@ -506,11 +992,218 @@ typedef struct {
 
     /** XSAVE features */
     uint8_t xfeatures[XFEATURE_FLAGS_MAX];
-    
-    /** Contains the feature flags */
-    uint8_t flags[CPU_FLAGS_MAX];
+
+    /** Core type of the CPU on a hybrid part, CORE_TYPE_UNKNOWN otherwise */
+    cpu_core_type_t core_type;
+
+    /** Native model ID of the core type on a hybrid part, 0 otherwise */
+    uint32_t native_model_id;
+
+    /** Highest x86-64 psABI level the CPU and OS satisfy */
+    x86_64_level_t x86_64_level;
+
+    /**
+     * Features that keep the CPU from the next x86-64 psABI level.
+     * Empty if x86_64_level is X86_64_V4.
+     */
+    cpuid_flags_t x86_64_missing;
+
+    /**
+     * XSAVE state components, as (1 << xfeature_t), that the OS would
+     * have to enable for the next x86-64 psABI level.
+     */
+    uint32_t x86_64_missing_xfeatures;
+
+    /**
+     * TSC frequency in Hz, 0 if unknown. Converts rdtsc ticks to time
+     * without calibration, see tsc_frequency_source for how exact it is.
+     */
+    uint64_t tsc_frequency;
+
+    /** Where tsc_frequency was obtained from */
+    cpu_freq_source_t tsc_frequency_source;
+
+    /** Core crystal clock frequency in Hz (leaf 0x15), 0 if unknown */
+    uint32_t crystal_frequency;
+
+    /** Base (nominal) frequency in MHz, 0 if unknown */
+    uint32_t base_frequency;
+
+    /** Where base_frequency was obtained from */
+    cpu_freq_source_t base_frequency_source;
+
+    /** Maximum frequency in MHz (leaf 0x16), 0 if unknown */
+    uint32_t max_frequency;
+
+    /**
+     * Bus (reference) frequency in MHz from leaf 0x16, or the APIC bus
+     * frequency reported by the hypervisor, 0 if unknown
+     */
+    uint32_t bus_frequency;
+
+    /** Hypervisor the CPU is virtualized by, HYPERVISOR_NONE on bare metal */
+    cpu_hypervisor_t hypervisor;
+
+    /**
+     * Signature of leaf 0x40000000, e.g. "KVMKVMKVM", empty on bare metal.
+     * Its paravirtualization features are in flags, e.g.
+     * CPU_FEATURE_KVM_PV_UNHALT or CPU_FEATURE_HV_REF_TSC.
+     */
+    char hypervisor_str[VENDOR_STR_MAX];
+
+    /**
+     * Size in bytes of the XSAVE area for the components enabled in XCR0,
+     * what XSAVE or XSAVEOPT store. 0 if the OS hasn't enabled XSAVE.
+     */
+    uint32_t xsave_size;
+
+    /** Size of the XSAVE area if every user component was enabled */
+    uint32_t xsave_max_size;
+
+    /**
+     * Size in bytes of the compacted area XSAVEC stores for the components
+     * enabled in XCR0, 0 without XSAVEC
+     */
+    uint32_t xsavec_size;
+
+    /**
+     * Size in bytes of the area XSAVES stores for XCR0 | IA32_XSS, as set
+     * by the OS, 0 without XSAVES
+     */
+    uint32_t xsaves_size;
+
+    /** User (XCR0) components supported by the CPU, as (1 << xfeature_t) */
+    uint64_t xsave_user_mask;
+
+    /** Supervisor (IA32_XSS) components supported by the CPU */
+    uint64_t xsave_supervisor_mask;
+
+    /** Per state component sizes and offsets, indexed by xfeature_t */
+    cpuid_xsave_component_t xsave_components[XFEATURE_FLAGS_MAX];
+
+    /** Contains the feature flags, see \ref icuid_flags_test */
+    cpuid_flags_t flags;
 } cpuid_data_t;
 
+/**
+ * @brief Identification of a single logical CPU
+ */
+typedef struct {
+    /** Logical CPU number, as used by the OS */
+    uint32_t cpu;
+
+    /** x2APIC ID if leaf 0xB is supported, the initial APIC ID otherwise */
+    uint32_t apic_id;
+
+    /** Core type, see \ref cpuid_data_t */
+    cpu_core_type_t core_type;
+
+    /** Native model ID, see \ref cpuid_data_t */
+    uint32_t native_model_id;
+
+    /** Index of the core type of this CPU in cpuid_system_data_t.core_types */
+    uint32_t core_type_index;
+
+    /**
+     * Position of this CPU in the topology, decomposed from its APIC ID
+     * using leaf 0x1F, leaf 0xB or the AMD/legacy leaves. topo_id[level] is
+     * the ID of the level within its parent, e.g. topo_id[TOPO_LEVEL_SMT]
+     * is the thread within its core. IDs need not be contiguous, and are 0
+     * for levels the CPU doesn't report.
+     */
+    uint32_t topo_id[NUM_TOPO_LEVELS];
+
+    /** AMD compute unit ID from leaf 0x8000001E, 0 otherwise */
+    uint32_t compute_unit_id;
+
+    /** AMD node ID from leaf 0x8000001E, 0 otherwise */
+    uint32_t node_id;
+} cpuid_cpu_data_t;
+
+/**
+ * @brief The logical CPUs of one core type, e.g. all the P-cores
+ */
+typedef struct {
+    /** Core type of these CPUs, CORE_TYPE_UNKNOWN on non-hybrid parts */
+    cpu_core_type_t core_type;
+
+    /** Native model ID of these CPUs */
+    uint32_t native_model_id;
+
+    /** Number of physical cores of this type */
+    uint32_t cores;
+
+    /** Number of logical CPUs of this type */
+    uint32_t logical_cpus;
+
+    /** The logical CPUs of this type */
+    cpuid_cpuset_t cpus;
+
+    /**
+     * Identification of the first CPU of this type, e.g. its cache
+     * geometry, as seen from a core of this type.
+     */
+    cpuid_data_t data;
+} cpuid_core_type_data_t;
+
+/**
+ * @brief One instance of a cache and the logical CPUs sharing it, e.g. the
+ *        L3 of one CCX on Zen
+ */
+typedef struct {
+    /** Cache level, 1 for L1 */
+    uint32_t level;
+
+    /** Data, instruction or unified cache */
+    cpu_cache_type_t type;
+
+    /** Size in KB */
+    uint32_t size;
+
+    /** Number of logical CPUs sharing this cache */
+    uint32_t logical_cpus;
+
+    /** The logical CPUs sharing this cache */
+    cpuid_cpuset_t cpus;
+} cpuid_cache_domain_t;
+
+/**
+ * @brief Identification of every logical CPU the process may run on
+ */
+typedef struct {
+    /** Number of logical CPUs in cpus[] */
+    uint32_t num_cpus;
+
+    /** Identification of every CPU, ordered by OS CPU number */
+    cpuid_cpu_data_t *cpus;
+
+    /**
+     * Number of instances of each topology level, e.g.
+     * topo_count[TOPO_LEVEL_CORE] is the number of cores in the system and
+     * topo_count[TOPO_LEVEL_SMT] the number of logical CPUs. A level the
+     * CPU doesn't report has one instance per instance of its parent.
+     */
+    uint32_t topo_count[NUM_TOPO_LEVELS];
+
+    /** Number of cache instances in caches[] */
+    uint32_t num_caches;
+
+    /**
+     * Every cache instance, ordered by level, type and first CPU. CPUs
+     * are grouped by the APIC ID bits above the number of logical
+     * processors sharing the cache (EAX[25:14] of leaf 4 on Intel, of
+     * leaf 0x8000001D on AMD). AMD CPUs without TOPOEXT are assumed to
+     * share the L3 across the whole package.
+     */
+    cpuid_cache_domain_t *caches;
+
+    /** Number of different core types, 1 on non-hybrid parts */
+    uint32_t num_core_types;
+
+    /** The CPUs grouped by core type and native model ID */
+    cpuid_core_type_data_t core_types[MAX_CORE_TYPES];
+} cpuid_system_data_t;
+
 /**
  * @brief Returns the short form of the CPU feature flag
  * @param feature [in] - the feature, whose short form is desired
@@ -518,6 +1211,43 @@ typedef struct {
  */
 const char *cpu_feature_str(cpuid_feature_t feature);
 
+/**
+ * @brief Looks a CPU feature flag up by name, ignoring case
+ * @param name [in] - the short form returned by \ref cpu_feature_str, or
+ *                    the name /proc/cpuinfo or GCC's
+ *                    __builtin_cpu_supports() use for it; e.g. "sse4_1"
+ * @returns the feature, or NUM_CPU_FEATURES if the name is unknown
+ */
+cpuid_feature_t cpu_feature_from_str(const char *name);
+
+/**
+ * @brief Returns the name of an x86-64 psABI level
+ * @param level [in] - the level, whose name is desired
+ * @returns a (const char *) string usable with -march; e.g. "x86-64-v3"
+ */
+const char *x86_64_level_str(x86_64_level_t level);
+
+/**
+ * @brief Returns the name of a hybrid core type
+ * @param type [in] - the core type, whose name is desired
+ * @returns a (const char *) string of the core type; e.g. "P-core"
+ */
+const char *core_type_str(cpu_core_type_t type);
+
+/**
+ * @brief Returns the name of a frequency source
+ * @param source [in] - the source, whose name is desired
+ * @returns a (const char *) string of the source; e.g. "cpuid 0x15"
+ */
+const char *freq_source_str(cpu_freq_source_t source);
+
+/**
+ * @brief Returns the name of a hypervisor
+ * @param hypervisor [in] - the hypervisor, whose name is desired
+ * @returns a (const char *) string of the hypervisor; e.g. "KVM"
+ */
+const char *hypervisor_name(cpu_hypervisor_t hypervisor);
+
 /**
  * @brief Obtains the raw CPUID info from the CPU
  * @param raw [in] - a pointer to a cpuid_raw_data_t structure
@@ -527,6 +1257,67 @@ const char *cpu_feature_str(cpuid_feature_t feature);
  */
 int cpuid_get_raw_data(cpuid_raw_data_t *raw);
 
+/**
+ * @brief Prepares a raw CPUID structure for lazy collection
+ * @param raw [in] - a pointer to a cpuid_raw_data_t structure
+ * @note Only leaf 0 and leaf 0x80000000 are executed here. Every other
+ *       leaf (and subleaf enumeration) is executed the first time it is
+ *       needed by \ref icuid_identify or \ref cpuid_raw_leaf and then
+ *       memoized in |raw|. Since a lazy |raw| is filled in as it is used
+ *       it must not be shared between threads, and it always describes
+ *       the CPU it is used on, not the one it was created on.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int cpuid_get_raw_data_lazy(cpuid_raw_data_t *raw);
+
+/**
+ * @brief Executes every leaf of a lazily collected raw CPUID structure
+ * @param raw [in] - a pointer to a cpuid_raw_data_t structure obtained by
+ *                   \ref cpuid_get_raw_data_lazy
+ * @note Afterwards |raw| is equivalent to one obtained by
+ *       \ref cpuid_get_raw_data, e.g. for dumping. Does nothing if |raw|
+ *       is not lazy.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int cpuid_materialize_raw_data(cpuid_raw_data_t *raw);
+
+/**
+ * @brief Reads a single leaf from a raw CPUID structure
+ * @param raw [in] - a pointer to a cpuid_raw_data_t structure
+ * @param leaf [in] - a basic (0x0000xxxx), hypervisor (0x4000xxxx) or
+ *                    extended (0x8000xxxx) leaf
+ * @param regs [out] - the leaf registers. regs[0] = EAX, regs[1] = EBX, ...
+ * @note If |raw| is lazy and the leaf wasn't fetched yet it is executed now.
+ *       Leaves above the maximum level reported by the CPU read as zero.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int cpuid_raw_leaf(cpuid_raw_data_t *raw, uint32_t leaf, uint32_t *regs);
+
+/**
+ * @brief Obtains the raw CPUID info of every logical CPU
+ * @param sys [out] - a pointer to a cpuid_system_raw_t structure, which must
+ *                    be freed with \ref cpuid_free_system_raw_data
+ * @param method [in] - how to run cpuid on the other CPUs
+ * @note Only the CPUs in the affinity mask of the process are enumerated
+ *       with ICUID_ENUM_THREADS, the calling thread's own affinity is not
+ *       changed. ICUID_ENUM_DEVICE enumerates every online CPU. On Windows
+ *       only the processor group of the process is enumerated.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int cpuid_get_system_raw_data(cpuid_system_raw_t *sys,
+                              cpuid_enum_method_t method);
+
+/**
+ * @brief Frees the memory of a cpuid_system_raw_t structure
+ * @param sys [in] - a pointer to a cpuid_system_raw_t structure obtained by
+ *                   \ref cpuid_get_system_raw_data
+ */
+void cpuid_free_system_raw_data(cpuid_system_raw_t *sys);
+
 /**
  * @brief Writes the raw CPUID info to a file or stdout
  * @param raw [in] - a pointer to a cpuid_raw_data_t structure
@@ -555,20 +1346,544 @@ int cpuid_serialize_raw_data(cpuid_raw_data_t *raw, const char *file);
  */
 int cpuid_deserialize_raw_data(cpuid_raw_data_t *raw, const char *file);
 
+/**
+ * @brief Parses raw CPUID info in the text format of
+ *        \ref cpuid_deserialize_raw_data from memory
+ * @param buf [in] - the text, it doesn't have to be NUL terminated
+ * @param len [in] - the length of buf in bytes
+ * @param raw [out] - a pointer to a cpuid_raw_data_t structure
+ * @note Parses in a single pass without allocating or copying and keeps
+ *       no state between calls, so it can be called from many threads.
+ *       Lines of unknown tables are ignored, as with
+ *       \ref cpuid_serialize_raw_data.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_parse_raw_buffer(const char *buf, size_t len, cpuid_raw_data_t *raw);
+
+/**
+ * @brief Writes raw CPUID info in the text format of
+ *        \ref cpuid_deserialize_raw_data to memory
+ * @param raw [in] - the raw CPUID info, not collected lazily (see
+ *                   \ref cpuid_materialize_raw_data)
+ * @param buf [out] - where to write the text, or NULL to only get its size
+ * @param size [in,out] - the size of buf, set to the size of the text
+ * @returns ICUID_OK if successful, ICUID_ERROR_MEMORY if buf is too small,
+ *          and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_raw_to_text(const cpuid_raw_data_t *raw, char *buf, size_t *size);
+
+#define ICUID_BINARY_MAGIC   "ICRD"
+#define ICUID_BINARY_VERSION 1
+/** Leaf of the entries holding XCRs, their subleaf is the XCR number */
+#define ICUID_BINARY_XCR     0xFFFFFFFF
+/** The entry is a leaf read with subleaf 0, e.g. cpuid[4] */
+#define ICUID_BINARY_LEAF    0x1
+/** The entry is a subleaf of an enumerated leaf, e.g. intel_dc[0] */
+#define ICUID_BINARY_SUBLEAF 0x2
+
+/**
+ * @brief Header of a binary raw CPUID dump, see \ref icuid_raw_to_binary
+ * @note All fields are little endian. Readers must step over headers and
+ *       entries by header_size and entry_size, later versions may grow them.
+ */
+typedef struct {
+    char magic[4];        /*!< ICUID_BINARY_MAGIC */
+    uint16_t version;     /*!< ICUID_BINARY_VERSION */
+    uint16_t header_size; /*!< Offset of the first entry */
+    uint32_t entry_size;  /*!< Size of each entry */
+    uint32_t num_entries; /*!< Number of entries */
+} icuid_binary_header_t;
+
+/**
+ * @brief Entry of a binary raw CPUID dump. Entries are sorted by leaf,
+ *        then subleaf, and rows whose registers are all zero are left out.
+ */
+typedef struct {
+    uint32_t leaf;    /*!< CPUID leaf, or ICUID_BINARY_XCR */
+    uint32_t subleaf; /*!< CPUID subleaf, or XCR number */
+    uint32_t tables;  /*!< ICUID_BINARY_LEAF and/or ICUID_BINARY_SUBLEAF */
+    uint32_t regs[4]; /*!< EAX, EBX, ECX, EDX */
+} icuid_binary_entry_t;
+
+/**
+ * @brief Writes raw CPUID info in the binary dump format
+ * @param raw [in] - the raw CPUID info, not collected lazily (see
+ *                   \ref cpuid_materialize_raw_data)
+ * @param buf [out] - where to write the dump, or NULL to only get its size
+ * @param size [in,out] - the size of buf, set to the size of the dump
+ * @note The dump is a \ref icuid_binary_header_t followed by a sorted,
+ *       sparse table of \ref icuid_binary_entry_t. It converts to and from
+ *       the text format without loss.
+ * @returns ICUID_OK if successful, ICUID_ERROR_MEMORY if buf is too small,
+ *          and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_raw_to_binary(const cpuid_raw_data_t *raw, void *buf, size_t *size);
+
+/**
+ * @brief Reads raw CPUID info from a binary dump
+ * @param buf [in] - the dump, e.g. a mapped file
+ * @param size [in] - the size of buf
+ * @param raw [out] - a pointer to a cpuid_raw_data_t structure
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_raw_from_binary(const void *buf, size_t size, cpuid_raw_data_t *raw);
+
+/**
+ * @brief Looks a leaf up in a binary dump in place, without reading it
+ *        into a cpuid_raw_data_t
+ * @param buf [in] - the dump, e.g. a mapped file
+ * @param size [in] - the size of buf
+ * @param leaf [in] - the CPUID leaf, or ICUID_BINARY_XCR
+ * @param subleaf [in] - the CPUID subleaf, or the XCR number
+ * @param regs [out] - EAX, EBX, ECX and EDX, all zero if the dump has no
+ *                     such entry
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_binary_leaf(const void *buf, size_t size, uint32_t leaf,
+                      uint32_t subleaf, uint32_t regs[4]);
+
+#define ICUID_ARCHIVE_MAGIC       "ICRA"
+#define ICUID_ARCHIVE_INDEX_MAGIC "ICRX"
+#define ICUID_ARCHIVE_VERSION     2
+#define ICUID_HOSTNAME_LEN        64
+
+/**
+ * @brief A record of a raw CPUID archive. Each record is stored as this
+ *        structure followed by a binary dump (see \ref icuid_raw_to_binary),
+ *        and the index at the end of the archive holds a copy of it.
+ */
+typedef struct {
+    char hostname[ICUID_HOSTNAME_LEN]; /*!< Machine, NUL terminated */
+    uint64_t timestamp; /*!< When the data was collected, seconds since 1970 */
+    uint32_t cpu;       /*!< Logical CPU the data was collected on */
+    uint32_t size;      /*!< Size of the record, set by the library */
+    uint64_t offset;    /*!< Offset of the record, set by the library */
+} icuid_archive_entry_t;
+
+/**
+ * @brief An archive opened for reading with \ref icuid_archive_open
+ */
+typedef struct {
+    /** Number of records in index[] */
+    uint32_t num_records;
+
+    /** Every record, sorted by hostname, CPU and then timestamp */
+    icuid_archive_entry_t *index;
+
+    /** Offset of the next record \ref icuid_archive_next reads */
+    uint64_t next;
+
+    /** Number of records \ref icuid_archive_next has read */
+    uint32_t num_read;
+
+    /** Offset of the index, records end there */
+    uint64_t index_offset;
+
+    /** The archive file */
+    void *fp;
+} icuid_archive_t;
+
+/**
+ * @brief Appends raw CPUID records to an archive, creating it if needed
+ * @param file [in] - the archive file
+ * @param meta [in] - hostname, timestamp and CPU of each record
+ * @param raw [in] - raw CPUID info of each record, not collected lazily
+ * @param count [in] - the number of records
+ * @note A new index is written once per call and the old one is left
+ *       behind, append in batches where possible, e.g. every logical CPU
+ *       of a machine at once.
+ * @note The archive is locked while appending, so concurrent appends are
+ *       serialized. An append that fails or is interrupted leaves the
+ *       records already in the archive readable.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_archive_append(const char *file, const icuid_archive_entry_t *meta,
+                         const cpuid_raw_data_t *raw, uint32_t count);
+
+/**
+ * @brief Opens an archive and reads its index
+ * @param ar [out] - a pointer to an icuid_archive_t structure, which must be
+ *                   closed with \ref icuid_archive_close
+ * @param file [in] - the archive file
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_archive_open(icuid_archive_t *ar, const char *file);
+
+/**
+ * @brief Reads the next record in the order they were appended
+ * @param ar [in] - an archive opened with \ref icuid_archive_open
+ * @param meta [out] - the record's metadata
+ * @param raw [out] - the record's raw CPUID info
+ * @returns ICUID_OK if successful, ICUID_ERROR_NOT_FOUND after the last
+ *          record, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_archive_next(icuid_archive_t *ar, icuid_archive_entry_t *meta,
+                       cpuid_raw_data_t *raw);
+
+/**
+ * @brief Reads the latest record of a logical CPU of a machine, seeking
+ *        straight to it through the index
+ * @param ar [in] - an archive opened with \ref icuid_archive_open
+ * @param hostname [in] - the machine
+ * @param cpu [in] - the logical CPU
+ * @param meta [out] - the record's metadata
+ * @param raw [out] - the record's raw CPUID info
+ * @returns ICUID_OK if successful, ICUID_ERROR_NOT_FOUND if the archive has
+ *          no such record, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_archive_find(icuid_archive_t *ar, const char *hostname, uint32_t cpu,
+                       icuid_archive_entry_t *meta, cpuid_raw_data_t *raw);
+
+/**
+ * @brief Closes an archive
+ * @param ar [in] - an archive opened with \ref icuid_archive_open
+ */
+void icuid_archive_close(icuid_archive_t *ar);
+
 /**
  * @brief Identifies the CPU
  * @param raw [in] - a pointer to the raw CPUID data, which is obtained
  *              by cpuid_get_raw_data or by passing NULL, in which case
- *              the function calls cpuid_get_raw_data itself.
+ *              the function collects it lazily itself, only executing
+ *              the leaves it needs.
  * @param data [out] - the decoded CPU information
  * @note This function will not fail if some information collected is wrong
  *       due to error or unsupported info.
+ * @note Unless raw was collected lazily, only raw is read: neither CPUID
+ *       nor XGETBV is executed, so dumps of other machines may be
+ *       identified on any thread.
  * @returns ICUID_OK if successful, and some other error code otherwise.
  *          The error message can be obtained by calling \ref icuid_errorstr.
  *
  */
 int icuid_identify(cpuid_raw_data_t *raw, cpuid_data_t *data);
 
+/**
+ * @brief Identifies many CPUs, e.g. a fleet's dumps, on a pool of threads
+ * @param raw [in] - n raw CPUID records, none collected lazily
+ * @param data [out] - the decoded info of each record, all zero for a
+ *                     record that failed
+ * @param status [out] - n results, ICUID_OK or the error of each record,
+ *                       e.g. ICUID_ERROR_INVALID for a lazy one. May be NULL.
+ * @param n [in] - the number of records
+ * @param nthreads [in] - the number of threads to use including the calling
+ *                        one, 0 for one per CPU the process may run on
+ * @note A failing record doesn't stop the others from being identified.
+ * @returns ICUID_OK if every record was identified, and the error of the
+ *          first record that failed otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_identify_batch(cpuid_raw_data_t *raw, cpuid_data_t *data,
+                         int *status, uint32_t n, uint32_t nthreads);
+
+/**
+ * @brief Compiles a text codename database into the file format read by
+ *        \ref icuid_codename_db_load
+ * @param text [in] - the text database, one "vendor ext_family ext_model
+ *                    stepping codename" row per line, e.g.
+ *                    "intel 0x06 0xCF * Emerald Rapids". vendor is intel
+ *                    or amd, a stepping of * matches any stepping and
+ *                    lines starting with # are comments.
+ * @param file [in] - the database file to write
+ * @note The database is written to a new file in the same directory that
+ *       is then renamed over |file|, so a process that has |file| loaded
+ *       keeps reading the old one until it reloads. This is the only safe
+ *       way to update a database; never rewrite a loaded one in place.
+ * @returns ICUID_OK if successful, ICUID_ERROR_PARSING for a malformed
+ *          line or two rows with the same key, and some other error code
+ *          otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_codename_db_compile(const char *text, const char *file);
+
+/**
+ * @brief Maps a codename database read-only; its rows take precedence over
+ *        the built-in tables in \ref icuid_identify
+ * @param file [in] - the database file, or NULL to go back to the built-in
+ *                    tables alone
+ * @note Identification may run on other threads meanwhile, it sees either
+ *       the old or the new database. Codenames returned before stay valid,
+ *       databases are never unmapped. Calls to this function and
+ *       \ref icuid_codename_db_reload must not race each other.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_codename_db_load(const char *file);
+
+/**
+ * @brief Loads the codename database again if a new file was renamed over
+ *        it since \ref icuid_codename_db_load, e.g. by
+ *        \ref icuid_codename_db_compile
+ * @note Rewriting a loaded file in place is not supported.
+ * @returns ICUID_OK if successful or nothing changed, and some other error
+ *          code otherwise, in which case the current database stays.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_codename_db_reload(void);
+
+/**
+ * @brief Identifies every logical CPU, its place in the topology, and
+ *        groups the CPUs by core type
+ * @param sys [in] - the raw CPUID info obtained by
+ *                   \ref cpuid_get_system_raw_data
+ * @param data [out] - the decoded information, which must be freed with
+ *                     \ref icuid_free_system_data
+ * @note Only the first MAX_CORE_TYPES core types are grouped, CPUs of any
+ *       further type have a core_type_index of MAX_CORE_TYPES.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_identify_system(cpuid_system_raw_t *sys, cpuid_system_data_t *data);
+
+/**
+ * @brief Frees the memory of a cpuid_system_data_t structure
+ * @param data [in] - a pointer to a cpuid_system_data_t structure obtained
+ *                    by \ref icuid_identify_system
+ */
+void icuid_free_system_data(cpuid_system_data_t *data);
+
+/**
+ * @brief Plans where to pin a pool of worker threads
+ * @param data [in] - the system identification obtained by
+ *                    \ref icuid_identify_system
+ * @param policy [in] - how to place the threads
+ * @param cpus [out] - receives the logical CPU of each thread, cpus[i] is
+ *                     the OS CPU number to pin thread i to
+ * @param num_threads [in] - the number of threads, i.e. of entries in cpus
+ * @note Only the CPUs the process may run on at the time of the call are
+ *       used (sched_getaffinity on Linux). If there are more threads than
+ *       CPUs the plan wraps around and the CPUs are reused in the same order.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_plan_affinity(const cpuid_system_data_t *data,
+                        cpuid_affinity_policy_t policy, uint32_t *cpus,
+                        uint32_t num_threads);
+
+/**
+ * @brief Returns the identification of the CPU the process is running on
+ * @note The CPU is identified once, by the first caller, as if by
+ *       icuid_identify(NULL, ...). Every later call, from any thread, only
+ *       returns the cached result without locking. If identification failed
+ *       (e.g. there is no cpuid instruction) the result is all zero.
+ * @returns a pointer to an immutable cpuid_data_t, valid for the lifetime
+ *          of the process. It is never NULL.
+ */
+const cpuid_data_t *icuid_get(void);
+
+/*
+ * Points at icuid_get()->flags once the CPU is identified and is NULL
+ * before. Not part of the API, read it through icuid_get_flags().
+ */
+ICUID_DATA const cpuid_flags_t *icuid_flags_cache;
+
+/**
+ * @brief Returns the feature flags of the CPU the process is running on
+ * @note Equivalent to &icuid_get()->flags, but once the CPU is identified
+ *       this is a single load and NULL check, inline. Only calls made
+ *       before that go through \ref icuid_get.
+ * @returns a pointer to immutable flags, valid for the lifetime of the
+ *          process. It is never NULL.
+ */
+ICUID_INLINE const cpuid_flags_t *icuid_get_flags(void)
+{
+    const cpuid_flags_t *flags =
+        (const cpuid_flags_t *)ICUID_LOAD_ACQUIRE(icuid_flags_cache);
+
+    return flags != NULL ? flags : &icuid_get()->flags;
+}
+
+/**
+ * @brief Checks a feature flag of the CPU the process is running on
+ * @param feature [in] - the feature to check
+ * @note Equivalent to icuid_flags_test(&icuid_get()->flags, feature);
+ *       intended for hot paths, where it is a load of the cached flags
+ *       and a bit test, see \ref icuid_get_flags.
+ * @returns non-zero if the feature is supported, 0 otherwise.
+ */
+ICUID_INLINE int icuid_has(cpuid_feature_t feature)
+{
+    return icuid_flags_test(icuid_get_flags(), feature);
+}
+
+/**
+ * @brief Checks a set of feature flags of the CPU the process is running on
+ * @param need [in] - the features to check
+ * @note Inline like \ref icuid_has.
+ * @returns non-zero if every feature in |need| is supported, 0 otherwise.
+ */
+ICUID_INLINE int icuid_has_all(const cpuid_flags_t *need)
+{
+    return icuid_flags_subset(need, icuid_get_flags());
+}
+
+/**
+ * @brief How \ref icuid_clock_t reads the TSC
+ */
+typedef enum {
+    TSC_READ_NONE = 0, /*!< No usable TSC */
+    TSC_READ_RDTSCP,   /*!< rdtscp; lfence, see \ref icuid_rdtscp */
+    TSC_READ_LFENCE,   /*!< lfence; rdtsc; lfence, see \ref icuid_rdtsc_lfence */
+    TSC_READ_MFENCE,   /*!< mfence; rdtsc; mfence, see \ref icuid_rdtsc_mfence */
+} tsc_read_method_t;
+
+/**
+ * @brief A cycle clock based on the TSC, see \ref icuid_clock_init
+ */
+typedef struct {
+    /** How the TSC is read */
+    tsc_read_method_t method;
+
+    /** Reads the TSC with the serialization of method */
+    uint64_t (*read)(void);
+
+    /**
+     * Non-zero if the TSC is invariant (CPU_FEATURE_CONSTANT_TSC): it ticks
+     * at a constant rate in every P-, C- and T-state. Otherwise cycles
+     * don't measure time and can't be compared across frequency changes.
+     */
+    int stable;
+
+    /** TSC frequency in Hz, 0 if unknown, see \ref cpuid_data_t */
+    uint64_t frequency;
+} icuid_clock_t;
+
+/**
+ * @brief Sets up a TSC clock for timing code
+ * @param clock [out] - the clock
+ * @param data [in] - the identification of the CPU, or NULL to use
+ *                    \ref icuid_get
+ * @note Picks the cheapest correctly serialized way to read the TSC:
+ *       rdtscp if supported, else lfence; rdtsc; lfence where lfence is
+ *       dispatch serializing (Intel, AMD family 0x17 and later), else
+ *       mfence; rdtsc; mfence.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_clock_init(icuid_clock_t *clock, const cpuid_data_t *data);
+
+/**
+ * @brief Reads the TSC at the start of a timed region
+ * @param clock [in] - a clock set up by \ref icuid_clock_init
+ * @returns the time stamp counter, after every earlier instruction
+ */
+ICUID_INLINE uint64_t icuid_clock_begin(const icuid_clock_t *clock)
+{
+    return clock->read();
+}
+
+/**
+ * @brief Reads the TSC at the end of a timed region
+ * @param clock [in] - a clock set up by \ref icuid_clock_init
+ * @returns the time stamp counter, after every instruction of the region
+ */
+ICUID_INLINE uint64_t icuid_clock_end(const icuid_clock_t *clock)
+{
+    return clock->read();
+}
+
+/**
+ * @brief Converts TSC cycles to nanoseconds
+ * @param clock [in] - a clock set up by \ref icuid_clock_init
+ * @param cycles [in] - e.g. icuid_clock_end() - icuid_clock_begin()
+ * @returns the nanoseconds, or 0 if the TSC frequency is unknown
+ */
+ICUID_INLINE uint64_t icuid_clock_ns(const icuid_clock_t *clock,
+                                     uint64_t cycles)
+{
+    uint64_t f = clock->frequency;
+
+    if (f == 0)
+        return 0;
+
+    /* Split to avoid overflowing cycles * 10^9 */
+    return cycles / f * 1000000000 + cycles % f * 1000000000 / f;
+}
+
+/**
+ * @brief Vector widths measured by \ref icuid_probe_vector_width
+ */
+typedef enum {
+    VECTOR_WIDTH_128 = 0, /*!< SSE / AVX-128 (xmm) */
+    VECTOR_WIDTH_256,     /*!< AVX / AVX2 (ymm) */
+    VECTOR_WIDTH_512,     /*!< AVX-512 (zmm) */
+    NUM_VECTOR_WIDTHS,
+} cpu_vector_width_t;
+
+/**
+ * @brief Measured throughput of a vector width
+ */
+typedef struct {
+    /**
+     * Non-zero if the CPU and OS support the integer kernel of this width:
+     * SSE2, AVX2 with the AVX state enabled, or AVX512F with the AVX-512
+     * states enabled. The rest of the fields are 0 otherwise.
+     */
+    uint8_t supported;
+
+    /** 32-bit integer additions per core cycle */
+    double int_per_cycle;
+
+    /** 32-bit float FMAs per core cycle, 0 without FMA */
+    double fma_per_cycle;
+
+    /**
+     * Core frequency right after running FMAs (or additions without FMA)
+     * of this width, relative to scalar code. Below 1 if the CPU clocks
+     * down for this width, e.g. AVX-512 on some Xeons.
+     */
+    double frequency_ratio;
+
+    /** Core frequency in MHz while running this width, 0 if unknown */
+    uint32_t frequency;
+} cpuid_vector_width_info_t;
+
+/**
+ * @brief Result of \ref icuid_probe_vector_width
+ */
+typedef struct {
+    /** Indexed by cpu_vector_width_t */
+    cpuid_vector_width_info_t widths[NUM_VECTOR_WIDTHS];
+
+    /**
+     * Core frequency in MHz running scalar code, 0 if the TSC frequency
+     * is unknown
+     */
+    uint32_t scalar_frequency;
+
+    /**
+     * Widest vector width, in bits, that is a net win: at least 10% more
+     * work per unit of time than the next narrower one once its frequency
+     * impact is accounted for. 512-bit operations that are split in two
+     * (e.g. Zen 4) or clock the core down don't qualify.
+     */
+    uint32_t preferred_width;
+} cpuid_vector_probe_t;
+
+/**
+ * @brief Measures the throughput of each supported vector width
+ * @param probe [out] - the measurements and the preferred width
+ * @param data [in] - the identification of the CPU, or NULL to use
+ *                    \ref icuid_get
+ * @note Runs short SSE, AVX2 and AVX-512 integer and FMA kernels on the
+ *       calling thread, gated on the feature flags and the XSAVE state the
+ *       OS enabled. This takes tens of milliseconds; pin the thread to a
+ *       CPU of the type of interest first on hybrid parts.
+ * @returns ICUID_OK if successful, and some other error code otherwise.
+ *          The error message can be obtained by calling \ref icuid_errorstr.
+ */
+int icuid_probe_vector_width(cpuid_vector_probe_t *probe,
+                             const cpuid_data_t *data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,12 @@ extern "C" {
 #define ICUID_PASSED_NULL     2  /*!< Passed a NULL parameter when you shouldn't have */
 #define ICUID_ERROR_OPEN      3  /*!< Error opening file */
 #define ICUID_ERROR_PARSING   4  /*!< Error parsing cpuid data from input */
+#define ICUID_ERROR_MEMORY    5  /*!< Out of memory */
+#define ICUID_ERROR_AFFINITY  6  /*!< Unable to run cpuid on every logical CPU */
+#define ICUID_ERROR_INVALID   7  /*!< Invalid parameter */
+#define ICUID_ERROR_NO_CPUS   8  /*!< None of the logical CPUs may be used */
+#define ICUID_ERROR_NO_TSC    9  /*!< No TSC that can be read with serialization */
+#define ICUID_ERROR_NOT_FOUND 10 /*!< No such record */
 
 const char *icuid_errorstr(int err);
 
@@ -21,10 +21,19 @@
 #define VENDOR_STR_MAX       16
 #define BRAND_STR_MAX        48
 #define CPU_FLAGS_MAX        256
+#define CPU_FLAGS_WORDS      (CPU_FLAGS_MAX / 64)
 #define XFEATURE_FLAGS_MAX   32
 #define MAX_CPUID_LEVEL      32
 #define MAX_EXT_CPUID_LEVEL  32
+#define MAX_HV_CPUID_LEVEL   32
 #define MAX_INTEL_DC_LEVEL   16
 #define MAX_INTEL_ET_LEVEL   16
+#define MAX_INTEL_V2ET_LEVEL 8
+#define MAX_AMD_DC_LEVEL     8
+#define MAX_XSAVE_LEVEL      32
+#define MAX_XGETBV_LEVEL     1
+#define MAX_LOGICAL_CPUS     1024
+#define CPUSET_WORDS         (MAX_LOGICAL_CPUS / 64)
+#define MAX_CORE_TYPES       4
 
 #endif /* __LIBICUID_LIMITS_H__ */
@@ -21,6 +21,8 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+
 #if !defined(_MSC_VER) || _MSC_VER >= 1700
  #include <stdint.h>
 #else
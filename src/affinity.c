@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include <icuid/icuid.h>
+
+#include "affinity.h"
+#include "thread.h"
+
+#define NUM_PLAN_KEYS 4
+
+/* Where a logical CPU sits, as seen by the planner */
+typedef struct {
+    const cpuid_cpu_data_t *data;
+    uint32_t cpu;
+    uint32_t core;      /* Lowest APIC ID of the core, orders the cores */
+    uint32_t smt;       /* Rank of the CPU among the threads of its core */
+    uint32_t llc;       /* Index of the last level cache in data->caches */
+    uint32_t llc_core;  /* Rank of the core among the cores of its LLC */
+    uint32_t type;      /* 0 for performance cores */
+    uint32_t key[NUM_PLAN_KEYS];
+} plan_cpu_t;
+
+static int same_core(const cpuid_cpu_data_t *a, const cpuid_cpu_data_t *b)
+{
+    int level;
+
+    for (level = TOPO_LEVEL_CORE; level < NUM_TOPO_LEVELS; level++) {
+        if (a->topo_id[level] != b->topo_id[level])
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Returns the index of the highest level data or unified cache of |cpu| */
+static uint32_t find_llc(const cpuid_system_data_t *data, uint32_t cpu)
+{
+    const cpuid_cache_domain_t *cache;
+    uint32_t i, llc = data->num_caches, level = 0;
+
+    for (i = 0; i < data->num_caches; i++) {
+        cache = &data->caches[i];
+        if (cache->type == CACHE_TYPE_INSTRUCTION || cache->level <= level)
+            continue;
+        if (icuid_cpuset_test(&cache->cpus, cpu)) {
+            llc = i;
+            level = cache->level;
+        }
+    }
+
+    return llc;
+}
+
+static uint32_t type_rank(cpu_core_type_t core_type)
+{
+    switch (core_type) {
+        case CORE_TYPE_CORE:
+            return 0;
+        case CORE_TYPE_ATOM:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+static void set_keys(plan_cpu_t *p, cpuid_affinity_policy_t policy)
+{
+    uint32_t i;
+
+    for (i = 0; i < NUM_PLAN_KEYS; i++)
+        p->key[i] = 0;
+
+    switch (policy) {
+        case ICUID_AFFINITY_SPREAD_LLC:
+            p->key[0] = p->smt;
+            p->key[1] = p->llc_core;
+            p->key[2] = p->llc;
+            p->key[3] = p->core;
+            break;
+        case ICUID_AFFINITY_COMPACT_LLC:
+            p->key[0] = p->llc;
+            p->key[1] = p->smt;
+            p->key[2] = p->core;
+            break;
+        case ICUID_AFFINITY_PHYSICAL_CORES:
+            p->key[0] = p->smt;
+            p->key[1] = p->core;
+            break;
+        case ICUID_AFFINITY_PCORES_FIRST:
+            p->key[0] = p->smt;
+            p->key[1] = p->type;
+            p->key[2] = p->core;
+            break;
+        default:
+            break;
+    }
+}
+
+static int compare_plan(const void *a, const void *b)
+{
+    const plan_cpu_t *pa = a, *pb = b;
+    int i;
+
+    for (i = 0; i < NUM_PLAN_KEYS; i++) {
+        if (pa->key[i] != pb->key[i])
+            return pa->key[i] < pb->key[i] ? -1 : 1;
+    }
+
+    return (pa->cpu > pb->cpu) - (pa->cpu < pb->cpu);
+}
+
+/* Returns the CPUs the process may run on, or all of them if unknown */
+static void get_allowed(cpuid_cpuset_t *allowed)
+{
+    uint32_t *list;
+    uint32_t i, n = 0;
+
+    list = malloc(MAX_LOGICAL_CPUS * sizeof(*list));
+    if (list != NULL)
+        n = icuid_allowed_cpus(list, MAX_LOGICAL_CPUS);
+
+    for (i = 0; i < CPUSET_WORDS; i++)
+        allowed->words[i] = n ? 0 : ~(uint64_t)0;
+    for (i = 0; i < n; i++) {
+        if (list[i] < MAX_LOGICAL_CPUS)
+            icuid_cpuset_set(allowed, list[i]);
+    }
+
+    free(list);
+}
+
+int affinity_plan(const cpuid_system_data_t *data,
+                  const cpuid_cpuset_t *allowed,
+                  cpuid_affinity_policy_t policy, uint32_t *cpus,
+                  uint32_t num_threads)
+{
+    const cpuid_cpu_data_t *ci, *cj;
+    plan_cpu_t *plan;
+    uint32_t i, j, n = 0;
+
+    if (data == NULL || allowed == NULL || cpus == NULL)
+        return ICUID_PASSED_NULL;
+    if ((unsigned)policy >= NUM_AFFINITY_POLICIES)
+        return ICUID_ERROR_INVALID;
+    if (num_threads == 0)
+        return ICUID_OK;
+
+    plan = malloc((data->num_cpus ? data->num_cpus : 1) * sizeof(*plan));
+    if (plan == NULL)
+        return ICUID_ERROR_MEMORY;
+
+    for (i = 0; i < data->num_cpus; i++) {
+        if (data->cpus[i].cpu < MAX_LOGICAL_CPUS &&
+            icuid_cpuset_test(allowed, data->cpus[i].cpu))
+            plan[n++].data = &data->cpus[i];
+    }
+
+    if (n == 0) {
+        free(plan);
+        return ICUID_ERROR_NO_CPUS;
+    }
+
+    /* Number the usable threads of each core and name the core after its
+     * lowest APIC ID */
+    for (i = 0; i < n; i++) {
+        ci = plan[i].data;
+        plan[i].cpu = ci->cpu;
+        plan[i].core = ci->apic_id;
+        plan[i].smt = 0;
+        plan[i].llc = find_llc(data, ci->cpu);
+        plan[i].type = type_rank(ci->core_type);
+        for (j = 0; j < n; j++) {
+            cj = plan[j].data;
+            if (j == i || !same_core(ci, cj) || cj->apic_id > ci->apic_id)
+                continue;
+            plan[i].smt++;
+            if (cj->apic_id < plan[i].core)
+                plan[i].core = cj->apic_id;
+        }
+    }
+
+    /* Rank the cores of each LLC, counting each core by its first thread */
+    for (i = 0; i < n; i++) {
+        plan[i].llc_core = 0;
+        for (j = 0; j < n; j++) {
+            if (plan[j].smt == 0 && plan[j].llc == plan[i].llc &&
+                plan[j].core < plan[i].core)
+                plan[i].llc_core++;
+        }
+        set_keys(&plan[i], policy);
+    }
+
+    qsort(plan, n, sizeof(*plan), compare_plan);
+    for (i = 0; i < num_threads; i++)
+        cpus[i] = plan[i % n].cpu;
+
+    free(plan);
+
+    return ICUID_OK;
+}
+
+int icuid_plan_affinity(const cpuid_system_data_t *data,
+                        cpuid_affinity_policy_t policy, uint32_t *cpus,
+                        uint32_t num_threads)
+{
+    cpuid_cpuset_t allowed;
+
+    get_allowed(&allowed);
+
+    return affinity_plan(data, &allowed, policy, cpus, num_threads);
+}
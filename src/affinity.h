@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* icuid_plan_affinity() on an explicit set of usable CPUs instead of the
+ * affinity mask of the process, so tests can plan synthetic topologies */
+int affinity_plan(const cpuid_system_data_t *data,
+                  const cpuid_cpuset_t *allowed,
+                  cpuid_affinity_policy_t policy, uint32_t *cpus,
+                  uint32_t num_threads);
@@ -16,51 +16,58 @@
 
 #include <icuid/icuid.h>
 
+#include "cache.h"
 #include "features.h"
 #include "internal.h"
 #include "match.h"
+#include "raw.h"
 
 /**
  * Get number of cores
+ * N.B. 0x80000008 ECX[15:12] (ApicIdCoreIdSize) is the width of the core ID
+ * in the APIC ID, not a core count.
  */
-static void get_amd_number_cores(const cpuid_raw_data_t *raw, cpuid_data_t *data)
+static void get_amd_number_cores(cpuid_raw_data_t *raw, cpuid_data_t *data)
 {
-    uint32_t logical_cpus = 0, cores = 0;
-    
-    if (data->cpuid_max_basic >= 1) {
-        logical_cpus = (raw->cpuid[1][ebx] >> 16) & 0xFF;
-        if (raw->cpuid_ext[0][0] >= 8) {
-            cores = (raw->cpuid_ext[8][ecx] >> 12) & 0xF; /* ApicIdCoreIdSize */
-        }
-    }
-    if (data->flags[CPU_FEATURE_HT]) {
-        if (cores > 1) {
-            data->cores = cores;
-            data->logical_cpus = logical_cpus;
-        } else {
-            data->cores = 1;
-            data->logical_cpus = (logical_cpus >= 2 ? logical_cpus : 2);
-        }
-    } else {
-        data->cores = data->logical_cpus = 1;
-    }
-}
+    uint32_t logical_cpus = 1, threads_per_core = 1;
 
-const match_codename_t codename_amd_t[] = {
-    /* Zen */
+    if (data->cpuid_max_ext >= 0x80000008)
+        logical_cpus = (raw_leaf(raw, 0x80000008)[ecx] & 0xFF) + 1; /* NC */
+    else if (icuid_flags_test(&data->flags, CPU_FEATURE_HT))
+        logical_cpus = (raw_leaf(raw, 1)[ebx] >> 16) & 0xFF;
 
-    { 0x0F, 0x08, 0x01, 0x00,   NA, "Zen"             },
-    { 0x0F, 0x08, 0x01, 0x01,   NA, "Raven Ridge"     },
+    /* Before Zen the cores of a compute unit are not SMT siblings */
+    if (data->ext_family >= 0x17 &&
+        icuid_flags_test(&data->flags, CPU_FEATURE_TOPOEXT))
+        threads_per_core = ((raw_leaf(raw, 0x8000001E)[ebx] >> 8) & 0xFF) + 1;
 
-    /* Zen+ */
-
-    { 0x0F, 0x17, 0x08, 0x18,   NA, "Picasso"         },
-    { 0x0F, 0x17, 0x08, 0x08,   NA, "Pinnacle Ridge"  },
+    if (logical_cpus < threads_per_core)
+        logical_cpus = threads_per_core;
+    data->logical_cpus = logical_cpus;
+    data->cores = logical_cpus / threads_per_core;
+}
 
-    /* Zen 2 */
+/* X(ext_family, ext_model, stepping, codename), see INTEL_CODENAMES */
+#define AMD_CODENAMES(X) \
+    /* Zen */ \
+    X(0x17, 0x01,   NA, "Zen") \
+    X(0x17, 0x11,   NA, "Raven Ridge") \
+    \
+    /* Zen+ */ \
+    X(0x17, 0x18,   NA, "Picasso") \
+    X(0x17, 0x08,   NA, "Pinnacle Ridge") \
+    \
+    /* Zen 2 */ \
+    X(0x17, 0x71,   NA, "Matisse")
 
-    { 0x0F, 0x17, 0x08, 0x71,   NA, "Matisse"         },
-};
+const char *amd_codename(uint32_t key)
+{
+    switch (key) {
+        AMD_CODENAMES(CODENAME_CASE)
+        default:
+            return NULL;
+    }
+}
 
 /**
  * Get codename
@@ -72,45 +79,58 @@ static void get_amd_codename(cpuid_data_t *data)
     if (data->cpuid_max_basic < 1)
         return;
 
-    cpu_to_codename(data, codename_amd_t, NELEMS(codename_amd_t));
+    cpu_to_codename(data, amd_codename);
 }
 
 /**
  * Get Cache Info
+ * Leaf 0x8000001D (TOPOEXT) describes the caches like Intel's leaf 4,
+ * otherwise fall back to the legacy 0x80000005/0x80000006 descriptors.
  */
-static void get_amd_cache_info(const cpuid_raw_data_t *raw, cpuid_data_t *data)
+static void get_amd_cache_info(cpuid_raw_data_t *raw, cpuid_data_t *data)
 {
-    uint32_t l3_result;
+    uint32_t l3_result, levels;
+    const uint32_t *regs;
     const uint32_t assoc_table[16] = {
         /* 0x0 - 0xF */
         0, 1, 2, 0, 4, 0, 8, 0, 16, 0, 32, 48, 64, 96, 128, 255
     };
-    
+
+    if (icuid_flags_test(&data->flags, CPU_FEATURE_TOPOEXT)) {
+        levels = raw_subleaves(raw, RAW_TABLE_AMD_DC);
+        if (levels > 1) {
+            set_deterministic_cache_info(data, raw->amd_dc, levels);
+            return;
+        }
+    }
+
     if (data->cpuid_max_ext >= 0x80000005) {
-        data->l1_data_cache = (raw->cpuid_ext[5][ecx] >> 24) & 0xFF;
-        data->l1_associativity = (raw->cpuid_ext[5][ecx] >> 16) & 0xFF;
-        data->l1_cacheline = (raw->cpuid_ext[5][ecx]) & 0xFF;
-        data->l1_instruction_cache = (raw->cpuid_ext[5][edx] >> 24) & 0xFF;
+        regs = raw_leaf(raw, 0x80000005);
+        data->l1_data_cache = (regs[ecx] >> 24) & 0xFF;
+        data->l1_associativity = (regs[ecx] >> 16) & 0xFF;
+        data->l1_cacheline = (regs[ecx]) & 0xFF;
+        data->l1_instruction_cache = (regs[edx] >> 24) & 0xFF;
     }
 
     if (data->cpuid_max_ext < 0x80000006)
         return;
 
-    data->l2_cache = (raw->cpuid_ext[6][ecx] >> 16) & 0xFFFF;
-    data->l2_associativity = assoc_table[(raw->cpuid_ext[6][ecx] >> 12) & 0xF];
-    data->l2_cacheline = (raw->cpuid_ext[6][ecx]) & 0xFF;
+    regs = raw_leaf(raw, 0x80000006);
+    data->l2_cache = (regs[ecx] >> 16) & 0xFFFF;
+    data->l2_associativity = assoc_table[(regs[ecx] >> 12) & 0xF];
+    data->l2_cacheline = (regs[ecx]) & 0xFF;
       
-    l3_result = (raw->cpuid_ext[6][3] >> 18);
+    l3_result = (regs[3] >> 18);
     if (l3_result > 0) {
         data->l3_cache = l3_result * 512; /* Size in KB */
-        data->l3_associativity = assoc_table[(raw->cpuid_ext[6][edx] >> 12) & 0xF];
-        data->l3_cacheline = (raw->cpuid_ext[6][edx]) & 0xFF;
+        data->l3_associativity = assoc_table[(regs[edx] >> 12) & 0xF];
+        data->l3_cacheline = (regs[edx]) & 0xFF;
     } else {
         data->l3_cache = 0;
     }
 }
 
-void read_amd_data(const cpuid_raw_data_t *raw, cpuid_data_t *data)
+void read_amd_data(cpuid_raw_data_t *raw, cpuid_data_t *data)
 {
     get_amd_number_cores(raw, data);
     get_amd_cache_info(raw, data);
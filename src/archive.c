@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * An archive is a header, the records in the order they were appended and
+ * an index of every record, sorted by key, followed by a trailer pointing
+ * back at it:
+ *
+ *   header | entry dump | entry dump | ... | entry entry ... | trailer
+ *
+ * Appending never overwrites what the header points at. The new records,
+ * a new index and a new trailer go after the current trailer, leaving the
+ * old index behind as dead space, and only then is the header pointed at
+ * the new trailer. An append that fails or is cut short leaves the
+ * archive as it was, plus some bytes past its trailer that the next
+ * append overwrites.
+ */
+
+#if !defined(_WIN32)
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include <icuid/icuid.h>
+
+#if defined(_WIN32)
+#define archive_seek(fp, off) _fseeki64(fp, (__int64)(off), SEEK_SET)
+#define archive_seek_end(fp, off) _fseeki64(fp, -(__int64)(off), SEEK_END)
+#define archive_tell(fp) _ftelli64(fp)
+#define archive_sync(fp) _commit(_fileno(fp))
+#else
+#define archive_seek(fp, off) fseeko(fp, (off_t)(off), SEEK_SET)
+#define archive_seek_end(fp, off) fseeko(fp, -(off_t)(off), SEEK_END)
+#define archive_tell(fp) ftello(fp)
+#define archive_sync(fp) fsync(fileno(fp))
+#endif
+
+typedef struct {
+    char magic[4];           /* ICUID_ARCHIVE_MAGIC */
+    uint16_t version;        /* ICUID_ARCHIVE_VERSION */
+    uint16_t header_size;    /* Offset of the first record */
+    uint32_t entry_size;     /* Size of icuid_archive_entry_t */
+    uint32_t reserved;
+    uint64_t trailer_offset; /* The current trailer, 0 before the first */
+} archive_header_t;
+
+typedef struct {
+    uint64_t index_offset;
+    uint32_t num_records;
+    char magic[4];        /* ICUID_ARCHIVE_INDEX_MAGIC */
+} archive_trailer_t;
+
+static int compare_keys(const icuid_archive_entry_t *x, const char *hostname,
+                        uint32_t cpu)
+{
+    int cmp = strncmp(x->hostname, hostname, ICUID_HOSTNAME_LEN);
+
+    if (cmp != 0)
+        return cmp;
+    if (x->cpu != cpu)
+        return x->cpu < cpu ? -1 : 1;
+
+    return 0;
+}
+
+/* Orders by key, then by time and position so the latest record is last */
+static int compare_entries(const void *a, const void *b)
+{
+    const icuid_archive_entry_t *x = a, *y = b;
+    int cmp = compare_keys(x, y->hostname, y->cpu);
+
+    if (cmp != 0)
+        return cmp;
+    if (x->timestamp != y->timestamp)
+        return x->timestamp < y->timestamp ? -1 : 1;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+
+    return 0;
+}
+
+/* Reads the trailer at |offset| */
+static int read_trailer(FILE *fp, uint64_t offset, archive_trailer_t *trailer)
+{
+    if (archive_seek(fp, offset) != 0 ||
+        fread(trailer, sizeof(*trailer), 1, fp) != 1 ||
+        memcmp(trailer->magic, ICUID_ARCHIVE_INDEX_MAGIC,
+               sizeof(trailer->magic)) != 0 ||
+        trailer->index_offset < sizeof(archive_header_t) ||
+        trailer->index_offset > offset ||
+        offset - trailer->index_offset !=
+            trailer->num_records * (uint64_t)sizeof(icuid_archive_entry_t))
+        return ICUID_ERROR_PARSING;
+
+    return ICUID_OK;
+}
+
+/*
+ * Checks the header of |fp| and reads the index its trailer points at.
+ * |end| is where the next append goes, past the trailer.
+ */
+static int read_index(FILE *fp, archive_trailer_t *trailer,
+                      icuid_archive_entry_t **index, uint64_t *end)
+{
+    archive_header_t header;
+    int ret;
+
+    *index = NULL;
+    if (archive_seek(fp, 0) != 0 ||
+        fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, ICUID_ARCHIVE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != ICUID_ARCHIVE_VERSION ||
+        header.header_size != sizeof(header) ||
+        header.entry_size != sizeof(icuid_archive_entry_t))
+        return ICUID_ERROR_PARSING;
+
+    /* Created, but the first append never completed */
+    if (header.trailer_offset == 0) {
+        trailer->index_offset = sizeof(header);
+        trailer->num_records = 0;
+        *end = sizeof(header);
+        return ICUID_OK;
+    }
+    ret = read_trailer(fp, header.trailer_offset, trailer);
+    if (ret != ICUID_OK)
+        return ret;
+    *end = header.trailer_offset + sizeof(*trailer);
+
+    if (trailer->num_records == 0)
+        return ICUID_OK;
+    *index = malloc(trailer->num_records * sizeof(**index));
+    if (*index == NULL)
+        return ICUID_ERROR_MEMORY;
+    if (archive_seek(fp, trailer->index_offset) != 0 ||
+        fread(*index, sizeof(**index), trailer->num_records, fp) !=
+            trailer->num_records) {
+        free(*index);
+        *index = NULL;
+        return ICUID_ERROR_PARSING;
+    }
+
+    return ICUID_OK;
+}
+
+/* Creates an empty archive */
+static int write_header(FILE *fp, archive_trailer_t *trailer, uint64_t *end)
+{
+    archive_header_t header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ICUID_ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ICUID_ARCHIVE_VERSION;
+    header.header_size = sizeof(header);
+    header.entry_size = sizeof(icuid_archive_entry_t);
+    if (archive_seek(fp, 0) != 0 || fwrite(&header, sizeof(header), 1, fp) != 1)
+        return ICUID_ERROR_OPEN;
+
+    trailer->index_offset = sizeof(header);
+    trailer->num_records = 0;
+    *end = sizeof(header);
+
+    return ICUID_OK;
+}
+
+/* Keeps other appends out until |fp| is closed */
+static int lock_archive(FILE *fp)
+{
+#if defined(_WIN32)
+    OVERLAPPED ov;
+
+    memset(&ov, 0, sizeof(ov));
+    return LockFileEx((HANDLE)_get_osfhandle(_fileno(fp)),
+                      LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &ov)
+               ? 0 : -1;
+#else
+    return flock(fileno(fp), LOCK_EX);
+#endif
+}
+
+/* Makes |trailer_offset| the trailer once everything before it is written */
+static int commit_trailer(FILE *fp, uint64_t trailer_offset)
+{
+    if (fflush(fp) != 0 || archive_sync(fp) != 0 ||
+        archive_seek(fp, offsetof(archive_header_t, trailer_offset)) != 0 ||
+        fwrite(&trailer_offset, sizeof(trailer_offset), 1, fp) != 1 ||
+        fflush(fp) != 0 || archive_sync(fp) != 0)
+        return ICUID_ERROR_OPEN;
+
+    return ICUID_OK;
+}
+
+int icuid_archive_append(const char *file, const icuid_archive_entry_t *meta,
+                         const cpuid_raw_data_t *raw, uint32_t count)
+{
+    icuid_archive_entry_t *index = NULL, *grown, *e;
+    archive_trailer_t trailer;
+    uint64_t offset;
+    size_t size, buf_size = 0;
+    void *buf = NULL, *p;
+    uint32_t i;
+    FILE *fp;
+    int ret;
+
+    if (file == NULL || meta == NULL || raw == NULL)
+        return ICUID_PASSED_NULL;
+    if (count == 0)
+        return ICUID_OK;
+
+    /* Create the file without truncating one another append is writing */
+    if ((fp = fopen(file, "ab")) == NULL)
+        return ICUID_ERROR_OPEN;
+    fclose(fp);
+    if ((fp = fopen(file, "r+b")) == NULL)
+        return ICUID_ERROR_OPEN;
+    if (lock_archive(fp) != 0) {
+        ret = ICUID_ERROR_OPEN;
+        goto out;
+    }
+
+    /* An empty file, e.g. new or from mkstemp, is a new archive */
+    if (archive_seek_end(fp, 0) == 0 && archive_tell(fp) == 0)
+        ret = write_header(fp, &trailer, &offset);
+    else
+        ret = read_index(fp, &trailer, &index, &offset);
+    if (ret != ICUID_OK)
+        goto out;
+
+    grown = realloc(index, (trailer.num_records + (size_t)count) *
+                    sizeof(*index));
+    if (grown == NULL) {
+        ret = ICUID_ERROR_MEMORY;
+        goto out;
+    }
+    index = grown;
+
+    /* New records go past the trailer, the old index stays intact */
+    if (archive_seek(fp, offset) != 0) {
+        ret = ICUID_ERROR_OPEN;
+        goto out;
+    }
+    for (i = 0; i < count; i++) {
+        ret = icuid_raw_to_binary(&raw[i], NULL, &size);
+        if (ret != ICUID_OK)
+            goto out;
+        if (size > buf_size) {
+            if ((p = realloc(buf, size)) == NULL) {
+                ret = ICUID_ERROR_MEMORY;
+                goto out;
+            }
+            buf = p;
+            buf_size = size;
+        }
+        ret = icuid_raw_to_binary(&raw[i], buf, &size);
+        if (ret != ICUID_OK)
+            goto out;
+
+        e = &index[trailer.num_records + i];
+        *e = meta[i];
+        e->hostname[ICUID_HOSTNAME_LEN - 1] = '\0';
+        e->size = (uint32_t)(sizeof(*e) + size);
+        e->offset = offset;
+        if (fwrite(e, sizeof(*e), 1, fp) != 1 ||
+            fwrite(buf, 1, size, fp) != size) {
+            ret = ICUID_ERROR_OPEN;
+            goto out;
+        }
+        offset += e->size;
+    }
+
+    trailer.num_records += count;
+    trailer.index_offset = offset;
+    memcpy(trailer.magic, ICUID_ARCHIVE_INDEX_MAGIC, sizeof(trailer.magic));
+    qsort(index, trailer.num_records, sizeof(*index), compare_entries);
+    if (fwrite(index, sizeof(*index), trailer.num_records, fp) !=
+            trailer.num_records ||
+        fwrite(&trailer, sizeof(trailer), 1, fp) != 1)
+        ret = ICUID_ERROR_OPEN;
+    else
+        ret = commit_trailer(fp, offset + trailer.num_records * sizeof(*index));
+
+out:
+    if (fclose(fp) != 0 && ret == ICUID_OK)
+        ret = ICUID_ERROR_OPEN;
+    free(buf);
+    free(index);
+
+    return ret;
+}
+
+int icuid_archive_open(icuid_archive_t *ar, const char *file)
+{
+    archive_trailer_t trailer;
+    uint64_t end;
+    FILE *fp;
+    int ret;
+
+    if (ar == NULL || file == NULL)
+        return ICUID_PASSED_NULL;
+
+    memset(ar, 0, sizeof(*ar));
+    if ((fp = fopen(file, "rb")) == NULL)
+        return ICUID_ERROR_OPEN;
+    ret = read_index(fp, &trailer, &ar->index, &end);
+    if (ret != ICUID_OK) {
+        fclose(fp);
+        return ret;
+    }
+
+    ar->fp = fp;
+    ar->num_records = trailer.num_records;
+    ar->next = sizeof(archive_header_t);
+    ar->index_offset = trailer.index_offset;
+
+    return ICUID_OK;
+}
+
+/* Reads the record at |offset| */
+static int read_record(icuid_archive_t *ar, uint64_t offset,
+                       icuid_archive_entry_t *meta, cpuid_raw_data_t *raw)
+{
+    size_t size;
+    void *buf;
+    int ret;
+
+    if (archive_seek(ar->fp, offset) != 0 ||
+        fread(meta, sizeof(*meta), 1, ar->fp) != 1 ||
+        meta->offset != offset || meta->size < sizeof(*meta) ||
+        meta->size > ar->index_offset - offset)
+        return ICUID_ERROR_PARSING;
+
+    size = meta->size - sizeof(*meta);
+    if ((buf = malloc(size > 0 ? size : 1)) == NULL)
+        return ICUID_ERROR_MEMORY;
+    if (fread(buf, 1, size, ar->fp) != size)
+        ret = ICUID_ERROR_PARSING;
+    else
+        ret = icuid_raw_from_binary(buf, size, raw);
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * Skips the index an earlier append left at ar->next, if there is one.
+ * It indexes every record before it, and a record's entry points at
+ * itself while an index entry points further back.
+ */
+static int skip_dead_index(icuid_archive_t *ar)
+{
+    icuid_archive_entry_t e;
+    archive_trailer_t trailer;
+    uint64_t trailer_offset;
+
+    if (archive_seek(ar->fp, ar->next) != 0 ||
+        fread(&e, sizeof(e), 1, ar->fp) != 1)
+        return ICUID_ERROR_PARSING;
+    if (e.offset == ar->next)
+        return ICUID_OK;
+
+    trailer_offset = ar->next + ar->num_read * (uint64_t)sizeof(e);
+    if (read_trailer(ar->fp, trailer_offset, &trailer) != ICUID_OK ||
+        trailer.index_offset != ar->next || trailer.num_records != ar->num_read)
+        return ICUID_ERROR_PARSING;
+    ar->next = trailer_offset + sizeof(trailer);
+
+    return ICUID_OK;
+}
+
+int icuid_archive_next(icuid_archive_t *ar, icuid_archive_entry_t *meta,
+                       cpuid_raw_data_t *raw)
+{
+    int ret;
+
+    if (ar == NULL || ar->fp == NULL || meta == NULL || raw == NULL)
+        return ICUID_PASSED_NULL;
+    if (ar->next >= ar->index_offset)
+        return ICUID_ERROR_NOT_FOUND;
+
+    ret = skip_dead_index(ar);
+    if (ret == ICUID_OK && ar->next >= ar->index_offset)
+        ret = ICUID_ERROR_PARSING;
+    if (ret == ICUID_OK)
+        ret = read_record(ar, ar->next, meta, raw);
+    if (ret != ICUID_OK)
+        return ret;
+    ar->next += meta->size;
+    ar->num_read++;
+
+    return ICUID_OK;
+}
+
+int icuid_archive_find(icuid_archive_t *ar, const char *hostname, uint32_t cpu,
+                       icuid_archive_entry_t *meta, cpuid_raw_data_t *raw)
+{
+    uint32_t lo, hi, mid;
+
+    if (ar == NULL || ar->fp == NULL || hostname == NULL || meta == NULL ||
+        raw == NULL)
+        return ICUID_PASSED_NULL;
+
+    /* First entry past the key, the one before it is the latest record */
+    for (lo = 0, hi = ar->num_records; lo < hi;) {
+        mid = lo + (hi - lo) / 2;
+        if (compare_keys(&ar->index[mid], hostname, cpu) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0 || compare_keys(&ar->index[lo - 1], hostname, cpu) != 0)
+        return ICUID_ERROR_NOT_FOUND;
+
+    return read_record(ar, ar->index[lo - 1].offset, meta, raw);
+}
+
+void icuid_archive_close(icuid_archive_t *ar)
+{
+    if (ar == NULL)
+        return;
+
+    if (ar->fp != NULL)
+        fclose(ar->fp);
+    free(ar->index);
+    memset(ar, 0, sizeof(*ar));
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "thread.h"
+
+/* Workers used when the caller doesn't say how many */
+#define MAX_BATCH_THREADS 64
+
+struct batch_worker {
+    cpuid_raw_data_t *raw;
+    cpuid_data_t *data;
+    int *status;
+    uint32_t n;
+    uint32_t first;
+    uint32_t stride;
+    uint32_t failed; /* First record that failed, if ret isn't ICUID_OK */
+    int ret;
+};
+
+/*
+ * Records take about the same time to identify, so each worker takes every
+ * stride-th one instead of pulling them off a shared counter
+ */
+static void batch_worker(void *arg)
+{
+    struct batch_worker *w = arg;
+    uint32_t i;
+    int ret;
+
+    for (i = w->first; i < w->n; i += w->stride) {
+        /* Lazy records would run CPUID on whichever CPU the worker is on */
+        if (w->raw[i].lazy)
+            ret = ICUID_ERROR_INVALID;
+        else
+            ret = icuid_identify(&w->raw[i], &w->data[i]);
+        if (ret != ICUID_OK)
+            memset(&w->data[i], 0, sizeof(w->data[i]));
+        if (w->status != NULL)
+            w->status[i] = ret;
+        if (ret != ICUID_OK && w->ret == ICUID_OK) {
+            w->ret = ret;
+            w->failed = i;
+        }
+    }
+}
+
+int icuid_identify_batch(cpuid_raw_data_t *raw, cpuid_data_t *data,
+                         int *status, uint32_t n, uint32_t nthreads)
+{
+    uint32_t cpus[MAX_BATCH_THREADS];
+    struct batch_worker *workers, one;
+    icuid_thread_t *threads;
+    uint32_t i, started, failed = n;
+    int ret = ICUID_OK;
+
+    if (raw == NULL || data == NULL)
+        return ICUID_PASSED_NULL;
+
+    if (nthreads == 0)
+        nthreads = icuid_allowed_cpus(cpus, MAX_BATCH_THREADS);
+    if (nthreads > n)
+        nthreads = n;
+    if (nthreads <= 1) {
+        memset(&one, 0, sizeof(one));
+        one.raw = raw;
+        one.data = data;
+        one.status = status;
+        one.n = n;
+        one.stride = 1;
+        batch_worker(&one);
+        return one.ret;
+    }
+
+    workers = calloc(nthreads, sizeof(*workers));
+    threads = calloc(nthreads, sizeof(*threads));
+    if (workers == NULL || threads == NULL) {
+        free(workers);
+        free(threads);
+        return ICUID_ERROR_MEMORY;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        workers[i].raw = raw;
+        workers[i].data = data;
+        workers[i].status = status;
+        workers[i].n = n;
+        workers[i].first = i;
+        workers[i].stride = nthreads;
+    }
+
+    /* Worker 0 runs on the calling thread */
+    for (started = 1; started < nthreads; started++) {
+        if (icuid_thread_create(&threads[started], batch_worker,
+                                &workers[started]) != 0)
+            break;
+    }
+    batch_worker(&workers[0]);
+    /* Do the share of any worker that couldn't be started ourselves */
+    for (i = started; i < nthreads; i++)
+        batch_worker(&workers[i]);
+
+    /* Report the first record that failed, whichever worker had it */
+    for (i = 0; i < nthreads; i++) {
+        if (i > 0 && i < started)
+            icuid_thread_join(threads[i]);
+        if (workers[i].ret != ICUID_OK && workers[i].failed < failed) {
+            ret = workers[i].ret;
+            failed = workers[i].failed;
+        }
+    }
+
+    free(threads);
+    free(workers);
+
+    return ret;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "cache.h"
+#include "internal.h"
+#include "raw.h"
+#include "topology.h"
+
+/**
+ * Decodes a leaf 4 style subleaf, returns 0 if it is the null cache that
+ * ends enumeration.
+ */
+int decode_cache_leaf(const uint32_t *regs, cache_desc_t *desc)
+{
+    uint32_t partitions, sets;
+
+    desc->type = (cpu_cache_type_t)(regs[eax] & 0x1F);
+    if (desc->type == CACHE_TYPE_NULL)
+        return 0;
+
+    desc->level = (regs[eax] >> 5) & 0x7;
+    desc->associativity = (regs[ebx] >> 22) + 1;
+    partitions = ((regs[ebx] >> 12) & 0x3FF) + 1;
+    desc->linesize = (regs[ebx] & 0xFFF) + 1;
+    sets = regs[ecx] + 1;
+    desc->size = (desc->linesize * sets * desc->associativity * partitions) >> 10;
+    /* Maximum number of logical processors sharing this cache */
+    desc->sharing_bits = bit_width(((regs[eax] >> 14) & 0xFFF) + 1);
+
+    return 1;
+}
+
+typedef enum {
+    Lnone, /*!< Indicates error */
+    L1I,   /*!< L1 Instruction Cache */
+    L1D,   /*!< L1 Data Cache */
+    L2,    /*!< L2 Cache */
+    L3,    /*!< L3 Cache */
+    L4,    /*!< L4 Cache */
+} cache_type_t;
+
+static void set_cache_info(cpuid_data_t *data, const cache_type_t cache,
+                           const uint32_t size, const uint32_t associativity,
+                           const uint32_t linesize)
+{
+    switch (cache) {
+        case L1I:
+            data->l1_instruction_cache = size;
+            break;
+        case L1D:
+            data->l1_data_cache = size;
+            data->l1_associativity = associativity;
+            data->l1_cacheline = linesize;
+            break;
+        case L2:
+            data->l2_cache = size;
+            data->l2_associativity = associativity;
+            data->l2_cacheline = linesize;
+            break;
+        case L3:
+            data->l3_cache = size;
+            data->l3_associativity = associativity;
+            data->l3_cacheline = linesize;
+            break;
+        case L4:
+            data->l4_cache = size;
+            data->l4_associativity = associativity;
+            data->l4_cacheline = linesize;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Fills in the cache fields of |data| from the |levels| rows of a leaf 4
+ * style table (Intel leaf 4 or AMD leaf 0x8000001D).
+ */
+void set_deterministic_cache_info(cpuid_data_t *data, uint32_t (*regs)[4],
+                                  const uint32_t levels)
+{
+    uint32_t idx;
+    cache_desc_t desc;
+    cache_type_t type;
+
+    for (idx = 0; idx < levels; idx++) {
+        type = Lnone;
+        if (!decode_cache_leaf(regs[idx], &desc)) /* Check validity */
+            break;
+        switch (desc.level) {
+            case 1:
+                if (desc.type == CACHE_TYPE_DATA)
+                    type = L1D;
+                else if (desc.type == CACHE_TYPE_INSTRUCTION)
+                    type = L1I;
+                break;
+            case 2:
+                if (desc.type == CACHE_TYPE_UNIFIED)
+                    type = L2;
+                break;
+            case 3:
+                if (desc.type == CACHE_TYPE_UNIFIED)
+                    type = L3;
+                break;
+            case 4:
+                if (desc.type == CACHE_TYPE_UNIFIED)
+                    type = L4;
+                break;
+            default:
+                break;
+        }
+        set_cache_info(data, type, desc.size, desc.associativity, desc.linesize);
+    }
+}
+
+static uint32_t add_desc(cache_desc_t *descs, uint32_t n, uint32_t max,
+                         uint32_t level, cpu_cache_type_t type, uint32_t size,
+                         uint32_t associativity, uint32_t linesize,
+                         uint32_t sharing_bits)
+{
+    if (size == 0 || n >= max)
+        return n;
+
+    descs[n].level = level;
+    descs[n].type = type;
+    descs[n].size = size;
+    descs[n].associativity = associativity;
+    descs[n].linesize = linesize;
+    descs[n].sharing_bits = sharing_bits;
+
+    return n + 1;
+}
+
+/**
+ * Lists the caches of the CPU |raw| was collected on, with the APIC ID
+ * bits that tell apart the logical CPUs sharing each of them.
+ */
+uint32_t get_cache_descs(cpuid_raw_data_t *raw, const cpuid_data_t *data,
+                         cache_desc_t *descs, uint32_t max)
+{
+    uint32_t shift[NUM_TOPO_LEVELS];
+    uint32_t (*regs)[4] = NULL;
+    uint32_t i, levels = 0, n = 0;
+
+    if (data->vendor == VENDOR_INTEL) {
+        levels = raw_subleaves(raw, RAW_TABLE_INTEL_DC);
+        regs = raw->intel_dc;
+    } else if (data->vendor == VENDOR_AMD &&
+               icuid_flags_test(&data->flags, CPU_FEATURE_TOPOEXT) &&
+               raw_subleaves(raw, RAW_TABLE_AMD_DC) > 1) {
+        levels = raw_subleaves(raw, RAW_TABLE_AMD_DC);
+        regs = raw->amd_dc;
+    } else if (data->vendor == VENDOR_AMD) {
+        /**
+         * The legacy leaves don't describe sharing: L1 and L2 are private
+         * to a core, assume L3 is shared by the whole package.
+         */
+        get_topology_shifts(raw, data, shift);
+        n = add_desc(descs, n, max, 1, CACHE_TYPE_DATA, data->l1_data_cache,
+                     data->l1_associativity, data->l1_cacheline,
+                     shift[TOPO_LEVEL_SMT]);
+        n = add_desc(descs, n, max, 1, CACHE_TYPE_INSTRUCTION,
+                     data->l1_instruction_cache, 0, 0, shift[TOPO_LEVEL_SMT]);
+        n = add_desc(descs, n, max, 2, CACHE_TYPE_UNIFIED, data->l2_cache,
+                     data->l2_associativity, data->l2_cacheline,
+                     shift[TOPO_LEVEL_SMT]);
+        n = add_desc(descs, n, max, 3, CACHE_TYPE_UNIFIED, data->l3_cache,
+                     data->l3_associativity, data->l3_cacheline,
+                     shift[TOPO_LEVEL_DIE]);
+    }
+
+    for (i = 0; i < levels && n < max; i++) {
+        if (decode_cache_leaf(regs[i], &descs[n]))
+            n++;
+    }
+
+    return n;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* A cache, as described by a deterministic cache parameters leaf */
+typedef struct {
+    uint32_t level;
+    cpu_cache_type_t type;
+    uint32_t size;          /* KB */
+    uint32_t associativity;
+    uint32_t linesize;
+    uint32_t sharing_bits;  /* Low APIC ID bits that differ between sharers */
+} cache_desc_t;
+
+int decode_cache_leaf(const uint32_t *regs, cache_desc_t *desc);
+void set_deterministic_cache_info(cpuid_data_t *data, uint32_t (*regs)[4],
+                                  const uint32_t levels);
+uint32_t get_cache_descs(cpuid_raw_data_t *raw, const cpuid_data_t *data,
+                         cache_desc_t *descs, uint32_t max);
@@ -80,3 +80,139 @@ uint64_t icuid_xgetbv(const uint32_t xcr)
 
     return (((uint64_t)edx) << 32) | eax;
 }
+
+uint64_t icuid_rdtscp(void)
+{
+    uint32_t eax, edx;
+
+    __asm__ __volatile__ (
+        "rdtscp\n"
+        "lfence"
+        : "=a"(eax), "=d"(edx) : : "ecx", "memory"
+    );
+
+    return (((uint64_t)edx) << 32) | eax;
+}
+
+uint64_t icuid_rdtsc_lfence(void)
+{
+    uint32_t eax, edx;
+
+    __asm__ __volatile__ (
+        "lfence\n"
+        "rdtsc\n"
+        "lfence"
+        : "=a"(eax), "=d"(edx) : : "memory"
+    );
+
+    return (((uint64_t)edx) << 32) | eax;
+}
+
+uint64_t icuid_rdtsc_mfence(void)
+{
+    uint32_t eax, edx;
+
+    __asm__ __volatile__ (
+        "mfence\n"
+        "rdtsc\n"
+        "mfence"
+        : "=a"(eax), "=d"(edx) : : "memory"
+    );
+
+    return (((uint64_t)edx) << 32) | eax;
+}
+
+/*
+ * Throughput kernels of the vector width probe. Each iteration runs one
+ * instruction per accumulator register, the accumulators are independent
+ * so the loop is bound by throughput rather than latency. The sources are
+ * zero so FMAs never hit denormal assists.
+ */
+#if defined(ICUID_X86_64)
+#define VOP(op, r, a) op " %%" r "14, %%" r "15, %%" r #a "\n"
+#define SOP(op, a)    op " %%xmm14, %%xmm" #a "\n"
+#define VBODY(op, r) \
+    VOP(op, r, 0) VOP(op, r, 1) VOP(op, r, 2) VOP(op, r, 3) \
+    VOP(op, r, 4) VOP(op, r, 5) VOP(op, r, 6) VOP(op, r, 7) \
+    VOP(op, r, 8) VOP(op, r, 9) VOP(op, r, 10) VOP(op, r, 11)
+#define SBODY(op) \
+    SOP(op, 0) SOP(op, 1) SOP(op, 2) SOP(op, 3) SOP(op, 4) SOP(op, 5) \
+    SOP(op, 6) SOP(op, 7) SOP(op, 8) SOP(op, 9) SOP(op, 10) SOP(op, 11)
+#define VCLEAR(op) \
+    op " %%xmm14, %%xmm14, %%xmm14\n" op " %%xmm15, %%xmm15, %%xmm15\n"
+#define SCLEAR "pxor %%xmm14, %%xmm14\n"
+#define VCLOBBERS \
+    "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", \
+    "xmm8", "xmm9", "xmm10", "xmm11", "xmm14", "xmm15"
+#else
+#define VOP(op, r, a) op " %%" r "6, %%" r "7, %%" r #a "\n"
+#define SOP(op, a)    op " %%xmm6, %%xmm" #a "\n"
+#define VBODY(op, r) \
+    VOP(op, r, 0) VOP(op, r, 1) VOP(op, r, 2) \
+    VOP(op, r, 3) VOP(op, r, 4) VOP(op, r, 5)
+#define SBODY(op) \
+    SOP(op, 0) SOP(op, 1) SOP(op, 2) SOP(op, 3) SOP(op, 4) SOP(op, 5)
+#define VCLEAR(op) \
+    op " %%xmm6, %%xmm6, %%xmm6\n" op " %%xmm7, %%xmm7, %%xmm7\n"
+#define SCLEAR "pxor %%xmm6, %%xmm6\n"
+#define VCLOBBERS \
+    "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+#endif
+
+#define VLOOP(init, body, fini) \
+    __asm__ __volatile__ (     \
+        init                   \
+        "1:\n"                 \
+        body                   \
+        "dec %0\n"             \
+        "jnz 1b\n"             \
+        fini                   \
+        : "+r"(n) : : VCLOBBERS, "cc")
+
+void icuid_loop_scalar(uint32_t n)
+{
+    uint32_t x = 0;
+
+    /* A dependency chain of 1 cycle adds, the loop counter runs beside it */
+    __asm__ __volatile__ (
+        "1:\n"
+        "add $1, %1\n" "add $1, %1\n" "add $1, %1\n" "add $1, %1\n"
+        "add $1, %1\n" "add $1, %1\n" "add $1, %1\n" "add $1, %1\n"
+        "dec %0\n"
+        "jnz 1b\n"
+        : "+r"(n), "+r"(x) : : "cc"
+    );
+}
+
+void icuid_loop_int128(uint32_t n)
+{
+    VLOOP(SCLEAR, SBODY("paddd"), "");
+}
+
+void icuid_loop_fma128(uint32_t n)
+{
+    VLOOP(VCLEAR("vpxor") VBODY("vpxor", "xmm"),
+          VBODY("vfmadd231ps", "xmm"), "");
+}
+
+void icuid_loop_int256(uint32_t n)
+{
+    VLOOP(VCLEAR("vpxor"), VBODY("vpaddd", "ymm"), "vzeroupper\n");
+}
+
+void icuid_loop_fma256(uint32_t n)
+{
+    VLOOP(VCLEAR("vpxor") VBODY("vpxor", "xmm"),
+          VBODY("vfmadd231ps", "ymm"), "vzeroupper\n");
+}
+
+void icuid_loop_int512(uint32_t n)
+{
+    VLOOP(VCLEAR("vpxor"), VBODY("vpaddd", "zmm"), "vzeroupper\n");
+}
+
+void icuid_loop_fma512(uint32_t n)
+{
+    VLOOP(VCLEAR("vpxor") VBODY("vpxor", "xmm"),
+          VBODY("vfmadd231ps", "zmm"), "vzeroupper\n");
+}
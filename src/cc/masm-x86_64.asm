@@ -53,4 +53,249 @@ icuid_xgetbv proc
 
 icuid_xgetbv endp
 
+icuid_rdtscp proc
+    db 15, 1, 249 ; rdtscp
+    db 15, 174, 232 ; lfence
+    shl rdx, 32
+    or  rax, rdx
+    ret
+icuid_rdtscp endp
+
+icuid_rdtsc_lfence proc
+    db 15, 174, 232 ; lfence
+    rdtsc
+    db 15, 174, 232 ; lfence
+    shl rdx, 32
+    or  rax, rdx
+    ret
+icuid_rdtsc_lfence endp
+
+icuid_rdtsc_mfence proc
+    db 15, 174, 240 ; mfence
+    rdtsc
+    db 15, 174, 240 ; mfence
+    shl rdx, 32
+    or  rax, rdx
+    ret
+icuid_rdtsc_mfence endp
+
+; Throughput kernels of the vector width probe, see gcc.c. xmm6-xmm15 are
+; callee saved in the Windows x64 ABI.
+SAVE_XMM macro
+    sub rsp, 128
+    movdqu [rsp], xmm6
+    movdqu 16[rsp], xmm7
+    movdqu 32[rsp], xmm8
+    movdqu 48[rsp], xmm9
+    movdqu 64[rsp], xmm10
+    movdqu 80[rsp], xmm11
+    movdqu 96[rsp], xmm14
+    movdqu 112[rsp], xmm15
+endm
+
+RESTORE_XMM macro
+    movdqu xmm6, [rsp]
+    movdqu xmm7, 16[rsp]
+    movdqu xmm8, 32[rsp]
+    movdqu xmm9, 48[rsp]
+    movdqu xmm10, 64[rsp]
+    movdqu xmm11, 80[rsp]
+    movdqu xmm14, 96[rsp]
+    movdqu xmm15, 112[rsp]
+    add rsp, 128
+endm
+
+icuid_loop_scalar proc
+    xor eax, eax
+@@:
+    add eax, 1
+    add eax, 1
+    add eax, 1
+    add eax, 1
+    add eax, 1
+    add eax, 1
+    add eax, 1
+    add eax, 1
+    dec ecx
+    jnz @B
+    ret
+icuid_loop_scalar endp
+
+icuid_loop_int128 proc
+    SAVE_XMM
+    pxor xmm14, xmm14
+@@:
+    paddd xmm0, xmm14
+    paddd xmm1, xmm14
+    paddd xmm2, xmm14
+    paddd xmm3, xmm14
+    paddd xmm4, xmm14
+    paddd xmm5, xmm14
+    paddd xmm6, xmm14
+    paddd xmm7, xmm14
+    paddd xmm8, xmm14
+    paddd xmm9, xmm14
+    paddd xmm10, xmm14
+    paddd xmm11, xmm14
+    dec ecx
+    jnz @B
+    RESTORE_XMM
+    ret
+icuid_loop_int128 endp
+
+icuid_loop_fma128 proc
+    SAVE_XMM
+    vpxor xmm14, xmm14, xmm14
+    vpxor xmm15, xmm15, xmm15
+    vpxor xmm0, xmm14, xmm15
+    vpxor xmm1, xmm14, xmm15
+    vpxor xmm2, xmm14, xmm15
+    vpxor xmm3, xmm14, xmm15
+    vpxor xmm4, xmm14, xmm15
+    vpxor xmm5, xmm14, xmm15
+    vpxor xmm6, xmm14, xmm15
+    vpxor xmm7, xmm14, xmm15
+    vpxor xmm8, xmm14, xmm15
+    vpxor xmm9, xmm14, xmm15
+    vpxor xmm10, xmm14, xmm15
+    vpxor xmm11, xmm14, xmm15
+@@:
+    vfmadd231ps xmm0, xmm14, xmm15
+    vfmadd231ps xmm1, xmm14, xmm15
+    vfmadd231ps xmm2, xmm14, xmm15
+    vfmadd231ps xmm3, xmm14, xmm15
+    vfmadd231ps xmm4, xmm14, xmm15
+    vfmadd231ps xmm5, xmm14, xmm15
+    vfmadd231ps xmm6, xmm14, xmm15
+    vfmadd231ps xmm7, xmm14, xmm15
+    vfmadd231ps xmm8, xmm14, xmm15
+    vfmadd231ps xmm9, xmm14, xmm15
+    vfmadd231ps xmm10, xmm14, xmm15
+    vfmadd231ps xmm11, xmm14, xmm15
+    dec ecx
+    jnz @B
+    RESTORE_XMM
+    ret
+icuid_loop_fma128 endp
+
+icuid_loop_int256 proc
+    SAVE_XMM
+    vpxor xmm14, xmm14, xmm14
+    vpxor xmm15, xmm15, xmm15
+@@:
+    vpaddd ymm0, ymm14, ymm15
+    vpaddd ymm1, ymm14, ymm15
+    vpaddd ymm2, ymm14, ymm15
+    vpaddd ymm3, ymm14, ymm15
+    vpaddd ymm4, ymm14, ymm15
+    vpaddd ymm5, ymm14, ymm15
+    vpaddd ymm6, ymm14, ymm15
+    vpaddd ymm7, ymm14, ymm15
+    vpaddd ymm8, ymm14, ymm15
+    vpaddd ymm9, ymm14, ymm15
+    vpaddd ymm10, ymm14, ymm15
+    vpaddd ymm11, ymm14, ymm15
+    dec ecx
+    jnz @B
+    vzeroupper
+    RESTORE_XMM
+    ret
+icuid_loop_int256 endp
+
+icuid_loop_fma256 proc
+    SAVE_XMM
+    vpxor xmm14, xmm14, xmm14
+    vpxor xmm15, xmm15, xmm15
+    vpxor xmm0, xmm14, xmm15
+    vpxor xmm1, xmm14, xmm15
+    vpxor xmm2, xmm14, xmm15
+    vpxor xmm3, xmm14, xmm15
+    vpxor xmm4, xmm14, xmm15
+    vpxor xmm5, xmm14, xmm15
+    vpxor xmm6, xmm14, xmm15
+    vpxor xmm7, xmm14, xmm15
+    vpxor xmm8, xmm14, xmm15
+    vpxor xmm9, xmm14, xmm15
+    vpxor xmm10, xmm14, xmm15
+    vpxor xmm11, xmm14, xmm15
+@@:
+    vfmadd231ps ymm0, ymm14, ymm15
+    vfmadd231ps ymm1, ymm14, ymm15
+    vfmadd231ps ymm2, ymm14, ymm15
+    vfmadd231ps ymm3, ymm14, ymm15
+    vfmadd231ps ymm4, ymm14, ymm15
+    vfmadd231ps ymm5, ymm14, ymm15
+    vfmadd231ps ymm6, ymm14, ymm15
+    vfmadd231ps ymm7, ymm14, ymm15
+    vfmadd231ps ymm8, ymm14, ymm15
+    vfmadd231ps ymm9, ymm14, ymm15
+    vfmadd231ps ymm10, ymm14, ymm15
+    vfmadd231ps ymm11, ymm14, ymm15
+    dec ecx
+    jnz @B
+    vzeroupper
+    RESTORE_XMM
+    ret
+icuid_loop_fma256 endp
+
+icuid_loop_int512 proc
+    SAVE_XMM
+    vpxor xmm14, xmm14, xmm14
+    vpxor xmm15, xmm15, xmm15
+@@:
+    vpaddd zmm0, zmm14, zmm15
+    vpaddd zmm1, zmm14, zmm15
+    vpaddd zmm2, zmm14, zmm15
+    vpaddd zmm3, zmm14, zmm15
+    vpaddd zmm4, zmm14, zmm15
+    vpaddd zmm5, zmm14, zmm15
+    vpaddd zmm6, zmm14, zmm15
+    vpaddd zmm7, zmm14, zmm15
+    vpaddd zmm8, zmm14, zmm15
+    vpaddd zmm9, zmm14, zmm15
+    vpaddd zmm10, zmm14, zmm15
+    vpaddd zmm11, zmm14, zmm15
+    dec ecx
+    jnz @B
+    vzeroupper
+    RESTORE_XMM
+    ret
+icuid_loop_int512 endp
+
+icuid_loop_fma512 proc
+    SAVE_XMM
+    vpxor xmm14, xmm14, xmm14
+    vpxor xmm15, xmm15, xmm15
+    vpxor xmm0, xmm14, xmm15
+    vpxor xmm1, xmm14, xmm15
+    vpxor xmm2, xmm14, xmm15
+    vpxor xmm3, xmm14, xmm15
+    vpxor xmm4, xmm14, xmm15
+    vpxor xmm5, xmm14, xmm15
+    vpxor xmm6, xmm14, xmm15
+    vpxor xmm7, xmm14, xmm15
+    vpxor xmm8, xmm14, xmm15
+    vpxor xmm9, xmm14, xmm15
+    vpxor xmm10, xmm14, xmm15
+    vpxor xmm11, xmm14, xmm15
+@@:
+    vfmadd231ps zmm0, zmm14, zmm15
+    vfmadd231ps zmm1, zmm14, zmm15
+    vfmadd231ps zmm2, zmm14, zmm15
+    vfmadd231ps zmm3, zmm14, zmm15
+    vfmadd231ps zmm4, zmm14, zmm15
+    vfmadd231ps zmm5, zmm14, zmm15
+    vfmadd231ps zmm6, zmm14, zmm15
+    vfmadd231ps zmm7, zmm14, zmm15
+    vfmadd231ps zmm8, zmm14, zmm15
+    vfmadd231ps zmm9, zmm14, zmm15
+    vfmadd231ps zmm10, zmm14, zmm15
+    vfmadd231ps zmm11, zmm14, zmm15
+    dec ecx
+    jnz @B
+    vzeroupper
+    RESTORE_XMM
+    ret
+icuid_loop_fma512 endp
+
 END
@@ -80,3 +80,179 @@ void icuid_cpuid_ext(uint32_t *regs)
         mov 12[edi], edx
     }
 }
+
+/* The 64-bit result is returned in EDX:EAX */
+uint64_t icuid_rdtscp(void)
+{
+    __asm {
+        _asm _emit 0x0f _asm _emit 0x01 _asm _emit 0xf9 /* rdtscp */
+        _asm _emit 0x0f _asm _emit 0xae _asm _emit 0xe8 /* lfence */
+    }
+}
+
+uint64_t icuid_rdtsc_lfence(void)
+{
+    __asm {
+        _asm _emit 0x0f _asm _emit 0xae _asm _emit 0xe8 /* lfence */
+        rdtsc
+        _asm _emit 0x0f _asm _emit 0xae _asm _emit 0xe8 /* lfence */
+    }
+}
+
+uint64_t icuid_rdtsc_mfence(void)
+{
+    __asm {
+        _asm _emit 0x0f _asm _emit 0xae _asm _emit 0xf0 /* mfence */
+        rdtsc
+        _asm _emit 0x0f _asm _emit 0xae _asm _emit 0xf0 /* mfence */
+    }
+}
+
+/* Throughput kernels of the vector width probe, see gcc.c */
+void icuid_loop_scalar(uint32_t n)
+{
+    __asm {
+        mov ecx, n
+        xor eax, eax
+    again:
+        add eax, 1
+        add eax, 1
+        add eax, 1
+        add eax, 1
+        add eax, 1
+        add eax, 1
+        add eax, 1
+        add eax, 1
+        dec ecx
+        jnz again
+    }
+}
+
+void icuid_loop_int128(uint32_t n)
+{
+    __asm {
+        mov ecx, n
+        pxor xmm6, xmm6
+    again:
+        paddd xmm0, xmm6
+        paddd xmm1, xmm6
+        paddd xmm2, xmm6
+        paddd xmm3, xmm6
+        paddd xmm4, xmm6
+        paddd xmm5, xmm6
+        dec ecx
+        jnz again
+    }
+}
+
+void icuid_loop_fma128(uint32_t n)
+{
+    __asm {
+        mov ecx, n
+        vpxor xmm6, xmm6, xmm6
+        vpxor xmm7, xmm7, xmm7
+        vpxor xmm0, xmm6, xmm7
+        vpxor xmm1, xmm6, xmm7
+        vpxor xmm2, xmm6, xmm7
+        vpxor xmm3, xmm6, xmm7
+        vpxor xmm4, xmm6, xmm7
+        vpxor xmm5, xmm6, xmm7
+    again:
+        vfmadd231ps xmm0, xmm6, xmm7
+        vfmadd231ps xmm1, xmm6, xmm7
+        vfmadd231ps xmm2, xmm6, xmm7
+        vfmadd231ps xmm3, xmm6, xmm7
+        vfmadd231ps xmm4, xmm6, xmm7
+        vfmadd231ps xmm5, xmm6, xmm7
+        dec ecx
+        jnz again
+    }
+}
+
+void icuid_loop_int256(uint32_t n)
+{
+    __asm {
+        mov ecx, n
+        vpxor xmm6, xmm6, xmm6
+        vpxor xmm7, xmm7, xmm7
+    again:
+        vpaddd ymm0, ymm6, ymm7
+        vpaddd ymm1, ymm6, ymm7
+        vpaddd ymm2, ymm6, ymm7
+        vpaddd ymm3, ymm6, ymm7
+        vpaddd ymm4, ymm6, ymm7
+        vpaddd ymm5, ymm6, ymm7
+        dec ecx
+        jnz again
+        vzeroupper
+    }
+}
+
+void icuid_loop_fma256(uint32_t n)
+{
+    __asm {
+        mov ecx, n
+        vpxor xmm6, xmm6, xmm6
+        vpxor xmm7, xmm7, xmm7
+        vpxor xmm0, xmm6, xmm7
+        vpxor xmm1, xmm6, xmm7
+        vpxor xmm2, xmm6, xmm7
+        vpxor xmm3, xmm6, xmm7
+        vpxor xmm4, xmm6, xmm7
+        vpxor xmm5, xmm6, xmm7
+    again:
+        vfmadd231ps ymm0, ymm6, ymm7
+        vfmadd231ps ymm1, ymm6, ymm7
+        vfmadd231ps ymm2, ymm6, ymm7
+        vfmadd231ps ymm3, ymm6, ymm7
+        vfmadd231ps ymm4, ymm6, ymm7
+        vfmadd231ps ymm5, ymm6, ymm7
+        dec ecx
+        jnz again
+        vzeroupper
+    }
+}
+
+void icuid_loop_int512(uint32_t n)
+{
+    __asm {
+        mov ecx, n
+        vpxor xmm6, xmm6, xmm6
+        vpxor xmm7, xmm7, xmm7
+    again:
+        vpaddd zmm0, zmm6, zmm7
+        vpaddd zmm1, zmm6, zmm7
+        vpaddd zmm2, zmm6, zmm7
+        vpaddd zmm3, zmm6, zmm7
+        vpaddd zmm4, zmm6, zmm7
+        vpaddd zmm5, zmm6, zmm7
+        dec ecx
+        jnz again
+        vzeroupper
+    }
+}
+
+void icuid_loop_fma512(uint32_t n)
+{
+    __asm {
+        mov ecx, n
+        vpxor xmm6, xmm6, xmm6
+        vpxor xmm7, xmm7, xmm7
+        vpxor xmm0, xmm6, xmm7
+        vpxor xmm1, xmm6, xmm7
+        vpxor xmm2, xmm6, xmm7
+        vpxor xmm3, xmm6, xmm7
+        vpxor xmm4, xmm6, xmm7
+        vpxor xmm5, xmm6, xmm7
+    again:
+        vfmadd231ps zmm0, zmm6, zmm7
+        vfmadd231ps zmm1, zmm6, zmm7
+        vfmadd231ps zmm2, zmm6, zmm7
+        vfmadd231ps zmm3, zmm6, zmm7
+        vfmadd231ps zmm4, zmm6, zmm7
+        vfmadd231ps zmm5, zmm6, zmm7
+        dec ecx
+        jnz again
+        vzeroupper
+    }
+}
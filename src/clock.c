@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+/**
+ * lfence is dispatch serializing on every Intel CPU with SSE2, and on AMD
+ * from family 0x17. Older AMD CPUs only make it so if the OS set a MSR bit,
+ * which we can't see from user space.
+ */
+static int lfence_serializes(const cpuid_data_t *data)
+{
+    if (data->vendor == VENDOR_INTEL)
+        return 1;
+    if (data->vendor == VENDOR_AMD)
+        return data->ext_family >= 0x17;
+
+    return 0;
+}
+
+int icuid_clock_init(icuid_clock_t *clock, const cpuid_data_t *data)
+{
+    if (clock == NULL)
+        return ICUID_PASSED_NULL;
+
+    if (data == NULL)
+        data = icuid_get();
+
+    memset(clock, 0, sizeof(*clock));
+
+    if (!icuid_flags_test(&data->flags, CPU_FEATURE_TSC))
+        return ICUID_ERROR_NO_TSC;
+
+    if (icuid_flags_test(&data->flags, CPU_FEATURE_RDTSCP)) {
+        clock->method = TSC_READ_RDTSCP;
+        clock->read = icuid_rdtscp;
+    } else if (!icuid_flags_test(&data->flags, CPU_FEATURE_SSE2)) {
+        return ICUID_ERROR_NO_TSC; /* No fences */
+    } else if (lfence_serializes(data)) {
+        clock->method = TSC_READ_LFENCE;
+        clock->read = icuid_rdtsc_lfence;
+    } else {
+        clock->method = TSC_READ_MFENCE;
+        clock->read = icuid_rdtsc_mfence;
+    }
+
+    clock->stable = icuid_flags_test(&data->flags, CPU_FEATURE_CONSTANT_TSC);
+    clock->frequency = data->tsc_frequency;
+
+    return ICUID_OK;
+}
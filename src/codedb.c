@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Codename database: rows like the built-in tables, compiled from text
+ * into a file that is mapped read-only and searched in place.
+ *
+ *   header | entries sorted by vendor and key | NUL terminated names
+ *
+ * Codenames point into the mapping. Replaced mappings are never unmapped,
+ * so codenames handed out before a reload stay valid; reloads are rare
+ * and the files small.
+ *
+ * A mapped file must never change: a new database is written next to it
+ * and renamed over it, which is what icuid_codename_db_compile() does.
+ * Truncating or rewriting a mapped file in place breaks readers.
+ */
+
+#if !defined(_WIN32)
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <icuid/icuid.h>
+
+#include "codedb.h"
+#include "match.h"
+#include "thread.h"
+
+#define CODEDB_MAGIC   "ICDB"
+#define CODEDB_VERSION 1
+
+/* Longest line of a text database */
+#define CODEDB_LINE_MAX 256
+
+typedef struct {
+    char magic[4];           /* CODEDB_MAGIC */
+    uint16_t version;        /* CODEDB_VERSION */
+    uint16_t header_size;    /* Offset of the first entry */
+    uint32_t entry_size;     /* Size of codedb_entry_t */
+    uint32_t num_entries;
+    uint32_t strings_offset; /* Offset of the names */
+    uint32_t strings_size;
+} codedb_header_t;
+
+typedef struct {
+    uint32_t vendor;         /* cpu_vendor_t */
+    uint32_t key;            /* CODENAME_KEY */
+    uint32_t name;           /* Offset of the codename in the names */
+} codedb_entry_t;
+
+/* The database lookups use, NULL until one is loaded */
+static const codedb_header_t *current_db;
+
+/* Identity of a database file, to tell when another one replaced it */
+#if defined(_WIN32)
+typedef FILETIME db_id_t;
+#else
+typedef struct stat db_id_t;
+#endif
+
+/* What was loaded, for icuid_codename_db_reload() */
+static char db_path[4096];
+static db_id_t db_id;
+
+static int compare_entries(const void *a, const void *b)
+{
+    const codedb_entry_t *x = a, *y = b;
+
+    if (x->vendor != y->vendor)
+        return x->vendor < y->vendor ? -1 : 1;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+
+    return 0;
+}
+
+/* Returns the entries of the database in |buf| if it is valid */
+static const codedb_entry_t *db_entries(const void *buf, size_t size)
+{
+    const codedb_header_t *h = buf;
+    const codedb_entry_t *e;
+    const char *strings;
+    uint32_t i;
+
+    if (size < sizeof(*h) ||
+        memcmp(h->magic, CODEDB_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CODEDB_VERSION || h->header_size != sizeof(*h) ||
+        h->entry_size != sizeof(*e) ||
+        (size - sizeof(*h)) / sizeof(*e) < h->num_entries ||
+        h->strings_offset != sizeof(*h) + h->num_entries * sizeof(*e) ||
+        h->strings_size == 0 || size - h->strings_offset < h->strings_size)
+        return NULL;
+
+    /* Names must end inside the file, keys must be sorted and unique */
+    e = (const codedb_entry_t *)((const char *)buf + h->header_size);
+    strings = (const char *)buf + h->strings_offset;
+    if (strings[h->strings_size - 1] != '\0')
+        return NULL;
+    for (i = 0; i < h->num_entries; i++) {
+        if (e[i].name >= h->strings_size ||
+            (i > 0 && compare_entries(&e[i - 1], &e[i]) >= 0))
+            return NULL;
+    }
+
+    return e;
+}
+
+const char *codedb_lookup(cpu_vendor_t vendor, uint32_t key)
+{
+    const codedb_header_t *h = icuid_atomic_load_ptr(&current_db);
+    const codedb_entry_t *e;
+    codedb_entry_t k;
+    uint32_t lo, hi, mid;
+    int cmp;
+
+    if (h == NULL)
+        return NULL;
+
+    e = (const codedb_entry_t *)((const char *)h + h->header_size);
+    k.vendor = (uint32_t)vendor;
+    k.key = key;
+    for (lo = 0, hi = h->num_entries; lo < hi;) {
+        mid = lo + (hi - lo) / 2;
+        cmp = compare_entries(&e[mid], &k);
+        if (cmp == 0)
+            return (const char *)h + h->strings_offset + e[mid].name;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+/* Maps |file| read-only and stores its identity in |id| */
+static int map_db(const char *file, const void **buf, size_t *size,
+                  db_id_t *id)
+{
+#if defined(_WIN32)
+    HANDLE fh, mh;
+    LARGE_INTEGER len;
+
+    fh = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                     NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE)
+        return ICUID_ERROR_OPEN;
+    if (!GetFileSizeEx(fh, &len) || len.QuadPart == 0 ||
+        !GetFileTime(fh, NULL, NULL, id)) {
+        CloseHandle(fh);
+        return ICUID_ERROR_PARSING;
+    }
+    mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fh);
+    if (mh == NULL)
+        return ICUID_ERROR_MEMORY;
+    *buf = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mh);
+    if (*buf == NULL)
+        return ICUID_ERROR_MEMORY;
+    *size = (size_t)len.QuadPart;
+#else
+    void *p;
+    int fd;
+
+    if ((fd = open(file, O_RDONLY)) < 0)
+        return ICUID_ERROR_OPEN;
+    if (fstat(fd, id) != 0 || id->st_size == 0) {
+        close(fd);
+        return ICUID_ERROR_PARSING;
+    }
+    p = mmap(NULL, (size_t)id->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return ICUID_ERROR_MEMORY;
+    *buf = p;
+    *size = (size_t)id->st_size;
+#endif
+
+    return ICUID_OK;
+}
+
+static void unmap_db(const void *buf, size_t size)
+{
+#if defined(_WIN32)
+    (void)size;
+    UnmapViewOfFile(buf);
+#else
+    munmap((void *)buf, size);
+#endif
+}
+
+int icuid_codename_db_load(const char *file)
+{
+    const void *buf;
+    size_t size;
+    db_id_t id;
+    int ret;
+
+    if (file == NULL) {
+        icuid_atomic_store_ptr(&current_db, NULL);
+        db_path[0] = '\0';
+        return ICUID_OK;
+    }
+    if (strlen(file) >= sizeof(db_path))
+        return ICUID_ERROR_INVALID;
+
+    ret = map_db(file, &buf, &size, &id);
+    if (ret != ICUID_OK)
+        return ret;
+    if (db_entries(buf, size) == NULL) {
+        unmap_db(buf, size);
+        return ICUID_ERROR_PARSING;
+    }
+
+    /* The old mapping stays, its codenames may still be in use. Only now
+     * does the file become the one reloads compare against, so a rejected
+     * file is tried again instead of passing for the current one */
+    icuid_atomic_store_ptr(&current_db, (const codedb_header_t *)buf);
+    db_id = id;
+    if (db_path != file)
+        strcpy(db_path, file);
+
+    return ICUID_OK;
+}
+
+int icuid_codename_db_reload(void)
+{
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+#else
+    struct stat st;
+#endif
+
+    if (db_path[0] == '\0')
+        return ICUID_OK;
+
+#if defined(_WIN32)
+    if (!GetFileAttributesExA(db_path, GetFileExInfoStandard, &attr))
+        return ICUID_ERROR_OPEN;
+    if (CompareFileTime(&attr.ftLastWriteTime, &db_id) == 0)
+        return ICUID_OK;
+#else
+    if (stat(db_path, &st) != 0)
+        return ICUID_ERROR_OPEN;
+    /* Files are only ever replaced, which gives them a new inode */
+    if (st.st_ino == db_id.st_ino && st.st_dev == db_id.st_dev)
+        return ICUID_OK;
+#endif
+
+    return icuid_codename_db_load(db_path);
+}
+
+/* Opens a new file next to |file| for writing, its name goes to |tmp| */
+static FILE *open_temp(const char *file, char *tmp, size_t size)
+{
+#if defined(_WIN32)
+    if (strlen(file) + sizeof(".tmp") > size)
+        return NULL;
+    sprintf(tmp, "%s.tmp", file);
+    return fopen(tmp, "wb");
+#else
+    FILE *fp;
+    int fd;
+
+    if (strlen(file) + sizeof(".XXXXXX") > size)
+        return NULL;
+    sprintf(tmp, "%s.XXXXXX", file);
+    if ((fd = mkstemp(tmp)) < 0)
+        return NULL;
+    /* mkstemp() creates it private, databases are shared */
+    if (fchmod(fd, 0644) != 0 || (fp = fdopen(fd, "wb")) == NULL) {
+        close(fd);
+        remove(tmp);
+        return NULL;
+    }
+    return fp;
+#endif
+}
+
+/* Atomically replaces |file| with |tmp| */
+static int replace_file(const char *tmp, const char *file)
+{
+#if defined(_WIN32)
+    return MoveFileExA(tmp, file, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(tmp, file);
+#endif
+}
+
+/* Parses a "vendor ext_family ext_model stepping codename" line */
+static int parse_db_line(char *line, codedb_entry_t *e, char **name)
+{
+    unsigned long ext_family, ext_model, stepping = NA;
+    char *p = line, *end;
+
+    while (isspace((unsigned char)*p))
+        p++;
+    for (end = p; *end != '\0' && !isspace((unsigned char)*end); end++)
+        ;
+    if (end - p == 5 && memcmp(p, "intel", 5) == 0)
+        e->vendor = VENDOR_INTEL;
+    else if (end - p == 3 && memcmp(p, "amd", 3) == 0)
+        e->vendor = VENDOR_AMD;
+    else
+        return 0;
+    p = end;
+
+    ext_family = strtoul(p, &end, 0);
+    if (end == p || ext_family > 0xFFF)
+        return 0;
+    ext_model = strtoul(p = end, &end, 0);
+    if (end == p || ext_model > 0xFF)
+        return 0;
+    for (p = end; isspace((unsigned char)*p); p++)
+        ;
+    if (*p == '*') {
+        end = p + 1;
+    } else {
+        stepping = strtoul(p, &end, 0);
+        if (end == p || stepping > 0xF)
+            return 0;
+    }
+    e->key = CODENAME_KEY(ext_family, ext_model, stepping);
+
+    for (p = end; isspace((unsigned char)*p); p++)
+        ;
+    for (end = p + strlen(p); end > p && isspace((unsigned char)end[-1]); end--)
+        ;
+    if (end == p)
+        return 0;
+    *end = '\0';
+    *name = p;
+
+    return 1;
+}
+
+int icuid_codename_db_compile(const char *text, const char *file)
+{
+    char line[CODEDB_LINE_MAX], tmp[sizeof(db_path)], *name, *p;
+    codedb_entry_t *entries = NULL, *grown;
+    char *strings = NULL;
+    codedb_header_t h;
+    size_t len, n = 0, max = 0, strings_size = 1, strings_max = 0;
+    uint32_t i;
+    FILE *in, *out;
+    int ret = ICUID_OK;
+
+    if (text == NULL || file == NULL)
+        return ICUID_PASSED_NULL;
+    if ((in = fopen(text, "r")) == NULL)
+        return ICUID_ERROR_OPEN;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        for (p = line; isspace((unsigned char)*p); p++)
+            ;
+        if (*p == '\0' || *p == '#')
+            continue;
+        if (n == max) {
+            max = max ? max * 2 : 64;
+            if ((grown = realloc(entries, max * sizeof(*entries))) == NULL) {
+                ret = ICUID_ERROR_MEMORY;
+                break;
+            }
+            entries = grown;
+        }
+        if (!parse_db_line(p, &entries[n], &name)) {
+            ret = ICUID_ERROR_PARSING;
+            break;
+        }
+
+        /* Names are stored after a leading NUL, each once */
+        len = strlen(name) + 1;
+        if (strings_size + len > strings_max) {
+            strings_max = (strings_size + len) * 2;
+            if ((p = realloc(strings, strings_max)) == NULL) {
+                ret = ICUID_ERROR_MEMORY;
+                break;
+            }
+            strings = p;
+            strings[0] = '\0';
+        }
+        for (i = 1; i < strings_size; i += strlen(strings + i) + 1) {
+            if (strcmp(strings + i, name) == 0)
+                break;
+        }
+        if (i == strings_size) {
+            memcpy(strings + strings_size, name, len);
+            strings_size += len;
+        }
+        entries[n++].name = i;
+    }
+    fclose(in);
+    if (ret != ICUID_OK)
+        goto out;
+
+    /* Two rows for one key are ambiguous, like in the built-in tables */
+    qsort(entries, n, sizeof(*entries), compare_entries);
+    for (i = 1; i < n; i++) {
+        if (compare_entries(&entries[i - 1], &entries[i]) == 0) {
+            ret = ICUID_ERROR_PARSING;
+            goto out;
+        }
+    }
+    if (strings == NULL && (strings = calloc(1, 1)) == NULL) {
+        ret = ICUID_ERROR_MEMORY;
+        goto out;
+    }
+
+    memcpy(h.magic, CODEDB_MAGIC, sizeof(h.magic));
+    h.version = CODEDB_VERSION;
+    h.header_size = sizeof(h);
+    h.entry_size = sizeof(*entries);
+    h.num_entries = (uint32_t)n;
+    h.strings_offset = (uint32_t)(sizeof(h) + n * sizeof(*entries));
+    h.strings_size = (uint32_t)strings_size;
+
+    /* |file| may be mapped by a running process, never write to it */
+    if ((out = open_temp(file, tmp, sizeof(tmp))) == NULL) {
+        ret = ICUID_ERROR_OPEN;
+        goto out;
+    }
+    if (fwrite(&h, sizeof(h), 1, out) != 1 ||
+        fwrite(entries, sizeof(*entries), n, out) != n ||
+        fwrite(strings, 1, strings_size, out) != strings_size)
+        ret = ICUID_ERROR_OPEN;
+    if (fclose(out) != 0 && ret == ICUID_OK)
+        ret = ICUID_ERROR_OPEN;
+    if (ret == ICUID_OK && replace_file(tmp, file) != 0)
+        ret = ICUID_ERROR_OPEN;
+    if (ret != ICUID_OK)
+        remove(tmp);
+
+out:
+    free(entries);
+    free(strings);
+
+    return ret;
+}
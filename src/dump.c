@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "internal.h"
+#include "raw.h"
+
+/* Rows of every table, the most entries a binary dump can hold */
+#define MAX_BINARY_ENTRIES \
+    (MAX_CPUID_LEVEL + MAX_EXT_CPUID_LEVEL + MAX_HV_CPUID_LEVEL + \
+     MAX_INTEL_DC_LEVEL + MAX_INTEL_ET_LEVEL + MAX_INTEL_V2ET_LEVEL + \
+     MAX_AMD_DC_LEVEL + MAX_XSAVE_LEVEL + MAX_XGETBV_LEVEL)
+
+/* Longest "name[i]=eax ebx ecx edx\n" line */
+#define MAX_TEXT_LINE 64
+
+/* Sets the leaf, subleaf and table kind of row |i| of table |t| */
+static void row_key(const raw_table_t *t, uint32_t i, icuid_binary_entry_t *e)
+{
+    switch (t->kind) {
+        case RAW_LEAVES:
+            e->leaf = t->base + i;
+            e->subleaf = 0;
+            e->tables = ICUID_BINARY_LEAF;
+            break;
+        case RAW_SUBLEAVES:
+            e->leaf = t->base;
+            e->subleaf = i;
+            e->tables = ICUID_BINARY_SUBLEAF;
+            break;
+        default: /* RAW_XCR */
+            e->leaf = ICUID_BINARY_XCR;
+            e->subleaf = t->base + i;
+            e->tables = ICUID_BINARY_LEAF;
+            break;
+    }
+}
+
+/* Row of table |t| that entry |e| was read from, or -1 */
+static int key_row(const raw_table_t *t, const icuid_binary_entry_t *e)
+{
+    switch (t->kind) {
+        case RAW_LEAVES:
+            if (!(e->tables & ICUID_BINARY_LEAF) || e->subleaf != 0 ||
+                e->leaf < t->base || e->leaf - t->base >= t->limit)
+                return -1;
+            return (int)(e->leaf - t->base);
+        case RAW_SUBLEAVES:
+            if (!(e->tables & ICUID_BINARY_SUBLEAF) || e->leaf != t->base ||
+                e->subleaf >= t->limit)
+                return -1;
+            return (int)e->subleaf;
+        default:
+            if (e->leaf != ICUID_BINARY_XCR || e->subleaf < t->base ||
+                e->subleaf - t->base >= t->limit)
+                return -1;
+            return (int)(e->subleaf - t->base);
+    }
+}
+
+static int compare_keys(const icuid_binary_entry_t *x,
+                        const icuid_binary_entry_t *y)
+{
+    if (x->leaf != y->leaf)
+        return x->leaf < y->leaf ? -1 : 1;
+    if (x->subleaf != y->subleaf)
+        return x->subleaf < y->subleaf ? -1 : 1;
+
+    return 0;
+}
+
+/* Orders by key, then by contents so equal rows end up next to each other */
+static int compare_entries(const void *a, const void *b)
+{
+    const icuid_binary_entry_t *x = a, *y = b;
+    int cmp = compare_keys(x, y);
+
+    return cmp != 0 ? cmp : memcmp(x->regs, y->regs, sizeof(x->regs));
+}
+
+int icuid_raw_to_binary(const cpuid_raw_data_t *raw, void *buf, size_t *size)
+{
+    icuid_binary_entry_t entries[MAX_BINARY_ENTRIES];
+    icuid_binary_header_t header;
+    const raw_table_t *t;
+    const uint32_t (*regs)[4];
+    uint32_t i, n = 0, total;
+    size_t needed;
+
+    if (raw == NULL || size == NULL)
+        return ICUID_PASSED_NULL;
+    if (raw->lazy)
+        return ICUID_ERROR_INVALID;
+
+    /*
+     * Walk every row rather than the counted levels, dumps may carry rows
+     * past a table's terminator and those must survive a round trip
+     */
+    for (t = raw_tables; t < raw_tables + NUM_RAW_TABLES; t++) {
+        regs = (const uint32_t (*)[4])((const char *)raw + t->regs);
+        for (i = 0; i < t->limit; i++) {
+            /* Sparse: zero rows are implied */
+            if ((regs[i][eax] | regs[i][ebx] | regs[i][ecx] | regs[i][edx]) == 0)
+                continue;
+            row_key(t, i, &entries[n]);
+            memcpy(entries[n].regs, regs[i], sizeof(entries[n].regs));
+            n++;
+        }
+    }
+    qsort(entries, n, sizeof(entries[0]), compare_entries);
+
+    /*
+     * Leaf tables and subleaf tables both hold subleaf 0 of some leaves,
+     * store it once if both agree
+     */
+    for (i = 0, total = n, n = 0; i < total; i++) {
+        if (n > 0 && compare_entries(&entries[n - 1], &entries[i]) == 0)
+            entries[n - 1].tables |= entries[i].tables;
+        else
+            entries[n++] = entries[i];
+    }
+
+    needed = sizeof(header) + n * sizeof(entries[0]);
+    if (buf == NULL || *size < needed) {
+        *size = needed;
+        return buf == NULL ? ICUID_OK : ICUID_ERROR_MEMORY;
+    }
+
+    memcpy(header.magic, ICUID_BINARY_MAGIC, sizeof(header.magic));
+    header.version = ICUID_BINARY_VERSION;
+    header.header_size = sizeof(header);
+    header.entry_size = sizeof(entries[0]);
+    header.num_entries = n;
+    memcpy(buf, &header, sizeof(header));
+    memcpy((char *)buf + sizeof(header), entries, n * sizeof(entries[0]));
+    *size = needed;
+
+    return ICUID_OK;
+}
+
+/* Returns the header of the binary dump in |buf| if it is valid */
+static const icuid_binary_header_t *binary_header(const void *buf, size_t size)
+{
+    const icuid_binary_header_t *header = buf;
+
+    if (size < sizeof(*header) ||
+        memcmp(header->magic, ICUID_BINARY_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != ICUID_BINARY_VERSION ||
+        header->header_size < sizeof(*header) ||
+        header->entry_size < sizeof(icuid_binary_entry_t) ||
+        header->header_size > size ||
+        (size - header->header_size) / header->entry_size < header->num_entries)
+        return NULL;
+
+    return header;
+}
+
+#define BINARY_ENTRY(header, i) \
+    ((const icuid_binary_entry_t *)((const char *)(header) + \
+        (header)->header_size + (size_t)(i) * (header)->entry_size))
+
+int icuid_binary_leaf(const void *buf, size_t size, uint32_t leaf,
+                      uint32_t subleaf, uint32_t regs[4])
+{
+    const icuid_binary_header_t *header;
+    const icuid_binary_entry_t *e;
+    icuid_binary_entry_t key;
+    uint32_t lo, hi, mid;
+    int cmp;
+
+    if (buf == NULL || regs == NULL)
+        return ICUID_PASSED_NULL;
+    header = binary_header(buf, size);
+    if (header == NULL)
+        return ICUID_ERROR_PARSING;
+
+    key.leaf = leaf;
+    key.subleaf = subleaf;
+    memset(regs, 0, 4 * sizeof(uint32_t));
+    for (lo = 0, hi = header->num_entries; lo < hi;) {
+        mid = lo + (hi - lo) / 2;
+        e = BINARY_ENTRY(header, mid);
+        cmp = compare_keys(e, &key);
+        if (cmp == 0) {
+            memcpy(regs, e->regs, 4 * sizeof(uint32_t));
+            break;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return ICUID_OK;
+}
+
+int icuid_raw_from_binary(const void *buf, size_t size, cpuid_raw_data_t *raw)
+{
+    const icuid_binary_header_t *header;
+    const icuid_binary_entry_t *e;
+    const raw_table_t *t;
+    uint32_t i;
+    int row;
+
+    if (buf == NULL || raw == NULL)
+        return ICUID_PASSED_NULL;
+    header = binary_header(buf, size);
+    if (header == NULL)
+        return ICUID_ERROR_PARSING;
+
+    memset(raw, 0, sizeof(*raw));
+    for (i = 0; i < header->num_entries; i++) {
+        e = BINARY_ENTRY(header, i);
+        for (t = raw_tables; t < raw_tables + NUM_RAW_TABLES; t++) {
+            row = key_row(t, e);
+            if (row >= 0)
+                memcpy(RAW_TABLE_REGS(raw, t)[row], e->regs, sizeof(e->regs));
+        }
+    }
+    raw_count_levels(raw);
+
+    return ICUID_OK;
+}
+
+int icuid_raw_to_text(const cpuid_raw_data_t *raw, char *buf, size_t *size)
+{
+    char line[MAX_TEXT_LINE];
+    const raw_table_t *t;
+    const uint32_t (*regs)[4];
+    uint32_t i, levels;
+    size_t len, needed = 0;
+
+    if (raw == NULL || size == NULL)
+        return ICUID_PASSED_NULL;
+    if (raw->lazy)
+        return ICUID_ERROR_INVALID;
+
+    for (t = raw_tables; t < raw_tables + NUM_RAW_TABLES; t++) {
+        regs = (const uint32_t (*)[4])((const char *)raw + t->regs);
+        levels = *(const uint32_t *)((const char *)raw + t->levels);
+        for (i = 0; i < t->limit; i++) {
+            /* Same rows as the file dump, plus any kept past the levels */
+            if (i >= levels && (regs[i][eax] | regs[i][ebx] | regs[i][ecx] |
+                                regs[i][edx]) == 0)
+                continue;
+            len = sprintf(line, "%s[%u]=%08x %08x %08x %08x\n", t->name, i,
+                          regs[i][eax], regs[i][ebx], regs[i][ecx],
+                          regs[i][edx]);
+            if (buf != NULL && needed + len <= *size)
+                memcpy(buf + needed, line, len);
+            needed += len;
+        }
+    }
+
+    if (buf != NULL && needed > *size) {
+        *size = needed;
+        return ICUID_ERROR_MEMORY;
+    }
+    *size = needed;
+
+    return ICUID_OK;
+}
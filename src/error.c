@@ -29,6 +29,18 @@ const char *icuid_errorstr(int err)
             return "Error opening file";
         case ICUID_ERROR_PARSING:
             return "Error parsing cpuid data from input";
+        case ICUID_ERROR_MEMORY:
+            return "Out of memory";
+        case ICUID_ERROR_AFFINITY:
+            return "Unable to run cpuid on every logical CPU";
+        case ICUID_ERROR_INVALID:
+            return "Invalid parameter";
+        case ICUID_ERROR_NO_CPUS:
+            return "None of the logical CPUs may be used by the process";
+        case ICUID_ERROR_NO_TSC:
+            return "No time stamp counter that can be read with serialization";
+        case ICUID_ERROR_NOT_FOUND:
+            return "No such record";
         default:
             return "Unknown error";
     }
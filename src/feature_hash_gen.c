@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Writes feature_hash.h, a perfect hash of every feature name and alias
+ * for cpu_feature_from_str(). Names are spread over buckets by
+ * feature_name_hash(0, name); each bucket then gets the first seed that
+ * puts all of its names into free slots, largest buckets first.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "internal.h"
+#include "features.h"
+
+/* Seeds are stored as uint16_t */
+#define MAX_SEED 0xFFFF
+
+static feature_name_t names[NUM_CPU_FEATURES * 2];
+static unsigned int num_names;
+
+/* Per name, per bucket and per slot state; never more than two per name */
+static unsigned int bucket_of[NELEMS(names)], slot_of[NELEMS(names)];
+static unsigned int order[NELEMS(names)], size[NELEMS(names)];
+static uint16_t seeds[NELEMS(names)];
+static int taken[NELEMS(names) * 2];
+
+static void add_name(const char *name, cpuid_feature_t feature)
+{
+    unsigned int i;
+
+    if (strlen(name) >= FEATURE_NAME_MAX) {
+        fprintf(stderr, "feature_hash_gen: \"%s\" is too long\n", name);
+        exit(1);
+    }
+    /* cpu_feature_from_str() lower-cases its input before the lookup */
+    for (i = 0; name[i] != '\0'; i++) {
+        if (isupper((unsigned char)name[i])) {
+            fprintf(stderr, "feature_hash_gen: \"%s\" is not lower case\n",
+                    name);
+            exit(1);
+        }
+    }
+    for (i = 0; i < num_names; i++) {
+        if (strcmp(names[i].name, name) != 0)
+            continue;
+        if (names[i].feature != feature) {
+            fprintf(stderr, "feature_hash_gen: \"%s\" names two features\n",
+                    name);
+            exit(1);
+        }
+        return;
+    }
+    if (num_names == NELEMS(names)) {
+        fprintf(stderr, "feature_hash_gen: too many names\n");
+        exit(1);
+    }
+    names[num_names].name = name;
+    names[num_names++].feature = feature;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int buckets, slots, i, j, k, b, t;
+    uint32_t seed;
+    FILE *fp;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: feature_hash_gen <feature_hash.h>\n");
+        return 1;
+    }
+
+    for (i = 0; i < NUM_CPU_FEATURES; i++) {
+        if (cpu_feature_str((cpuid_feature_t)i)[0] != '\0')
+            add_name(cpu_feature_str((cpuid_feature_t)i), (cpuid_feature_t)i);
+    }
+    for (i = 0; i < num_feature_aliases; i++)
+        add_name(feature_aliases[i].name, feature_aliases[i].feature);
+
+    buckets = num_names / 4 + 1;
+    slots = num_names + num_names / 4;
+
+    for (i = 0; i < num_names; i++) {
+        bucket_of[i] = feature_name_hash(0, names[i].name) % buckets;
+        size[bucket_of[i]]++;
+    }
+    /* Largest buckets first, while most slots are free */
+    for (i = 0; i < buckets; i++)
+        order[i] = i;
+    for (i = 1; i < buckets; i++) {
+        for (j = i; j > 0 && size[order[j - 1]] < size[order[j]]; j--) {
+            t = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = t;
+        }
+    }
+
+    for (i = 0; i < buckets && size[order[i]] > 0; i++) {
+        b = order[i];
+        for (seed = 1; seed <= MAX_SEED; seed++) {
+            for (j = 0; j < num_names; j++) {
+                if (bucket_of[j] != b)
+                    continue;
+                slot_of[j] = feature_name_hash(seed, names[j].name) % slots;
+                if (taken[slot_of[j]])
+                    break;
+                /* Names of one bucket must not collide either */
+                for (k = 0; k < j; k++) {
+                    if (bucket_of[k] == b && slot_of[k] == slot_of[j])
+                        break;
+                }
+                if (k < j)
+                    break;
+            }
+            if (j == num_names)
+                break;
+        }
+        if (seed > MAX_SEED) {
+            fprintf(stderr, "feature_hash_gen: no seed for bucket %u\n", b);
+            return 1;
+        }
+        seeds[b] = (uint16_t)seed;
+        for (j = 0; j < num_names; j++) {
+            if (bucket_of[j] == b)
+                taken[slot_of[j]] = (int)j + 1;
+        }
+    }
+
+    if ((fp = fopen(argv[1], "w")) == NULL) {
+        fprintf(stderr, "feature_hash_gen: can't open %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(fp, "/* Generated by feature_hash_gen, do not edit */\n\n");
+    fprintf(fp, "#define FEATURE_HASH_BUCKETS %u\n", buckets);
+    fprintf(fp, "#define FEATURE_HASH_SLOTS %u\n\n", slots);
+    fprintf(fp, "static const uint16_t feature_hash_seeds[FEATURE_HASH_BUCKETS] = {");
+    for (i = 0; i < buckets; i++)
+        fprintf(fp, "%s%u,", i % 12 == 0 ? "\n   " : "", seeds[i]);
+    fprintf(fp, "\n};\n\n");
+    fprintf(fp, "static const feature_name_t feature_hash_slots[FEATURE_HASH_SLOTS] = {\n");
+    for (i = 0; i < slots; i++) {
+        if (taken[i] == 0)
+            fprintf(fp, "    { NULL, NUM_CPU_FEATURES },\n");
+        else
+            fprintf(fp, "    { \"%s\", (cpuid_feature_t)%u },\n",
+                    names[taken[i] - 1].name, names[taken[i] - 1].feature);
+    }
+    fprintf(fp, "};\n");
+
+    return fclose(fp) != 0;
+}
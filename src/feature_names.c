@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <icuid/icuid.h>
+
+#include "internal.h"
+#include "features.h"
+
+/*
+ * Names of the features, and the names /proc/cpuinfo and GCC's
+ * __builtin_cpu_supports() use where they differ. Also compiled into
+ * feature_hash_gen, which builds the cpu_feature_from_str() hash from them.
+ */
+
+/* Map feature to string */
+const char *cpu_feature_str(cpuid_feature_t feature)
+{
+    switch (feature) {
+        case CPU_FEATURE_FPU: return "fpu";
+        case CPU_FEATURE_VME: return "vme";
+        case CPU_FEATURE_DE: return "de";
+        case CPU_FEATURE_PSE: return "pse";
+        case CPU_FEATURE_TSC: return "tsc";
+        case CPU_FEATURE_MSR: return "msr";
+        case CPU_FEATURE_PAE: return "pae";
+        case CPU_FEATURE_MCE: return "mce";
+        case CPU_FEATURE_CX8: return "cx8";
+        case CPU_FEATURE_APIC: return "apic";
+        case CPU_FEATURE_MTRR: return "mtrr";
+        case CPU_FEATURE_SEP: return "sep";
+        case CPU_FEATURE_PGE: return "pge";
+        case CPU_FEATURE_MCA: return "mca";
+        case CPU_FEATURE_CMOV: return "cmov";
+        case CPU_FEATURE_PAT: return "pat";
+        case CPU_FEATURE_PSE36: return "pse36";
+        case CPU_FEATURE_PN: return "pn";
+        case CPU_FEATURE_CLFLUSH: return "clflush";
+        case CPU_FEATURE_DTS: return "dts";
+        case CPU_FEATURE_ACPI: return "acpi";
+        case CPU_FEATURE_MMX: return "mmx";
+        case CPU_FEATURE_FXSR: return "fxsr";
+        case CPU_FEATURE_PDPE1GB: return "pdpe1gb";
+        case CPU_FEATURE_SSE: return "sse";
+        case CPU_FEATURE_SSE2: return "sse2";
+        case CPU_FEATURE_SS: return "ss";
+        case CPU_FEATURE_HT: return "ht";
+        case CPU_FEATURE_TM: return "tm";
+        case CPU_FEATURE_IA64: return "ia64";
+        case CPU_FEATURE_PBE: return "pbe";
+        case CPU_FEATURE_PNI: return "pni";
+        case CPU_FEATURE_PCLMULDQ: return "pclmuldq";
+        case CPU_FEATURE_DTS64: return "dts64";
+        case CPU_FEATURE_MONITOR: return "monitor";
+        case CPU_FEATURE_DS_CPL: return "ds_cpl";
+        case CPU_FEATURE_VMX: return "vmx";
+        case CPU_FEATURE_SMX: return "smx";
+        case CPU_FEATURE_EST: return "est";
+        case CPU_FEATURE_TM2: return "tm2";
+        case CPU_FEATURE_SSSE3: return "ssse3";
+        case CPU_FEATURE_CID: return "cid";
+        case CPU_FEATURE_SDBG: return "sdbg";
+        case CPU_FEATURE_CX16: return "cx16";
+        case CPU_FEATURE_XTPR: return "xtpr";
+        case CPU_FEATURE_PDCM: return "pdcm";
+        case CPU_FEATURE_PCID: return "pcid";
+        case CPU_FEATURE_DCA: return "dca";
+        case CPU_FEATURE_SSE4_1: return "sse4.1";
+        case CPU_FEATURE_SSE4_2: return "sse4.2";
+        case CPU_FEATURE_SYSCALL: return "syscall";
+        case CPU_FEATURE_X2APIC: return "x2apic";
+        case CPU_FEATURE_MOVBE: return "movbe";
+        case CPU_FEATURE_POPCNT: return "popcnt";
+        case CPU_FEATURE_TSC_DEADLINE: return "tsc_deadline_timer";
+        case CPU_FEATURE_AES: return "aes";
+        case CPU_FEATURE_XSAVE: return "xsave";
+        case CPU_FEATURE_OSXSAVE: return "osxsave";
+        case CPU_FEATURE_AVX: return "avx";
+        case CPU_FEATURE_MMXEXT: return "mmxext";
+        case CPU_FEATURE_3DNOW: return "3dnow";
+        case CPU_FEATURE_3DNOWEXT: return "3dnowext";
+        case CPU_FEATURE_NX: return "nx";
+        case CPU_FEATURE_FXSR_OPT: return "fxsr_opt";
+        case CPU_FEATURE_RDTSCP: return "rdtscp";
+        case CPU_FEATURE_LM: return "lm";
+        case CPU_FEATURE_LAHF_LM: return "lahf_lm";
+        case CPU_FEATURE_CMP_LEGACY: return "cmp_legacy";
+        case CPU_FEATURE_SVM: return "svm";
+        case CPU_FEATURE_SSE4A: return "sse4a";
+        case CPU_FEATURE_MISALIGNSSE: return "misalignsse";
+        case CPU_FEATURE_ABM: return "abm";
+        case CPU_FEATURE_3DNOWPREFETCH: return "3dnowprefetch";
+        case CPU_FEATURE_OSVW: return "osvw";
+        case CPU_FEATURE_IBS: return "ibs";
+        case CPU_FEATURE_SKINIT: return "skinit";
+        case CPU_FEATURE_WDT: return "wdt";
+        case CPU_FEATURE_TS: return "ts";
+        case CPU_FEATURE_FID: return "fid";
+        case CPU_FEATURE_VID: return "vid";
+        case CPU_FEATURE_TTP: return "ttp";
+        case CPU_FEATURE_TM_AMD: return "tm_amd";
+        case CPU_FEATURE_STC: return "stc";
+        case CPU_FEATURE_100MHZSTEPS: return "100mhzsteps";
+        case CPU_FEATURE_HWPSTATE: return "hwpstate";
+        case CPU_FEATURE_CONSTANT_TSC: return "constant_tsc";
+        case CPU_FEATURE_XOP: return "xop";
+        case CPU_FEATURE_FMA: return "fma";
+        case CPU_FEATURE_FMA4: return "fma4";
+        case CPU_FEATURE_TBM: return "tbm";
+        case CPU_FEATURE_F16C: return "f16c";
+        case CPU_FEATURE_RDRAND: return "rdrand";
+        case CPU_FEATURE_CPB: return "cpb";
+        case CPU_FEATURE_APERFMPERF: return "aperfmperf";
+        case CPU_FEATURE_PFI: return "pfi";
+        case CPU_FEATURE_PA: return "pa";
+        case CPU_FEATURE_AVX2: return "avx2";
+        case CPU_FEATURE_BMI1: return "bmi1";
+        case CPU_FEATURE_BMI2: return "bmi2";
+        case CPU_FEATURE_HYPERVISOR: return "hypervisor";
+        case CPU_FEATURE_FSGSBASE: return "fsgsbase";
+        case CPU_FEATURE_HLE: return "hle";
+        case CPU_FEATURE_SMEP: return "smep";
+        case CPU_FEATURE_ERMS: return "erms";
+        case CPU_FEATURE_INVPCID: return "invpcid";
+        case CPU_FEATURE_MPX: return "mpx";
+        case CPU_FEATURE_RDTA: return "rdt_a";
+        case CPU_FEATURE_RDSEED: return "rdseed";
+        case CPU_FEATURE_ADX: return "adx";
+        case CPU_FEATURE_SMAP: return "smap";
+        case CPU_FEATURE_AVX512IFMA: return "avx512_ifma";
+        case CPU_FEATURE_SHA: return "sha";
+        case CPU_FEATURE_CLZERO: return "clzero";
+        case CPU_FEATURE_IRPERF: return "irperf";
+        case CPU_FEATURE_EXTAPIC: return "extapic";
+        case CPU_FEATURE_CR8_LEGACY: return "cr8_legacy";
+        case CPU_FEATURE_LWP: return "lwp";
+        case CPU_FEATURE_TCE: return "tce";
+        case CPU_FEATURE_NODEID_MSR: return "nodeid_msr";
+        case CPU_FEATURE_TOPOEXT: return "topoext";
+        case CPU_FEATURE_PERFCTR_CORE: return "perfctr_core";
+        case CPU_FEATURE_PERFCTR_NB: return "perfctr_nb";
+        case CPU_FEATURE_BPEXT: return "bpext";
+        case CPU_FEATURE_PERFCTR_L2: return "perfctr_l2";
+        case CPU_FEATURE_MONITORX: return "monitorx";
+        case CPU_FEATURE_TSC_ADJUST: return "tsc_adjust";
+        case CPU_FEATURE_RTM: return "rtm";
+        case CPU_FEATURE_CQM: return "cqm";
+        case CPU_FEATURE_AVX512F: return "avx512f";
+        case CPU_FEATURE_AVX512DQ: return "avx512dq";
+        case CPU_FEATURE_PCOMMIT: return "pcommit";
+        case CPU_FEATURE_CLFLUSHOPT: return "clflushopt";
+        case CPU_FEATURE_CLWB: return "clwb";
+        case CPU_FEATURE_IPT: return "ipt";
+        case CPU_FEATURE_AVX512PF: return "avx512pf";
+        case CPU_FEATURE_AVX512ER: return "avx512er";
+        case CPU_FEATURE_AVX512CD: return "avx512cd";
+        case CPU_FEATURE_AVX512BW: return "avx512bw";
+        case CPU_FEATURE_AVX512VL: return "avx512vl";
+        case CPU_FEATURE_SGX: return "sgx";
+        case CPU_FEATURE_SME: return "sme";
+        case CPU_FEATURE_PREFETCHWT1: return "prefetchwt1";
+        case CPU_FEATURE_AVX512_VBMI: return "avx512_vbmi";
+        case CPU_FEATURE_UMIP: return "umip";
+        case CPU_FEATURE_PKU: return "pku";
+        case CPU_FEATURE_OSPKE: return "ospke";
+        case CPU_FEATURE_WAITPKG: return "waitpkg";
+        case CPU_FEATURE_AVX512_VBMI2: return "avx512_vbmi2";
+        case CPU_FEATURE_CETSS: return "cetss";
+        case CPU_FEATURE_GFNI: return "gfni";
+        case CPU_FEATURE_VAES: return "vaes";
+        case CPU_FEATURE_VPCLMULQDQ: return "vpclmulqdq";
+        case CPU_FEATURE_AVX512_VNNI: return "avx512_vnni";
+        case CPU_FEATURE_AVX512_BITALG: return "avx512_bitalg";
+        case CPU_FEATURE_AVX512_VPOPCNTDQ: return "avx512_vpopcntdq";
+        case CPU_FEATURE_LA57: return "la57";
+        case CPU_FEATURE_RDPID: return "rdpid";
+        case CPU_FEATURE_KL: return "kl";
+        case CPU_FEATURE_CLDEMOTE: return "cldemote";
+        case CPU_FEATURE_MOVDIRI: return "movdiri";
+        case CPU_FEATURE_MOVDIR64B: return "movdir64b";
+        case CPU_FEATURE_ENQCMD: return "enqcmd";
+        case CPU_FEATURE_SGX_LC: return "sqx_lc";
+        case CPU_FEATURE_PKS: return "pks";
+        case CPU_FEATURE_AVX512_4VNNIW: return "avx512_4vnniw";
+        case CPU_FEATURE_AVX512_4FMAPS: return "avx512_4fmaps";
+        case CPU_FEATURE_AVX512_FSRM: return "avx512_fsrm";
+        case CPU_FEATURE_AVX512_VP2INTERSECT: return "avx512_vp2intersect";
+        case CPU_FEATURE_SRBDS_CTRL: return "srbds_ctrl";
+        case CPU_FEATURE_MD_CLEAR: return "md_clear";
+        case CPU_FEATURE_TSX_FORCE_ABORT: return "tsx_force_abort";
+        case CPU_FEATURE_SERIALIZE: return "serialize";
+        case CPU_FEATURE_HYBRID: return "hybrid_cpu";
+        case CPU_FEATURE_TSXLDTRK: return "tsxldtrk";
+        case CPU_FEATURE_PCONFIG: return "pconfig";
+        case CPU_FEATURE_ARCH_LBR: return "arch_lbr";
+        case CPU_FEATURE_AVX512_FP16: return "avx512_fp16";
+        case CPU_FEATURE_SPEC_CTRL: return "spec_ctrl";
+        case CPU_FEATURE_INTEL_STIBP: return "intel_stibp";
+        case CPU_FEATURE_FLUSH_L1D: return "flush_l1d";
+        case CPU_FEATURE_ARCH_CAPABILITIES: return "arch_capabilities";
+        case CPU_FEATURE_CORE_CAPABILITIES: return "core_capabilities";
+        case CPU_FEATURE_SPEC_CTRL_SSBD: return "spec_ctrl_ssbd";
+        case CPU_FEATURE_SEV: return "sev";
+        case CPU_FEATURE_PAGEFLUSH: return "page_flush";
+        case CPU_FEATURE_SEV_ES: return "sev_es";
+        case CPU_FEATURE_KVM_CLOCK: return "kvm_clock";
+        case CPU_FEATURE_KVM_NOP_IO_DELAY: return "kvm_nopiodelay";
+        case CPU_FEATURE_KVM_CLOCK2: return "kvm_clock2";
+        case CPU_FEATURE_KVM_ASYNC_PF: return "kvm_async_pf";
+        case CPU_FEATURE_KVM_STEAL_TIME: return "kvm_steal_time";
+        case CPU_FEATURE_KVM_PV_EOI: return "kvm_pv_eoi";
+        case CPU_FEATURE_KVM_PV_UNHALT: return "kvm_pv_unhalt";
+        case CPU_FEATURE_KVM_PV_TLB_FLUSH: return "kvm_pv_tlb_flush";
+        case CPU_FEATURE_KVM_ASYNC_PF_VMEXIT: return "kvm_async_pf_vmexit";
+        case CPU_FEATURE_KVM_PV_SEND_IPI: return "kvm_pv_send_ipi";
+        case CPU_FEATURE_KVM_POLL_CONTROL: return "kvm_poll_control";
+        case CPU_FEATURE_KVM_PV_SCHED_YIELD: return "kvm_pv_sched_yield";
+        case CPU_FEATURE_KVM_ASYNC_PF_INT: return "kvm_async_pf_int";
+        case CPU_FEATURE_KVM_MSI_EXT_DEST_ID: return "kvm_msi_ext_dest_id";
+        case CPU_FEATURE_KVM_CLOCK_STABLE: return "kvm_clock_stable";
+        case CPU_FEATURE_KVM_HINTS_REALTIME: return "kvm_hints_realtime";
+        case CPU_FEATURE_HV_TIME_REF_COUNT: return "hv_time_ref_count";
+        case CPU_FEATURE_HV_SYNIC: return "hv_synic";
+        case CPU_FEATURE_HV_STIMER: return "hv_stimer";
+        case CPU_FEATURE_HV_REF_TSC: return "hv_ref_tsc";
+        case CPU_FEATURE_HV_FREQ_MSRS: return "hv_freq_msrs";
+        case CPU_FEATURE_HV_TSC_INVARIANT: return "hv_tsc_invariant";
+        case CPU_FEATURE_HV_REMOTE_TLB_FLUSH: return "hv_remote_tlb_flush";
+        case CPU_FEATURE_HV_RELAXED_TIMING: return "hv_relaxed_timing";
+        case CPU_FEATURE_HV_EX_PROCESSOR_MASKS: return "hv_ex_processor_masks";
+        case CPU_FEATURE_HV_SPINLOCKS: return "hv_spinlocks";
+        case CPU_FEATURE_XSAVEOPT: return "xsaveopt";
+        case CPU_FEATURE_XSAVEC: return "xsavec";
+        case CPU_FEATURE_XGETBV1: return "xgetbv1";
+        case CPU_FEATURE_XSAVES: return "xsaves";
+        case CPU_FEATURE_XFD: return "xfd";
+        default:
+            return "";
+    }
+}
+
+const feature_name_t feature_aliases[] = {
+    /* /proc/cpuinfo */
+    { "pclmulqdq",           CPU_FEATURE_PCLMULDQ },
+    { "sse4_1",              CPU_FEATURE_SSE4_1 },
+    { "sse4_2",              CPU_FEATURE_SSE4_2 },
+    { "dtes64",              CPU_FEATURE_DTS64 },
+    { "avx512vbmi",          CPU_FEATURE_AVX512_VBMI },
+    { "avx512ifma",          CPU_FEATURE_AVX512IFMA },
+    { "sha_ni",              CPU_FEATURE_SHA },
+    { "intel_pt",            CPU_FEATURE_IPT },
+    { "ssbd",                CPU_FEATURE_SPEC_CTRL_SSBD },
+    { "stibp",               CPU_FEATURE_INTEL_STIBP },
+    { "fsrm",                CPU_FEATURE_AVX512_FSRM },
+    { "mwaitx",              CPU_FEATURE_MONITORX },
+    { "user_shstk",          CPU_FEATURE_CETSS },
+    { "sgx_lc",              CPU_FEATURE_SGX_LC },
+
+    /* __builtin_cpu_supports() */
+    { "sse3",                CPU_FEATURE_PNI },
+    { "pclmul",              CPU_FEATURE_PCLMULDQ },
+    { "bmi",                 CPU_FEATURE_BMI1 },
+    { "rdrnd",               CPU_FEATURE_RDRAND },
+    { "lzcnt",               CPU_FEATURE_ABM },
+    { "cmpxchg16b",          CPU_FEATURE_CX16 },
+    { "cmpxchg8b",           CPU_FEATURE_CX8 },
+    { "fxsave",              CPU_FEATURE_FXSR },
+    { "shstk",               CPU_FEATURE_CETSS },
+    { "3dnowp",              CPU_FEATURE_3DNOWEXT },
+    { "prfchw",              CPU_FEATURE_3DNOWPREFETCH },
+    { "avx5124vnniw",        CPU_FEATURE_AVX512_4VNNIW },
+    { "avx5124fmaps",        CPU_FEATURE_AVX512_4FMAPS },
+    { "avx512vpopcntdq",     CPU_FEATURE_AVX512_VPOPCNTDQ },
+    { "avx512vbmi2",         CPU_FEATURE_AVX512_VBMI2 },
+    { "avx512vnni",          CPU_FEATURE_AVX512_VNNI },
+    { "avx512bitalg",        CPU_FEATURE_AVX512_BITALG },
+    { "avx512vp2intersect",  CPU_FEATURE_AVX512_VP2INTERSECT },
+    { "avx512fp16",          CPU_FEATURE_AVX512_FP16 },
+};
+const unsigned int num_feature_aliases = NELEMS(feature_aliases);
+
+/* FNV-1a with a seed and a final mix, for the perfect hash */
+uint32_t feature_name_hash(uint32_t seed, const char *name)
+{
+    uint32_t h = 2166136261U ^ seed;
+
+    for (; *name != '\0'; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619U;
+    }
+    h ^= h >> 15;
+    h *= 0x2C1B3C6DU;
+    h ^= h >> 12;
+
+    return h;
+}
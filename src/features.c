@@ -14,13 +14,18 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <icuid/icuid.h>
 
 #include "internal.h"
 #include "features.h"
+#include "feature_hash.h"
+#include "raw.h"
+#include "thread.h"
 
 #define IS_AMD   (data->vendor == VENDOR_AMD)
 #define IS_INTEL (data->vendor == VENDOR_INTEL)
@@ -28,6 +33,9 @@
 #define VEND_INTEL  0
 #define VEND_AMD    1
 #define VEND_SHARED 2
+#define VEND_KVM    3  /* Hypervisor leaves, by hypervisor */
+#define VEND_HYPERV 4
+#define NUM_VENDS   5
 
 typedef struct {
     uint8_t bit;
@@ -35,444 +43,367 @@ typedef struct {
     uint8_t vendor;
 } cpuid_feature_map_t;
 
-static void set_feature_bits(cpuid_data_t *data,
-                      const cpuid_feature_map_t *feature,
-                      const unsigned int array_size, const uint32_t reg)
-{
-    unsigned int i;
-    for (i = 0; i < array_size; i++) {
-        if (!(reg & (1 << feature[i].bit)))
-            continue;
-        if (feature[i].vendor == VEND_SHARED)
-            data->flags[feature[i].feature] = 1;
-        else if (feature[i].vendor == VEND_INTEL && IS_INTEL)
-            data->flags[feature[i].feature] = 1;
-        else if (feature[i].vendor == VEND_AMD && IS_AMD)
-            data->flags[feature[i].feature] = 1;
-    }
-}
+static const cpuid_feature_map_t regidmap_ecx01[] = {
+    { 0,  CPU_FEATURE_PNI,             VEND_SHARED },
+    { 1,  CPU_FEATURE_PCLMULDQ,        VEND_SHARED },
+    { 2,  CPU_FEATURE_DTS64,           VEND_INTEL  },
+    { 3,  CPU_FEATURE_MONITOR,         VEND_SHARED },
+    { 4,  CPU_FEATURE_DS_CPL,          VEND_INTEL  },
+    { 5,  CPU_FEATURE_VMX,             VEND_INTEL  },
+    { 6,  CPU_FEATURE_SMX,             VEND_INTEL  },
+    { 7,  CPU_FEATURE_EST,             VEND_INTEL  },
+    { 8,  CPU_FEATURE_TM2,             VEND_INTEL  },
+    { 9,  CPU_FEATURE_SSSE3,           VEND_SHARED },
+    { 10, CPU_FEATURE_CID,             VEND_INTEL  },
+    { 11, CPU_FEATURE_SDBG,            VEND_INTEL  },
+    { 12, CPU_FEATURE_FMA,             VEND_SHARED },
+    { 13, CPU_FEATURE_CX16,            VEND_SHARED },
+    { 14, CPU_FEATURE_XTPR,            VEND_INTEL  },
+    { 15, CPU_FEATURE_PDCM,            VEND_INTEL  },
+    { 17, CPU_FEATURE_PCID,            VEND_INTEL  },
+    { 18, CPU_FEATURE_DCA,             VEND_INTEL  },
+    { 19, CPU_FEATURE_SSE4_1,          VEND_SHARED },
+    { 20, CPU_FEATURE_SSE4_2,          VEND_SHARED },
+    { 21, CPU_FEATURE_X2APIC,          VEND_INTEL  },
+    { 22, CPU_FEATURE_MOVBE,           VEND_SHARED },
+    { 23, CPU_FEATURE_POPCNT,          VEND_SHARED },
+    { 24, CPU_FEATURE_TSC_DEADLINE,    VEND_INTEL  },
+    { 25, CPU_FEATURE_AES,             VEND_SHARED },
+    { 26, CPU_FEATURE_XSAVE,           VEND_SHARED },
+    { 27, CPU_FEATURE_OSXSAVE,         VEND_SHARED },
+    { 28, CPU_FEATURE_AVX,             VEND_SHARED },
+    { 29, CPU_FEATURE_F16C,            VEND_SHARED },
+    { 30, CPU_FEATURE_RDRAND,          VEND_SHARED },
+    { 31, CPU_FEATURE_HYPERVISOR,      VEND_SHARED },
+};
+
+static const cpuid_feature_map_t regidmap_edx01[] = {
+    { 0,  CPU_FEATURE_FPU,             VEND_SHARED },
+    { 1,  CPU_FEATURE_VME,             VEND_SHARED },
+    { 2,  CPU_FEATURE_DE,              VEND_SHARED },
+    { 3,  CPU_FEATURE_PSE,             VEND_SHARED },
+    { 4,  CPU_FEATURE_TSC,             VEND_SHARED },
+    { 5,  CPU_FEATURE_MSR,             VEND_SHARED },
+    { 6,  CPU_FEATURE_PAE,             VEND_SHARED },
+    { 7,  CPU_FEATURE_MCE,             VEND_SHARED },
+    { 8,  CPU_FEATURE_CX8,             VEND_SHARED },
+    { 9,  CPU_FEATURE_APIC,            VEND_SHARED },
+    { 11, CPU_FEATURE_SEP,             VEND_SHARED },
+    { 12, CPU_FEATURE_MTRR,            VEND_SHARED },
+    { 13, CPU_FEATURE_PGE,             VEND_SHARED },
+    { 14, CPU_FEATURE_MCA,             VEND_SHARED },
+    { 15, CPU_FEATURE_CMOV,            VEND_SHARED },
+    { 16, CPU_FEATURE_PAT,             VEND_SHARED },
+    { 17, CPU_FEATURE_PSE36,           VEND_SHARED },
+    { 18, CPU_FEATURE_PN,              VEND_INTEL  },
+    { 19, CPU_FEATURE_CLFLUSH,         VEND_SHARED },
+    { 21, CPU_FEATURE_DTS,             VEND_INTEL  },
+    { 22, CPU_FEATURE_ACPI,            VEND_INTEL  },
+    { 23, CPU_FEATURE_MMX,             VEND_SHARED },
+    { 24, CPU_FEATURE_FXSR,            VEND_SHARED },
+    { 25, CPU_FEATURE_SSE,             VEND_SHARED },
+    { 26, CPU_FEATURE_SSE2,            VEND_SHARED },
+    { 27, CPU_FEATURE_SS,              VEND_INTEL  },
+    { 28, CPU_FEATURE_HT,              VEND_SHARED },
+    { 29, CPU_FEATURE_TM,              VEND_INTEL  },
+    { 30, CPU_FEATURE_IA64,            VEND_INTEL  },
+    { 31, CPU_FEATURE_PBE,             VEND_INTEL  },
+};
+
+static const cpuid_feature_map_t regidmap_ebx07[] = {
+    { 0,  CPU_FEATURE_FSGSBASE,        VEND_SHARED },
+    { 1,  CPU_FEATURE_TSC_ADJUST,      VEND_INTEL  },
+    { 2,  CPU_FEATURE_SGX,             VEND_INTEL  },
+    { 3,  CPU_FEATURE_BMI1,            VEND_SHARED },
+    { 4,  CPU_FEATURE_HLE,             VEND_INTEL  },
+    { 5,  CPU_FEATURE_AVX2,            VEND_SHARED },
+    { 7,  CPU_FEATURE_SMEP,            VEND_SHARED },
+    { 8,  CPU_FEATURE_BMI2,            VEND_SHARED },
+    { 9,  CPU_FEATURE_ERMS,            VEND_INTEL  },
+    { 10, CPU_FEATURE_INVPCID,         VEND_INTEL  },
+    { 11, CPU_FEATURE_RTM,             VEND_INTEL  },
+    { 12, CPU_FEATURE_CQM,             VEND_INTEL  },
+    { 14, CPU_FEATURE_MPX,             VEND_INTEL  },
+    { 15, CPU_FEATURE_RDTA,            VEND_INTEL  },
+    { 16, CPU_FEATURE_AVX512F,         VEND_SHARED },
+    { 17, CPU_FEATURE_AVX512DQ,        VEND_SHARED },
+    { 18, CPU_FEATURE_RDSEED,          VEND_SHARED },
+    { 19, CPU_FEATURE_ADX,             VEND_SHARED },
+    { 20, CPU_FEATURE_SMAP,            VEND_SHARED },
+    { 21, CPU_FEATURE_AVX512IFMA,      VEND_SHARED },
+    { 22, CPU_FEATURE_PCOMMIT,         VEND_INTEL  },
+    { 23, CPU_FEATURE_CLFLUSHOPT,      VEND_SHARED },
+    { 24, CPU_FEATURE_CLWB,            VEND_SHARED },
+    { 25, CPU_FEATURE_IPT,             VEND_INTEL  },
+    { 26, CPU_FEATURE_AVX512PF,        VEND_INTEL  },
+    { 27, CPU_FEATURE_AVX512ER,        VEND_INTEL  },
+    { 28, CPU_FEATURE_AVX512CD,        VEND_SHARED },
+    { 29, CPU_FEATURE_SHA,             VEND_SHARED },
+    { 30, CPU_FEATURE_AVX512BW,        VEND_SHARED },
+    { 31, CPU_FEATURE_AVX512VL,        VEND_SHARED },
+};
+
+static const cpuid_feature_map_t regidmap_ecx07[] = {
+    { 0,  CPU_FEATURE_PREFETCHWT1,      VEND_INTEL  },
+    { 1,  CPU_FEATURE_AVX512_VBMI,      VEND_SHARED },
+    { 2,  CPU_FEATURE_UMIP,             VEND_SHARED },
+    { 3,  CPU_FEATURE_PKU,              VEND_SHARED },
+    { 4,  CPU_FEATURE_OSPKE,            VEND_SHARED },
+    { 5,  CPU_FEATURE_WAITPKG,          VEND_INTEL  },
+    { 6,  CPU_FEATURE_AVX512_VBMI2,     VEND_SHARED },
+    { 7,  CPU_FEATURE_CETSS,            VEND_SHARED },
+    { 8,  CPU_FEATURE_GFNI,             VEND_SHARED },
+    { 9,  CPU_FEATURE_VAES,             VEND_SHARED },
+    { 10, CPU_FEATURE_VPCLMULQDQ,       VEND_SHARED },
+    { 11, CPU_FEATURE_AVX512_VNNI,      VEND_SHARED },
+    { 12, CPU_FEATURE_AVX512_BITALG,    VEND_SHARED },
+    { 14, CPU_FEATURE_AVX512_VPOPCNTDQ, VEND_SHARED },
+    { 16, CPU_FEATURE_LA57,             VEND_INTEL  },
+    { 22, CPU_FEATURE_RDPID,            VEND_SHARED },
+    { 23, CPU_FEATURE_KL,               VEND_INTEL  },
+    { 25, CPU_FEATURE_CLDEMOTE,         VEND_INTEL  },
+    { 27, CPU_FEATURE_MOVDIRI,          VEND_INTEL  },
+    { 28, CPU_FEATURE_MOVDIR64B,        VEND_INTEL  },
+    { 29, CPU_FEATURE_ENQCMD,           VEND_INTEL  },
+    { 30, CPU_FEATURE_SGX_LC,           VEND_INTEL  },
+    { 31, CPU_FEATURE_PKS,              VEND_INTEL  },
+};
+
+static const cpuid_feature_map_t regidmap_edx07[] = {
+    { 2,  CPU_FEATURE_AVX512_4VNNIW,       VEND_INTEL },
+    { 3,  CPU_FEATURE_AVX512_4FMAPS,       VEND_INTEL },
+    { 4,  CPU_FEATURE_AVX512_FSRM,         VEND_INTEL },
+    { 8,  CPU_FEATURE_AVX512_VP2INTERSECT, VEND_INTEL },
+    { 9,  CPU_FEATURE_SRBDS_CTRL,          VEND_INTEL },
+    { 10, CPU_FEATURE_MD_CLEAR,            VEND_INTEL },
+    { 13, CPU_FEATURE_TSX_FORCE_ABORT,     VEND_INTEL },
+    { 14, CPU_FEATURE_SERIALIZE,           VEND_INTEL },
+    { 15, CPU_FEATURE_HYBRID,              VEND_INTEL },
+    { 16, CPU_FEATURE_TSXLDTRK,            VEND_INTEL },
+    { 18, CPU_FEATURE_PCONFIG,             VEND_INTEL },
+    { 19, CPU_FEATURE_ARCH_LBR,            VEND_INTEL },
+    { 23, CPU_FEATURE_AVX512_FP16,         VEND_INTEL },
+    { 26, CPU_FEATURE_SPEC_CTRL,           VEND_INTEL },
+    { 26, CPU_FEATURE_INTEL_STIBP,         VEND_INTEL },
+    { 27, CPU_FEATURE_FLUSH_L1D,           VEND_INTEL },
+    { 28, CPU_FEATURE_ARCH_CAPABILITIES,   VEND_INTEL },
+    { 29, CPU_FEATURE_CORE_CAPABILITIES,   VEND_INTEL },
+    { 30, CPU_FEATURE_SPEC_CTRL_SSBD,      VEND_INTEL },
+};
+
+static const cpuid_feature_map_t regidmap_ecx81[] = {
+    { 0,  CPU_FEATURE_LAHF_LM,         VEND_SHARED },
+    { 1,  CPU_FEATURE_CMP_LEGACY,      VEND_AMD    },
+    { 2,  CPU_FEATURE_SVM,             VEND_AMD    },
+    { 3,  CPU_FEATURE_EXTAPIC,         VEND_AMD    },
+    { 4,  CPU_FEATURE_CR8_LEGACY,      VEND_AMD    },
+    { 5,  CPU_FEATURE_ABM,             VEND_SHARED },
+    { 6,  CPU_FEATURE_SSE4A,           VEND_AMD    },
+    { 7,  CPU_FEATURE_MISALIGNSSE,     VEND_AMD    },
+    { 8,  CPU_FEATURE_3DNOWPREFETCH,   VEND_AMD    },
+    { 9,  CPU_FEATURE_OSVW,            VEND_AMD    },
+    { 10, CPU_FEATURE_IBS,             VEND_AMD    },
+    { 11, CPU_FEATURE_XOP,             VEND_AMD    },
+    { 12, CPU_FEATURE_SKINIT,          VEND_AMD    },
+    { 13, CPU_FEATURE_WDT,             VEND_AMD    },
+    { 15, CPU_FEATURE_LWP,             VEND_AMD    },
+    { 16, CPU_FEATURE_FMA4,            VEND_AMD    },
+    { 17, CPU_FEATURE_TCE,             VEND_AMD    },
+    { 19, CPU_FEATURE_NODEID_MSR,      VEND_AMD    },
+    { 21, CPU_FEATURE_TBM,             VEND_AMD    },
+    { 22, CPU_FEATURE_TOPOEXT,         VEND_AMD    },
+    { 23, CPU_FEATURE_PERFCTR_CORE,    VEND_AMD    },
+    { 24, CPU_FEATURE_PERFCTR_NB,      VEND_AMD    },
+    { 26, CPU_FEATURE_BPEXT,           VEND_AMD    },
+    { 28, CPU_FEATURE_PERFCTR_L2,      VEND_AMD    },
+    { 29, CPU_FEATURE_MONITORX,        VEND_AMD    },
+};
+
+static const cpuid_feature_map_t regidmap_edx81[] = {
+    { 11, CPU_FEATURE_SYSCALL,         VEND_SHARED },
+    { 20, CPU_FEATURE_NX,              VEND_SHARED },
+    { 22, CPU_FEATURE_MMXEXT,          VEND_AMD    },
+    { 25, CPU_FEATURE_FXSR_OPT,        VEND_AMD    },
+    { 26, CPU_FEATURE_PDPE1GB,         VEND_SHARED },
+    { 27, CPU_FEATURE_RDTSCP,          VEND_SHARED },
+    { 29, CPU_FEATURE_LM,              VEND_SHARED },
+    { 30, CPU_FEATURE_3DNOWEXT,        VEND_AMD    },
+    { 31, CPU_FEATURE_3DNOW,           VEND_AMD    },
+};
+
+static const cpuid_feature_map_t regidmap_edx87[] = {
+    { 0,  CPU_FEATURE_TS,              VEND_AMD    },
+    { 1,  CPU_FEATURE_FID,             VEND_AMD    },
+    { 2,  CPU_FEATURE_VID,             VEND_AMD    },
+    { 3,  CPU_FEATURE_TTP,             VEND_AMD    },
+    { 4,  CPU_FEATURE_TM_AMD,          VEND_AMD    },
+    { 5,  CPU_FEATURE_STC,             VEND_AMD    },
+    { 6,  CPU_FEATURE_100MHZSTEPS,     VEND_AMD    },
+    { 7,  CPU_FEATURE_HWPSTATE,        VEND_AMD    },
+    { 8,  CPU_FEATURE_CONSTANT_TSC,    VEND_SHARED },
+    { 9,  CPU_FEATURE_CPB,             VEND_AMD    },
+    { 10, CPU_FEATURE_APERFMPERF,      VEND_AMD    },
+    { 11, CPU_FEATURE_PFI,             VEND_AMD    },
+    { 12, CPU_FEATURE_PA,              VEND_AMD    },
+};
+
+static const cpuid_feature_map_t regidmap_ebx88[] = {
+    {  0, CPU_FEATURE_CLZERO,          VEND_AMD    },
+    {  1, CPU_FEATURE_IRPERF,          VEND_AMD    },
+};
+
+static const cpuid_feature_map_t regidmap_eax_8000_1F[] = {
+    {  0, CPU_FEATURE_SME,             VEND_AMD    },
+    {  1, CPU_FEATURE_SEV,             VEND_AMD    },
+    {  2, CPU_FEATURE_PAGEFLUSH,       VEND_AMD    },
+    {  3, CPU_FEATURE_SEV_ES,          VEND_AMD    },
+};
+
+static const cpuid_feature_map_t regidmap_eax_4000_01[] = {
+    {  0, CPU_FEATURE_KVM_CLOCK,           VEND_KVM    },
+    {  1, CPU_FEATURE_KVM_NOP_IO_DELAY,    VEND_KVM    },
+    {  3, CPU_FEATURE_KVM_CLOCK2,          VEND_KVM    },
+    {  4, CPU_FEATURE_KVM_ASYNC_PF,        VEND_KVM    },
+    {  5, CPU_FEATURE_KVM_STEAL_TIME,      VEND_KVM    },
+    {  6, CPU_FEATURE_KVM_PV_EOI,          VEND_KVM    },
+    {  7, CPU_FEATURE_KVM_PV_UNHALT,       VEND_KVM    },
+    {  9, CPU_FEATURE_KVM_PV_TLB_FLUSH,    VEND_KVM    },
+    { 10, CPU_FEATURE_KVM_ASYNC_PF_VMEXIT, VEND_KVM    },
+    { 11, CPU_FEATURE_KVM_PV_SEND_IPI,     VEND_KVM    },
+    { 12, CPU_FEATURE_KVM_POLL_CONTROL,    VEND_KVM    },
+    { 13, CPU_FEATURE_KVM_PV_SCHED_YIELD,  VEND_KVM    },
+    { 14, CPU_FEATURE_KVM_ASYNC_PF_INT,    VEND_KVM    },
+    { 15, CPU_FEATURE_KVM_MSI_EXT_DEST_ID, VEND_KVM    },
+    { 24, CPU_FEATURE_KVM_CLOCK_STABLE,    VEND_KVM    },
+};
+
+static const cpuid_feature_map_t regidmap_edx_4000_01[] = {
+    {  0, CPU_FEATURE_KVM_HINTS_REALTIME,  VEND_KVM    },
+};
+
+static const cpuid_feature_map_t regidmap_eax_4000_03[] = {
+    {  1, CPU_FEATURE_HV_TIME_REF_COUNT,   VEND_HYPERV },
+    {  2, CPU_FEATURE_HV_SYNIC,            VEND_HYPERV },
+    {  3, CPU_FEATURE_HV_STIMER,           VEND_HYPERV },
+    {  9, CPU_FEATURE_HV_REF_TSC,          VEND_HYPERV },
+    { 11, CPU_FEATURE_HV_FREQ_MSRS,        VEND_HYPERV },
+    { 15, CPU_FEATURE_HV_TSC_INVARIANT,    VEND_HYPERV },
+};
+
+static const cpuid_feature_map_t regidmap_eax_4000_04[] = {
+    {  2, CPU_FEATURE_HV_REMOTE_TLB_FLUSH, VEND_HYPERV },
+    {  5, CPU_FEATURE_HV_RELAXED_TIMING,   VEND_HYPERV },
+    { 11, CPU_FEATURE_HV_EX_PROCESSOR_MASKS, VEND_HYPERV },
+};
 
-/* Map feature to string */
-const char *cpu_feature_str(cpuid_feature_t feature)
+/* Registers that hold feature bits, and how their bits map to features */
+static const struct {
+    uint32_t leaf;
+    cpuid_register_t reg;
+    const cpuid_feature_map_t *map;
+    unsigned int map_size;
+} feature_regs[] = {
+    { 0x00000001, ecx, regidmap_ecx01,       NELEMS(regidmap_ecx01)       },
+    { 0x00000001, edx, regidmap_edx01,       NELEMS(regidmap_edx01)       },
+    { 0x00000007, ebx, regidmap_ebx07,       NELEMS(regidmap_ebx07)       },
+    { 0x00000007, ecx, regidmap_ecx07,       NELEMS(regidmap_ecx07)       },
+    { 0x00000007, edx, regidmap_edx07,       NELEMS(regidmap_edx07)       },
+    { 0x80000001, ecx, regidmap_ecx81,       NELEMS(regidmap_ecx81)       },
+    { 0x80000001, edx, regidmap_edx81,       NELEMS(regidmap_edx81)       },
+    { 0x80000007, edx, regidmap_edx87,       NELEMS(regidmap_edx87)       },
+    { 0x80000008, ebx, regidmap_ebx88,       NELEMS(regidmap_ebx88)       },
+    { 0x8000001F, eax, regidmap_eax_8000_1F, NELEMS(regidmap_eax_8000_1F) },
+    { 0x40000001, eax, regidmap_eax_4000_01, NELEMS(regidmap_eax_4000_01) },
+    { 0x40000001, edx, regidmap_edx_4000_01, NELEMS(regidmap_edx_4000_01) },
+    { 0x40000003, eax, regidmap_eax_4000_03, NELEMS(regidmap_eax_4000_03) },
+    { 0x40000004, eax, regidmap_eax_4000_04, NELEMS(regidmap_eax_4000_04) },
+};
+
+/**
+ * A run of consecutive register bits that map to consecutive features of
+ * the same vendor. Copying a run into the feature set is a shift, two ANDs
+ * and one or two ORs, instead of a test and a vendor check per bit.
+ */
+typedef struct {
+    uint32_t mask;     /* Run bits, shifted down to bit 0 */
+    uint8_t shift;     /* First register bit of the run */
+    uint8_t vendor;    /* VEND_* */
+    uint16_t feature;  /* Feature of the first register bit */
+} feature_run_t;
+
+static feature_run_t feature_runs[CPU_FLAGS_MAX];
+static unsigned int feature_reg_runs[NELEMS(feature_regs) + 1];
+static icuid_once_t feature_runs_once = ICUID_ONCE_INIT;
+
+/**
+ * Compiles the feature maps into runs. The runs of feature_regs[i] are
+ * feature_runs[feature_reg_runs[i]] up to feature_runs[feature_reg_runs[i + 1]].
+ */
+static void build_feature_runs(void)
 {
-    switch (feature) {
-        case CPU_FEATURE_FPU: return "fpu";
-        case CPU_FEATURE_VME: return "vme";
-        case CPU_FEATURE_DE: return "de";
-        case CPU_FEATURE_PSE: return "pse";
-        case CPU_FEATURE_TSC: return "tsc";
-        case CPU_FEATURE_MSR: return "msr";
-        case CPU_FEATURE_PAE: return "pae";
-        case CPU_FEATURE_MCE: return "mce";
-        case CPU_FEATURE_CX8: return "cx8";
-        case CPU_FEATURE_APIC: return "apic";
-        case CPU_FEATURE_MTRR: return "mtrr";
-        case CPU_FEATURE_SEP: return "sep";
-        case CPU_FEATURE_PGE: return "pge";
-        case CPU_FEATURE_MCA: return "mca";
-        case CPU_FEATURE_CMOV: return "cmov";
-        case CPU_FEATURE_PAT: return "pat";
-        case CPU_FEATURE_PSE36: return "pse36";
-        case CPU_FEATURE_PN: return "pn";
-        case CPU_FEATURE_CLFLUSH: return "clflush";
-        case CPU_FEATURE_DTS: return "dts";
-        case CPU_FEATURE_ACPI: return "acpi";
-        case CPU_FEATURE_MMX: return "mmx";
-        case CPU_FEATURE_FXSR: return "fxsr";
-        case CPU_FEATURE_PDPE1GB: return "pdpe1gb";
-        case CPU_FEATURE_SSE: return "sse";
-        case CPU_FEATURE_SSE2: return "sse2";
-        case CPU_FEATURE_SS: return "ss";
-        case CPU_FEATURE_HT: return "ht";
-        case CPU_FEATURE_TM: return "tm";
-        case CPU_FEATURE_IA64: return "ia64";
-        case CPU_FEATURE_PBE: return "pbe";
-        case CPU_FEATURE_PNI: return "pni";
-        case CPU_FEATURE_PCLMULDQ: return "pclmuldq";
-        case CPU_FEATURE_DTS64: return "dts64";
-        case CPU_FEATURE_MONITOR: return "monitor";
-        case CPU_FEATURE_DS_CPL: return "ds_cpl";
-        case CPU_FEATURE_VMX: return "vmx";
-        case CPU_FEATURE_SMX: return "smx";
-        case CPU_FEATURE_EST: return "est";
-        case CPU_FEATURE_TM2: return "tm2";
-        case CPU_FEATURE_SSSE3: return "ssse3";
-        case CPU_FEATURE_CID: return "cid";
-        case CPU_FEATURE_SDBG: return "sdbg";
-        case CPU_FEATURE_CX16: return "cx16";
-        case CPU_FEATURE_XTPR: return "xtpr";
-        case CPU_FEATURE_PDCM: return "pdcm";
-        case CPU_FEATURE_PCID: return "pcid";
-        case CPU_FEATURE_DCA: return "dca";
-        case CPU_FEATURE_SSE4_1: return "sse4.1";
-        case CPU_FEATURE_SSE4_2: return "sse4.2";
-        case CPU_FEATURE_SYSCALL: return "syscall";
-        case CPU_FEATURE_X2APIC: return "x2apic";
-        case CPU_FEATURE_MOVBE: return "movbe";
-        case CPU_FEATURE_POPCNT: return "popcnt";
-        case CPU_FEATURE_TSC_DEADLINE: return "tsc_deadline_timer";
-        case CPU_FEATURE_AES: return "aes";
-        case CPU_FEATURE_XSAVE: return "xsave";
-        case CPU_FEATURE_OSXSAVE: return "osxsave";
-        case CPU_FEATURE_AVX: return "avx";
-        case CPU_FEATURE_MMXEXT: return "mmxext";
-        case CPU_FEATURE_3DNOW: return "3dnow";
-        case CPU_FEATURE_3DNOWEXT: return "3dnowext";
-        case CPU_FEATURE_NX: return "nx";
-        case CPU_FEATURE_FXSR_OPT: return "fxsr_opt";
-        case CPU_FEATURE_RDTSCP: return "rdtscp";
-        case CPU_FEATURE_LM: return "lm";
-        case CPU_FEATURE_LAHF_LM: return "lahf_lm";
-        case CPU_FEATURE_CMP_LEGACY: return "cmp_legacy";
-        case CPU_FEATURE_SVM: return "svm";
-        case CPU_FEATURE_SSE4A: return "sse4a";
-        case CPU_FEATURE_MISALIGNSSE: return "misalignsse";
-        case CPU_FEATURE_ABM: return "abm";
-        case CPU_FEATURE_3DNOWPREFETCH: return "3dnowprefetch";
-        case CPU_FEATURE_OSVW: return "osvw";
-        case CPU_FEATURE_IBS: return "ibs";
-        case CPU_FEATURE_SKINIT: return "skinit";
-        case CPU_FEATURE_WDT: return "wdt";
-        case CPU_FEATURE_TS: return "ts";
-        case CPU_FEATURE_FID: return "fid";
-        case CPU_FEATURE_VID: return "vid";
-        case CPU_FEATURE_TTP: return "ttp";
-        case CPU_FEATURE_TM_AMD: return "tm_amd";
-        case CPU_FEATURE_STC: return "stc";
-        case CPU_FEATURE_100MHZSTEPS: return "100mhzsteps";
-        case CPU_FEATURE_HWPSTATE: return "hwpstate";
-        case CPU_FEATURE_CONSTANT_TSC: return "constant_tsc";
-        case CPU_FEATURE_XOP: return "xop";
-        case CPU_FEATURE_FMA: return "fma";
-        case CPU_FEATURE_FMA4: return "fma4";
-        case CPU_FEATURE_TBM: return "tbm";
-        case CPU_FEATURE_F16C: return "f16c";
-        case CPU_FEATURE_RDRAND: return "rdrand";
-        case CPU_FEATURE_CPB: return "cpb";
-        case CPU_FEATURE_APERFMPERF: return "aperfmperf";
-        case CPU_FEATURE_PFI: return "pfi";
-        case CPU_FEATURE_PA: return "pa";
-        case CPU_FEATURE_AVX2: return "avx2";
-        case CPU_FEATURE_BMI1: return "bmi1";
-        case CPU_FEATURE_BMI2: return "bmi2";
-        case CPU_FEATURE_HYPERVISOR: return "hypervisor";
-        case CPU_FEATURE_FSGSBASE: return "fsgsbase";
-        case CPU_FEATURE_HLE: return "hle";
-        case CPU_FEATURE_SMEP: return "smep";
-        case CPU_FEATURE_ERMS: return "erms";
-        case CPU_FEATURE_INVPCID: return "invpcid";
-        case CPU_FEATURE_MPX: return "mpx";
-        case CPU_FEATURE_RDTA: return "rdt_a";
-        case CPU_FEATURE_RDSEED: return "rdseed";
-        case CPU_FEATURE_ADX: return "adx";
-        case CPU_FEATURE_SMAP: return "smap";
-        case CPU_FEATURE_AVX512IFMA: return "avx512_ifma";
-        case CPU_FEATURE_SHA: return "sha";
-        case CPU_FEATURE_CLZERO: return "clzero";
-        case CPU_FEATURE_IRPERF: return "irperf";
-        case CPU_FEATURE_EXTAPIC: return "extapic";
-        case CPU_FEATURE_CR8_LEGACY: return "cr8_legacy";
-        case CPU_FEATURE_LWP: return "lwp";
-        case CPU_FEATURE_TCE: return "tce";
-        case CPU_FEATURE_NODEID_MSR: return "nodeid_msr";
-        case CPU_FEATURE_TOPOEXT: return "topoext";
-        case CPU_FEATURE_PERFCTR_CORE: return "perfctr_core";
-        case CPU_FEATURE_PERFCTR_NB: return "perfctr_nb";
-        case CPU_FEATURE_BPEXT: return "bpext";
-        case CPU_FEATURE_PERFCTR_L2: return "perfctr_l2";
-        case CPU_FEATURE_MONITORX: return "monitorx";
-        case CPU_FEATURE_TSC_ADJUST: return "tsc_adjust";
-        case CPU_FEATURE_RTM: return "rtm";
-        case CPU_FEATURE_CQM: return "cqm";
-        case CPU_FEATURE_AVX512F: return "avx512f";
-        case CPU_FEATURE_AVX512DQ: return "avx512dq";
-        case CPU_FEATURE_PCOMMIT: return "pcommit";
-        case CPU_FEATURE_CLFLUSHOPT: return "clflushopt";
-        case CPU_FEATURE_CLWB: return "clwb";
-        case CPU_FEATURE_IPT: return "ipt";
-        case CPU_FEATURE_AVX512PF: return "avx512pf";
-        case CPU_FEATURE_AVX512ER: return "avx512er";
-        case CPU_FEATURE_AVX512CD: return "avx512cd";
-        case CPU_FEATURE_AVX512BW: return "avx512bw";
-        case CPU_FEATURE_AVX512VL: return "avx512vl";
-        case CPU_FEATURE_SGX: return "sgx";
-        case CPU_FEATURE_SME: return "sme";
-        case CPU_FEATURE_PREFETCHWT1: return "prefetchwt1";
-        case CPU_FEATURE_AVX512_VBMI: return "avx512_vbmi";
-        case CPU_FEATURE_UMIP: return "umip";
-        case CPU_FEATURE_PKU: return "pku";
-        case CPU_FEATURE_OSPKE: return "ospke";
-        case CPU_FEATURE_WAITPKG: return "waitpkg";
-        case CPU_FEATURE_AVX512_VBMI2: return "avx512_vbmi2";
-        case CPU_FEATURE_CETSS: return "cetss";
-        case CPU_FEATURE_GFNI: return "gfni";
-        case CPU_FEATURE_VAES: return "vaes";
-        case CPU_FEATURE_VPCLMULQDQ: return "vpclmulqdq";
-        case CPU_FEATURE_AVX512_VNNI: return "avx512_vnni";
-        case CPU_FEATURE_AVX512_BITALG: return "avx512_bitalg";
-        case CPU_FEATURE_AVX512_VPOPCNTDQ: return "avx512_vpopcntdq";
-        case CPU_FEATURE_LA57: return "la57";
-        case CPU_FEATURE_RDPID: return "rdpid";
-        case CPU_FEATURE_KL: return "kl";
-        case CPU_FEATURE_CLDEMOTE: return "cldemote";
-        case CPU_FEATURE_MOVDIRI: return "movdiri";
-        case CPU_FEATURE_MOVDIR64B: return "movdir64b";
-        case CPU_FEATURE_ENQCMD: return "enqcmd";
-        case CPU_FEATURE_SGX_LC: return "sqx_lc";
-        case CPU_FEATURE_PKS: return "pks";
-        case CPU_FEATURE_AVX512_4VNNIW: return "avx512_4vnniw";
-        case CPU_FEATURE_AVX512_4FMAPS: return "avx512_4fmaps";
-        case CPU_FEATURE_AVX512_FSRM: return "avx512_fsrm";
-        case CPU_FEATURE_AVX512_VP2INTERSECT: return "avx512_vp2intersect";
-        case CPU_FEATURE_SRBDS_CTRL: return "srbds_ctrl";
-        case CPU_FEATURE_MD_CLEAR: return "md_clear";
-        case CPU_FEATURE_TSX_FORCE_ABORT: return "tsx_force_abort";
-        case CPU_FEATURE_SERIALIZE: return "serialize";
-        case CPU_FEATURE_TSXLDTRK: return "tsxldtrk";
-        case CPU_FEATURE_PCONFIG: return "pconfig";
-        case CPU_FEATURE_ARCH_LBR: return "arch_lbr";
-        case CPU_FEATURE_AVX512_FP16: return "avx512_fp16";
-        case CPU_FEATURE_SPEC_CTRL: return "spec_ctrl";
-        case CPU_FEATURE_INTEL_STIBP: return "intel_stibp";
-        case CPU_FEATURE_FLUSH_L1D: return "flush_l1d";
-        case CPU_FEATURE_ARCH_CAPABILITIES: return "arch_capabilities";
-        case CPU_FEATURE_CORE_CAPABILITIES: return "core_capabilities";
-        case CPU_FEATURE_SPEC_CTRL_SSBD: return "spec_ctrl_ssbd";
-        case CPU_FEATURE_SEV: return "sev";
-        case CPU_FEATURE_PAGEFLUSH: return "page_flush";
-        case CPU_FEATURE_SEV_ES: return "sev_es";
-        default:
-            return "";
+    const cpuid_feature_map_t *m;
+    feature_run_t *run = NULL;
+    unsigned int i, j, n = 0;
+
+    for (i = 0; i < NELEMS(feature_regs); i++) {
+        feature_reg_runs[i] = n;
+        for (j = 0; j < feature_regs[i].map_size; j++) {
+            m = &feature_regs[i].map[j];
+            if (run != NULL && j > 0 && run->vendor == m->vendor &&
+                m->bit == m[-1].bit + 1 && m->feature == m[-1].feature + 1U) {
+                run->mask |= 1U << (m->bit - run->shift);
+                continue;
+            }
+            run = &feature_runs[n++];
+            run->mask = 1;
+            run->shift = m->bit;
+            run->vendor = m->vendor;
+            run->feature = (uint16_t)m->feature;
+        }
     }
+    feature_reg_runs[i] = n;
 }
 
-void set_cpuid_features(const cpuid_raw_data_t *raw, cpuid_data_t *data)
+void set_cpuid_features(cpuid_raw_data_t *raw, cpuid_data_t *data)
 {
-    const cpuid_feature_map_t regidmap_ecx01[] = {
-        { 0,  CPU_FEATURE_PNI,             VEND_SHARED },
-        { 1,  CPU_FEATURE_PCLMULDQ,        VEND_SHARED },
-        { 2,  CPU_FEATURE_DTS64,           VEND_INTEL  },
-        { 3,  CPU_FEATURE_MONITOR,         VEND_SHARED },
-        { 4,  CPU_FEATURE_DS_CPL,          VEND_INTEL  },
-        { 5,  CPU_FEATURE_VMX,             VEND_INTEL  },
-        { 6,  CPU_FEATURE_SMX,             VEND_INTEL  },
-        { 7,  CPU_FEATURE_EST,             VEND_INTEL  },
-        { 8,  CPU_FEATURE_TM2,             VEND_INTEL  },
-        { 9,  CPU_FEATURE_SSSE3,           VEND_SHARED },
-        { 10, CPU_FEATURE_CID,             VEND_INTEL  },
-        { 11, CPU_FEATURE_SDBG,            VEND_INTEL  },
-        { 12, CPU_FEATURE_FMA,             VEND_SHARED },
-        { 13, CPU_FEATURE_CX16,            VEND_SHARED },
-        { 14, CPU_FEATURE_XTPR,            VEND_INTEL  },
-        { 15, CPU_FEATURE_PDCM,            VEND_INTEL  },
-        { 17, CPU_FEATURE_PCID,            VEND_INTEL  },
-        { 18, CPU_FEATURE_DCA,             VEND_INTEL  },
-        { 19, CPU_FEATURE_SSE4_1,          VEND_SHARED },
-        { 20, CPU_FEATURE_SSE4_2,          VEND_SHARED },
-        { 21, CPU_FEATURE_X2APIC,          VEND_INTEL  },
-        { 22, CPU_FEATURE_MOVBE,           VEND_SHARED },
-        { 23, CPU_FEATURE_POPCNT,          VEND_SHARED },
-        { 24, CPU_FEATURE_TSC_DEADLINE,    VEND_INTEL  },
-        { 25, CPU_FEATURE_AES,             VEND_SHARED },
-        { 26, CPU_FEATURE_XSAVE,           VEND_SHARED },
-        { 27, CPU_FEATURE_OSXSAVE,         VEND_SHARED },
-        { 28, CPU_FEATURE_AVX,             VEND_SHARED },
-        { 29, CPU_FEATURE_F16C,            VEND_SHARED },
-        { 30, CPU_FEATURE_RDRAND,          VEND_SHARED },
-        { 31, CPU_FEATURE_HYPERVISOR,      VEND_SHARED },
-    };
-    const cpuid_feature_map_t regidmap_edx01[] = {
-        { 0,  CPU_FEATURE_FPU,             VEND_SHARED },
-        { 1,  CPU_FEATURE_VME,             VEND_SHARED },
-        { 2,  CPU_FEATURE_DE,              VEND_SHARED },
-        { 3,  CPU_FEATURE_PSE,             VEND_SHARED },
-        { 4,  CPU_FEATURE_TSC,             VEND_SHARED },
-        { 5,  CPU_FEATURE_MSR,             VEND_SHARED },
-        { 6,  CPU_FEATURE_PAE,             VEND_SHARED },
-        { 7,  CPU_FEATURE_MCE,             VEND_SHARED },
-        { 8,  CPU_FEATURE_CX8,             VEND_SHARED },
-        { 9,  CPU_FEATURE_APIC,            VEND_SHARED },
-        { 11, CPU_FEATURE_SEP,             VEND_SHARED },
-        { 12, CPU_FEATURE_MTRR,            VEND_SHARED },
-        { 13, CPU_FEATURE_PGE,             VEND_SHARED },
-        { 14, CPU_FEATURE_MCA,             VEND_SHARED },
-        { 15, CPU_FEATURE_CMOV,            VEND_SHARED },
-        { 16, CPU_FEATURE_PAT,             VEND_SHARED },
-        { 17, CPU_FEATURE_PSE36,           VEND_SHARED },
-        { 18, CPU_FEATURE_PN,              VEND_INTEL  },
-        { 19, CPU_FEATURE_CLFLUSH,         VEND_SHARED },
-        { 21, CPU_FEATURE_DTS,             VEND_INTEL  },
-        { 22, CPU_FEATURE_ACPI,            VEND_INTEL  },
-        { 23, CPU_FEATURE_MMX,             VEND_SHARED },
-        { 24, CPU_FEATURE_FXSR,            VEND_SHARED },
-        { 25, CPU_FEATURE_SSE,             VEND_SHARED },
-        { 26, CPU_FEATURE_SSE2,            VEND_SHARED },
-        { 27, CPU_FEATURE_SS,              VEND_INTEL  },
-        { 28, CPU_FEATURE_HT,              VEND_SHARED },
-        { 29, CPU_FEATURE_TM,              VEND_INTEL  },
-        { 30, CPU_FEATURE_IA64,            VEND_INTEL  },
-        { 31, CPU_FEATURE_PBE,             VEND_INTEL  },
-    };
-    const cpuid_feature_map_t regidmap_ebx07[] = {
-        { 0,  CPU_FEATURE_FSGSBASE,        VEND_SHARED },
-        { 1,  CPU_FEATURE_TSC_ADJUST,      VEND_INTEL  },
-        { 2,  CPU_FEATURE_SGX,             VEND_INTEL  },
-        { 3,  CPU_FEATURE_BMI1,            VEND_SHARED },
-        { 4,  CPU_FEATURE_HLE,             VEND_INTEL  },
-        { 5,  CPU_FEATURE_AVX2,            VEND_SHARED },
-        { 7,  CPU_FEATURE_SMEP,            VEND_SHARED },
-        { 8,  CPU_FEATURE_BMI2,            VEND_SHARED },
-        { 9,  CPU_FEATURE_ERMS,            VEND_INTEL  },
-        { 10, CPU_FEATURE_INVPCID,         VEND_INTEL  },
-        { 11, CPU_FEATURE_RTM,             VEND_INTEL  },
-        { 12, CPU_FEATURE_CQM,             VEND_INTEL  },
-        { 14, CPU_FEATURE_MPX,             VEND_INTEL  },
-        { 15, CPU_FEATURE_RDTA,            VEND_INTEL  },
-        { 16, CPU_FEATURE_AVX512F,         VEND_INTEL  },
-        { 17, CPU_FEATURE_AVX512DQ,        VEND_INTEL  },
-        { 18, CPU_FEATURE_RDSEED,          VEND_SHARED },
-        { 19, CPU_FEATURE_ADX,             VEND_SHARED },
-        { 20, CPU_FEATURE_SMAP,            VEND_SHARED },
-        { 21, CPU_FEATURE_AVX512IFMA,      VEND_INTEL  },
-        { 22, CPU_FEATURE_PCOMMIT,         VEND_INTEL  },
-        { 23, CPU_FEATURE_CLFLUSHOPT,      VEND_SHARED },
-        { 24, CPU_FEATURE_CLWB,            VEND_SHARED },
-        { 25, CPU_FEATURE_IPT,             VEND_INTEL  },
-        { 26, CPU_FEATURE_AVX512PF,        VEND_INTEL  },
-        { 27, CPU_FEATURE_AVX512ER,        VEND_INTEL  },
-        { 28, CPU_FEATURE_AVX512CD,        VEND_INTEL  },
-        { 29, CPU_FEATURE_SHA,             VEND_SHARED },
-        { 30, CPU_FEATURE_AVX512BW,        VEND_INTEL  },
-        { 31, CPU_FEATURE_AVX512VL,        VEND_INTEL  },
-    };
-    const cpuid_feature_map_t regidmap_ecx07[] = {
-        { 0,  CPU_FEATURE_PREFETCHWT1,      VEND_INTEL  },
-        { 1,  CPU_FEATURE_AVX512_VBMI,      VEND_INTEL  },
-        { 2,  CPU_FEATURE_UMIP,             VEND_SHARED },
-        { 3,  CPU_FEATURE_PKU,              VEND_SHARED },
-        { 4,  CPU_FEATURE_OSPKE,            VEND_SHARED },
-        { 5,  CPU_FEATURE_WAITPKG,          VEND_INTEL  },
-        { 6,  CPU_FEATURE_AVX512_VBMI2,     VEND_INTEL  },
-        { 7,  CPU_FEATURE_CETSS,            VEND_SHARED },
-        { 8,  CPU_FEATURE_GFNI,             VEND_INTEL  },
-        { 9,  CPU_FEATURE_VAES,             VEND_SHARED },
-        { 10, CPU_FEATURE_VPCLMULQDQ,       VEND_SHARED },
-        { 11, CPU_FEATURE_AVX512_VNNI,      VEND_INTEL  },
-        { 12, CPU_FEATURE_AVX512_BITALG,    VEND_INTEL  },
-        { 14, CPU_FEATURE_AVX512_VPOPCNTDQ, VEND_INTEL  },
-        { 16, CPU_FEATURE_LA57,             VEND_INTEL  },
-        { 22, CPU_FEATURE_RDPID,            VEND_SHARED },
-        { 23, CPU_FEATURE_KL,               VEND_INTEL  },
-        { 25, CPU_FEATURE_CLDEMOTE,         VEND_INTEL  },
-        { 27, CPU_FEATURE_MOVDIRI,          VEND_INTEL  },
-        { 28, CPU_FEATURE_MOVDIR64B,        VEND_INTEL  },
-        { 29, CPU_FEATURE_ENQCMD,           VEND_INTEL  },
-        { 30, CPU_FEATURE_SGX_LC,           VEND_INTEL  },
-        { 31, CPU_FEATURE_PKS,              VEND_INTEL  },
-    };
-    const cpuid_feature_map_t regidmap_edx07[] = {
-        { 2,  CPU_FEATURE_AVX512_4VNNIW,       VEND_INTEL },
-        { 3,  CPU_FEATURE_AVX512_4FMAPS,       VEND_INTEL },
-        { 4,  CPU_FEATURE_AVX512_FSRM,         VEND_INTEL },
-        { 8,  CPU_FEATURE_AVX512_VP2INTERSECT, VEND_INTEL },
-        { 9,  CPU_FEATURE_SRBDS_CTRL,          VEND_INTEL },
-        { 10, CPU_FEATURE_MD_CLEAR,            VEND_INTEL },
-        { 13, CPU_FEATURE_TSX_FORCE_ABORT,     VEND_INTEL },
-        { 14, CPU_FEATURE_SERIALIZE,           VEND_INTEL },
-        { 16, CPU_FEATURE_TSXLDTRK,            VEND_INTEL },
-        { 18, CPU_FEATURE_PCONFIG,             VEND_INTEL },
-        { 19, CPU_FEATURE_ARCH_LBR,            VEND_INTEL },
-        { 23, CPU_FEATURE_AVX512_FP16,         VEND_INTEL },
-        { 26, CPU_FEATURE_SPEC_CTRL,           VEND_INTEL },
-        { 26, CPU_FEATURE_INTEL_STIBP,         VEND_INTEL },
-        { 27, CPU_FEATURE_FLUSH_L1D,           VEND_INTEL },
-        { 28, CPU_FEATURE_ARCH_CAPABILITIES,   VEND_INTEL },
-        { 29, CPU_FEATURE_CORE_CAPABILITIES,   VEND_INTEL },
-        { 30, CPU_FEATURE_SPEC_CTRL_SSBD,      VEND_INTEL },
-    };
-    const cpuid_feature_map_t regidmap_ecx81[] = {
-        { 0,  CPU_FEATURE_LAHF_LM,         VEND_SHARED },
-        { 1,  CPU_FEATURE_CMP_LEGACY,      VEND_AMD    },
-        { 2,  CPU_FEATURE_SVM,             VEND_AMD    },
-        { 3,  CPU_FEATURE_EXTAPIC,         VEND_AMD    },
-        { 4,  CPU_FEATURE_CR8_LEGACY,      VEND_AMD    },
-        { 5,  CPU_FEATURE_ABM,             VEND_AMD    },
-        { 6,  CPU_FEATURE_SSE4A,           VEND_AMD    },
-        { 7,  CPU_FEATURE_MISALIGNSSE,     VEND_AMD    },
-        { 8,  CPU_FEATURE_3DNOWPREFETCH,   VEND_AMD    },
-        { 9,  CPU_FEATURE_OSVW,            VEND_AMD    },
-        { 10, CPU_FEATURE_IBS,             VEND_AMD    },
-        { 11, CPU_FEATURE_XOP,             VEND_AMD    },
-        { 12, CPU_FEATURE_SKINIT,          VEND_AMD    },
-        { 13, CPU_FEATURE_WDT,             VEND_AMD    },
-        { 15, CPU_FEATURE_LWP,             VEND_AMD    },
-        { 16, CPU_FEATURE_FMA4,            VEND_AMD    },
-        { 17, CPU_FEATURE_TCE,             VEND_AMD    },
-        { 19, CPU_FEATURE_NODEID_MSR,      VEND_AMD    },
-        { 21, CPU_FEATURE_TBM,             VEND_AMD    },
-        { 22, CPU_FEATURE_TOPOEXT,         VEND_AMD    },
-        { 23, CPU_FEATURE_PERFCTR_CORE,    VEND_AMD    },
-        { 24, CPU_FEATURE_PERFCTR_NB,      VEND_AMD    },
-        { 26, CPU_FEATURE_BPEXT,           VEND_AMD    },
-        { 28, CPU_FEATURE_PERFCTR_L2,      VEND_AMD    },
-        { 29, CPU_FEATURE_MONITORX,        VEND_AMD    },
-    };
-    const cpuid_feature_map_t regidmap_edx81[] = {
-        { 11, CPU_FEATURE_SYSCALL,         VEND_SHARED },
-        { 20, CPU_FEATURE_NX,              VEND_SHARED },
-        { 22, CPU_FEATURE_MMXEXT,          VEND_AMD    },
-        { 25, CPU_FEATURE_FXSR_OPT,        VEND_AMD    },
-        { 26, CPU_FEATURE_PDPE1GB,         VEND_SHARED },
-        { 27, CPU_FEATURE_RDTSCP,          VEND_SHARED },
-        { 29, CPU_FEATURE_LM,              VEND_SHARED },
-        { 30, CPU_FEATURE_3DNOWEXT,        VEND_AMD    },
-        { 31, CPU_FEATURE_3DNOW,           VEND_AMD    },
-    };
-    const cpuid_feature_map_t regidmap_edx87[] = {
-        { 0,  CPU_FEATURE_TS,              VEND_AMD    },
-        { 1,  CPU_FEATURE_FID,             VEND_AMD    },
-        { 2,  CPU_FEATURE_VID,             VEND_AMD    },
-        { 3,  CPU_FEATURE_TTP,             VEND_AMD    },
-        { 4,  CPU_FEATURE_TM_AMD,          VEND_AMD    },
-        { 5,  CPU_FEATURE_STC,             VEND_AMD    },
-        { 6,  CPU_FEATURE_100MHZSTEPS,     VEND_AMD    },
-        { 7,  CPU_FEATURE_HWPSTATE,        VEND_AMD    },
-        { 8,  CPU_FEATURE_CONSTANT_TSC,    VEND_SHARED },
-        { 9,  CPU_FEATURE_CPB,             VEND_AMD    },
-        { 10, CPU_FEATURE_APERFMPERF,      VEND_AMD    },
-        { 11, CPU_FEATURE_PFI,             VEND_AMD    },
-        { 12, CPU_FEATURE_PA,              VEND_AMD    },
-    };
-    const cpuid_feature_map_t regidmap_ebx88[] = {
-        {  0, CPU_FEATURE_CLZERO,          VEND_AMD    },
-        {  1, CPU_FEATURE_IRPERF,          VEND_AMD    },
-    };
-    const cpuid_feature_map_t regidmap_eax_8000_1F[] = {
-        {  0, CPU_FEATURE_SME,             VEND_AMD    },
-        {  1, CPU_FEATURE_SEV,             VEND_AMD    },
-        {  2, CPU_FEATURE_PAGEFLUSH,       VEND_AMD    },
-        {  3, CPU_FEATURE_SEV_ES,          VEND_AMD    },
-    };
+    uint64_t words[CPU_FLAGS_WORDS + 1];
+    uint64_t bits;
+    uint32_t reg, vendor_mask[NUM_VENDS];
+    const feature_run_t *run;
+    unsigned int i, r, off;
 
-    if (data->cpuid_max_basic >= 1) {
-        set_feature_bits(data, regidmap_ecx01, NELEMS(regidmap_ecx01), raw->cpuid[1][ecx]);
-        set_feature_bits(data, regidmap_edx01, NELEMS(regidmap_edx01), raw->cpuid[1][edx]);
-    }
-    if (data->cpuid_max_basic >= 7) {
-        set_feature_bits(data, regidmap_ebx07, NELEMS(regidmap_ebx07), raw->cpuid[7][ebx]);
-        set_feature_bits(data, regidmap_ecx07, NELEMS(regidmap_ecx07), raw->cpuid[7][ecx]);
-        set_feature_bits(data, regidmap_edx07, NELEMS(regidmap_edx07), raw->cpuid[7][edx]);
-    }
-    if (data->cpuid_max_ext >= 0x80000001) {
-        set_feature_bits(data, regidmap_ecx81, NELEMS(regidmap_ecx81), raw->cpuid_ext[1][ecx]);
-        set_feature_bits(data, regidmap_edx81, NELEMS(regidmap_edx81), raw->cpuid_ext[1][edx]);
+    icuid_call_once(&feature_runs_once, build_feature_runs);
+
+    vendor_mask[VEND_INTEL] = IS_INTEL ? 0xFFFFFFFF : 0;
+    vendor_mask[VEND_AMD] = IS_AMD ? 0xFFFFFFFF : 0;
+    vendor_mask[VEND_SHARED] = 0xFFFFFFFF;
+    vendor_mask[VEND_KVM] = data->hypervisor == HYPERVISOR_KVM ? 0xFFFFFFFF : 0;
+    vendor_mask[VEND_HYPERV] =
+        data->hypervisor == HYPERVISOR_HYPERV ? 0xFFFFFFFF : 0;
+
+    memset(words, 0, sizeof(words));
+    for (i = 0; i < NELEMS(feature_regs); i++) {
+        if (feature_regs[i].leaf & 0x80000000) {
+            if (data->cpuid_max_ext < feature_regs[i].leaf)
+                continue;
+        } else if (feature_regs[i].leaf & 0x40000000) {
+            if (raw_hv_levels(raw) <= (feature_regs[i].leaf & 0xFF))
+                continue;
+        } else if (data->cpuid_max_basic < feature_regs[i].leaf) {
+            continue;
+        }
+        reg = raw_leaf(raw, feature_regs[i].leaf)[feature_regs[i].reg];
+        for (r = feature_reg_runs[i]; r < feature_reg_runs[i + 1]; r++) {
+            run = &feature_runs[r];
+            bits = (reg >> run->shift) & run->mask & vendor_mask[run->vendor];
+            off = run->feature & 63;
+            /* A run may straddle two words; (bits >> 1) >> (63 - off)
+             * is bits >> (64 - off) without shifting by 64 when off is 0 */
+            words[run->feature >> 6] |= bits << off;
+            words[(run->feature >> 6) + 1] |= (bits >> 1) >> (63 - off);
+        }
     }
-    if (data->cpuid_max_ext >= 0x80000007)
-        set_feature_bits(data, regidmap_edx87, NELEMS(regidmap_edx87), raw->cpuid_ext[7][edx]);
-    if (data->cpuid_max_ext >= 0x80000008)
-        set_feature_bits(data, regidmap_ebx88, NELEMS(regidmap_ebx88), raw->cpuid_ext[8][ebx]);
-    if (data->cpuid_max_ext >= 0x8000001F)
-        set_feature_bits(data, regidmap_eax_8000_1F, NELEMS(regidmap_eax_8000_1F), raw->cpuid_ext[31][eax]);
+    memcpy(data->flags.words, words, sizeof(data->flags.words));
 }
 
 void set_cpuid_xfeatures(cpuid_data_t *data, const uint64_t xcr0)
@@ -492,9 +423,123 @@ void set_cpuid_xfeatures(cpuid_data_t *data, const uint64_t xcr0)
         { 7, XFEATURE_Hi16_ZMM },
         { 8, XFEATURE_IA32_XSS },
         { 9, XFEATURE_PKRU },
+        { 10, XFEATURE_PASID },
+        { 11, XFEATURE_CET_U },
+        { 12, XFEATURE_CET_S },
+        { 13, XFEATURE_HDC },
+        { 14, XFEATURE_UINTR },
+        { 15, XFEATURE_LBR },
+        { 16, XFEATURE_HWP },
+        { 17, XFEATURE_XTILECFG },
+        { 18, XFEATURE_XTILEDATA },
+        { 19, XFEATURE_APX },
     };
     for (i = 0; i < NUM_XFEATURES; i++) {
         if (xcr0 & (1ULL << xfeatures_t[i].bit))
             data->xfeatures[xfeatures_t[i].feature] = 1;
     }
 }
+
+static const cpuid_feature_t x86_64_v1_features[] = {
+    CPU_FEATURE_CMOV, CPU_FEATURE_CX8, CPU_FEATURE_FPU, CPU_FEATURE_FXSR,
+    CPU_FEATURE_MMX, CPU_FEATURE_SSE, CPU_FEATURE_SSE2, CPU_FEATURE_LM,
+};
+
+static const cpuid_feature_t x86_64_v2_features[] = {
+    CPU_FEATURE_CX16, CPU_FEATURE_LAHF_LM, CPU_FEATURE_POPCNT, CPU_FEATURE_PNI,
+    CPU_FEATURE_SSE4_1, CPU_FEATURE_SSE4_2, CPU_FEATURE_SSSE3,
+};
+
+static const cpuid_feature_t x86_64_v3_features[] = {
+    CPU_FEATURE_AVX, CPU_FEATURE_AVX2, CPU_FEATURE_BMI1, CPU_FEATURE_BMI2,
+    CPU_FEATURE_F16C, CPU_FEATURE_FMA, CPU_FEATURE_ABM, CPU_FEATURE_MOVBE,
+    CPU_FEATURE_OSXSAVE,
+};
+
+static const cpuid_feature_t x86_64_v4_features[] = {
+    CPU_FEATURE_AVX512F, CPU_FEATURE_AVX512BW, CPU_FEATURE_AVX512CD,
+    CPU_FEATURE_AVX512DQ, CPU_FEATURE_AVX512VL,
+};
+
+#define XSTATE(x) (1U << (x))
+
+/* Requirements of each level on top of the level below it */
+static const struct {
+    const cpuid_feature_t *features;
+    unsigned int num_features;
+    uint32_t xfeatures;
+} x86_64_levels[NUM_X86_64_LEVELS] = {
+    { NULL, 0, 0 },
+    { x86_64_v1_features, NELEMS(x86_64_v1_features), 0 },
+    { x86_64_v2_features, NELEMS(x86_64_v2_features), 0 },
+    { x86_64_v3_features, NELEMS(x86_64_v3_features),
+      XSTATE(XFEATURE_SSE) | XSTATE(XFEATURE_AVX) },
+    { x86_64_v4_features, NELEMS(x86_64_v4_features),
+      XSTATE(XFEATURE_OPMASK) | XSTATE(XFEATURE_ZMM_Hi256) |
+      XSTATE(XFEATURE_Hi16_ZMM) },
+};
+
+cpuid_feature_t cpu_feature_from_str(const char *name)
+{
+    char lower[FEATURE_NAME_MAX];
+    const feature_name_t *slot;
+    uint32_t seed;
+    size_t i;
+
+    if (name == NULL)
+        return NUM_CPU_FEATURES;
+
+    for (i = 0; name[i] != '\0'; i++) {
+        if (i == sizeof(lower) - 1)
+            return NUM_CPU_FEATURES;
+        lower[i] = (char)tolower((unsigned char)name[i]);
+    }
+    lower[i] = '\0';
+
+    /* Every name has a slot of its own, one compare tells if it's ours */
+    seed = feature_hash_seeds[feature_name_hash(0, lower) % FEATURE_HASH_BUCKETS];
+    slot = &feature_hash_slots[feature_name_hash(seed, lower) % FEATURE_HASH_SLOTS];
+    if (slot->name == NULL || strcmp(slot->name, lower) != 0)
+        return NUM_CPU_FEATURES;
+
+    return slot->feature;
+}
+
+const char *x86_64_level_str(x86_64_level_t level)
+{
+    switch (level) {
+        case X86_64_V1: return "x86-64";
+        case X86_64_V2: return "x86-64-v2";
+        case X86_64_V3: return "x86-64-v3";
+        case X86_64_V4: return "x86-64-v4";
+        default:
+            return "";
+    }
+}
+
+/* Must be called after the feature flags and xfeatures are set */
+void set_x86_64_level(cpuid_data_t *data)
+{
+    cpuid_flags_t need;
+    uint32_t xfeatures = 0;
+    unsigned int level, i;
+
+    for (i = 0; i < NUM_XFEATURES; i++) {
+        if (data->xfeatures[i])
+            xfeatures |= XSTATE(i);
+    }
+
+    for (level = X86_64_V1; level < NUM_X86_64_LEVELS; level++) {
+        memset(&need, 0, sizeof(need));
+        for (i = 0; i < x86_64_levels[level].num_features; i++)
+            icuid_flags_set(&need, x86_64_levels[level].features[i]);
+
+        if (!icuid_flags_subset(&need, &data->flags) ||
+            (x86_64_levels[level].xfeatures & ~xfeatures) != 0) {
+            icuid_flags_andnot(&data->x86_64_missing, &need, &data->flags);
+            data->x86_64_missing_xfeatures = x86_64_levels[level].xfeatures & ~xfeatures;
+            return;
+        }
+        data->x86_64_level = (x86_64_level_t)level;
+    }
+}
@@ -14,5 +14,20 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-void set_cpuid_features(const cpuid_raw_data_t *raw, cpuid_data_t *data);
+void set_cpuid_features(cpuid_raw_data_t *raw, cpuid_data_t *data);
 void set_cpuid_xfeatures(cpuid_data_t *data, const uint64_t xcr0);
+void set_x86_64_level(cpuid_data_t *data);
+
+/* Longest feature name, including the NUL */
+#define FEATURE_NAME_MAX 32
+
+/* A feature name, canonical or an alias */
+typedef struct {
+    const char *name;
+    cpuid_feature_t feature;
+} feature_name_t;
+
+extern const feature_name_t feature_aliases[];
+extern const unsigned int num_feature_aliases;
+
+uint32_t feature_name_hash(uint32_t seed, const char *name);
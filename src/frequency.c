@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "frequency.h"
+#include "internal.h"
+#include "raw.h"
+
+/**
+ * Crystal clock of family 6 models that report a 0 crystal frequency in
+ * leaf 0x15, see the Intel SDM table "Nominal Core Crystal Clock Frequency"
+ */
+static const struct {
+    uint8_t model;
+    uint32_t crystal;   /* Hz */
+} crystal_table[] = {
+    { 0x4E, 24000000 }, /* Skylake (Mobile) */
+    { 0x5E, 24000000 }, /* Skylake (Desktop) */
+    { 0x8E, 24000000 }, /* Kaby Lake (Mobile) */
+    { 0x9E, 24000000 }, /* Kaby Lake (Desktop) */
+    { 0x5C, 19200000 }, /* Goldmont */
+    { 0x5F, 25000000 }, /* Goldmont (Denverton) */
+};
+
+const char *freq_source_str(cpu_freq_source_t source)
+{
+    switch (source) {
+        case FREQ_SOURCE_CPUID_15H: return "cpuid 0x15";
+        case FREQ_SOURCE_CRYSTAL: return "cpuid 0x15, known crystal";
+        case FREQ_SOURCE_CPUID_16H: return "cpuid 0x16";
+        case FREQ_SOURCE_HYPERVISOR: return "hypervisor";
+        case FREQ_SOURCE_BRAND: return "brand string";
+        default:
+            return "";
+    }
+}
+
+/**
+ * Parses the nominal frequency at the end of brand strings like
+ * "Intel(R) Core(TM) i7-4790K CPU @ 4.00GHz", returns MHz or 0.
+ */
+static uint32_t get_brand_frequency(const char *brand)
+{
+    const char *p, *unit = NULL, *start;
+    uint64_t value = 0, scale = 1, mult;
+    int fraction = 0;
+
+    for (p = strstr(brand, "Hz"); p != NULL; p = strstr(p + 2, "Hz"))
+        unit = p;
+    if (unit == NULL || unit - brand < 2)
+        return 0;
+
+    switch (unit[-1]) {
+        case 'M': mult = 1; break;
+        case 'G': mult = 1000; break;
+        case 'T': mult = 1000000; break;
+        default:
+            return 0;
+    }
+
+    for (start = unit - 1; start > brand; start--) {
+        if ((start[-1] < '0' || start[-1] > '9') && start[-1] != '.')
+            break;
+    }
+    if (start == unit - 1)
+        return 0;
+
+    for (p = start; p < unit - 1; p++) {
+        if (*p == '.') {
+            if (fraction++)
+                return 0;
+            continue;
+        }
+        if (value > 0xFFFFFFFF)
+            return 0;
+        value = value * 10 + (uint64_t)(*p - '0');
+        if (fraction)
+            scale *= 10;
+    }
+
+    return (uint32_t)(value * mult / scale);
+}
+
+/* Returns the crystal frequency in Hz when leaf 0x15 doesn't report it */
+static uint32_t get_known_crystal(cpuid_raw_data_t *raw, cpuid_data_t *data,
+                                  cpu_freq_source_t *source)
+{
+    const uint32_t *regs;
+    uint32_t base;
+    unsigned int i;
+
+    if (data->family == 0x6) {
+        for (i = 0; i < NELEMS(crystal_table); i++) {
+            if (crystal_table[i].model == data->ext_model) {
+                *source = FREQ_SOURCE_CRYSTAL;
+                return crystal_table[i].crystal;
+            }
+        }
+    }
+
+    /* The TSC runs at the base frequency of leaf 0x16 */
+    if (data->cpuid_max_basic >= 0x16) {
+        regs = raw_leaf(raw, 0x15);
+        base = raw_leaf(raw, 0x16)[eax] & 0xFFFF;
+        if (base) {
+            *source = FREQ_SOURCE_CPUID_16H;
+            return (uint32_t)((uint64_t)base * 1000000 * regs[eax] / regs[ebx]);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Time Stamp Counter and Nominal Core Crystal Clock leaf 0x15:
+ * TSC = crystal * EBX / EAX
+ */
+static void get_tsc_from_crystal(cpuid_raw_data_t *raw, cpuid_data_t *data)
+{
+    const uint32_t *regs;
+    cpu_freq_source_t source = FREQ_SOURCE_CPUID_15H;
+    uint32_t crystal;
+
+    if (data->vendor != VENDOR_INTEL || data->cpuid_max_basic < 0x15)
+        return;
+
+    regs = raw_leaf(raw, 0x15);
+    if (regs[eax] == 0 || regs[ebx] == 0)
+        return;
+
+    crystal = regs[ecx];
+    if (crystal == 0)
+        crystal = get_known_crystal(raw, data, &source);
+    if (crystal == 0)
+        return;
+
+    data->crystal_frequency = crystal;
+    data->tsc_frequency = (uint64_t)crystal * regs[ebx] / regs[eax];
+    data->tsc_frequency_source = source;
+}
+
+/**
+ * Hypervisor timing information leaf 0x40000010 (VMware, KVM):
+ * EAX is the TSC frequency and EBX the APIC bus frequency, in kHz
+ */
+static void get_hypervisor_timing(cpuid_raw_data_t *raw, cpuid_data_t *data)
+{
+    const uint32_t *regs;
+
+    if (!icuid_flags_test(&data->flags, CPU_FEATURE_HYPERVISOR) ||
+        raw_hv_levels(raw) <= 0x10)
+        return;
+
+    regs = raw_leaf(raw, 0x40000010);
+    if (regs[eax] == 0)
+        return;
+
+    data->tsc_frequency = (uint64_t)regs[eax] * 1000;
+    data->tsc_frequency_source = FREQ_SOURCE_HYPERVISOR;
+    if (data->bus_frequency == 0)
+        data->bus_frequency = regs[ebx] / 1000;
+}
+
+/* Must be called after the feature flags and the brand string are set */
+void set_frequency_info(cpuid_raw_data_t *raw, cpuid_data_t *data)
+{
+    const uint32_t *regs;
+    uint32_t brand;
+
+    /* Processor Frequency Information leaf 0x16, in MHz */
+    if (data->vendor == VENDOR_INTEL && data->cpuid_max_basic >= 0x16) {
+        regs = raw_leaf(raw, 0x16);
+        data->base_frequency = regs[eax] & 0xFFFF;
+        data->max_frequency = regs[ebx] & 0xFFFF;
+        data->bus_frequency = regs[ecx] & 0xFFFF;
+        if (data->base_frequency)
+            data->base_frequency_source = FREQ_SOURCE_CPUID_16H;
+    }
+
+    /* A hypervisor knows the TSC frequency of the guest best */
+    get_hypervisor_timing(raw, data);
+    if (data->tsc_frequency == 0)
+        get_tsc_from_crystal(raw, data);
+
+    brand = get_brand_frequency(data->brand_str);
+    if (data->base_frequency == 0 && brand) {
+        data->base_frequency = brand;
+        data->base_frequency_source = FREQ_SOURCE_BRAND;
+    }
+    /* Without leaf 0x15, Intel's constant TSC runs at the nominal frequency */
+    if (data->tsc_frequency == 0 && brand && data->vendor == VENDOR_INTEL &&
+        icuid_flags_test(&data->flags, CPU_FEATURE_CONSTANT_TSC)) {
+        data->tsc_frequency = (uint64_t)brand * 1000000;
+        data->tsc_frequency_source = FREQ_SOURCE_BRAND;
+    }
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "hex.h"
+#include "thread.h"
+
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define HAVE_SSSE3_DECODER
+#include <tmmintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define TARGET_SSSE3
+#endif
+
+/* Value of hex digit |c|, or -1 */
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+/* Register i is the 8 digits at p + 9 * i, the first three end in a space */
+static int decode_regs_scalar(const char *p, uint32_t regs[4])
+{
+    int i, j, digit;
+
+    for (i = 0; i < 4; i++) {
+        if (i < 3 && p[9 * i + 8] != ' ')
+            return 0;
+        for (regs[i] = 0, j = 0; j < 8; j++) {
+            if ((digit = hex_digit(p[9 * i + j])) < 0)
+                return 0;
+            regs[i] = regs[i] << 4 | digit;
+        }
+    }
+
+    return 1;
+}
+
+#ifdef HAVE_SSSE3_DECODER
+
+/* Bytes of |d| that are not hex digits, above 0x7F compares as negative */
+TARGET_SSSE3 static __m128i not_hex(__m128i d)
+{
+    __m128i lower = _mm_or_si128(d, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(d, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), d));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+
+    return _mm_andnot_si128(_mm_or_si128(digit, alpha), _mm_set1_epi8(-1));
+}
+
+/* Values of hex digits: the low nibble, plus 9 for letters */
+TARGET_SSSE3 static __m128i nibbles(__m128i d)
+{
+    return _mm_add_epi8(_mm_and_si128(d, _mm_set1_epi8(0x0F)),
+                        _mm_and_si128(_mm_cmpgt_epi8(d, _mm_set1_epi8('9')),
+                                      _mm_set1_epi8(9)));
+}
+
+/*
+ * Gathers the 32 digits of the line into two vectors with three loads that
+ * stay inside the 35 bytes, then converts 16 digits at a time
+ */
+TARGET_SSSE3 static int decode_regs_ssse3(const char *p, uint32_t regs[4])
+{
+    const __m128i a = _mm_loadu_si128((const __m128i *)p);
+    const __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    const __m128i c = _mm_loadu_si128((const __m128i *)(p + 19));
+    __m128i d01, d23, v01, v23;
+
+    if (p[8] != ' ' || p[17] != ' ' || p[26] != ' ')
+        return 0;
+
+    /* Digits of registers 0 and 1, then of registers 2 and 3 */
+    d01 = _mm_or_si128(
+        _mm_shuffle_epi8(a, _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11,
+                                          12, 13, 14, 15, -1)),
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                          -1, -1, -1, -1, -1, -1, 0)));
+    d23 = _mm_or_si128(
+        _mm_shuffle_epi8(b, _mm_setr_epi8(2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1,
+                                          -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 8,
+                                          9, 10, 11, 12, 13, 14, 15)));
+    if (_mm_movemask_epi8(_mm_or_si128(not_hex(d01), not_hex(d23))) != 0)
+        return 0;
+
+    /* hi * 16 + lo for every pair of digits, then one byte per pair */
+    v01 = _mm_maddubs_epi16(nibbles(d01), _mm_set1_epi16(0x0110));
+    v23 = _mm_maddubs_epi16(nibbles(d23), _mm_set1_epi16(0x0110));
+    v01 = _mm_packus_epi16(v01, v23);
+
+    /* Digits are most significant first, registers little endian */
+    v01 = _mm_shuffle_epi8(v01, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10,
+                                              9, 8, 15, 14, 13, 12));
+    _mm_storeu_si128((__m128i *)regs, v01);
+
+    return 1;
+}
+
+#endif /* HAVE_SSSE3_DECODER */
+
+static hex_decoder_t decode_regs = decode_regs_scalar;
+static icuid_once_t decode_regs_once = ICUID_ONCE_INIT;
+
+static void select_decoder(void)
+{
+#ifdef HAVE_SSSE3_DECODER
+    if (icuid_flags_test(&icuid_get()->flags, CPU_FEATURE_SSSE3))
+        decode_regs = decode_regs_ssse3;
+#endif
+}
+
+/* Lists the decoders this CPU can run, the scalar one first */
+unsigned int hex_get_decoders(hex_decoder_t decoders[HEX_MAX_DECODERS])
+{
+    unsigned int n = 0;
+
+    decoders[n++] = decode_regs_scalar;
+#ifdef HAVE_SSSE3_DECODER
+    if (icuid_flags_test(&icuid_get()->flags, CPU_FEATURE_SSSE3))
+        decoders[n++] = decode_regs_ssse3;
+#endif
+
+    return n;
+}
+
+/**
+ * Decodes the registers of a dump line, |p| must have HEX_REGS_LEN bytes.
+ * Returns 0 if they are not exactly four space separated 8 digit words,
+ * the caller then falls back to the lenient parser.
+ */
+int hex_decode_regs(const char *p, uint32_t regs[4])
+{
+    icuid_call_once(&decode_regs_once, select_decoder);
+
+    return decode_regs(p, regs);
+}
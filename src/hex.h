@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Length of the "%08x %08x %08x %08x" registers of a dump line */
+#define HEX_REGS_LEN 35
+
+int hex_decode_regs(const char *p, uint32_t regs[4]);
+
+/* Decoders hex_decode_regs() picks from, for tests to compare them */
+#define HEX_MAX_DECODERS 2
+
+typedef int (*hex_decoder_t)(const char *p, uint32_t regs[4]);
+
+unsigned int hex_get_decoders(hex_decoder_t decoders[HEX_MAX_DECODERS]);
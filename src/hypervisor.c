@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "hypervisor.h"
+#include "internal.h"
+#include "raw.h"
+
+static const struct {
+    const char *signature;
+    cpu_hypervisor_t hypervisor;
+} hypervisors[] = {
+    { "KVMKVMKVM",    HYPERVISOR_KVM    },
+    { "Microsoft Hv", HYPERVISOR_HYPERV },
+    { "XenVMMXenVMM", HYPERVISOR_XEN    },
+    { "VMwareVMware", HYPERVISOR_VMWARE },
+    { "bhyve bhyve ", HYPERVISOR_BHYVE  },
+};
+
+const char *hypervisor_name(cpu_hypervisor_t hypervisor)
+{
+    switch (hypervisor) {
+        case HYPERVISOR_UNKNOWN: return "Unknown";
+        case HYPERVISOR_KVM: return "KVM";
+        case HYPERVISOR_HYPERV: return "Hyper-V";
+        case HYPERVISOR_XEN: return "Xen";
+        case HYPERVISOR_VMWARE: return "VMware";
+        case HYPERVISOR_BHYVE: return "bhyve";
+        default:
+            return "";
+    }
+}
+
+/**
+ * Identifies the hypervisor from the signature of leaf 0x40000000
+ * Must be called after the basic leaves are read, before the features
+ */
+void get_hypervisor(cpuid_raw_data_t *raw, cpuid_data_t *data)
+{
+    const uint32_t *regs;
+    unsigned int i;
+
+    if (raw_hv_levels(raw) == 0)
+        return;
+
+    regs = raw_leaf(raw, 0x40000000);
+    memcpy(data->hypervisor_str + 0, &regs[ebx], 4);
+    memcpy(data->hypervisor_str + 4, &regs[ecx], 4);
+    memcpy(data->hypervisor_str + 8, &regs[edx], 4);
+    data->hypervisor_str[12] = '\0';
+
+    data->hypervisor = HYPERVISOR_UNKNOWN;
+    for (i = 0; i < NELEMS(hypervisors); i++) {
+        if (strcmp(data->hypervisor_str, hypervisors[i].signature) == 0) {
+            data->hypervisor = hypervisors[i].hypervisor;
+            break;
+        }
+    }
+}
+
+/**
+ * Sets the paravirtualization features that aren't a bit of their own
+ * Must be called after set_cpuid_features
+ */
+void set_hypervisor_features(cpuid_raw_data_t *raw, cpuid_data_t *data)
+{
+    /* Hyper-V: recommended spin count before notifying, all ones is never */
+    if (data->hypervisor == HYPERVISOR_HYPERV && raw_hv_levels(raw) > 0x4 &&
+        raw_leaf(raw, 0x40000004)[ebx] != 0xFFFFFFFF)
+        icuid_flags_set(&data->flags, CPU_FEATURE_HV_SPINLOCKS);
+}
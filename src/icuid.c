@@ -14,22 +14,27 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <errno.h>
-#include <limits.h>
+#include <ctype.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
 #include <icuid/icuid.h>
 
 #include "internal.h"
 #include "features.h"
+#include "frequency.h"
+#include "hex.h"
+#include "hypervisor.h"
 #include "intel.h"
 #include "amd.h"
+#include "raw.h"
+#include "thread.h"
+#include "xsave.h"
 
-int cpuid_get_raw_data(cpuid_raw_data_t *raw)
+int cpuid_get_raw_data_lazy(cpuid_raw_data_t *raw)
 {
-    uint32_t i;
+    if (raw == NULL)
+        return ICUID_PASSED_NULL;
 
     if (!cpuid_is_supported())
         return ICUID_NO_CPUID;
@@ -43,107 +48,150 @@ int cpuid_get_raw_data(cpuid_raw_data_t *raw)
 
     if (raw->max_cpuid_level > MAX_CPUID_LEVEL)
         raw->max_cpuid_level = MAX_CPUID_LEVEL;
-    for (i = 1; i < raw->max_cpuid_level; i++)
-        icuid_cpuid(i, raw->cpuid[i]);
     if (raw->max_cpuid_ext_level > MAX_EXT_CPUID_LEVEL)
         raw->max_cpuid_ext_level = MAX_EXT_CPUID_LEVEL;
-    for (i = 1; i < raw->max_cpuid_ext_level; i++)
-        icuid_cpuid(0x80000000 + i, raw->cpuid_ext[i]);
-    if (raw->max_cpuid_level >= 0x4) {
-        for (i = 0; i < MAX_INTEL_DC_LEVEL; i++) {
-            raw->intel_dc[i][eax] = 4;
-            raw->intel_dc[i][ecx] = i;
-            icuid_cpuid_ext(raw->intel_dc[i]);
-            if ((raw->intel_dc[i][eax] & 0x1F) == 0)
-                break;
-        }
-        raw->max_intel_dc_level = i + 1;
-    }
-    if (raw->max_cpuid_level >= 0xB) {
-        for (i = 0; i < MAX_INTEL_ET_LEVEL; i++) {
-            raw->intel_et[i][eax] = 11;
-            raw->intel_et[i][ecx] = i;
-            icuid_cpuid_ext(raw->intel_et[i]);
-            if (raw->intel_et[i][ebx] == 0)
-                break;
-        }
-        raw->max_intel_et_level = i + 1;
-    }
+
+    raw->lazy = 1;
+    raw->cpuid_fetched[0] = 1;
+    raw->cpuid_ext_fetched[0] = 1;
 
     return ICUID_OK;
 }
 
-static int parse_line(char *line, const char *token, uint32_t regs[][4],
-                      const uint32_t limit)
+int cpuid_materialize_raw_data(cpuid_raw_data_t *raw)
 {
-    int i;
-    char buf[64];
-    char *p, *pp, *ex;
-    size_t tokenlen = strlen(token);
-    unsigned long level, reg;
-
-    /* Check if our token matches the line */
-    p = line + tokenlen;
-    if (*p != '[')
-        return 2;
-    if (strncmp(line, token, tokenlen) != 0)
-        return 2;
-
-    /* Since strtok modifies the original buffer we need to make a copy */
-    strcpy(buf, p);
-
-    /* Separate the text between the brackets into separate strings */
-    p = strtok(buf, "[ ]");
-    if (p == NULL)
-        return 0;
+    if (raw == NULL)
+        return ICUID_PASSED_NULL;
 
-    errno = 0;
-    level = strtoul(p, &ex, 10);
-    if (ex == p) {
-        return 0;
-    } else if (level == ULONG_MAX && errno == ERANGE) {
-        return 0;
-    } else if (level > limit) {
-        return 0;
-    } else if ((level == 0 && errno == EINVAL)) {
-        return 0;
+    raw_fetch_all(raw);
+
+    return ICUID_OK;
+}
+
+int cpuid_get_raw_data(cpuid_raw_data_t *raw)
+{
+    int ret;
+
+    ret = cpuid_get_raw_data_lazy(raw);
+    if (ret != ICUID_OK)
+        return ret;
+
+    raw_fetch_all(raw);
+
+    return ICUID_OK;
+}
+
+int cpuid_raw_leaf(cpuid_raw_data_t *raw, uint32_t leaf, uint32_t *regs)
+{
+    if (raw == NULL || regs == NULL)
+        return ICUID_PASSED_NULL;
+
+    memcpy(regs, raw_leaf(raw, leaf), 4 * sizeof(uint32_t));
+
+    return ICUID_OK;
+}
+
+/* Parses up to |max| digits in |base|, returns the number of digits */
+static int parse_uint(const char *p, const char *end, uint32_t base,
+                      uint32_t max, uint32_t *value)
+{
+    uint32_t digit;
+    int n = 0;
+
+    for (*value = 0; p < end; p++, n++) {
+        if (*p >= '0' && *p <= '9')
+            digit = *p - '0';
+        else if (base == 16 && *p >= 'a' && *p <= 'f')
+            digit = *p - 'a' + 10;
+        else if (base == 16 && *p >= 'A' && *p <= 'F')
+            digit = *p - 'A' + 10;
+        else
+            break;
+        if (*value > (max - digit) / base)
+            return 0;
+        *value = *value * base + digit;
     }
 
-    /* Get the text after the equals sign */
-    p = strchr(line, '=');
-    if (p == NULL)
-        return 0;
-    p += 1;
+    return n;
+}
+
+/**
+ * Parses a "name[i]=eax ebx ecx edx" line of [p, end) into |raw| in a
+ * single pass. Lines of unknown tables are ignored.
+ * Returns 0 if the line names a table but is malformed.
+ */
+static int parse_line(const char *p, const char *end, cpuid_raw_data_t *raw)
+{
+    const raw_table_t *t;
+    const char *name = p;
+    uint32_t level, reg;
+    size_t len;
+    int i, n;
+
+    while (p < end && *p != '[')
+        p++;
+    if (p == end)
+        return 1;
+    len = p - name;
+
+    for (t = raw_tables; t < raw_tables + NUM_RAW_TABLES; t++) {
+        if (strlen(t->name) == len && memcmp(t->name, name, len) == 0)
+            break;
+    }
+    if (t == raw_tables + NUM_RAW_TABLES)
+        return 1;
 
-    /* Separate the text with spaces into separate strings */
-    pp = strtok(p, " ");
-    if (pp == NULL)
+    n = parse_uint(++p, end, 10, 0xFFFFFFFF, &level);
+    p += n;
+    if (n == 0 || level >= t->limit || end - p < 2 || p[0] != ']' ||
+        p[1] != '=')
         return 0;
+    p += 2;
+
+    /* Lines we wrote ourselves have a fixed shape, decode them at once */
+    if (end - p >= HEX_REGS_LEN &&
+        (end - p == HEX_REGS_LEN || !isxdigit((unsigned char)p[HEX_REGS_LEN])) &&
+        hex_decode_regs(p, RAW_TABLE_REGS(raw, t)[level]))
+        return 1;
+
+    for (i = 0; i < 4; i++) {
+        while (p < end && *p == ' ')
+            p++;
+        n = parse_uint(p, end, 16, 0xFFFFFFFF, &reg);
+        if (n == 0)
+            break;
+        RAW_TABLE_REGS(raw, t)[level][i] = reg;
+        p += n;
+    }
 
-    for (i = 0; i < 4 && pp != NULL; i++) {
-        errno = 0;
-        reg = strtoul(pp, &ex, 16);
-        if (ex == pp) {
-            return 0;
-        } else if (reg == ULONG_MAX && errno == ERANGE) {
-            return 0;
-        } else if (reg > 0xFFFFFFFF /* 2^32-1 */) {
-            return 0;
-        } else if ((reg == 0 && errno == EINVAL)) {
-            return 0;
-        }
-        regs[level][i] = reg;
-        pp = strtok(NULL, " "); /* Get next string */
+    return i > 0;
+}
+
+int icuid_parse_raw_buffer(const char *buf, size_t len, cpuid_raw_data_t *raw)
+{
+    const char *end = buf + len, *eol;
+
+    if (buf == NULL || raw == NULL)
+        return ICUID_PASSED_NULL;
+
+    memset(raw, 0, sizeof(*raw));
+
+    for (; buf < end; buf = eol + 1) {
+        eol = memchr(buf, '\n', end - buf);
+        if (eol == NULL)
+            eol = end;
+        if (*buf != '#' && !parse_line(buf, eol, raw))
+            return ICUID_ERROR_PARSING;
     }
+    raw_count_levels(raw);
 
-    return 1;
+    return ICUID_OK;
 }
 
 int cpuid_serialize_raw_data(cpuid_raw_data_t *raw, const char *file)
 {
     char line[64];
     FILE *fp;
-    uint32_t i;
 
     if (raw == NULL || file == NULL)
         return ICUID_PASSED_NULL;
@@ -159,52 +207,24 @@ int cpuid_serialize_raw_data(cpuid_raw_data_t *raw, const char *file)
     memset(raw, 0, sizeof(*raw));
 
     while (fgets(line, sizeof(line), fp)) {
-
         if (line[0] == '#')
             continue;
-
-        if (!parse_line(line, "cpuid", raw->cpuid, MAX_CPUID_LEVEL))
-            goto parse_err;
-        if (!parse_line(line, "cpuid_ext", raw->cpuid_ext, MAX_EXT_CPUID_LEVEL))
-            goto parse_err;
-        if (!parse_line(line, "intel_dc", raw->intel_dc, MAX_INTEL_DC_LEVEL))
-            goto parse_err;
-        if (!parse_line(line, "intel_et", raw->intel_et, MAX_INTEL_ET_LEVEL))
-            goto parse_err;
-    }
-    raw->max_cpuid_level = raw->cpuid[0][eax] + 1;
-    if (raw->max_cpuid_level > MAX_CPUID_LEVEL)
-        goto parse_err;
-    raw->max_cpuid_ext_level = (raw->cpuid_ext[0][eax] & ~0x80000000) + 1;
-    if (raw->max_cpuid_ext_level > MAX_EXT_CPUID_LEVEL)
-        goto parse_err;
-
-    if (raw->max_cpuid_level >= 0x4) {
-        for (i = 0; i < MAX_INTEL_DC_LEVEL; i++) {
-            if ((raw->intel_dc[i][eax] & 0x1F) == 0)
-                break;
+        if (!parse_line(line, line + strlen(line), raw)) {
+            fclose(fp);
+            return ICUID_ERROR_PARSING;
         }
-        raw->max_intel_dc_level = i + 1;
-    }
-    if (raw->max_cpuid_level >= 0xB) {
-        for (i = 0; i < MAX_INTEL_ET_LEVEL; i++) {
-            if (raw->intel_et[i][ebx] == 0)
-                break;
-        }
-        raw->max_intel_et_level = i + 1;
     }
+    raw_count_levels(raw);
 
     fclose(fp);
     return ICUID_OK;
-
-parse_err:
-    fclose(fp);
-    return ICUID_ERROR_PARSING;
 }
 
 int cpuid_deserialize_raw_data(cpuid_raw_data_t *raw, const char *file)
 {
     int ret = -1;
+    const raw_table_t *t;
+    uint32_t (*regs)[4];
     uint32_t i;
     FILE *fp;
 
@@ -225,22 +245,12 @@ int cpuid_deserialize_raw_data(cpuid_raw_data_t *raw, const char *file)
         return ret;
     }
 
-    for (i = 0; i < raw->max_cpuid_level; i++)
-        fprintf(fp, "cpuid[%u]=%08x %08x %08x %08x\n", i,
-                raw->cpuid[i][eax], raw->cpuid[i][ebx],
-                raw->cpuid[i][ecx], raw->cpuid[i][edx]);
-    for (i = 0; i < raw->max_cpuid_ext_level; i++)
-        fprintf(fp, "cpuid_ext[%u]=%08x %08x %08x %08x\n", i,
-                raw->cpuid_ext[i][eax], raw->cpuid_ext[i][ebx],
-                raw->cpuid_ext[i][ecx], raw->cpuid_ext[i][edx]);
-    for (i = 0; i < raw->max_intel_dc_level; i++)
-        fprintf(fp, "intel_dc[%u]=%08x %08x %08x %08x\n", i,
-                raw->intel_dc[i][eax], raw->intel_dc[i][ebx],
-                raw->intel_dc[i][ecx], raw->intel_dc[i][edx]);
-    for (i = 0; i < raw->max_intel_dc_level; i++)
-        fprintf(fp, "intel_et[%u]=%08x %08x %08x %08x\n", i,
-                raw->intel_et[i][eax], raw->intel_et[i][ebx],
-                raw->intel_et[i][ecx], raw->intel_et[i][edx]);
+    for (t = raw_tables; t < raw_tables + NUM_RAW_TABLES; t++) {
+        regs = RAW_TABLE_REGS(raw, t);
+        for (i = 0; i < RAW_TABLE_LEVELS(raw, t); i++)
+            fprintf(fp, "%s[%u]=%08x %08x %08x %08x\n", t->name, i,
+                    regs[i][eax], regs[i][ebx], regs[i][ecx], regs[i][edx]);
+    }
 
     fclose(fp);
 
@@ -283,10 +293,11 @@ int icuid_identify(cpuid_raw_data_t *raw, cpuid_data_t *data)
     uint8_t ext_family, ext_model;
     char brandstr[BRAND_STR_MAX];
     char *p;
+    const uint32_t *regs;
     cpuid_raw_data_t iraw;
 
     if (raw == NULL) {
-        ret = cpuid_get_raw_data(&iraw);
+        ret = cpuid_get_raw_data_lazy(&iraw);
         if (ret != ICUID_OK)
             return ret;
         raw = &iraw;
@@ -309,12 +320,13 @@ int icuid_identify(cpuid_raw_data_t *raw, cpuid_data_t *data)
     get_vendor(data);
 
     if (data->cpuid_max_basic >= 1) {
-        data->family = (raw->cpuid[1][eax] >> 8) & 0xF;
-        data->model = (raw->cpuid[1][eax] >> 4) & 0xF;
-        data->stepping = (raw->cpuid[1][eax] >> 0) & 0xF;
-        ext_model = (raw->cpuid[1][eax] >> 16) & 0xF;
-        ext_family = (raw->cpuid[1][eax] >> 20) & 0xFF;
-        data->signature = (raw->cpuid[1][eax]);
+        regs = raw_leaf(raw, 1);
+        data->family = (regs[eax] >> 8) & 0xF;
+        data->model = (regs[eax] >> 4) & 0xF;
+        data->stepping = (regs[eax] >> 0) & 0xF;
+        ext_model = (regs[eax] >> 16) & 0xF;
+        ext_family = (regs[eax] >> 20) & 0xFF;
+        data->signature = (regs[eax]);
         if ((IS_INTEL || IS_AMD) && data->family == 0xF)
             data->ext_family = data->family + ext_family;
         else
@@ -329,10 +341,11 @@ int icuid_identify(cpuid_raw_data_t *raw, cpuid_data_t *data)
     /* Get brand string */
     if (data->cpuid_max_ext >= 0x80000004) {
         for (i = 2; i <= 4; i++, j += 16) {
-            memcpy(brandstr +  0 + j, &raw->cpuid_ext[i][eax], 4);
-            memcpy(brandstr +  4 + j, &raw->cpuid_ext[i][ebx], 4);
-            memcpy(brandstr +  8 + j, &raw->cpuid_ext[i][ecx], 4);
-            memcpy(brandstr + 12 + j, &raw->cpuid_ext[i][edx], 4);
+            regs = raw_leaf(raw, 0x80000000 + i);
+            memcpy(brandstr +  0 + j, &regs[eax], 4);
+            memcpy(brandstr +  4 + j, &regs[ebx], 4);
+            memcpy(brandstr +  8 + j, &regs[ecx], 4);
+            memcpy(brandstr + 12 + j, &regs[edx], 4);
         }
         brandstr[BRAND_STR_MAX - 1] = '\0'; /* Ensure NUL termination */
         /*
@@ -344,19 +357,27 @@ int icuid_identify(cpuid_raw_data_t *raw, cpuid_data_t *data)
         strcpy(data->brand_str, p);
     }
 
+    /* Paravirtualization features depend on the hypervisor */
+    get_hypervisor(raw, data);
+
     /* Populate data->flags */
     set_cpuid_features(raw, data);
+    set_hypervisor_features(raw, data);
 
     /* Get addressing info */
     if (data->cpuid_max_ext >= 0x80000008) {
-        data->physical_address_bits = raw->cpuid_ext[8][eax] & 0xFF;
-        data->virtual_address_bits = (raw->cpuid_ext[8][eax] >> 8) & 0xFF;
+        regs = raw_leaf(raw, 0x80000008);
+        data->physical_address_bits = regs[eax] & 0xFF;
+        data->virtual_address_bits = (regs[eax] >> 8) & 0xFF;
     }
 
-    if (data->flags[CPU_FEATURE_OSXSAVE]) {
-        uint64_t xcr0 = icuid_xgetbv(0);
-        set_cpuid_xfeatures(data, xcr0);
-    }
+    if (icuid_flags_test(&data->flags, CPU_FEATURE_OSXSAVE))
+        set_cpuid_xfeatures(data, raw_xcr0(raw));
+    set_xsave_info(raw, data);
+
+    set_x86_64_level(data);
+
+    set_frequency_info(raw, data);
 
     /* Get vendor specific info */
     if (IS_INTEL)
@@ -366,3 +387,23 @@ int icuid_identify(cpuid_raw_data_t *raw, cpuid_data_t *data)
 
     return ICUID_OK;
 }
+
+static cpuid_data_t cached_data;
+static icuid_once_t cached_data_once = ICUID_ONCE_INIT;
+
+const cpuid_flags_t *icuid_flags_cache;
+
+static void init_cached_data(void)
+{
+    if (icuid_identify(NULL, &cached_data) != ICUID_OK)
+        memset(&cached_data, 0, sizeof(cached_data));
+    /* Lets icuid_get_flags() skip the once from now on */
+    icuid_atomic_store_ptr(&icuid_flags_cache, &cached_data.flags);
+}
+
+const cpuid_data_t *icuid_get(void)
+{
+    icuid_call_once(&cached_data_once, init_cached_data);
+
+    return &cached_data;
+}
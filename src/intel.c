@@ -20,130 +20,51 @@
 
 #include <icuid/icuid.h>
 
+#include "cache.h"
 #include "features.h"
 #include "internal.h"
 #include "intel.h"
 #include "match.h"
-
-typedef enum {
-    Lnone, /*!< Indicates error */
-    L1I,   /*!< L1 Instruction Cache */
-    L1D,   /*!< L1 Data Cache */
-    L2,    /*!< L2 Cache */
-    L3,    /*!< L3 Cache */
-    L4,    /*!< L4 Cache */
-} cache_type_t;
-
-static void set_cache_info(cpuid_data_t *data, const cache_type_t cache,
-                           const uint32_t size, const uint32_t associativity,
-                           const uint32_t linesize)
-{
-    
-    switch (cache) {
-        case L1I:
-            data->l1_instruction_cache = size;
-            break;
-        case L1D:
-            data->l1_data_cache = size;
-            data->l1_associativity = associativity;
-            data->l1_cacheline = linesize;
-            break;
-        case L2:
-            data->l2_cache = size;
-            data->l2_associativity = associativity;
-            data->l2_cacheline = linesize;
-            break;
-        case L3:
-            data->l3_cache = size;
-            data->l3_associativity = associativity;
-            data->l3_cacheline = linesize;
-            break;
-        case L4:
-            data->l4_cache = size;
-            data->l4_associativity = associativity;
-            data->l4_cacheline = linesize;
-            break;
-        default:
-            break;
-    }
-}
+#include "raw.h"
+#include "topology.h"
 
 /**
  * Intel Deterministic Cache Method
  */
-static void get_intel_deterministic_cacheinfo(const cpuid_raw_data_t *raw, cpuid_data_t *data)
+static void get_intel_deterministic_cacheinfo(cpuid_raw_data_t *raw, cpuid_data_t *data)
 {
-    uint32_t idx;
-    uint32_t associativity, partitions, linesize, sets, size, level, cache_type;
-    cache_type_t type;
-    for (idx = 0; idx < raw->max_intel_dc_level; idx++) {
-        type = Lnone;
-        cache_type = raw->intel_dc[idx][eax] & 0x1F;
-        if (cache_type == 0) /* Check validity */
-            break;
-        level = (raw->intel_dc[idx][eax] >> 5) & 0x7;
-        switch (level) {
-            case 1:
-                if (cache_type == 1)
-                    type = L1D;
-                else if (cache_type == 2)
-                    type = L1I;
-                break;
-            case 2:
-                if (cache_type == 3)
-                    type = L2;
-                break;
-            case 3:
-                if (cache_type == 3)
-                    type = L3;
-                break;
-            case 4:
-                if (cache_type == 3)
-                    type = L4;
-                break;
-            default:
-                break;
-        }
-        associativity = (raw->intel_dc[idx][ebx] >> 22) + 1;
-        partitions = ((raw->intel_dc[idx][ebx] >> 12) & 0x3FF) + 1;
-        linesize = (raw->intel_dc[idx][ebx] & 0xFFF) + 1;
-        sets = raw->intel_dc[idx][ecx] + 1;
-        size = (linesize * sets * associativity * partitions) >> 10; /* Size in KB */
-        set_cache_info(data, type, size, associativity, linesize);
-    }
+    uint32_t levels = raw_subleaves(raw, RAW_TABLE_INTEL_DC);
+
+    set_deterministic_cache_info(data, raw->intel_dc, levels);
 }
 
 /**
- * Read Extended Topology Information
+ * Read Extended Topology Information, V2 (0x1F) if available
  */
-static int read_intel_extended_topology(const cpuid_raw_data_t *raw, cpuid_data_t *data)
+static int read_intel_extended_topology(cpuid_raw_data_t *raw, cpuid_data_t *data)
 {
-    uint32_t i;
-    uint32_t smt = 0, cores = 0, level_type;
-    for (i = 0; i < raw->max_intel_et_level; i++) {
-        level_type = (raw->intel_et[i][ecx] >> 8) & 0xFF;
-        switch (level_type) {
-            case THREAD:
-                smt = raw->intel_et[i][ebx] & 0xFFFF;
-                break;
-            case CORE:
-                cores = raw->intel_et[i][ebx] & 0xFFFF;
-                break;
-            default:
-                break;
-        }
+    uint32_t (*regs)[4];
+    uint32_t i, levels;
+    uint32_t smt = 0, logical_cpus = 0;
+
+    levels = topology_table(raw, &regs);
+    for (i = 0; i < levels; i++) {
+        if (((regs[i][ecx] >> 8) & 0xFF) == TOPO_TYPE_SMT)
+            smt = regs[i][ebx] & 0xFFFF;
+        /* The last level counts every logical CPU of the package */
+        logical_cpus = regs[i][ebx] & 0xFFFF;
     }
-    if (!smt || !cores)
+    if (!smt || !logical_cpus)
         return 0;
-    data->cores = cores / smt;
-    data->logical_cpus = cores;
+    data->cores = logical_cpus / smt;
+    data->logical_cpus = logical_cpus;
     return 1;
 }
 
 /**
  * Get the number of cores
  */
-static void get_intel_number_cores(const cpuid_raw_data_t *raw, cpuid_data_t *data)
+static void get_intel_number_cores(cpuid_raw_data_t *raw, cpuid_data_t *data)
 {
     uint32_t cores = 0, logical_cpus = 0;
     if (data->cpuid_max_basic >= 0xB) {
@@ -152,11 +73,11 @@ static void get_intel_number_cores(const cpuid_raw_data_t *raw, cpuid_data_t *da
     }
 
     if (data->cpuid_max_basic >= 1) {
-        logical_cpus = (raw->cpuid[1][ebx] >> 16) & 0xFF;
-        if (raw->cpuid[0][0] >= 4)
-            cores = 1 + ((raw->cpuid[4][eax] >> 26) & 0x3F);
+        logical_cpus = (raw_leaf(raw, 1)[ebx] >> 16) & 0xFF;
+        if (data->cpuid_max_basic >= 4)
+            cores = 1 + ((raw_leaf(raw, 4)[eax] >> 26) & 0x3F);
     }
-    if (data->flags[CPU_FEATURE_HT]) {
+    if (icuid_flags_test(&data->flags, CPU_FEATURE_HT)) {
         if (cores > 1) {
             data->cores = cores;
             data->logical_cpus = logical_cpus;
@@ -164,111 +85,123 @@ static void get_intel_number_cores(const cpuid_raw_data_t *raw, cpuid_data_t *da
             data->cores = 1;
             data->logical_cpus = (logical_cpus >= 2 ? logical_cpus : 1);
             if (data->logical_cpus == 1)
-                data->flags[CPU_FEATURE_HT] = 0;
+                icuid_flags_clear(&data->flags, CPU_FEATURE_HT);
         }
     } else {
         data->cores = data->logical_cpus = 1;
     }
 }
 
-const match_codename_t codename_intel_t[] = {
-    /* Atom */
-
-    /* Bonnell (45nm) */
-    { 0x06,   NA,   NA, 0x1C,   NA,    "Bonnell"                },
-    { 0x06,   NA,   NA, 0x26,   NA,    "Lincroft"               },
-
-    /* Saltwell (32nm) */
-    { 0x06,   NA,   NA, 0x35,   NA,    "Cloverview"             },
-    { 0x06,   NA,   NA, 0x36,   NA,    "Cedarview"              },
-    { 0x06,   NA,   NA, 0x27,   NA,    "Penwell"                },
-
-    /* Silvermont (22nm)*/
-    { 0x06,   NA,   NA, 0x5D,   NA,    "SoFIA"                  },
-    { 0x06,   NA,   NA, 0x5A,   NA,    "Anniedale"              },
-    { 0x06,   NA,   NA, 0x4D,   NA,    "Silvermont"             },
-    { 0x06,   NA,   NA, 0x4A,   NA,    "Tangier"                },
-    { 0x06,   NA,   NA, 0x37,   NA,    "Bay Trail"              },
-
-    /* Moorefield (22nm) */
-    { 0x06,   NA,   NA, 0x37,   NA,    "Moorefield"             },
-
-    /* Airmont (14nm) */
-    { 0x06,   NA,   NA, 0x4C,   NA,    "Airmont"                },
-
-    /* Goldmont (14nm) */
-    { 0x06,   NA,   NA, 0x5C,   NA,    "Apollo Lake"            },
-    { 0x06,   NA,   NA, 0x5F,   NA,    "Denverton"              },
-
-    /* Goldmont Plus (14nm) */
-    { 0x06,   NA,   NA, 0x7A,   NA,    "Gemini Lake"            },
-
-    /* Tremont (10nm) */
-    { 0x06,   NA,   NA, 0x86,   NA,    "Tremont"                },
-
-    /* 90nm */
-    { 0x0F,   NA, 0x03, 0x00,   NA,    "Prescott"               },
-    { 0x0F,   NA, 0x04, 0x00,   NA,    "Prescott"               },
-
-    /* 65nm */
-    { 0x0F,   NA, 0x06, 0x00,   NA,    "Presler"                },
-    { 0x06,   NA, 0x0F, 0x00,   NA,    "Merom"                  },
-    { 0x06,   NA, 0x16, 0x00,   NA,    "Merom"                  },
-
-    /* 45nm */
-    { 0x06,   NA,   NA, 0x1D,   NA,    "Dunnington (MP)"        },
-    { 0x06,   NA,   NA, 0x17,   NA,    "Penryn"                 },
-    { 0x06,   NA,   NA, 0x17, 0x0A,    "Wolfdale"               },
-    { 0x06,   NA,   NA, 0x1A,   NA,    "Nehalem"                },
-    { 0x06,   NA,   NA, 0x1E,   NA,    "Clarksfield"            },
-    { 0x06,   NA,   NA, 0x2E,   NA,    "Nehalem EX"             },
-
-    /* 32nm */
-    { 0x06,   NA,   NA, 0x25,   NA,    "Westmere"               },
-    { 0x06,   NA,   NA, 0x2C,   NA,    "Westmere"               },
-    { 0x06,   NA,   NA, 0x2F,   NA,    "Westmere EX"            },
-
-    { 0x06,   NA,   NA, 0x2A,   NA,    "Sandy Bridge"           },
-    { 0x06,   NA,   NA, 0x2D,   NA,    "Sandy Bridge-E[NP]"     },
-
-    /* Ivy Bridge (22nm) */
-    { 0x06,   NA,   NA, 0x3A,   NA,    "Ivy Bridge"             },
-    { 0x06,   NA,   NA, 0x2B,   NA,    "Ivy Bridge LGA 2011"    },
-    { 0x06,   NA,   NA, 0x3E,   NA,    "Ivy Bridge E"           },
-
-    /* Haswell (22nm) */
-    { 0x06,   NA,   NA, 0x3C,   NA,    "Haswell"                },
-    { 0x06,   NA,   NA, 0x3F,   NA,    "Haswell-E"              },
-    { 0x06,   NA,   NA, 0x45,   NA,    "Haswell-ULT"            },
-    { 0x06,   NA,   NA, 0x46,   NA,    "Crystal Well"           },
-
-    /* Broadwell (14nm) */
-    { 0x06,   NA,   NA, 0x3D,   NA,    "Broadwell"              },
-    { 0x06,   NA,   NA, 0x47,   NA,    "Broadwell"              },
-    { 0x06,   NA,   NA, 0x4F,   NA,    "Broadwell"              },
-    { 0x06,   NA,   NA, 0x56,   NA,    "Broadwell"              },
-
-    /* Skylake (14nm) */
-    { 0x06,   NA,   NA, 0x4E,   NA,    "Skylake"                },
-    { 0x06,   NA,   NA, 0x5E,   NA,    "Skylake"                },
-
-    /* Knights Landing (14nm) */
-    { 0x06,   NA,   NA, 0x75,   NA,    "Knights Landing"        },
-    { 0x06,   NA,   NA, 0x58,   NA,    "Knights Mill"           },
-
-    /* Kaby Lake (14nm) */
-    { 0x06,   NA,   NA, 0x8E,   NA,    "Kaby Lake"              },
-
-    /* Coffee Lake (14nm) */
-    { 0x06,   NA,   NA, 0x9E,   NA,    "Coffee Lake"            },
-
-    /* Cannon Lake (14nm) */
-    { 0x06,   NA,   NA, 0x66,   NA,    "Cannon Lake"            },
-
-    /* Ice Lake (10nm) */
-    { 0x06,   NA,   NA, 0x7D,   NA,    "Ice Lake"               },
-    { 0x06,   NA,   NA, 0x7E,   NA,    "Ice Lake"               },
-};
+/*
+ * X(ext_family, ext_model, stepping, codename), NA matches any stepping.
+ * Every row becomes a case label of intel_codename(), so the compiler
+ * rejects two rows with the same key.
+ */
+#define INTEL_CODENAMES(X) \
+    /* Atom */ \
+    \
+    /* Bonnell (45nm) */ \
+    X(0x06, 0x1C,   NA, "Bonnell") \
+    X(0x06, 0x26,   NA, "Lincroft") \
+    \
+    /* Saltwell (32nm) */ \
+    X(0x06, 0x35,   NA, "Cloverview") \
+    X(0x06, 0x36,   NA, "Cedarview") \
+    X(0x06, 0x27,   NA, "Penwell") \
+    \
+    /* Silvermont (22nm)*/ \
+    X(0x06, 0x5D,   NA, "SoFIA") \
+    X(0x06, 0x5A,   NA, "Anniedale") \
+    X(0x06, 0x4D,   NA, "Silvermont") \
+    X(0x06, 0x4A,   NA, "Tangier") \
+    X(0x06, 0x37,   NA, "Bay Trail") \
+    \
+    /* Moorefield is Anniedale (0x5A) */ \
+    \
+    /* Airmont (14nm) */ \
+    X(0x06, 0x4C,   NA, "Airmont") \
+    \
+    /* Goldmont (14nm) */ \
+    X(0x06, 0x5C,   NA, "Apollo Lake") \
+    X(0x06, 0x5F,   NA, "Denverton") \
+    \
+    /* Goldmont Plus (14nm) */ \
+    X(0x06, 0x7A,   NA, "Gemini Lake") \
+    \
+    /* Tremont (10nm) */ \
+    X(0x06, 0x86,   NA, "Tremont") \
+    \
+    /* 90nm */ \
+    X(0x0F, 0x03,   NA, "Prescott") \
+    X(0x0F, 0x04,   NA, "Prescott") \
+    \
+    /* 65nm */ \
+    X(0x0F, 0x06,   NA, "Presler") \
+    X(0x06, 0x0F,   NA, "Merom") \
+    X(0x06, 0x16,   NA, "Merom") \
+    \
+    /* 45nm */ \
+    X(0x06, 0x1D,   NA, "Dunnington (MP)") \
+    X(0x06, 0x17,   NA, "Penryn") \
+    X(0x06, 0x17, 0x0A, "Wolfdale") \
+    X(0x06, 0x1A,   NA, "Nehalem") \
+    X(0x06, 0x1E,   NA, "Clarksfield") \
+    X(0x06, 0x2E,   NA, "Nehalem EX") \
+    \
+    /* 32nm */ \
+    X(0x06, 0x25,   NA, "Westmere") \
+    X(0x06, 0x2C,   NA, "Westmere") \
+    X(0x06, 0x2F,   NA, "Westmere EX") \
+    \
+    X(0x06, 0x2A,   NA, "Sandy Bridge") \
+    X(0x06, 0x2D,   NA, "Sandy Bridge-E[NP]") \
+    \
+    /* Ivy Bridge (22nm) */ \
+    X(0x06, 0x3A,   NA, "Ivy Bridge") \
+    X(0x06, 0x2B,   NA, "Ivy Bridge LGA 2011") \
+    X(0x06, 0x3E,   NA, "Ivy Bridge E") \
+    \
+    /* Haswell (22nm) */ \
+    X(0x06, 0x3C,   NA, "Haswell") \
+    X(0x06, 0x3F,   NA, "Haswell-E") \
+    X(0x06, 0x45,   NA, "Haswell-ULT") \
+    X(0x06, 0x46,   NA, "Crystal Well") \
+    \
+    /* Broadwell (14nm) */ \
+    X(0x06, 0x3D,   NA, "Broadwell") \
+    X(0x06, 0x47,   NA, "Broadwell") \
+    X(0x06, 0x4F,   NA, "Broadwell") \
+    X(0x06, 0x56,   NA, "Broadwell") \
+    \
+    /* Skylake (14nm) */ \
+    X(0x06, 0x4E,   NA, "Skylake") \
+    X(0x06, 0x5E,   NA, "Skylake") \
+    \
+    /* Knights Landing (14nm) */ \
+    X(0x06, 0x75,   NA, "Knights Landing") \
+    X(0x06, 0x58,   NA, "Knights Mill") \
+    \
+    /* Kaby Lake (14nm) */ \
+    X(0x06, 0x8E,   NA, "Kaby Lake") \
+    \
+    /* Coffee Lake (14nm) */ \
+    X(0x06, 0x9E,   NA, "Coffee Lake") \
+    \
+    /* Cannon Lake (14nm) */ \
+    X(0x06, 0x66,   NA, "Cannon Lake") \
+    \
+    /* Ice Lake (10nm) */ \
+    X(0x06, 0x7D,   NA, "Ice Lake") \
+    X(0x06, 0x7E,   NA, "Ice Lake")
+
+const char *intel_codename(uint32_t key)
+{
+    switch (key) {
+        INTEL_CODENAMES(CODENAME_CASE)
+        default:
+            return NULL;
+    }
+}
 
 /**
  * Get codename
@@ -280,11 +213,39 @@ static void get_intel_codename(cpuid_data_t *data)
     if (data->cpuid_max_basic < 1)
         return;
 
-    cpu_to_codename(data, codename_intel_t, NELEMS(codename_intel_t));
+    cpu_to_codename(data, intel_codename);
+}
+
+const char *core_type_str(cpu_core_type_t type)
+{
+    switch (type) {
+        case CORE_TYPE_ATOM: return "E-core";
+        case CORE_TYPE_CORE: return "P-core";
+        default:
+            return "";
+    }
+}
+
+/**
+ * Hybrid Information Enumeration Leaf, describes the core the leaf
+ * was executed on.
+ */
+static void get_intel_core_type(cpuid_raw_data_t *raw, cpuid_data_t *data)
+{
+    uint32_t info;
+
+    if (!icuid_flags_test(&data->flags, CPU_FEATURE_HYBRID) ||
+        data->cpuid_max_basic < 0x1A)
+        return;
+
+    info = raw_leaf(raw, 0x1A)[eax];
+    data->core_type = (cpu_core_type_t)(info >> 24);
+    data->native_model_id = info & 0xFFFFFF;
 }
 
-void read_intel_data(const cpuid_raw_data_t *raw, cpuid_data_t *data)
+void read_intel_data(cpuid_raw_data_t *raw, cpuid_data_t *data)
 {
+    get_intel_core_type(raw, data);
     get_intel_number_cores(raw, data);
     get_intel_deterministic_cacheinfo(raw, data);
     get_intel_codename(data);
@@ -14,8 +14,4 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-/* Extended Topology */
-#define THREAD  0x1
-#define CORE    0x2
-
-void read_intel_data(const cpuid_raw_data_t *raw, cpuid_data_t *data);
+void read_intel_data(cpuid_raw_data_t *raw, cpuid_data_t *data);
@@ -20,41 +20,30 @@
 
 #include <icuid/icuid.h>
 
+#include "codedb.h"
 #include "match.h"
 #include "intel.h"
 
-static unsigned int score(const cpuid_data_t *data, const match_codename_t *entry)
+/**
+ * Looks the CPU up by extended family, extended model and stepping, then
+ * by extended family and model alone. Codenames are only ever exact.
+ * A loaded codename database takes precedence over the built-in tables.
+ */
+void cpu_to_codename(cpuid_data_t *data, codename_lookup_t lookup)
 {
-    unsigned int rv = 0;
-
-    if (entry->family != NA && entry->family == data->family)
-        rv += 2;
-    if (entry->ext_family != NA && entry->ext_family == data->ext_family)
-        rv += 2;
-    if (entry->model != NA && entry->model == data->model)
-        rv += 2;
-    if (entry->ext_model != NA && entry->ext_model == data->ext_model)
-        rv += 2;
-    if (entry->stepping != NA && entry->stepping == data->stepping)
-        rv += 2;
+    uint32_t key, any;
+    const char *codename;
 
-    return rv;
-}
-
-void cpu_to_codename(cpuid_data_t *data, const match_codename_t *matchtable,
-                     const unsigned int array_size)
-{
-    unsigned int bestscore = 0;
-    unsigned int bestindex = 0;
-    unsigned int i, t;
+    key = CODENAME_KEY(data->ext_family, data->ext_model, data->stepping);
+    any = CODENAME_KEY(data->ext_family, data->ext_model, NA);
 
-    for (i = 0; i < array_size; i++) {
-        t = score(data, &matchtable[i]);
-        if (t > bestscore) {
-            bestscore = t;
-            bestindex = i;
-        }
-    }
+    codename = codedb_lookup(data->vendor, key);
+    if (codename == NULL)
+        codename = codedb_lookup(data->vendor, any);
+    if (codename == NULL)
+        codename = lookup(key);
+    if (codename == NULL)
+        codename = lookup(any);
 
-    data->codename = matchtable[bestindex].codename;
+    data->codename = codename != NULL ? codename : "Unknown";
 }
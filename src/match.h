@@ -14,18 +14,28 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-typedef struct {
-    uint32_t family;
-    uint32_t ext_family;
-    uint32_t model;
-    uint32_t ext_model;
-    uint32_t stepping;
-    const char *codename;
-} match_codename_t;
-
 #if !defined(NA)
 #define NA (unsigned)-1
 #endif
 
-void cpu_to_codename(cpuid_data_t *data, const match_codename_t *matchtable,
-                     const unsigned int array_size);
+/*
+ * Key of a codename row. Rows for any stepping use stepping NA, which
+ * can't collide with a real stepping (0 - 15).
+ */
+#define CODENAME_KEY(ext_family, ext_model, stepping) \
+    (((uint32_t)(ext_family) & 0xFFF) << 16 | \
+     ((uint32_t)(ext_model) & 0xFF) << 8 | ((uint32_t)(stepping) & 0xFF))
+
+/* Expands a codename table row into a case of its lookup function */
+#define CODENAME_CASE(ext_family, ext_model, stepping, codename) \
+    case CODENAME_KEY(ext_family, ext_model, stepping): \
+        return codename;
+
+/* Codename of a CODENAME_KEY, or NULL */
+typedef const char *(*codename_lookup_t)(uint32_t key);
+
+void cpu_to_codename(cpuid_data_t *data, codename_lookup_t lookup);
+
+/* Codename lookups of intel.c and amd.c */
+const char *intel_codename(uint32_t key);
+const char *amd_codename(uint32_t key);
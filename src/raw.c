@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "internal.h"
+#include "raw.h"
+
+#define BIT_TEST(bits, n) ((bits)[(n) / 32] & (1U << ((n) % 32)))
+#define BIT_SET(bits, n)  ((bits)[(n) / 32] |= (1U << ((n) % 32)))
+
+/* Cache type 0 (null) ends leaves 4 and 0x8000001D */
+static int last_intel_dc(const uint32_t (*regs)[4], uint32_t i)
+{
+    return (regs[i][eax] & 0x1F) == 0;
+}
+
+/* Level type 0 (invalid) ends leaves 0xB and 0x1F */
+static int last_intel_et(const uint32_t (*regs)[4], uint32_t i)
+{
+    return ((regs[i][ecx] >> 8) & 0xFF) == 0;
+}
+
+/*
+ * Leaf 0xD has a subleaf per state component: subleaf 0 enumerates the user
+ * components (XCR0), subleaf 1 the supervisor ones (IA32_XSS). It ends with
+ * the highest supported component.
+ */
+static int last_xsave(const uint32_t (*regs)[4], uint32_t i)
+{
+    if (i == 0)
+        return 0;
+    if (i + 1 >= 32)
+        return 1;
+
+    return ((regs[0][eax] | regs[1][ecx]) >> (i + 1)) == 0;
+}
+
+#define RAW_TABLE(name, base, kind, regs, levels, limit, last) \
+    { name, base, kind, (uint32_t)offsetof(cpuid_raw_data_t, regs), \
+      (uint32_t)offsetof(cpuid_raw_data_t, levels), limit, last }
+
+const raw_table_t raw_tables[NUM_RAW_TABLES] = {
+    RAW_TABLE("cpuid", 0x0, RAW_LEAVES, cpuid, max_cpuid_level,
+              MAX_CPUID_LEVEL, NULL),
+    RAW_TABLE("cpuid_ext", 0x80000000, RAW_LEAVES, cpuid_ext,
+              max_cpuid_ext_level, MAX_EXT_CPUID_LEVEL, NULL),
+    RAW_TABLE("cpuid_hv", 0x40000000, RAW_LEAVES, cpuid_hv,
+              max_cpuid_hv_level, MAX_HV_CPUID_LEVEL, NULL),
+    RAW_TABLE("intel_dc", 0x4, RAW_SUBLEAVES, intel_dc, max_intel_dc_level,
+              MAX_INTEL_DC_LEVEL, last_intel_dc),
+    RAW_TABLE("intel_et", 0xB, RAW_SUBLEAVES, intel_et, max_intel_et_level,
+              MAX_INTEL_ET_LEVEL, last_intel_et),
+    RAW_TABLE("intel_v2et", 0x1F, RAW_SUBLEAVES, intel_v2et,
+              max_intel_v2et_level, MAX_INTEL_V2ET_LEVEL, last_intel_et),
+    RAW_TABLE("amd_dc", 0x8000001D, RAW_SUBLEAVES, amd_dc, max_amd_dc_level,
+              MAX_AMD_DC_LEVEL, last_intel_dc),
+    RAW_TABLE("xsave", 0xD, RAW_SUBLEAVES, xsave, max_xsave_level,
+              MAX_XSAVE_LEVEL, last_xsave),
+    RAW_TABLE("xgetbv", 0x0, RAW_XCR, xgetbv, max_xgetbv_level,
+              MAX_XGETBV_LEVEL, NULL),
+};
+
+static int exec_local(void *ctx, uint32_t regs[4])
+{
+    (void)ctx;
+    icuid_cpuid_ext(regs);
+
+    return ICUID_OK;
+}
+
+static int exec_leaf(raw_exec_t exec, void *ctx, uint32_t leaf,
+                     uint32_t subleaf, uint32_t regs[4])
+{
+    regs[eax] = leaf;
+    regs[ebx] = 0;
+    regs[ecx] = subleaf;
+    regs[edx] = 0;
+
+    return exec(ctx, regs);
+}
+
+/**
+ * Returns the number of valid rows of the hypervisor table given leaf
+ * 0x40000000, whose EAX is the highest hypervisor leaf. Older KVM reports 0.
+ */
+uint32_t raw_hv_max_level(const uint32_t *regs)
+{
+    uint32_t max = regs[eax] ? regs[eax] : 0x40000001;
+
+    if ((max & 0xFFFFFF00) != 0x40000000)
+        return 1;
+    if ((max & 0xFF) + 1 > MAX_HV_CPUID_LEVEL)
+        return MAX_HV_CPUID_LEVEL;
+
+    return (max & 0xFF) + 1;
+}
+
+/**
+ * Returns the number of valid hypervisor leaves, 0 unless the HYPERVISOR
+ * bit is set. If |raw| was collected lazily leaf 0x40000000 is executed on
+ * first use.
+ */
+uint32_t raw_hv_levels(cpuid_raw_data_t *raw)
+{
+    if (raw->lazy && !(raw->subleaf_fetched & (1U << RAW_TABLE_CPUID_HV))) {
+        if (raw_leaf(raw, 1)[ecx] & (1U << 31)) { /* HYPERVISOR */
+            icuid_cpuid(0x40000000, raw->cpuid_hv[0]);
+            raw->max_cpuid_hv_level = raw_hv_max_level(raw->cpuid_hv[0]);
+            BIT_SET(raw->cpuid_hv_fetched, 0);
+        }
+        raw->subleaf_fetched |= 1U << RAW_TABLE_CPUID_HV;
+    }
+
+    return raw->max_cpuid_hv_level;
+}
+
+/**
+ * Returns the registers of a basic (0x0000xxxx), hypervisor (0x4000xxxx)
+ * or extended (0x8000xxxx) leaf. If |raw| was collected lazily the leaf is executed the first time
+ * it is requested and memoized in |raw|. Leaves above the maximum level
+ * reported by the CPU read as zero, just like in a fully collected |raw|.
+ */
+const uint32_t *raw_leaf(cpuid_raw_data_t *raw, const uint32_t leaf)
+{
+    static const uint32_t zero[4] = { 0, 0, 0, 0 };
+    uint32_t *regs, *fetched;
+    uint32_t idx;
+
+    if (leaf & 0x80000000) {
+        idx = leaf & ~0x80000000;
+        if (idx >= raw->max_cpuid_ext_level)
+            return zero;
+        regs = raw->cpuid_ext[idx];
+        fetched = raw->cpuid_ext_fetched;
+    } else if ((leaf & 0xFFFF0000) == 0x40000000) {
+        idx = leaf & ~0x40000000;
+        if (idx >= raw_hv_levels(raw))
+            return zero;
+        regs = raw->cpuid_hv[idx];
+        fetched = raw->cpuid_hv_fetched;
+    } else {
+        idx = leaf;
+        if (idx >= raw->max_cpuid_level)
+            return zero;
+        regs = raw->cpuid[idx];
+        fetched = raw->cpuid_fetched;
+    }
+
+    if (raw->lazy && !BIT_TEST(fetched, idx)) {
+        icuid_cpuid(leaf, regs);
+        BIT_SET(fetched, idx);
+    }
+
+    return regs;
+}
+
+/* Counts the valid rows of a subleaf table, including the one ending it */
+static uint32_t count_rows(cpuid_raw_data_t *raw, const raw_table_t *t)
+{
+    uint32_t (*regs)[4] = RAW_TABLE_REGS(raw, t);
+    uint32_t i;
+
+    for (i = 0; i < t->limit; i++) {
+        if (t->last((const uint32_t (*)[4])regs, i))
+            return i + 1;
+    }
+
+    return t->limit;
+}
+
+/* Returns non-zero if the leaf enumerated by subleaf table |t| exists */
+static int has_base_leaf(const cpuid_raw_data_t *raw, const raw_table_t *t)
+{
+    if (t->base & 0x80000000)
+        return (t->base & ~0x80000000) < raw->max_cpuid_ext_level;
+
+    return t->base < raw->max_cpuid_level;
+}
+
+static int fetch_subleaves(cpuid_raw_data_t *raw, const raw_table_t *t,
+                           raw_exec_t exec, void *ctx)
+{
+    uint32_t (*regs)[4] = RAW_TABLE_REGS(raw, t);
+    uint32_t i;
+    int ret;
+
+    if (!has_base_leaf(raw, t))
+        return ICUID_OK;
+
+    for (i = 0; i < t->limit; i++) {
+        ret = exec_leaf(exec, ctx, t->base, i, regs[i]);
+        if (ret != ICUID_OK)
+            return ret;
+        if (t->last((const uint32_t (*)[4])regs, i))
+            break;
+    }
+    RAW_TABLE_LEVELS(raw, t) = i < t->limit ? i + 1 : t->limit;
+
+    return ICUID_OK;
+}
+
+static void fetch_xcr0(cpuid_raw_data_t *raw)
+{
+    uint64_t xcr0 = icuid_xgetbv(0);
+
+    raw->xgetbv[0][eax] = (uint32_t)xcr0;
+    raw->xgetbv[0][edx] = (uint32_t)(xcr0 >> 32);
+    raw->max_xgetbv_level = 1;
+}
+
+/**
+ * Returns the number of valid rows of subleaf table |id|, enumerating all
+ * of them on first use if |raw| was collected lazily. The last row is the
+ * one that ended enumeration.
+ */
+uint32_t raw_subleaves(cpuid_raw_data_t *raw, raw_table_id_t id)
+{
+    const raw_table_t *t = &raw_tables[id];
+
+    if (raw->lazy && !(raw->subleaf_fetched & (1U << id))) {
+        fetch_subleaves(raw, t, exec_local, NULL);
+        raw->subleaf_fetched |= 1U << id;
+    }
+
+    return RAW_TABLE_LEVELS(raw, t);
+}
+
+/**
+ * Recomputes the number of valid rows of subleaf table |id| from its
+ * contents, e.g. after parsing a dump.
+ */
+uint32_t raw_count_subleaves(cpuid_raw_data_t *raw, raw_table_id_t id)
+{
+    const raw_table_t *t = &raw_tables[id];
+
+    RAW_TABLE_LEVELS(raw, t) = 0;
+    if (has_base_leaf(raw, t))
+        RAW_TABLE_LEVELS(raw, t) = count_rows(raw, t);
+
+    return RAW_TABLE_LEVELS(raw, t);
+}
+
+/**
+ * Sets the number of valid rows of every table from the contents of |raw|,
+ * after it was read from a dump
+ */
+void raw_count_levels(cpuid_raw_data_t *raw)
+{
+    uint32_t i;
+
+    /* Dumps only contain the leaves we store, clip like cpuid_get_raw_data */
+    raw->max_cpuid_level = raw->cpuid[0][eax] + 1;
+    if (raw->max_cpuid_level > MAX_CPUID_LEVEL)
+        raw->max_cpuid_level = MAX_CPUID_LEVEL;
+    raw->max_cpuid_ext_level = (raw->cpuid_ext[0][eax] & ~0x80000000) + 1;
+    if (raw->max_cpuid_ext_level > MAX_EXT_CPUID_LEVEL)
+        raw->max_cpuid_ext_level = MAX_EXT_CPUID_LEVEL;
+
+    /* Older dumps have no hypervisor leaves even if HYPERVISOR is set */
+    if (raw->max_cpuid_level >= 0x2 && (raw->cpuid[1][ecx] & (1U << 31)) &&
+        (raw->cpuid_hv[0][eax] || raw->cpuid_hv[0][ebx]))
+        raw->max_cpuid_hv_level = raw_hv_max_level(raw->cpuid_hv[0]);
+    for (i = 0; i < NUM_RAW_TABLES; i++) {
+        if (raw_tables[i].kind == RAW_SUBLEAVES)
+            raw_count_subleaves(raw, (raw_table_id_t)i);
+    }
+    if (raw->max_cpuid_level >= 0x2 && (raw->cpuid[1][ecx] & (1U << 27)))
+        raw->max_xgetbv_level = 1; /* OSXSAVE */
+}
+
+/**
+ * Returns XCR0, or 0 if the OS hasn't enabled XSAVE (OSXSAVE is clear).
+ * If |raw| was collected lazily XCR0 is read on first use.
+ */
+uint64_t raw_xcr0(cpuid_raw_data_t *raw)
+{
+    if (raw->lazy && !(raw->subleaf_fetched & (1U << RAW_TABLE_XGETBV))) {
+        if (raw_leaf(raw, 1)[ecx] & (1U << 27)) /* OSXSAVE */
+            fetch_xcr0(raw);
+        raw->subleaf_fetched |= 1U << RAW_TABLE_XGETBV;
+    }
+
+    if (raw->max_xgetbv_level < 1)
+        return 0;
+
+    return ((uint64_t)raw->xgetbv[0][edx] << 32) | raw->xgetbv[0][eax];
+}
+
+/**
+ * Executes every leaf of a lazily collected |raw| that hasn't been
+ * fetched yet, after which |raw| is no longer lazy.
+ */
+void raw_fetch_all(cpuid_raw_data_t *raw)
+{
+    uint32_t i;
+
+    if (!raw->lazy)
+        return;
+
+    for (i = 1; i < raw->max_cpuid_level; i++)
+        raw_leaf(raw, i);
+    for (i = 1; i < raw->max_cpuid_ext_level; i++)
+        raw_leaf(raw, 0x80000000 + i);
+    for (i = 1; i < raw_hv_levels(raw); i++)
+        raw_leaf(raw, 0x40000000 + i);
+    for (i = 0; i < NUM_RAW_TABLES; i++) {
+        if (raw_tables[i].kind == RAW_SUBLEAVES)
+            raw_subleaves(raw, (raw_table_id_t)i);
+    }
+    raw_xcr0(raw);
+
+    raw->lazy = 0;
+}
+
+/**
+ * Collects every leaf into |raw| by running CPUID through |exec|, e.g. on
+ * another CPU. XCR0 is OS state shared by every CPU, so it is read locally.
+ */
+int raw_collect(cpuid_raw_data_t *raw, raw_exec_t exec, void *ctx)
+{
+    uint32_t i;
+    int ret;
+
+    memset(raw, 0, sizeof(*raw));
+
+    ret = exec_leaf(exec, ctx, 0, 0, raw->cpuid[0]);
+    if (ret != ICUID_OK)
+        return ret;
+    ret = exec_leaf(exec, ctx, 0x80000000, 0, raw->cpuid_ext[0]);
+    if (ret != ICUID_OK)
+        return ret;
+
+    raw->max_cpuid_level = raw->cpuid[0][eax] + 1;
+    if (raw->max_cpuid_level > MAX_CPUID_LEVEL)
+        raw->max_cpuid_level = MAX_CPUID_LEVEL;
+    raw->max_cpuid_ext_level = (raw->cpuid_ext[0][eax] & ~0x80000000) + 1;
+    if (raw->max_cpuid_ext_level > MAX_EXT_CPUID_LEVEL)
+        raw->max_cpuid_ext_level = MAX_EXT_CPUID_LEVEL;
+
+    for (i = 1; i < raw->max_cpuid_level; i++) {
+        ret = exec_leaf(exec, ctx, i, 0, raw->cpuid[i]);
+        if (ret != ICUID_OK)
+            return ret;
+    }
+    for (i = 1; i < raw->max_cpuid_ext_level; i++) {
+        ret = exec_leaf(exec, ctx, 0x80000000 + i, 0, raw->cpuid_ext[i]);
+        if (ret != ICUID_OK)
+            return ret;
+    }
+    if (raw->max_cpuid_level > 0x1 && (raw->cpuid[1][ecx] & (1U << 31))) {
+        ret = exec_leaf(exec, ctx, 0x40000000, 0, raw->cpuid_hv[0]);
+        if (ret != ICUID_OK)
+            return ret;
+        raw->max_cpuid_hv_level = raw_hv_max_level(raw->cpuid_hv[0]);
+        for (i = 1; i < raw->max_cpuid_hv_level; i++) {
+            ret = exec_leaf(exec, ctx, 0x40000000 + i, 0, raw->cpuid_hv[i]);
+            if (ret != ICUID_OK)
+                return ret;
+        }
+    }
+    for (i = 0; i < NUM_RAW_TABLES; i++) {
+        if (raw_tables[i].kind != RAW_SUBLEAVES)
+            continue;
+        ret = fetch_subleaves(raw, &raw_tables[i], exec, ctx);
+        if (ret != ICUID_OK)
+            return ret;
+    }
+    if (raw->max_cpuid_level > 0x1 && (raw->cpuid[1][ecx] & (1U << 27)))
+        fetch_xcr0(raw);
+
+    return ICUID_OK;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* The register tables of cpuid_raw_data_t, in dump file order */
+typedef enum {
+    RAW_TABLE_CPUID = 0,
+    RAW_TABLE_CPUID_EXT,
+    RAW_TABLE_CPUID_HV,
+    RAW_TABLE_INTEL_DC,
+    RAW_TABLE_INTEL_ET,
+    RAW_TABLE_INTEL_V2ET,
+    RAW_TABLE_AMD_DC,
+    RAW_TABLE_XSAVE,
+    RAW_TABLE_XGETBV,
+    NUM_RAW_TABLES,
+} raw_table_id_t;
+
+/* How the rows of a raw table map to CPUID */
+#define RAW_LEAVES     0  /* row i is leaf base + i */
+#define RAW_SUBLEAVES  1  /* row i is subleaf i of basic or extended leaf base */
+#define RAW_XCR        2  /* row i is XCR i, read by xgetbv */
+
+/* Describes one of the register tables of cpuid_raw_data_t */
+typedef struct {
+    const char *name;   /* dump file token */
+    uint32_t base;
+    int kind;
+    uint32_t regs;      /* offsetof() the table */
+    uint32_t levels;    /* offsetof() its number of valid rows */
+    uint32_t limit;     /* capacity of the table */
+    /* RAW_SUBLEAVES: returns non-zero if row |i| ends enumeration */
+    int (*last)(const uint32_t (*regs)[4], uint32_t i);
+} raw_table_t;
+
+#define RAW_TABLE_REGS(raw, t) \
+    ((uint32_t (*)[4])((char *)(raw) + (t)->regs))
+#define RAW_TABLE_LEVELS(raw, t) \
+    (*(uint32_t *)((char *)(raw) + (t)->levels))
+
+extern const raw_table_t raw_tables[NUM_RAW_TABLES];
+
+/**
+ * Executes CPUID with the EAX/ECX input in |regs| somewhere, e.g. on another
+ * CPU, and returns ICUID_OK or an error code.
+ */
+typedef int (*raw_exec_t)(void *ctx, uint32_t regs[4]);
+
+const uint32_t *raw_leaf(cpuid_raw_data_t *raw, const uint32_t leaf);
+uint32_t raw_subleaves(cpuid_raw_data_t *raw, raw_table_id_t id);
+uint32_t raw_count_subleaves(cpuid_raw_data_t *raw, raw_table_id_t id);
+void raw_count_levels(cpuid_raw_data_t *raw);
+uint32_t raw_hv_max_level(const uint32_t *regs);
+uint32_t raw_hv_levels(cpuid_raw_data_t *raw);
+uint64_t raw_xcr0(cpuid_raw_data_t *raw);
+void raw_fetch_all(cpuid_raw_data_t *raw);
+int raw_collect(cpuid_raw_data_t *raw, raw_exec_t exec, void *ctx);
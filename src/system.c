@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#if defined(__linux__)
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <icuid/icuid.h>
+
+#include "cache.h"
+#include "internal.h"
+#include "raw.h"
+#include "thread.h"
+#include "topology.h"
+
+/* Per-CPU fields, which are expected to differ between CPUs */
+static const struct {
+    uint32_t leaf;
+    cpuid_register_t reg;
+    uint32_t mask;
+} per_cpu_fields[] = {
+    { 0x1,        ebx, 0xFF000000 }, /* Initial APIC ID */
+    { 0xB,        edx, 0xFFFFFFFF }, /* x2APIC ID */
+    { 0x1F,       edx, 0xFFFFFFFF }, /* x2APIC ID */
+    { 0x8000001E, eax, 0xFFFFFFFF }, /* Extended APIC ID */
+    { 0x8000001E, ebx, 0x000000FF }, /* Compute unit ID */
+    { 0x8000001E, ecx, 0x000000FF }, /* Node ID */
+};
+
+typedef struct {
+    cpuid_cpu_raw_t *cpu;
+    int ret;
+} worker_t;
+
+static void worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+
+    if (icuid_pin_thread(w->cpu->cpu) != 0) {
+        w->ret = ICUID_ERROR_AFFINITY;
+        return;
+    }
+
+    /* Lazy data would be completed on whatever CPU it is used on */
+    w->ret = cpuid_get_raw_data(&w->cpu->raw);
+}
+
+static int enum_threads(cpuid_system_raw_t *sys)
+{
+    icuid_thread_t *threads;
+    worker_t *workers;
+    uint32_t i, started;
+    int ret = ICUID_OK;
+
+    threads = calloc(sys->num_cpus, sizeof(*threads));
+    workers = calloc(sys->num_cpus, sizeof(*workers));
+    if (threads == NULL || workers == NULL) {
+        free(threads);
+        free(workers);
+        return ICUID_ERROR_MEMORY;
+    }
+
+    for (started = 0; started < sys->num_cpus; started++) {
+        workers[started].cpu = &sys->cpus[started];
+        if (icuid_thread_create(&threads[started], worker,
+                                &workers[started]) != 0) {
+            ret = ICUID_ERROR_AFFINITY;
+            break;
+        }
+    }
+
+    for (i = 0; i < started; i++) {
+        icuid_thread_join(threads[i]);
+        if (ret == ICUID_OK)
+            ret = workers[i].ret;
+    }
+
+    free(threads);
+    free(workers);
+
+    return ret;
+}
+
+#if defined(__linux__)
+
+/* The cpuid driver takes EAX in the low and ECX in the high half of the offset */
+static int exec_device(void *ctx, uint32_t regs[4])
+{
+    int fd = *(int *)ctx;
+    off_t offset = ((off_t)regs[ecx] << 32) | regs[eax];
+
+    if (pread(fd, regs, 16, offset) != 16)
+        return ICUID_ERROR_OPEN;
+
+    return ICUID_OK;
+}
+
+static int enum_device(cpuid_system_raw_t *sys)
+{
+    char path[32];
+    long conf;
+    uint32_t cpu;
+    int fd, ret;
+
+    conf = sysconf(_SC_NPROCESSORS_CONF);
+    if (conf <= 0 || conf > MAX_LOGICAL_CPUS)
+        conf = MAX_LOGICAL_CPUS;
+
+    sys->num_cpus = 0;
+    for (cpu = 0; cpu < (uint32_t)conf; cpu++) {
+        snprintf(path, sizeof(path), "/dev/cpu/%u/cpuid", cpu);
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            if (errno == ENOENT || errno == ENXIO || errno == EIO)
+                continue; /* Offline */
+            return ICUID_ERROR_OPEN;
+        }
+
+        sys->cpus[sys->num_cpus].cpu = cpu;
+        ret = raw_collect(&sys->cpus[sys->num_cpus].raw, exec_device, &fd);
+        close(fd);
+        if (ret != ICUID_OK)
+            return ret;
+        sys->num_cpus++;
+    }
+
+    return sys->num_cpus > 0 ? ICUID_OK : ICUID_ERROR_OPEN;
+}
+
+#else
+
+static int enum_device(cpuid_system_raw_t *sys)
+{
+    (void)sys;
+
+    return ICUID_ERROR_OPEN;
+}
+
+#endif
+
+static uint32_t per_cpu_mask(uint32_t leaf, uint32_t reg)
+{
+    uint32_t i, mask = 0;
+
+    for (i = 0; i < NELEMS(per_cpu_fields); i++) {
+        if (per_cpu_fields[i].leaf == leaf && per_cpu_fields[i].reg == reg)
+            mask |= per_cpu_fields[i].mask;
+    }
+
+    return mask;
+}
+
+/* Compares every CPU against the first one, a register at a time */
+static int find_diffs(cpuid_system_raw_t *sys)
+{
+    const raw_table_t *t;
+    cpuid_raw_diff_t *diff;
+    uint32_t (*ref)[4], (*regs)[4];
+    uint32_t capacity = 0, rows, row, reg, cpu, leaf, subleaf, x;
+
+    for (t = raw_tables; t < raw_tables + NUM_RAW_TABLES; t++)
+        capacity += t->limit * 4;
+
+    sys->diffs = calloc(capacity, sizeof(*sys->diffs));
+    if (sys->diffs == NULL)
+        return ICUID_ERROR_MEMORY;
+
+    for (t = raw_tables; t < raw_tables + NUM_RAW_TABLES; t++) {
+        if (t->kind == RAW_XCR)
+            continue; /* OS state, not per CPU */
+
+        rows = 0;
+        for (cpu = 0; cpu < sys->num_cpus; cpu++) {
+            if (RAW_TABLE_LEVELS(&sys->cpus[cpu].raw, t) > rows)
+                rows = RAW_TABLE_LEVELS(&sys->cpus[cpu].raw, t);
+        }
+
+        ref = RAW_TABLE_REGS(&sys->cpus[0].raw, t);
+        for (row = 0; row < rows; row++) {
+            leaf = t->kind == RAW_LEAVES ? t->base + row : t->base;
+            subleaf = t->kind == RAW_LEAVES ? 0 : row;
+            for (reg = 0; reg < 4; reg++) {
+                diff = &sys->diffs[sys->num_diffs];
+                for (cpu = 1; cpu < sys->num_cpus; cpu++) {
+                    regs = RAW_TABLE_REGS(&sys->cpus[cpu].raw, t);
+                    x = (regs[row][reg] ^ ref[row][reg]) &
+                        ~per_cpu_mask(leaf, reg);
+                    if (x == 0)
+                        continue;
+                    if (diff->num_cpus++ == 0)
+                        diff->first_cpu = cpu;
+                    diff->mask |= x;
+                }
+                if (diff->num_cpus > 0) {
+                    diff->leaf = leaf;
+                    diff->subleaf = subleaf;
+                    diff->reg = reg;
+                    sys->num_diffs++;
+                }
+            }
+        }
+    }
+
+    return ICUID_OK;
+}
+
+int cpuid_get_system_raw_data(cpuid_system_raw_t *sys,
+                              cpuid_enum_method_t method)
+{
+    cpuid_cpu_raw_t *cpus;
+    uint32_t *allowed = NULL;
+    uint32_t i;
+    int ret;
+
+    if (sys == NULL)
+        return ICUID_PASSED_NULL;
+
+    memset(sys, 0, sizeof(*sys));
+
+    if (!cpuid_is_supported())
+        return ICUID_NO_CPUID;
+
+    sys->cpus = calloc(MAX_LOGICAL_CPUS, sizeof(*sys->cpus));
+    allowed = calloc(MAX_LOGICAL_CPUS, sizeof(*allowed));
+    if (sys->cpus == NULL || allowed == NULL) {
+        ret = ICUID_ERROR_MEMORY;
+        goto err;
+    }
+
+    ret = ICUID_ERROR_AFFINITY;
+    if (method != ICUID_ENUM_DEVICE) {
+        sys->num_cpus = icuid_allowed_cpus(allowed, MAX_LOGICAL_CPUS);
+        for (i = 0; i < sys->num_cpus; i++)
+            sys->cpus[i].cpu = allowed[i];
+        if (sys->num_cpus > 0)
+            ret = enum_threads(sys);
+    }
+    if (method == ICUID_ENUM_DEVICE ||
+        (method == ICUID_ENUM_AUTO && ret == ICUID_ERROR_AFFINITY)) {
+        memset(sys->cpus, 0, MAX_LOGICAL_CPUS * sizeof(*sys->cpus));
+        ret = enum_device(sys);
+    }
+    if (ret != ICUID_OK)
+        goto err;
+
+    /* Give back what MAX_LOGICAL_CPUS over-allocated */
+    cpus = realloc(sys->cpus, sys->num_cpus * sizeof(*sys->cpus));
+    if (cpus != NULL)
+        sys->cpus = cpus;
+
+    for (i = 0; i < sys->num_cpus; i++)
+        sys->cpus[i].apic_id = get_apic_id(&sys->cpus[i].raw);
+
+    ret = find_diffs(sys);
+    if (ret != ICUID_OK)
+        goto err;
+
+    free(allowed);
+    return ICUID_OK;
+
+err:
+    free(allowed);
+    cpuid_free_system_raw_data(sys);
+    return ret;
+}
+
+void cpuid_free_system_raw_data(cpuid_system_raw_t *sys)
+{
+    if (sys == NULL)
+        return;
+
+    free(sys->cpus);
+    free(sys->diffs);
+    memset(sys, 0, sizeof(*sys));
+}
+
+static uint32_t get_core_type_index(cpuid_system_data_t *data,
+                                    const cpuid_data_t *id)
+{
+    cpuid_core_type_data_t *type;
+    uint32_t i;
+
+    for (i = 0; i < data->num_core_types; i++) {
+        type = &data->core_types[i];
+        if (type->core_type == id->core_type &&
+            type->native_model_id == id->native_model_id)
+            return i;
+    }
+    if (data->num_core_types == MAX_CORE_TYPES)
+        return MAX_CORE_TYPES;
+
+    type = &data->core_types[data->num_core_types];
+    type->core_type = id->core_type;
+    type->native_model_id = id->native_model_id;
+    type->data = *id;
+
+    return data->num_core_types++;
+}
+
+static int compare_uint32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Sorts |keys| and returns the number of distinct values */
+static uint32_t count_distinct(uint32_t *keys, uint32_t n)
+{
+    uint32_t i, count = 0;
+
+    qsort(keys, n, sizeof(*keys), compare_uint32);
+    for (i = 0; i < n; i++) {
+        if (i == 0 || keys[i] != keys[i - 1])
+            count++;
+    }
+
+    return count;
+}
+
+/* Identifies an instance of a cache while the domains are built */
+typedef struct {
+    uint32_t id;            /* APIC ID above the sharing bits */
+    uint32_t sharing_bits;
+} cache_key_t;
+
+/* Adds |cpu| to the instance of cache |desc| it shares with other CPUs */
+static int add_cache_cpu(cpuid_system_data_t *data, cache_key_t **keys,
+                         uint32_t *capacity, const cache_desc_t *desc,
+                         const cpuid_cpu_data_t *cpu)
+{
+    cpuid_cache_domain_t *domain, *caches;
+    cache_key_t key, *new_keys;
+    uint32_t i;
+
+    key.id = desc->sharing_bits >= 32 ? 0 : cpu->apic_id >> desc->sharing_bits;
+    key.sharing_bits = desc->sharing_bits;
+
+    for (i = 0; i < data->num_caches; i++) {
+        domain = &data->caches[i];
+        if (domain->level == desc->level && domain->type == desc->type &&
+            (*keys)[i].id == key.id &&
+            (*keys)[i].sharing_bits == key.sharing_bits)
+            break;
+    }
+
+    if (i == data->num_caches) {
+        if (i == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 16;
+            caches = realloc(data->caches, *capacity * sizeof(*caches));
+            if (caches == NULL)
+                return ICUID_ERROR_MEMORY;
+            data->caches = caches;
+            new_keys = realloc(*keys, *capacity * sizeof(*new_keys));
+            if (new_keys == NULL)
+                return ICUID_ERROR_MEMORY;
+            *keys = new_keys;
+        }
+        domain = &data->caches[i];
+        memset(domain, 0, sizeof(*domain));
+        domain->level = desc->level;
+        domain->type = desc->type;
+        domain->size = desc->size;
+        (*keys)[i] = key;
+        data->num_caches++;
+    }
+
+    icuid_cpuset_set(&domain->cpus, cpu->cpu);
+    domain->logical_cpus++;
+
+    return ICUID_OK;
+}
+
+static int compare_cache_domains(const void *a, const void *b)
+{
+    const cpuid_cache_domain_t *x = a, *y = b;
+    uint32_t fx, fy;
+
+    if (x->level != y->level)
+        return x->level < y->level ? -1 : 1;
+    if (x->type != y->type)
+        return x->type < y->type ? -1 : 1;
+    fx = icuid_cpuset_next(&x->cpus, 0);
+    fy = icuid_cpuset_next(&y->cpus, 0);
+
+    return fx < fy ? -1 : fx > fy;
+}
+
+int icuid_identify_system(cpuid_system_raw_t *sys, cpuid_system_data_t *data)
+{
+    cpuid_core_type_data_t *type;
+    cpuid_cpu_data_t *cpu;
+    cpuid_data_t id;
+    cache_desc_t descs[MAX_INTEL_DC_LEVEL];
+    cache_key_t *cache_keys = NULL;
+    uint32_t shift[NUM_TOPO_LEVELS];
+    uint32_t *keys;
+    uint32_t i, j, level, core_id, num_descs, cache_capacity = 0;
+    int ret;
+
+    if (sys == NULL || data == NULL)
+        return ICUID_PASSED_NULL;
+
+    memset(data, 0, sizeof(*data));
+
+    data->cpus = calloc(sys->num_cpus, sizeof(*data->cpus));
+    /* The APIC ID prefix of every CPU at every level, to count instances */
+    keys = calloc((size_t)sys->num_cpus * NUM_TOPO_LEVELS, sizeof(*keys));
+    if (data->cpus == NULL || keys == NULL) {
+        free(data->cpus);
+        free(keys);
+        data->cpus = NULL;
+        return ICUID_ERROR_MEMORY;
+    }
+    data->num_cpus = sys->num_cpus;
+
+    for (i = 0; i < sys->num_cpus; i++) {
+        ret = icuid_identify(&sys->cpus[i].raw, &id);
+        if (ret != ICUID_OK)
+            goto err;
+
+        cpu = &data->cpus[i];
+        cpu->cpu = sys->cpus[i].cpu;
+        cpu->apic_id = sys->cpus[i].apic_id;
+        cpu->core_type = id.core_type;
+        cpu->native_model_id = id.native_model_id;
+        cpu->core_type_index = get_core_type_index(data, &id);
+
+        get_topology_shifts(&sys->cpus[i].raw, &id, shift);
+        get_topology_ids(shift, cpu->apic_id, cpu->topo_id);
+        for (level = 0; level < NUM_TOPO_LEVELS; level++) {
+            keys[level * sys->num_cpus + i] =
+                level == 0 ? cpu->apic_id : cpu->apic_id >> shift[level - 1];
+        }
+        if (id.vendor == VENDOR_AMD &&
+            icuid_flags_test(&id.flags, CPU_FEATURE_TOPOEXT)) {
+            cpu->compute_unit_id =
+                raw_leaf(&sys->cpus[i].raw, 0x8000001E)[ebx] & 0xFF;
+            cpu->node_id = raw_leaf(&sys->cpus[i].raw, 0x8000001E)[ecx] & 0xFF;
+        }
+
+        num_descs = get_cache_descs(&sys->cpus[i].raw, &id, descs,
+                                    NELEMS(descs));
+        for (j = 0; j < num_descs; j++) {
+            ret = add_cache_cpu(data, &cache_keys, &cache_capacity, &descs[j],
+                                cpu);
+            if (ret != ICUID_OK)
+                goto err;
+        }
+
+        if (cpu->core_type_index == MAX_CORE_TYPES)
+            continue;
+        type = &data->core_types[cpu->core_type_index];
+        icuid_cpuset_set(&type->cpus, cpu->cpu);
+        type->logical_cpus++;
+
+        /* Count each core once, at its first logical CPU */
+        core_id = keys[TOPO_LEVEL_CORE * sys->num_cpus + i];
+        for (j = 0; j < i; j++) {
+            if (keys[TOPO_LEVEL_CORE * sys->num_cpus + j] == core_id &&
+                data->cpus[j].core_type_index == cpu->core_type_index)
+                break;
+        }
+        if (j == i)
+            type->cores++;
+    }
+
+    for (level = 0; level < NUM_TOPO_LEVELS; level++)
+        data->topo_count[level] =
+            count_distinct(keys + level * sys->num_cpus, sys->num_cpus);
+
+    if (data->num_caches > 0)
+        qsort(data->caches, data->num_caches, sizeof(*data->caches),
+              compare_cache_domains);
+
+    free(cache_keys);
+    free(keys);
+
+    return ICUID_OK;
+
+err:
+    free(cache_keys);
+    free(keys);
+    icuid_free_system_data(data);
+    return ret;
+}
+
+void icuid_free_system_data(cpuid_system_data_t *data)
+{
+    if (data == NULL)
+        return;
+
+    free(data->cpus);
+    free(data->caches);
+    memset(data, 0, sizeof(*data));
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include <stdlib.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include <icuid/icuid.h>
+
+#include "thread.h"
+
+/* Adapts void fn(void *) to the native thread entry point */
+struct thread_start {
+    void (*fn)(void *);
+    void *arg;
+};
+
+#if defined(_WIN32)
+
+/* States of an icuid_once_t */
+#define ONCE_NEW     0
+#define ONCE_RUNNING 1
+#define ONCE_DONE    2
+
+/**
+ * InitOnceExecuteOnce() needs Vista, so roll our own on top of
+ * InterlockedCompareExchange().
+ */
+void icuid_call_once(icuid_once_t *once, void (*fn)(void))
+{
+    if (*once == ONCE_DONE)
+        return;
+
+    if (InterlockedCompareExchange(once, ONCE_RUNNING, ONCE_NEW) == ONCE_NEW) {
+        fn();
+        InterlockedExchange(once, ONCE_DONE);
+        return;
+    }
+
+    while (*once != ONCE_DONE)
+        Sleep(0);
+}
+
+static DWORD WINAPI thread_start(LPVOID p)
+{
+    struct thread_start start = *(struct thread_start *)p;
+
+    free(p);
+    start.fn(start.arg);
+
+    return 0;
+}
+
+int icuid_thread_create(icuid_thread_t *thread, void (*fn)(void *), void *arg)
+{
+    struct thread_start *start;
+
+    start = malloc(sizeof(*start));
+    if (start == NULL)
+        return -1;
+    start->fn = fn;
+    start->arg = arg;
+
+    *thread = CreateThread(NULL, 0, thread_start, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return -1;
+    }
+
+    return 0;
+}
+
+void icuid_thread_join(icuid_thread_t thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+/**
+ * Only the processor group the process was started in is reachable with
+ * the affinity mask APIs, i.e. at most 64 logical CPUs.
+ */
+uint32_t icuid_allowed_cpus(uint32_t *cpus, uint32_t max)
+{
+    DWORD_PTR process, system;
+    uint32_t cpu, n = 0;
+
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+        return 0;
+
+    for (cpu = 0; cpu < sizeof(process) * 8 && n < max; cpu++) {
+        if (process & ((DWORD_PTR)1 << cpu))
+            cpus[n++] = cpu;
+    }
+
+    return n;
+}
+
+int icuid_pin_thread(uint32_t cpu)
+{
+    if (cpu >= sizeof(DWORD_PTR) * 8)
+        return -1;
+    if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) == 0)
+        return -1;
+    Sleep(0); /* Make sure we were moved */
+
+    return 0;
+}
+
+#else
+
+void icuid_call_once(icuid_once_t *once, void (*fn)(void))
+{
+    pthread_once(once, fn);
+}
+
+static void *thread_start(void *p)
+{
+    struct thread_start start = *(struct thread_start *)p;
+
+    free(p);
+    start.fn(start.arg);
+
+    return NULL;
+}
+
+int icuid_thread_create(icuid_thread_t *thread, void (*fn)(void *), void *arg)
+{
+    struct thread_start *start;
+
+    start = malloc(sizeof(*start));
+    if (start == NULL)
+        return -1;
+    start->fn = fn;
+    start->arg = arg;
+
+    if (pthread_create(thread, NULL, thread_start, start) != 0) {
+        free(start);
+        return -1;
+    }
+
+    return 0;
+}
+
+void icuid_thread_join(icuid_thread_t thread)
+{
+    pthread_join(thread, NULL);
+}
+
+#if defined(__linux__)
+
+uint32_t icuid_allowed_cpus(uint32_t *cpus, uint32_t max)
+{
+    cpu_set_t set;
+    uint32_t cpu, n = 0;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return 0;
+
+    for (cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        if (CPU_ISSET(cpu, &set))
+            cpus[n++] = cpu;
+    }
+
+    return n;
+}
+
+/* sched_setaffinity() migrates the calling thread before returning */
+int icuid_pin_thread(uint32_t cpu)
+{
+    cpu_set_t set;
+
+    if (cpu >= CPU_SETSIZE)
+        return -1;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return sched_setaffinity(0, sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+#else
+
+/* No portable affinity API, assume every online CPU is usable */
+uint32_t icuid_allowed_cpus(uint32_t *cpus, uint32_t max)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t cpu, n = 0;
+
+    for (cpu = 0; (long)cpu < online && n < max; cpu++)
+        cpus[n++] = cpu;
+
+    return n;
+}
+
+int icuid_pin_thread(uint32_t cpu)
+{
+    (void)cpu;
+
+    return -1;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Portable threading primitives used internally */
+
+#if defined(_WIN32)
+#include <windows.h>
+typedef volatile LONG icuid_once_t;
+typedef HANDLE icuid_thread_t;
+#define ICUID_ONCE_INIT 0
+#else
+#include <pthread.h>
+typedef pthread_once_t icuid_once_t;
+typedef pthread_t icuid_thread_t;
+#define ICUID_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+void icuid_call_once(icuid_once_t *once, void (*fn)(void));
+
+/* Pointer loads and stores that order the memory they point to */
+#if defined(_WIN32)
+#define icuid_atomic_load_ptr(p) \
+    InterlockedCompareExchangePointer((PVOID volatile *)(p), NULL, NULL)
+#define icuid_atomic_store_ptr(p, v) \
+    ((void)InterlockedExchangePointer((PVOID volatile *)(p), (PVOID)(v)))
+#else
+#define icuid_atomic_load_ptr(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define icuid_atomic_store_ptr(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#endif
+
+int icuid_thread_create(icuid_thread_t *thread, void (*fn)(void *), void *arg);
+void icuid_thread_join(icuid_thread_t thread);
+
+uint32_t icuid_allowed_cpus(uint32_t *cpus, uint32_t max);
+int icuid_pin_thread(uint32_t cpu);
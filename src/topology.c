@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "internal.h"
+#include "raw.h"
+#include "topology.h"
+
+/* Number of bits needed to hold the values 0 .. n - 1 */
+uint32_t bit_width(uint32_t n)
+{
+    uint32_t width = 0;
+
+    while (width < 32 && (1ULL << width) < n)
+        width++;
+
+    return width;
+}
+
+/**
+ * Returns the number of valid levels of the extended topology leaf,
+ * preferring V2 (0x1F) over 0xB, and points |regs| to its rows.
+ */
+uint32_t topology_table(cpuid_raw_data_t *raw, uint32_t (**regs)[4])
+{
+    uint32_t levels;
+
+    levels = raw_subleaves(raw, RAW_TABLE_INTEL_V2ET);
+    if (levels > 1) {
+        *regs = raw->intel_v2et;
+        return levels - 1;
+    }
+
+    levels = raw_subleaves(raw, RAW_TABLE_INTEL_ET);
+    if (levels > 1) {
+        *regs = raw->intel_et;
+        return levels - 1;
+    }
+
+    return 0;
+}
+
+static int has_topoext(cpuid_raw_data_t *raw)
+{
+    return raw->max_cpuid_ext_level > 0x1E &&
+           (raw_leaf(raw, 0x80000001)[ecx] & (1U << 22));
+}
+
+/**
+ * The x2APIC ID if the CPU has an extended topology leaf, else the
+ * extended APIC ID on AMD, else the 8-bit initial APIC ID.
+ */
+uint32_t get_apic_id(cpuid_raw_data_t *raw)
+{
+    uint32_t (*regs)[4];
+
+    if (topology_table(raw, &regs) > 0)
+        return regs[0][edx];
+    if (has_topoext(raw))
+        return raw_leaf(raw, 0x8000001E)[eax];
+
+    return raw_leaf(raw, 1)[ebx] >> 24;
+}
+
+/**
+ * Computes where each level starts in the APIC ID: the ID of |level| is
+ * made of the bits [shift[level - 1], shift[level]), the package ID is
+ * everything from shift[TOPO_LEVEL_DIE] up. Levels the CPU doesn't report
+ * are zero bits wide.
+ */
+void get_topology_shifts(cpuid_raw_data_t *raw, const cpuid_data_t *data,
+                         uint32_t shift[NUM_TOPO_LEVELS])
+{
+    uint32_t (*regs)[4];
+    uint32_t i, levels, type, bits, logical = 1, cores = 1;
+
+    memset(shift, 0, NUM_TOPO_LEVELS * sizeof(*shift));
+
+    levels = topology_table(raw, &regs);
+    if (levels > 0) {
+        for (i = 0; i < levels; i++) {
+            type = (regs[i][ecx] >> 8) & 0xFF;
+            bits = regs[i][eax] & 0x1F;
+            /* Die groups and unknown levels are folded into the die ID */
+            if (type > TOPO_TYPE_DIE)
+                type = TOPO_TYPE_DIE;
+            if (bits > shift[type - 1])
+                shift[type - 1] = bits;
+        }
+    } else if (data->vendor == VENDOR_AMD && has_topoext(raw) &&
+               data->ext_family >= 0x17) {
+        /* Zen: threads per compute unit, ApicIdCoreIdSize per package */
+        shift[TOPO_LEVEL_SMT] =
+            bit_width(((raw_leaf(raw, 0x8000001E)[ebx] >> 8) & 0xFF) + 1);
+        shift[TOPO_LEVEL_CORE] = (raw_leaf(raw, 0x80000008)[ecx] >> 12) & 0xF;
+    } else {
+        if (icuid_flags_test(&data->flags, CPU_FEATURE_HT))
+            logical = (raw_leaf(raw, 1)[ebx] >> 16) & 0xFF;
+        if (data->vendor == VENDOR_AMD) {
+            /* Pre-Zen AMD cores don't share, every logical CPU is a core */
+            cores = logical;
+            bits = (raw_leaf(raw, 0x80000008)[ecx] >> 12) & 0xF;
+            if (bits != 0)
+                shift[TOPO_LEVEL_CORE] = bits;
+        } else if (data->cpuid_max_basic >= 4) {
+            cores = ((raw_leaf(raw, 4)[eax] >> 26) & 0x3F) + 1;
+        }
+        if (logical < cores)
+            logical = cores;
+        shift[TOPO_LEVEL_SMT] = bit_width(logical / cores);
+        if (shift[TOPO_LEVEL_CORE] == 0)
+            shift[TOPO_LEVEL_CORE] = bit_width(logical);
+    }
+
+    for (i = TOPO_LEVEL_CORE; i < TOPO_LEVEL_PACKAGE; i++) {
+        if (shift[i] < shift[i - 1])
+            shift[i] = shift[i - 1];
+    }
+    shift[TOPO_LEVEL_PACKAGE] = 32;
+}
+
+/* Splits |apic_id| into the ID of each level, relative to its parent */
+void get_topology_ids(const uint32_t shift[NUM_TOPO_LEVELS],
+                      const uint32_t apic_id, uint32_t id[NUM_TOPO_LEVELS])
+{
+    uint32_t i, low = 0, width;
+
+    for (i = 0; i < NUM_TOPO_LEVELS; i++) {
+        width = shift[i] - low;
+        if (width >= 32)
+            id[i] = apic_id >> low;
+        else
+            id[i] = (apic_id >> low) & ((1U << width) - 1);
+        low = shift[i];
+    }
+}
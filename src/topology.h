@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Level types of leaves 0xB and 0x1F */
+#define TOPO_TYPE_INVALID 0
+#define TOPO_TYPE_SMT     1
+#define TOPO_TYPE_DIE     5
+
+uint32_t bit_width(uint32_t n);
+uint32_t topology_table(cpuid_raw_data_t *raw, uint32_t (**regs)[4]);
+uint32_t get_apic_id(cpuid_raw_data_t *raw);
+void get_topology_shifts(cpuid_raw_data_t *raw, const cpuid_data_t *data,
+                         uint32_t shift[NUM_TOPO_LEVELS]);
+void get_topology_ids(const uint32_t shift[NUM_TOPO_LEVELS],
+                      const uint32_t apic_id, uint32_t id[NUM_TOPO_LEVELS]);
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "vector.h"
+
+/* Minimum length of a timed run, in TSC ticks */
+#define PROBE_TICKS (1U << 21)
+/* Timed runs per kernel, the fastest one counts */
+#define PROBE_RUNS  3
+
+typedef void (*probe_loop_t)(uint32_t n);
+
+static const struct {
+    probe_loop_t int_loop;
+    probe_loop_t fma_loop;
+    uint32_t lanes; /* 32-bit elements per register */
+    uint32_t bits;
+} kernels[NUM_VECTOR_WIDTHS] = {
+    { icuid_loop_int128, icuid_loop_fma128,  4, 128 },
+    { icuid_loop_int256, icuid_loop_fma256,  8, 256 },
+    { icuid_loop_int512, icuid_loop_fma512, 16, 512 },
+};
+
+static uint64_t time_loop(const icuid_clock_t *clock, probe_loop_t loop,
+                          uint32_t n)
+{
+    uint64_t begin, end;
+
+    begin = icuid_clock_begin(clock);
+    loop(n);
+    end = icuid_clock_end(clock);
+
+    return end > begin ? end - begin : 1;
+}
+
+/* Returns the number of iterations of |loop| that last PROBE_TICKS */
+static uint32_t calibrate(const icuid_clock_t *clock, probe_loop_t loop)
+{
+    uint32_t n = 256;
+
+    while (n < (1U << 30) && time_loop(clock, loop, n) < PROBE_TICKS)
+        n *= 2;
+
+    return n;
+}
+
+/* Core cycles per TSC tick, at the frequency left by what ran before */
+static double core_per_tick(const icuid_clock_t *clock, uint32_t ref_n)
+{
+    return (double)ref_n * SCALAR_LOOP_OPS /
+           time_loop(clock, icuid_loop_scalar, ref_n);
+}
+
+/**
+ * Returns the instructions per core cycle of |loop|, and in |core| the
+ * core cycles per TSC tick measured right after it
+ */
+static double per_cycle(const icuid_clock_t *clock, probe_loop_t loop,
+                        uint32_t ref_n, double *core)
+{
+    uint64_t ticks, best = 0;
+    uint32_t n, i;
+
+    n = calibrate(clock, loop);
+    for (i = 0; i < PROBE_RUNS; i++) {
+        ticks = time_loop(clock, loop, n);
+        if (best == 0 || ticks < best)
+            best = ticks;
+    }
+    *core = core_per_tick(clock, ref_n);
+
+    return (double)n * VECTOR_LOOP_OPS / (best * *core);
+}
+
+/* VEX encoded instructions need the OS to save the AVX state, at any width */
+static int avx_enabled(const cpuid_data_t *data)
+{
+    return data->xfeatures[XFEATURE_SSE] && data->xfeatures[XFEATURE_AVX];
+}
+
+static int width_supported(const cpuid_data_t *data, cpu_vector_width_t w)
+{
+    const cpuid_flags_t *flags = &data->flags;
+    int avx_state = avx_enabled(data);
+
+    switch (w) {
+        case VECTOR_WIDTH_128:
+            return icuid_flags_test(flags, CPU_FEATURE_SSE2);
+        case VECTOR_WIDTH_256:
+            return avx_state && icuid_flags_test(flags, CPU_FEATURE_AVX2);
+        case VECTOR_WIDTH_512:
+            return avx_state && data->xfeatures[XFEATURE_OPMASK] &&
+                   data->xfeatures[XFEATURE_ZMM_Hi256] &&
+                   data->xfeatures[XFEATURE_Hi16_ZMM] &&
+                   icuid_flags_test(flags, CPU_FEATURE_AVX512F);
+        default:
+            return 0;
+    }
+}
+
+/* Work per unit of time, FMAs if both widths have them */
+static double work_rate(const cpuid_vector_width_info_t *info, int fma)
+{
+    return (fma ? info->fma_per_cycle : info->int_per_cycle) *
+           info->frequency_ratio;
+}
+
+int icuid_probe_vector_width(cpuid_vector_probe_t *probe,
+                             const cpuid_data_t *data)
+{
+    cpuid_vector_width_info_t *info, *best;
+    icuid_clock_t clock;
+    double core, scalar_core;
+    uint32_t ref_n, w;
+    int ret, fma;
+
+    if (probe == NULL)
+        return ICUID_PASSED_NULL;
+
+    if (data == NULL)
+        data = icuid_get();
+
+    memset(probe, 0, sizeof(*probe));
+
+    ret = icuid_clock_init(&clock, data);
+    if (ret != ICUID_OK)
+        return ret;
+
+    fma = icuid_flags_test(&data->flags, CPU_FEATURE_FMA) && avx_enabled(data);
+
+    /* Calibrating the scalar loop also brings the core out of idle */
+    ref_n = calibrate(&clock, icuid_loop_scalar) / 8;
+    scalar_core = core_per_tick(&clock, ref_n);
+    probe->scalar_frequency = (uint32_t)(scalar_core * clock.frequency / 1000000);
+
+    for (w = 0; w < NUM_VECTOR_WIDTHS; w++) {
+        info = &probe->widths[w];
+        if (!width_supported(data, (cpu_vector_width_t)w))
+            continue;
+
+        info->supported = 1;
+        info->int_per_cycle = kernels[w].lanes *
+            per_cycle(&clock, kernels[w].int_loop, ref_n, &core);
+        if (fma)
+            info->fma_per_cycle = kernels[w].lanes *
+                per_cycle(&clock, kernels[w].fma_loop, ref_n, &core);
+        info->frequency_ratio = core / scalar_core;
+        info->frequency = (uint32_t)(core * clock.frequency / 1000000);
+    }
+
+    best = &probe->widths[VECTOR_WIDTH_128];
+    probe->preferred_width = kernels[VECTOR_WIDTH_128].bits;
+    for (w = VECTOR_WIDTH_256; w < NUM_VECTOR_WIDTHS; w++) {
+        info = &probe->widths[w];
+        if (info->supported &&
+            work_rate(info, fma) >= 1.1 * work_rate(best, fma)) {
+            best = info;
+            probe->preferred_width = kernels[w].bits;
+        }
+    }
+
+    return ICUID_OK;
+}
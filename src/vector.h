@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Independent instructions per iteration of the vector kernels in cc/ */
+#if defined(__x86_64) || defined(__x86_64__) || defined(_M_X64)
+#define VECTOR_LOOP_OPS 12
+#else
+#define VECTOR_LOOP_OPS 6
+#endif
+
+/* Dependent 1 cycle adds per iteration of icuid_loop_scalar */
+#define SCALAR_LOOP_OPS 8
+
+void icuid_loop_scalar(uint32_t n);
+void icuid_loop_int128(uint32_t n);
+void icuid_loop_fma128(uint32_t n);
+void icuid_loop_int256(uint32_t n);
+void icuid_loop_fma256(uint32_t n);
+void icuid_loop_int512(uint32_t n);
+void icuid_loop_fma512(uint32_t n);
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <icuid/icuid.h>
+
+#include "internal.h"
+#include "raw.h"
+#include "xsave.h"
+
+/* Legacy region (x87 and SSE state) plus the XSAVE header */
+#define XSAVE_HEADER_END (512 + 64)
+
+static const struct {
+    uint8_t bit;
+    cpuid_feature_t feature;
+} xsave_features[] = {
+    { 0, CPU_FEATURE_XSAVEOPT },
+    { 1, CPU_FEATURE_XSAVEC   },
+    { 2, CPU_FEATURE_XGETBV1  },
+    { 3, CPU_FEATURE_XSAVES   },
+    { 4, CPU_FEATURE_XFD      },
+};
+
+/* Size of the compacted area XSAVEC stores for |mask| */
+static uint32_t compacted_size(const cpuid_data_t *data, uint64_t mask)
+{
+    const cpuid_xsave_component_t *c;
+    uint32_t size = XSAVE_HEADER_END;
+    uint32_t i;
+
+    /* Components 0 and 1 live in the legacy region */
+    for (i = 2; i < XFEATURE_FLAGS_MAX; i++) {
+        if (!(mask & (1ULL << i)))
+            continue;
+        c = &data->xsave_components[i];
+        if (c->align64)
+            size = (size + 63) & ~63U;
+        size += c->size;
+    }
+
+    return size;
+}
+
+/**
+ * Decodes the XSAVE state components and area sizes of leaf 0xD
+ * Must be called after set_cpuid_features and set_cpuid_xfeatures
+ */
+void set_xsave_info(cpuid_raw_data_t *raw, cpuid_data_t *data)
+{
+    cpuid_xsave_component_t *c;
+    const uint32_t (*regs)[4];
+    const uint32_t *leaf;
+    int osxsave;
+    uint32_t levels, i;
+
+    if (data->cpuid_max_basic < 0xD ||
+        !icuid_flags_test(&data->flags, CPU_FEATURE_XSAVE))
+        return;
+    osxsave = icuid_flags_test(&data->flags, CPU_FEATURE_OSXSAVE);
+
+    leaf = raw_leaf(raw, 0xD);
+    data->xsave_user_mask = ((uint64_t)leaf[edx] << 32) | leaf[eax];
+    data->xsave_max_size = leaf[ecx];
+    /* EBX follows XCR0, which is only meaningful once the OS enabled XSAVE */
+    if (osxsave)
+        data->xsave_size = leaf[ebx];
+
+    /* Older dumps have no subleaves */
+    levels = raw_subleaves(raw, RAW_TABLE_XSAVE);
+    if (levels < 2 || raw->xsave[0][eax] == 0)
+        return;
+    regs = (const uint32_t (*)[4])raw->xsave;
+
+    for (i = 0; i < NELEMS(xsave_features); i++) {
+        if (regs[1][eax] & (1U << xsave_features[i].bit))
+            icuid_flags_set(&data->flags, xsave_features[i].feature);
+    }
+    data->xsave_supervisor_mask = ((uint64_t)regs[1][edx] << 32) | regs[1][ecx];
+
+    /* The legacy region has a fixed layout, subleaf i describes component i */
+    data->xsave_components[XFEATURE_FP].size = 160;
+    data->xsave_components[XFEATURE_SSE].offset = 160;
+    data->xsave_components[XFEATURE_SSE].size = 256;
+    for (i = 2; i < levels; i++) {
+        c = &data->xsave_components[i];
+        c->size = regs[i][eax];
+        c->offset = regs[i][ebx];
+        c->supervisor = (regs[i][ecx] & 0x1) != 0;
+        c->align64 = (regs[i][ecx] & 0x2) != 0;
+        c->xfd = (regs[i][ecx] & 0x4) != 0;
+    }
+
+    if (!osxsave)
+        return;
+    if (icuid_flags_test(&data->flags, CPU_FEATURE_XSAVEC))
+        data->xsavec_size = compacted_size(data, raw_xcr0(raw));
+    if (icuid_flags_test(&data->flags, CPU_FEATURE_XSAVES))
+        data->xsaves_size = regs[1][ebx];
+}
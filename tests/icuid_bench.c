@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Benchmarks the library's hot paths: ns per call and the number of CPUID
+ * instructions each call executes, next to the compiler's own
+ * __builtin_cpu_init()/__builtin_cpu_supports() where available.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <icuid/icuid.h>
+
+#include "../src/match.h"
+
+/* Each benchmark runs for at least this long */
+#define BENCH_NS 20000000.0
+
+typedef void (*bench_fn_t)(void *ctx);
+
+static icuid_clock_t clk;
+static double ticks_per_ns;
+static const char *dump_file;
+static char dump_buf[16384];
+static size_t dump_len;
+static volatile uint64_t sink;
+static int failed;
+
+/* Falls back to timing the TSC against clock() if its frequency is unknown */
+static void calibrate_tsc(void)
+{
+    clock_t start, now;
+    uint64_t begin, end;
+
+    if (clk.frequency != 0) {
+        ticks_per_ns = clk.frequency / 1e9;
+        return;
+    }
+
+    start = clock();
+    while ((now = clock()) == start)
+        ;
+    begin = icuid_clock_begin(&clk);
+    while (clock() - now < CLOCKS_PER_SEC / 10)
+        ;
+    end = icuid_clock_end(&clk);
+    ticks_per_ns = (double)(end - begin) / (1e9 / 10);
+}
+
+static double elapsed_ns(uint64_t begin)
+{
+    return (icuid_clock_end(&clk) - begin) / ticks_per_ns;
+}
+
+/* CPUID instructions that filled |raw|: one per row, XCR0 is xgetbv */
+static uint32_t count_cpuid(const cpuid_raw_data_t *raw)
+{
+    uint32_t i, n = 0;
+
+    if (!raw->lazy)
+        return raw->max_cpuid_level + raw->max_cpuid_ext_level +
+               raw->max_cpuid_hv_level + raw->max_intel_dc_level +
+               raw->max_intel_et_level + raw->max_intel_v2et_level +
+               raw->max_amd_dc_level + raw->max_xsave_level;
+
+    for (i = 0; i < MAX_CPUID_LEVEL; i++)
+        n += (raw->cpuid_fetched[i / 32] >> (i % 32)) & 1;
+    for (i = 0; i < MAX_EXT_CPUID_LEVEL; i++)
+        n += (raw->cpuid_ext_fetched[i / 32] >> (i % 32)) & 1;
+    for (i = 0; i < MAX_HV_CPUID_LEVEL; i++)
+        n += (raw->cpuid_hv_fetched[i / 32] >> (i % 32)) & 1;
+    if (raw->subleaf_fetched)
+        n += raw->max_intel_dc_level + raw->max_intel_et_level +
+             raw->max_intel_v2et_level + raw->max_amd_dc_level +
+             raw->max_xsave_level;
+
+    return n;
+}
+
+/* Runs |fn| for at least BENCH_NS and prints the time per call */
+static void bench(const char *name, bench_fn_t fn, void *ctx, long cpuids)
+{
+    uint64_t begin;
+    uint32_t n = 1, i;
+    double ns;
+
+    fn(ctx); /* warm up */
+    for (;;) {
+        begin = icuid_clock_begin(&clk);
+        for (i = 0; i < n; i++)
+            fn(ctx);
+        ns = elapsed_ns(begin);
+        if (ns >= BENCH_NS || n >= (1U << 30))
+            break;
+        n *= 2;
+    }
+
+    if (cpuids < 0)
+        printf("%-36s %12.1f %8s\n", name, ns / n, "-");
+    else
+        printf("%-36s %12.1f %8ld\n", name, ns / n, cpuids);
+}
+
+static void bench_raw(void *ctx)
+{
+    if (cpuid_get_raw_data((cpuid_raw_data_t *)ctx) != ICUID_OK)
+        failed = 1;
+}
+
+static void bench_lazy_identify(void *ctx)
+{
+    cpuid_raw_data_t raw;
+
+    if (cpuid_get_raw_data_lazy(&raw) != ICUID_OK ||
+        icuid_identify(&raw, (cpuid_data_t *)ctx) != ICUID_OK)
+        failed = 1;
+}
+
+static void bench_identify(void *ctx)
+{
+    cpuid_raw_data_t raw;
+    cpuid_data_t data;
+
+    /* icuid_identify() may fetch into a lazy raw, work on a copy */
+    memcpy(&raw, ctx, sizeof(raw));
+    if (icuid_identify(&raw, &data) != ICUID_OK)
+        failed = 1;
+}
+
+static void bench_copy(void *ctx)
+{
+    cpuid_raw_data_t raw;
+
+    memcpy(&raw, ctx, sizeof(raw));
+    sink += raw.max_cpuid_level;
+}
+
+static void bench_parse(void *ctx)
+{
+    if (cpuid_serialize_raw_data((cpuid_raw_data_t *)ctx, dump_file) != ICUID_OK)
+        failed = 1;
+}
+
+static void bench_parse_buffer(void *ctx)
+{
+    if (icuid_parse_raw_buffer(dump_buf, dump_len, (cpuid_raw_data_t *)ctx) != ICUID_OK)
+        failed = 1;
+}
+
+static void bench_codename(void *ctx)
+{
+    cpuid_data_t *data = ctx;
+
+    if (data->vendor == VENDOR_AMD)
+        cpu_to_codename(data, amd_codename);
+    else
+        cpu_to_codename(data, intel_codename);
+    sink += (uint64_t)(size_t)data->codename;
+}
+
+static void bench_feature_str(void *ctx)
+{
+    uint32_t i;
+
+    (void)ctx;
+    for (i = 0; i < NUM_CPU_FEATURES; i++)
+        sink += (uint64_t)(size_t)cpu_feature_str((cpuid_feature_t)i);
+}
+
+static void bench_feature_from_str(void *ctx)
+{
+    (void)ctx;
+    sink += (uint64_t)cpu_feature_from_str("avx512_vnni");
+}
+
+static void bench_has(void *ctx)
+{
+    (void)ctx;
+    sink += icuid_has(CPU_FEATURE_AVX2);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_BUILTIN_CPU
+
+static void bench_builtin_supports(void *ctx)
+{
+    (void)ctx;
+    sink += __builtin_cpu_supports("avx2");
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    cpuid_raw_data_t raw, lazy_raw;
+    cpuid_data_t data;
+    uint64_t begin;
+    double first_get;
+    FILE *fp;
+#ifdef HAVE_BUILTIN_CPU
+    double first_init;
+#endif
+    int ret;
+
+    if (argc > 1)
+        dump_file = argv[1];
+
+    ret = icuid_clock_init(&clk, NULL);
+    if (ret == ICUID_ERROR_NO_TSC) {
+        printf("Skipped: %s\n", icuid_errorstr(ret));
+        return 0;
+    }
+    calibrate_tsc();
+
+    /*
+     * Startup costs, once per process. icuid_clock_init() above already
+     * ran icuid_get(), so time the lazy identification it runs instead.
+     * libgcc may have run __builtin_cpu_init() from a constructor.
+     */
+    begin = icuid_clock_begin(&clk);
+    ret = cpuid_get_raw_data_lazy(&lazy_raw);
+    if (ret == ICUID_OK)
+        ret = icuid_identify(&lazy_raw, &data);
+    first_get = elapsed_ns(begin);
+    if (ret != ICUID_OK) {
+        printf("%s\n", icuid_errorstr(ret));
+        return 1;
+    }
+#ifdef HAVE_BUILTIN_CPU
+    begin = icuid_clock_begin(&clk);
+    __builtin_cpu_init();
+    first_init = elapsed_ns(begin);
+#endif
+
+    printf("%-36s %12s %8s\n", "Startup", "ns", "cpuid");
+    printf("%-36s %12.1f %8u\n", "icuid_get() initialization", first_get,
+           count_cpuid(&lazy_raw));
+#ifdef HAVE_BUILTIN_CPU
+    printf("%-36s %12.1f %8s\n", "__builtin_cpu_init()", first_init, "-");
+#endif
+
+    printf("\n%-36s %12s %8s\n", "Per call", "ns/op", "cpuid");
+    ret = cpuid_get_raw_data(&raw);
+    if (ret != ICUID_OK) {
+        printf("%s\n", icuid_errorstr(ret));
+        return 1;
+    }
+    bench("cpuid_get_raw_data()", bench_raw, &raw, count_cpuid(&raw));
+    bench("lazy raw data + icuid_identify()", bench_lazy_identify, &data,
+          count_cpuid(&lazy_raw));
+    bench("icuid_identify(), prefilled raw", bench_identify, &raw, 0);
+    bench("  of which copying the raw data", bench_copy, &raw, 0);
+    if (dump_file != NULL) {
+        bench("parse text dump", bench_parse, &raw, 0);
+        fp = fopen(dump_file, "rb");
+        if (fp != NULL) {
+            dump_len = fread(dump_buf, 1, sizeof(dump_buf), fp);
+            fclose(fp);
+            bench("parse text dump from memory", bench_parse_buffer, &raw, 0);
+        }
+    }
+    bench("cpu_to_codename()", bench_codename, &data, 0);
+    bench("cpu_feature_str(), every feature", bench_feature_str, NULL, 0);
+    bench("cpu_feature_from_str()", bench_feature_from_str, NULL, 0);
+    bench("icuid_has()", bench_has, NULL, 0);
+#ifdef HAVE_BUILTIN_CPU
+    bench("__builtin_cpu_supports()", bench_builtin_supports, NULL, 0);
+#endif
+
+    return failed;
+}
@@ -22,6 +22,9 @@
 
 #include <icuid/icuid.h>
 
+#include "../src/affinity.h"
+#include "../src/hex.h"
+
 #define _eprintf(format, ...) fprintf(stdout, format, __VA_ARGS__)
 
 int generate_test(cpuid_raw_data_t *raw, cpuid_data_t *data, const char *file)
@@ -69,9 +72,14 @@ int generate_test(cpuid_raw_data_t *raw, cpuid_data_t *data, const char *file)
     fprintf(fp, "l4_linesz=%u\n", data->l4_cacheline);
     fprintf(fp, "physical_addrsz=%u\n", data->physical_address_bits);
     fprintf(fp, "virtual_addrsz=%u\n", data->virtual_address_bits);
+    fprintf(fp, "x86_64_level=%u\n", data->x86_64_level);
+    fprintf(fp, "base_mhz=%u\n", data->base_frequency);
+    fprintf(fp, "tsc_khz=%u\n", (uint32_t)(data->tsc_frequency / 1000));
+    fprintf(fp, "xsave_size=%u\n", data->xsave_size);
+    fprintf(fp, "xsavec_size=%u\n", data->xsavec_size);
     fprintf(fp, "features=");
     for (i = 0; i < NUM_CPU_FEATURES; i++) {
-        if (data->flags[i]) {
+        if (icuid_flags_test(&data->flags, i)) {
             if (i != 0)
                 fprintf(fp, " %s", cpu_feature_str(i));
             else
@@ -157,12 +165,74 @@ err:
 
 #define BUF_SIZE 4096
 
-int run_test(cpuid_data_t *data, const char *file)
+/*
+ * Identifies a system of CPUs like the one |raw| was collected on, with
+ * the APIC IDs listed in |apic_ids| as "0-5 8-13 ...", and checks that its
+ * L3 is split into |instances| caches shared by |sharing| CPUs each.
+ */
+static int check_l3_domains(cpuid_raw_data_t *raw, char *apic_ids,
+                            uint32_t instances, uint32_t sharing)
+{
+    cpuid_system_raw_t sys;
+    cpuid_system_data_t data;
+    unsigned long first, last;
+    uint32_t i, found = 0;
+    char *p = apic_ids, *end;
+    int ret = -1;
+
+    memset(&sys, 0, sizeof(sys));
+    sys.cpus = calloc(MAX_LOGICAL_CPUS, sizeof(*sys.cpus));
+    if (sys.cpus == NULL)
+        return ICUID_ERROR_MEMORY;
+    for (;;) {
+        first = strtoul(p, &end, 10);
+        if (end == p)
+            break;
+        last = first;
+        if (*end == '-')
+            last = strtoul(end + 1, &end, 10);
+        for (; first <= last && sys.num_cpus < MAX_LOGICAL_CPUS; first++) {
+            sys.cpus[sys.num_cpus].cpu = sys.num_cpus;
+            sys.cpus[sys.num_cpus].apic_id = (uint32_t)first;
+            sys.cpus[sys.num_cpus++].raw = *raw;
+        }
+        p = end;
+    }
+
+    ret = icuid_identify_system(&sys, &data);
+    if (ret != ICUID_OK) {
+        cpuid_free_system_raw_data(&sys);
+        return ret;
+    }
+    for (i = 0; i < data.num_caches; i++) {
+        if (data.caches[i].level != 3)
+            continue;
+        found++;
+        if (data.caches[i].logical_cpus != sharing) {
+            _eprintf("ERROR: got '%u' instead of '%u' CPUs sharing an L3\n",
+                     data.caches[i].logical_cpus, sharing);
+            ret = -1;
+        }
+    }
+    if (found != instances) {
+        _eprintf("ERROR: got '%u' instead of '%u' L3 instances\n", found,
+                 instances);
+        ret = -1;
+    }
+    icuid_free_system_data(&data);
+    cpuid_free_system_raw_data(&sys);
+
+    return ret;
+}
+
+int run_test(cpuid_raw_data_t *raw, cpuid_data_t *data, const char *file)
 {
     FILE *fp;
     char line[BUF_SIZE];
     char tmp_features[BUF_SIZE];
+    char apic_ids[BUF_SIZE] = "";
     unsigned int i, errors = 0;
+    uint32_t l3_instances = 0, l3_sharing = 0;
 
     fp = fopen(file, "rt");
     if (fp == NULL)
@@ -171,7 +241,7 @@ int run_test(cpuid_data_t *data, const char *file)
     /* Convert features to string */
     tmp_features[0] = '\0';
     for (i = 0; i < NUM_CPU_FEATURES; i++) {
-        if (data->flags[i]) {
+        if (icuid_flags_test(&data->flags, i)) {
             strcat(tmp_features, cpu_feature_str(i));
             strcat(tmp_features, " ");
         }
@@ -179,6 +249,19 @@ int run_test(cpuid_data_t *data, const char *file)
     tmp_features[strlen(tmp_features) - 1] = '\0';
 
     while (fgets(line, sizeof(line), fp)) {
+        /* The machine's CPUs and L3 caches, checked once all are read */
+        if (strncmp(line, "apic_ids=", 9) == 0) {
+            strcpy(apic_ids, line + 9);
+            continue;
+        }
+        if (strncmp(line, "l3_instances=", 13) == 0) {
+            l3_instances = (uint32_t)strtoul(line + 13, NULL, 10);
+            continue;
+        }
+        if (strncmp(line, "l3_sharing=", 11) == 0) {
+            l3_sharing = (uint32_t)strtoul(line + 11, NULL, 10);
+            continue;
+        }
         /* Check vendor name */
         if (!icuid_compare_string(line, "vendor_str", data->vendor_str)) {
             errors++;
@@ -319,6 +402,30 @@ int run_test(cpuid_data_t *data, const char *file)
             errors++;
             continue;
         }
+        /* Check x86-64 microarchitecture level */
+        if (!icuid_compare_uint(line, "x86_64_level", data->x86_64_level)) {
+            errors++;
+            continue;
+        }
+        /* Check base and TSC frequencies */
+        if (!icuid_compare_uint(line, "base_mhz", data->base_frequency)) {
+            errors++;
+            continue;
+        }
+        if (!icuid_compare_uint(line, "tsc_khz",
+                                (uint32_t)(data->tsc_frequency / 1000))) {
+            errors++;
+            continue;
+        }
+        /* Check XSAVE area sizes */
+        if (!icuid_compare_uint(line, "xsave_size", data->xsave_size)) {
+            errors++;
+            continue;
+        }
+        if (!icuid_compare_uint(line, "xsavec_size", data->xsavec_size)) {
+            errors++;
+            continue;
+        }
         /* Check CPU features */
         if (!icuid_compare_string(line, "features", tmp_features)) {
             errors++;
@@ -327,14 +434,984 @@ int run_test(cpuid_data_t *data, const char *file)
     }
     fclose(fp);
 
+    if (apic_ids[0] != '\0' &&
+        check_l3_domains(raw, apic_ids, l3_instances, l3_sharing) != ICUID_OK)
+        errors++;
+
     return errors;
 }
 
+int check_lazy(void)
+{
+    int ret;
+    cpuid_raw_data_t raw, lazy_raw;
+    cpuid_data_t data, lazy_data;
+
+    ret = cpuid_get_raw_data(&raw);
+    if (ret != ICUID_OK)
+        return ret;
+    ret = icuid_identify(&raw, &data);
+    if (ret != ICUID_OK)
+        return ret;
+
+    ret = cpuid_get_raw_data_lazy(&lazy_raw);
+    if (ret != ICUID_OK)
+        return ret;
+    ret = icuid_identify(&lazy_raw, &lazy_data);
+    if (ret != ICUID_OK)
+        return ret;
+
+    if (memcmp(&data, &lazy_data, sizeof(data)) != 0) {
+        _eprintf("ERROR: %s\n", "lazy identification differs from eager");
+        return -1;
+    }
+
+    ret = cpuid_materialize_raw_data(&lazy_raw);
+    if (ret != ICUID_OK)
+        return ret;
+    if (lazy_raw.lazy ||
+        lazy_raw.max_intel_dc_level != raw.max_intel_dc_level ||
+        lazy_raw.max_intel_et_level != raw.max_intel_et_level ||
+        lazy_raw.max_intel_v2et_level != raw.max_intel_v2et_level ||
+        lazy_raw.max_amd_dc_level != raw.max_amd_dc_level ||
+        lazy_raw.max_xsave_level != raw.max_xsave_level ||
+        lazy_raw.max_cpuid_hv_level != raw.max_cpuid_hv_level) {
+        _eprintf("ERROR: %s\n", "materialized raw data differs from eager");
+        return -1;
+    }
+
+    return 0;
+}
+
+int check_cached(void)
+{
+    int i, ret;
+    const cpuid_data_t *cached;
+    cpuid_data_t data;
+
+    ret = icuid_identify(NULL, &data);
+    if (ret != ICUID_OK)
+        return ret;
+
+    cached = icuid_get();
+    if (cached != icuid_get() || memcmp(cached, &data, sizeof(data)) != 0) {
+        _eprintf("ERROR: %s\n", "cached identification differs");
+        return -1;
+    }
+
+    for (i = 0; i < NUM_CPU_FEATURES; i++) {
+        if (!icuid_has(i) != !icuid_flags_test(&data.flags, i)) {
+            _eprintf("ERROR: icuid_has(%s) differs\n", cpu_feature_str(i));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Finds the identification of logical CPU |cpu| */
+static const cpuid_cpu_data_t *find_cpu(const cpuid_system_data_t *data,
+                                        uint32_t cpu)
+{
+    uint32_t i;
+
+    for (i = 0; i < data->num_cpus; i++) {
+        if (data->cpus[i].cpu == cpu)
+            return &data->cpus[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Checks that every affinity plan uses each CPU once and wraps around, and
+ * that the spreading ones use every core before a second thread of any core.
+ */
+static int check_plan(const cpuid_system_data_t *data, uint32_t cores)
+{
+    int ret;
+    uint32_t policy, i, j, n = data->num_cpus;
+    uint32_t *cpus;
+    const cpuid_cpu_data_t *ci, *cj;
+    cpuid_cpuset_t seen;
+
+    cpus = malloc(2 * n * sizeof(*cpus));
+    if (cpus == NULL)
+        return -1;
+
+    ret = -1;
+    for (policy = 0; policy < NUM_AFFINITY_POLICIES; policy++) {
+        if (icuid_plan_affinity(data, (cpuid_affinity_policy_t)policy, cpus,
+                                2 * n) != ICUID_OK) {
+            _eprintf("ERROR: affinity policy %u failed\n", policy);
+            goto out;
+        }
+        memset(&seen, 0, sizeof(seen));
+        for (i = 0; i < n; i++) {
+            ci = find_cpu(data, cpus[i]);
+            if (ci == NULL || icuid_cpuset_test(&seen, cpus[i]) ||
+                cpus[n + i] != cpus[i]) {
+                _eprintf("ERROR: bogus affinity plan %u\n", policy);
+                goto out;
+            }
+            icuid_cpuset_set(&seen, cpus[i]);
+            if (policy == ICUID_AFFINITY_COMPACT_LLC || i >= cores)
+                continue;
+            for (j = 0; j < i; j++) {
+                cj = find_cpu(data, cpus[j]);
+                if (memcmp(&ci->topo_id[TOPO_LEVEL_CORE],
+                           &cj->topo_id[TOPO_LEVEL_CORE],
+                           sizeof(ci->topo_id) -
+                           TOPO_LEVEL_CORE * sizeof(ci->topo_id[0])) == 0) {
+                    _eprintf("ERROR: affinity plan %u reuses a core\n",
+                             policy);
+                    goto out;
+                }
+            }
+        }
+    }
+    if (icuid_plan_affinity(data, NUM_AFFINITY_POLICIES, cpus, n) !=
+        ICUID_ERROR_INVALID) {
+        _eprintf("ERROR: %s\n", "invalid affinity policy accepted");
+        goto out;
+    }
+    ret = 0;
+
+out:
+    free(cpus);
+    return ret;
+}
+
+/*
+ * Plans a synthetic hybrid system with the exact CPU order each policy must
+ * give. LLC 0 has the P-cores at APIC IDs 0 and 2, LLC 1 the E-cores at 4
+ * and 6 and the P-core at 8. P-cores have two threads, and the OS numbers
+ * the first thread of every P-core before the second ones.
+ */
+int check_affinity(void)
+{
+    static const struct {
+        uint32_t apic_id, core, smt, llc;
+        cpu_core_type_t type;
+    } layout[] = {
+        { 0, 0, 0, 0, CORE_TYPE_CORE }, { 2, 1, 0, 0, CORE_TYPE_CORE },
+        { 8, 4, 0, 1, CORE_TYPE_CORE }, { 1, 0, 1, 0, CORE_TYPE_CORE },
+        { 3, 1, 1, 0, CORE_TYPE_CORE }, { 9, 4, 1, 1, CORE_TYPE_CORE },
+        { 4, 2, 0, 1, CORE_TYPE_ATOM }, { 6, 3, 0, 1, CORE_TYPE_ATOM },
+    };
+    static const uint32_t expected[NUM_AFFINITY_POLICIES][8] = {
+        { 0, 6, 1, 7, 2, 3, 4, 5 },     /* ICUID_AFFINITY_SPREAD_LLC */
+        { 0, 1, 3, 4, 6, 7, 2, 5 },     /* ICUID_AFFINITY_COMPACT_LLC */
+        { 0, 1, 6, 7, 2, 3, 4, 5 },     /* ICUID_AFFINITY_PHYSICAL_CORES */
+        { 0, 1, 2, 6, 7, 3, 4, 5 },     /* ICUID_AFFINITY_PCORES_FIRST */
+    };
+    /* Without CPU 0, its sibling becomes the first thread of core 0 */
+    static const uint32_t physical_no_cpu0[7] = { 3, 1, 6, 7, 2, 4, 5 };
+    cpuid_cpu_data_t cpus[8];
+    cpuid_cache_domain_t caches[7];
+    cpuid_system_data_t data;
+    cpuid_cpuset_t allowed;
+    uint32_t plan[8], policy, i, n = 8;
+
+    memset(cpus, 0, sizeof(cpus));
+    memset(caches, 0, sizeof(caches));
+    memset(&data, 0, sizeof(data));
+    memset(&allowed, 0, sizeof(allowed));
+
+    /* One L2 per core ahead of the two L3s, the planner must pick the L3 */
+    for (i = 0; i < 5; i++) {
+        caches[i].level = 2;
+        caches[i].type = CACHE_TYPE_UNIFIED;
+    }
+    for (i = 5; i < 7; i++) {
+        caches[i].level = 3;
+        caches[i].type = CACHE_TYPE_UNIFIED;
+    }
+    for (i = 0; i < n; i++) {
+        cpus[i].cpu = i;
+        cpus[i].apic_id = layout[i].apic_id;
+        cpus[i].core_type = layout[i].type;
+        cpus[i].topo_id[TOPO_LEVEL_SMT] = layout[i].smt;
+        cpus[i].topo_id[TOPO_LEVEL_CORE] = layout[i].core;
+        icuid_cpuset_set(&caches[layout[i].core].cpus, i);
+        icuid_cpuset_set(&caches[5 + layout[i].llc].cpus, i);
+        icuid_cpuset_set(&allowed, i);
+    }
+    data.num_cpus = n;
+    data.cpus = cpus;
+    data.num_caches = 7;
+    data.caches = caches;
+
+    for (policy = 0; policy < NUM_AFFINITY_POLICIES; policy++) {
+        if (affinity_plan(&data, &allowed, (cpuid_affinity_policy_t)policy,
+                          plan, n) != ICUID_OK) {
+            _eprintf("ERROR: affinity policy %u failed\n", policy);
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            if (plan[i] != expected[policy][i]) {
+                _eprintf("ERROR: affinity plan %u puts CPU %u at %u, "
+                         "expected %u\n", policy, plan[i], i,
+                         expected[policy][i]);
+                return -1;
+            }
+        }
+    }
+
+    allowed.words[0] &= ~(uint64_t)1;
+    if (affinity_plan(&data, &allowed, ICUID_AFFINITY_PHYSICAL_CORES, plan,
+                      n - 1) != ICUID_OK ||
+        memcmp(plan, physical_no_cpu0, sizeof(physical_no_cpu0)) != 0) {
+        _eprintf("ERROR: %s\n", "affinity plan uses a disallowed CPU");
+        return -1;
+    }
+
+    return 0;
+}
+
+int check_system(void)
+{
+    int ret;
+    uint32_t i, j, logical = 0, cores = 0;
+    cpuid_raw_data_t raw;
+    cpuid_system_raw_t sys;
+    cpuid_system_data_t data;
+
+    ret = cpuid_get_raw_data(&raw);
+    if (ret != ICUID_OK)
+        return ret;
+    ret = cpuid_get_system_raw_data(&sys, ICUID_ENUM_THREADS);
+    if (ret != ICUID_OK) {
+        _eprintf("%s\n", icuid_errorstr(ret));
+        return ret;
+    }
+
+    ret = -1;
+    if (sys.num_cpus == 0) {
+        _eprintf("ERROR: %s\n", "no logical CPUs");
+        goto out;
+    }
+    for (i = 0; i < sys.num_cpus; i++) {
+        if (memcmp(sys.cpus[i].raw.cpuid[0], raw.cpuid[0],
+                   sizeof(raw.cpuid[0])) != 0) {
+            _eprintf("ERROR: leaf 0 of CPU %u differs\n", sys.cpus[i].cpu);
+            goto out;
+        }
+        for (j = 0; j < i; j++) {
+            if (sys.cpus[j].cpu >= sys.cpus[i].cpu ||
+                sys.cpus[j].apic_id == sys.cpus[i].apic_id) {
+                _eprintf("ERROR: CPU %u is not unique\n", sys.cpus[i].cpu);
+                goto out;
+            }
+        }
+    }
+    for (i = 0; i < sys.num_diffs; i++) {
+        if (sys.diffs[i].num_cpus == 0 || sys.diffs[i].mask == 0 ||
+            sys.diffs[i].first_cpu == 0) {
+            _eprintf("ERROR: %s\n", "bogus diff");
+            goto out;
+        }
+    }
+
+    ret = icuid_identify_system(&sys, &data);
+    if (ret != ICUID_OK) {
+        _eprintf("%s\n", icuid_errorstr(ret));
+        goto out;
+    }
+    ret = -1;
+    for (i = 0; i < data.num_cpus; i++) {
+        j = data.cpus[i].core_type_index;
+        if (j >= data.num_core_types ||
+            !icuid_cpuset_test(&data.core_types[j].cpus, data.cpus[i].cpu) ||
+            data.core_types[j].core_type != data.cpus[i].core_type) {
+            _eprintf("ERROR: CPU %u is in the wrong core type\n",
+                     data.cpus[i].cpu);
+            goto free_data;
+        }
+    }
+    for (i = 0; i < data.num_core_types; i++) {
+        if (data.core_types[i].cores == 0 ||
+            data.core_types[i].cores > data.core_types[i].logical_cpus) {
+            _eprintf("ERROR: %s\n", "bogus core count");
+            goto free_data;
+        }
+        logical += data.core_types[i].logical_cpus;
+        cores += data.core_types[i].cores;
+    }
+    if (logical != data.num_cpus) {
+        _eprintf("ERROR: %s\n", "core types don't cover every CPU");
+        goto free_data;
+    }
+    if (data.topo_count[TOPO_LEVEL_SMT] != data.num_cpus ||
+        data.topo_count[TOPO_LEVEL_CORE] != cores) {
+        _eprintf("ERROR: %s\n", "topology doesn't match the core types");
+        goto free_data;
+    }
+    for (i = 0; i < data.num_caches; i++) {
+        logical = 0;
+        for (j = icuid_cpuset_next(&data.caches[i].cpus, 0);
+             j < MAX_LOGICAL_CPUS;
+             j = icuid_cpuset_next(&data.caches[i].cpus, j + 1))
+            logical++;
+        if (logical == 0 || logical != data.caches[i].logical_cpus) {
+            _eprintf("ERROR: %s\n", "bogus cache domain");
+            goto free_data;
+        }
+        for (j = 0; j < i; j++) {
+            if (data.caches[j].level == data.caches[i].level &&
+                data.caches[j].type == data.caches[i].type &&
+                icuid_cpuset_next(&data.caches[j].cpus, 0) >=
+                icuid_cpuset_next(&data.caches[i].cpus, 0)) {
+                _eprintf("ERROR: %s\n", "cache domains overlap");
+                goto free_data;
+            }
+        }
+    }
+    for (i = TOPO_LEVEL_CORE; i < NUM_TOPO_LEVELS; i++) {
+        if (data.topo_count[i] == 0 ||
+            data.topo_count[i] > data.topo_count[i - 1]) {
+            _eprintf("ERROR: %s\n", "bogus topology");
+            goto free_data;
+        }
+    }
+    ret = check_plan(&data, cores);
+
+free_data:
+    icuid_free_system_data(&data);
+out:
+    cpuid_free_system_raw_data(&sys);
+    return ret;
+}
+
+int check_clock(void)
+{
+    int ret;
+    uint32_t i;
+    uint64_t begin, end, prev = 0;
+    icuid_clock_t clock;
+    cpuid_data_t data;
+
+    /* The read method follows the vendor and features */
+    memset(&data, 0, sizeof(data));
+    icuid_flags_set(&data.flags, CPU_FEATURE_TSC);
+    icuid_flags_set(&data.flags, CPU_FEATURE_SSE2);
+    data.vendor = VENDOR_AMD;
+    data.ext_family = 0x15;
+    data.tsc_frequency = 3000000000U;
+    if (icuid_clock_init(&clock, &data) != ICUID_OK ||
+        clock.method != TSC_READ_MFENCE || clock.stable) {
+        _eprintf("ERROR: %s\n", "wrong clock for AMD family 0x15");
+        return -1;
+    }
+    data.ext_family = 0x17;
+    icuid_flags_set(&data.flags, CPU_FEATURE_CONSTANT_TSC);
+    if (icuid_clock_init(&clock, &data) != ICUID_OK ||
+        clock.method != TSC_READ_LFENCE || !clock.stable) {
+        _eprintf("ERROR: %s\n", "wrong clock for AMD family 0x17");
+        return -1;
+    }
+    if (icuid_clock_ns(&clock, 3000000000U) != 1000000000U ||
+        icuid_clock_ns(&clock, (uint64_t)3000000000U << 32) !=
+        (uint64_t)1000000000U << 32) {
+        _eprintf("ERROR: %s\n", "wrong cycles to ns conversion");
+        return -1;
+    }
+    icuid_flags_set(&data.flags, CPU_FEATURE_RDTSCP);
+    if (icuid_clock_init(&clock, &data) != ICUID_OK ||
+        clock.method != TSC_READ_RDTSCP) {
+        _eprintf("ERROR: %s\n", "rdtscp not preferred");
+        return -1;
+    }
+
+    /* The TSC of this CPU never goes backwards */
+    ret = icuid_clock_init(&clock, NULL);
+    if (ret != ICUID_OK)
+        return icuid_has(CPU_FEATURE_TSC) ? ret : 0;
+    for (i = 0; i < 1000; i++) {
+        begin = icuid_clock_begin(&clock);
+        end = icuid_clock_end(&clock);
+        if (begin < prev || end < begin) {
+            _eprintf("ERROR: %s\n", "TSC went backwards");
+            return -1;
+        }
+        prev = end;
+    }
+
+    return 0;
+}
+
+/*
+ * Checks the flag set operations on the bits next to the 32 and 64-bit word
+ * boundaries and on the last two features, which are in the last word.
+ */
+int check_flags(void)
+{
+    static const int bits[] = {
+        0, 31, 32, 63, 64, NUM_CPU_FEATURES - 2, NUM_CPU_FEATURES - 1
+    };
+    const int nbits = (int)(sizeof(bits) / sizeof(bits[0]));
+    cpuid_flags_t all, one, none, some, got, want;
+    int i, f;
+
+    memset(&all, 0, sizeof(all));
+    memset(&none, 0, sizeof(none));
+    for (i = 0; i < nbits; i++)
+        icuid_flags_set(&all, (cpuid_feature_t)bits[i]);
+
+    /* icuid_flags_next() visits exactly the set bits, in order */
+    for (i = 0, f = icuid_flags_next(&all, 0); f < NUM_CPU_FEATURES;
+         i++, f = icuid_flags_next(&all, f + 1)) {
+        if (i >= nbits || f != bits[i] ||
+            icuid_flags_next(&all, bits[i]) != bits[i]) {
+            _eprintf("ERROR: icuid_flags_next() returned %d\n", f);
+            return -1;
+        }
+    }
+    if (i != nbits || icuid_flags_next(&all, NUM_CPU_FEATURES) !=
+        NUM_CPU_FEATURES || icuid_flags_next(&none, 0) != NUM_CPU_FEATURES) {
+        _eprintf("ERROR: %s\n", "icuid_flags_next() missed the end");
+        return -1;
+    }
+
+    /* Every bit is a subset of the set, and the set without it is not */
+    if (!icuid_flags_subset(&none, &none) || !icuid_flags_subset(&all, &all) ||
+        icuid_flags_subset(&all, &none)) {
+        _eprintf("ERROR: %s\n", "wrong icuid_flags_subset()");
+        return -1;
+    }
+    for (i = 0; i < nbits; i++) {
+        memset(&one, 0, sizeof(one));
+        icuid_flags_set(&one, (cpuid_feature_t)bits[i]);
+        some = all;
+        icuid_flags_clear(&some, (cpuid_feature_t)bits[i]);
+        if (!icuid_flags_subset(&one, &all) ||
+            icuid_flags_subset(&one, &some) ||
+            icuid_flags_subset(&all, &some) ||
+            !icuid_flags_subset(&some, &all)) {
+            _eprintf("ERROR: icuid_flags_subset() wrong for bit %d\n",
+                     bits[i]);
+            return -1;
+        }
+    }
+
+    /* Split the set on every other bit, plus one bit only |some| has */
+    memset(&some, 0, sizeof(some));
+    for (i = 1; i < nbits; i += 2)
+        icuid_flags_set(&some, (cpuid_feature_t)bits[i]);
+    icuid_flags_set(&some, (cpuid_feature_t)33);
+
+    memset(&want, 0, sizeof(want));
+    for (i = 1; i < nbits; i += 2)
+        icuid_flags_set(&want, (cpuid_feature_t)bits[i]);
+    icuid_flags_and(&got, &all, &some);
+    if (memcmp(&got, &want, sizeof(got)) != 0) {
+        _eprintf("ERROR: %s\n", "wrong icuid_flags_and()");
+        return -1;
+    }
+
+    memset(&want, 0, sizeof(want));
+    for (i = 0; i < nbits; i += 2)
+        icuid_flags_set(&want, (cpuid_feature_t)bits[i]);
+    icuid_flags_andnot(&got, &all, &some);
+    if (memcmp(&got, &want, sizeof(got)) != 0) {
+        _eprintf("ERROR: %s\n", "wrong icuid_flags_andnot()");
+        return -1;
+    }
+
+    return 0;
+}
+
+int check_vector(void)
+{
+    int ret, w;
+    cpuid_vector_probe_t probe;
+
+    /* Only runs the kernels the CPU and OS support */
+    ret = icuid_probe_vector_width(&probe, NULL);
+    if (ret != ICUID_OK)
+        return icuid_has(CPU_FEATURE_TSC) ? ret : 0;
+    for (w = 0; w < NUM_VECTOR_WIDTHS; w++) {
+        if (probe.widths[w].supported &&
+            (probe.widths[w].int_per_cycle <= 0 ||
+             probe.widths[w].frequency_ratio <= 0)) {
+            _eprintf("ERROR: %s\n", "vector width not measured");
+            return -1;
+        }
+    }
+    w = probe.preferred_width == 512 ? VECTOR_WIDTH_512 :
+        probe.preferred_width == 256 ? VECTOR_WIDTH_256 : VECTOR_WIDTH_128;
+    if (probe.preferred_width != 128U << w || !probe.widths[w].supported) {
+        _eprintf("ERROR: %s\n", "unsupported preferred vector width");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Every hex decoder the CPU can run agrees on valid and malformed lines */
+static int check_hex_decoders(void)
+{
+    static const char *lines[] = {
+        "0000000D 756E6547 6C65746E 49656E69",
+        "0000000d 756e6547 6c65746e 49656e69",
+        "ffffffff 00000000 AbCdEf01 23456789",
+    };
+    static const uint32_t expected[][4] = {
+        { 0xD, 0x756E6547, 0x6C65746E, 0x49656E69 },
+        { 0xD, 0x756E6547, 0x6C65746E, 0x49656E69 },
+        { 0xFFFFFFFF, 0, 0xABCDEF01, 0x23456789 },
+    };
+    static const char bad[] = { 'g', 'G', '/', ':', '@', '`', ' ', 'x',
+                                '\t', (char)0x80, (char)0xE6 };
+    hex_decoder_t decoders[HEX_MAX_DECODERS];
+    unsigned int num, d, i, j, k;
+    char line[HEX_REGS_LEN + 1];
+    uint32_t regs[4];
+
+    num = hex_get_decoders(decoders);
+    for (d = 0; d < num; d++) {
+        for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+            if (!decoders[d](lines[i], regs) ||
+                memcmp(regs, expected[i], sizeof(regs)) != 0) {
+                _eprintf("ERROR: decoder %u misparsed '%s'\n", d, lines[i]);
+                return -1;
+            }
+            /* Any byte out of place, digit or separator, is rejected */
+            for (j = 0; j < HEX_REGS_LEN; j++) {
+                for (k = 0; k < sizeof(bad); k++) {
+                    strcpy(line, lines[i]);
+                    if (line[j] == ' ' && bad[k] == ' ')
+                        line[j] = '0';
+                    else
+                        line[j] = bad[k];
+                    if (decoders[d](line, regs)) {
+                        _eprintf("ERROR: decoder %u accepted byte %u of "
+                                 "'%s' as 0x%02X\n", d, j, lines[i],
+                                 (unsigned char)line[j]);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Parsing from memory matches parsing the file */
+int check_parse(const char *file)
+{
+    static char buf[16384];
+    cpuid_raw_data_t raw, mem_raw;
+    size_t len;
+    FILE *fp;
+    int ret;
+
+    ret = cpuid_serialize_raw_data(&raw, file);
+    if (ret != ICUID_OK)
+        return ret;
+    fp = fopen(file, "rb");
+    if (fp == NULL)
+        return ICUID_ERROR_OPEN;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+
+    ret = icuid_parse_raw_buffer(buf, len, &mem_raw);
+    if (ret != ICUID_OK)
+        return ret;
+    if (memcmp(&raw, &mem_raw, sizeof(raw)) != 0) {
+        _eprintf("ERROR: %s\n", "buffer and file parsing differ");
+        return -1;
+    }
+
+    if (icuid_parse_raw_buffer("cpuid[0]=", 9, &mem_raw) != ICUID_ERROR_PARSING ||
+        icuid_parse_raw_buffer("cpuid[99]=0", 11, &mem_raw) != ICUID_ERROR_PARSING ||
+        icuid_parse_raw_buffer("cpuid[0]=100000000", 18, &mem_raw) != ICUID_ERROR_PARSING) {
+        _eprintf("ERROR: %s\n", "malformed line accepted");
+        return -1;
+    }
+
+    /* Fixed width lines take a faster path than the others */
+    if (icuid_parse_raw_buffer("cpuid[0]=0000000D 756E6547 6C65746E 49656E69",
+                               44, &mem_raw) != ICUID_OK ||
+        mem_raw.cpuid[0][0] != 0xD || mem_raw.cpuid[0][3] != 0x49656E69 ||
+        icuid_parse_raw_buffer("cpuid[0]=0000000d 756e6547 6c65746e 049656e69",
+                               45, &mem_raw) != ICUID_OK ||
+        mem_raw.cpuid[0][3] != 0x49656E69 ||
+        icuid_parse_raw_buffer("cpuid[0]=0000000d 756e6547 6c65746e 4965z6e6",
+                               44, &mem_raw) != ICUID_OK ||
+        mem_raw.cpuid[0][3] != 0x4965) {
+        _eprintf("ERROR: %s\n", "fixed width line misparsed");
+        return -1;
+    }
+
+    return check_hex_decoders();
+}
+
+/* Text and binary dumps convert to each other without loss */
+int check_binary(const char *file)
+{
+    static char text[16384];
+    static unsigned char bin[16384];
+    cpuid_raw_data_t raw, bin_raw, text_raw;
+    uint32_t regs[4];
+    size_t size;
+    int ret;
+
+    ret = cpuid_serialize_raw_data(&raw, file);
+    if (ret != ICUID_OK)
+        return ret;
+
+    size = sizeof(bin);
+    ret = icuid_raw_to_binary(&raw, bin, &size);
+    if (ret != ICUID_OK)
+        return ret;
+    ret = icuid_raw_from_binary(bin, size, &bin_raw);
+    if (ret != ICUID_OK)
+        return ret;
+    if (memcmp(&raw, &bin_raw, sizeof(raw)) != 0) {
+        _eprintf("ERROR: %s\n", "binary round trip differs");
+        return -1;
+    }
+
+    ret = icuid_binary_leaf(bin, size, 4, 0, regs);
+    if (ret != ICUID_OK)
+        return ret;
+    if (memcmp(regs, raw.cpuid[4], sizeof(regs)) != 0) {
+        _eprintf("ERROR: %s\n", "binary leaf lookup differs");
+        return -1;
+    }
+    if (icuid_raw_from_binary(bin, size - 1, &bin_raw) != ICUID_ERROR_PARSING) {
+        _eprintf("ERROR: %s\n", "truncated binary dump accepted");
+        return -1;
+    }
+
+    size = sizeof(text);
+    ret = icuid_raw_to_text(&raw, text, &size);
+    if (ret != ICUID_OK)
+        return ret;
+    ret = icuid_parse_raw_buffer(text, size, &text_raw);
+    if (ret != ICUID_OK)
+        return ret;
+    if (memcmp(&raw, &text_raw, sizeof(raw)) != 0) {
+        _eprintf("ERROR: %s\n", "text round trip differs");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Records stream back in order and the index finds the latest one */
+int check_archive(const char *file)
+{
+    static const char *archive = "check_archive.icra";
+    icuid_archive_entry_t meta[3], found;
+    cpuid_raw_data_t raw[3], read;
+    icuid_archive_t ar;
+    uint32_t i;
+    FILE *fp;
+    int ret;
+
+    ret = cpuid_serialize_raw_data(&raw[0], file);
+    if (ret != ICUID_OK)
+        return ret;
+    raw[1] = raw[0];
+    raw[1].cpuid[1][1] ^= 0x01000000; /* Another APIC ID */
+    raw[2] = raw[0];
+    raw[2].cpuid[1][0] += 1; /* A later stepping */
+
+    memset(meta, 0, sizeof(meta));
+    strcpy(meta[0].hostname, "node-b");
+    meta[0].timestamp = 100;
+    strcpy(meta[1].hostname, "node-a");
+    meta[1].timestamp = 100;
+    meta[1].cpu = 1;
+    strcpy(meta[2].hostname, "node-b");
+    meta[2].timestamp = 200;
+
+    remove(archive);
+    ret = icuid_archive_append(archive, meta, raw, 2);
+    if (ret != ICUID_OK)
+        return ret;
+
+    /* An append cut short leaves part of a record past the trailer */
+    if ((fp = fopen(archive, "ab")) == NULL)
+        return ICUID_ERROR_OPEN;
+    fwrite(&meta[2], sizeof(meta[2]), 1, fp);
+    fwrite(&raw[2], sizeof(raw[2]) / 2, 1, fp);
+    fclose(fp);
+    ret = icuid_archive_open(&ar, archive);
+    if (ret != ICUID_OK)
+        return ret;
+    for (i = 0; i < 2 && ret == ICUID_OK; i++)
+        ret = icuid_archive_next(&ar, &found, &read);
+    if (ret == ICUID_OK)
+        ret = icuid_archive_find(&ar, "node-b", 0, &found, &read);
+    icuid_archive_close(&ar);
+    if (ret != ICUID_OK || found.timestamp != 100) {
+        _eprintf("ERROR: %s\n", "interrupted append lost records");
+        return -1;
+    }
+
+    ret = icuid_archive_append(archive, &meta[2], &raw[2], 1);
+    if (ret == ICUID_OK)
+        ret = icuid_archive_open(&ar, archive);
+    if (ret != ICUID_OK)
+        return ret;
+
+    for (i = 0; i < 3; i++) {
+        ret = icuid_archive_next(&ar, &found, &read);
+        if (ret != ICUID_OK)
+            goto out;
+        if (strcmp(found.hostname, meta[i].hostname) != 0 ||
+            found.cpu != meta[i].cpu || found.timestamp != meta[i].timestamp ||
+            memcmp(&read, &raw[i], sizeof(read)) != 0) {
+            _eprintf("ERROR: %s\n", "archive record differs");
+            ret = -1;
+            goto out;
+        }
+    }
+    if (icuid_archive_next(&ar, &found, &read) != ICUID_ERROR_NOT_FOUND) {
+        _eprintf("ERROR: %s\n", "archive has too many records");
+        ret = -1;
+        goto out;
+    }
+
+    ret = icuid_archive_find(&ar, "node-b", 0, &found, &read);
+    if (ret != ICUID_OK)
+        goto out;
+    if (found.timestamp != 200 || memcmp(&read, &raw[2], sizeof(read)) != 0) {
+        _eprintf("ERROR: %s\n", "archive lookup missed the latest record");
+        ret = -1;
+        goto out;
+    }
+    if (icuid_archive_find(&ar, "node-a", 0, &found, &read) !=
+        ICUID_ERROR_NOT_FOUND) {
+        _eprintf("ERROR: %s\n", "archive lookup found a missing record");
+        ret = -1;
+    }
+
+out:
+    icuid_archive_close(&ar);
+    remove(archive);
+
+    return ret;
+}
+
+#define BATCH_RECORDS 64
+
+/* Identifying on a pool of threads matches identifying one by one */
+int check_batch(const char *file)
+{
+    static cpuid_raw_data_t raw[BATCH_RECORDS];
+    static cpuid_data_t data[BATCH_RECORDS], expected;
+    int status[BATCH_RECORDS];
+    uint32_t i;
+    int ret;
+
+    ret = cpuid_serialize_raw_data(&raw[0], file);
+    if (ret != ICUID_OK)
+        return ret;
+    for (i = 1; i < BATCH_RECORDS; i++) {
+        raw[i] = raw[0];
+        raw[i].cpuid[1][0] += i & 0xF; /* Vary the stepping */
+    }
+
+    ret = icuid_identify_batch(raw, data, NULL, BATCH_RECORDS, 4);
+    if (ret != ICUID_OK)
+        return ret;
+    for (i = 0; i < BATCH_RECORDS; i++) {
+        icuid_identify(&raw[i], &expected);
+        if (memcmp(&data[i], &expected, sizeof(expected)) != 0) {
+            _eprintf("ERROR: %s\n", "batch identification differs");
+            return -1;
+        }
+    }
+
+    /* A lazy record fails on its own, the others are still identified */
+    raw[5].lazy = 1;
+    raw[2].lazy = 1;
+    if (icuid_identify_batch(raw, data, status, BATCH_RECORDS, 4) !=
+        ICUID_ERROR_INVALID) {
+        _eprintf("ERROR: %s\n", "lazy raw data accepted by batch");
+        return -1;
+    }
+    for (i = 0; i < BATCH_RECORDS; i++) {
+        if (i != 2 && i != 5)
+            icuid_identify(&raw[i], &expected);
+        else
+            memset(&expected, 0, sizeof(expected));
+        if (status[i] != (i == 2 || i == 5 ? ICUID_ERROR_INVALID : ICUID_OK) ||
+            memcmp(&data[i], &expected, sizeof(expected)) != 0) {
+            _eprintf("ERROR: batch record %u has the wrong result\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* A loaded database overrides the built-in tables and can be swapped */
+int check_codedb(const char *text, const char *file)
+{
+    static const char *db = "check_codedb.icdb";
+    static const char *next_text = "check_codedb.txt";
+    static const char *next_db = "check_codedb.next.icdb";
+    cpuid_raw_data_t raw;
+    cpuid_data_t data;
+    const char *old, *cur;
+    FILE *fp;
+    int ret;
+
+    ret = cpuid_serialize_raw_data(&raw, file);
+    if (ret == ICUID_OK)
+        ret = icuid_codename_db_compile(text, db);
+    if (ret == ICUID_OK)
+        ret = icuid_codename_db_load(db);
+    if (ret != ICUID_OK)
+        return ret;
+    icuid_identify(&raw, &data);
+    old = data.codename;
+    if (strcmp(old, "Unknown") == 0) {
+        _eprintf("ERROR: %s\n", "codename database not used");
+        return -1;
+    }
+
+    /* Compiling over the loaded database replaces it, never rewrites it */
+    if ((fp = fopen(next_text, "w")) == NULL)
+        return ICUID_ERROR_OPEN;
+    fprintf(fp, "intel 0x%02X 0x%02X * Next\namd 0x%02X 0x%02X * Next\n",
+            data.ext_family, data.ext_model, data.ext_family, data.ext_model);
+    fclose(fp);
+    ret = icuid_codename_db_compile(next_text, db);
+    if (ret == ICUID_OK)
+        ret = icuid_codename_db_reload();
+    if (ret != ICUID_OK)
+        goto out;
+    icuid_identify(&raw, &data);
+    if (strcmp(data.codename, "Next") != 0 || strcmp(old, "Next") == 0) {
+        _eprintf("ERROR: %s\n", "reloaded codename database not used");
+        ret = -1;
+        goto out;
+    }
+    cur = data.codename;
+
+    /* A rejected file changes nothing, and is never taken for the current
+     * database by later reloads */
+    if ((fp = fopen(next_db, "w")) == NULL) {
+        ret = ICUID_ERROR_OPEN;
+        goto out;
+    }
+    fprintf(fp, "not a codename database\n");
+    fclose(fp);
+    ret = -1;
+    if (icuid_codename_db_load(next_db) != ICUID_ERROR_PARSING ||
+        icuid_codename_db_reload() != ICUID_OK) {
+        _eprintf("ERROR: %s\n", "failed load changed the codename database");
+        goto out;
+    }
+    icuid_identify(&raw, &data);
+    if (data.codename != cur) {
+        _eprintf("ERROR: %s\n", "codename database mapped again");
+        goto out;
+    }
+    if (rename(next_db, db) != 0 ||
+        icuid_codename_db_reload() != ICUID_ERROR_PARSING ||
+        icuid_codename_db_reload() != ICUID_ERROR_PARSING) {
+        _eprintf("ERROR: %s\n", "rejected codename database went unnoticed");
+        goto out;
+    }
+    icuid_identify(&raw, &data);
+    if (data.codename != cur) {
+        _eprintf("ERROR: %s\n", "rejected codename database used");
+        goto out;
+    }
+    ret = ICUID_OK;
+
+    /* Without a database the built-in tables answer */
+    icuid_codename_db_load(NULL);
+    icuid_identify(&raw, &data);
+    if (strcmp(data.codename, "Next") == 0) {
+        _eprintf("ERROR: %s\n", "unloaded codename database used");
+        ret = -1;
+        goto out;
+    }
+
+    /* Ambiguous rows are rejected */
+    if ((fp = fopen(next_text, "w")) == NULL)
+        return ICUID_ERROR_OPEN;
+    fprintf(fp, "intel 0x06 0x37 * Bay Trail\nintel 0x06 0x37 * Moorefield\n");
+    fclose(fp);
+    if (icuid_codename_db_compile(next_text, next_db) != ICUID_ERROR_PARSING) {
+        _eprintf("ERROR: %s\n", "ambiguous codename rows accepted");
+        ret = -1;
+    }
+
+out:
+    remove(db);
+    remove(next_db);
+    remove(next_text);
+
+    return ret;
+}
+
+/* Every feature name, and its common aliases, maps back to the feature */
+int check_feature_names(void)
+{
+    static const struct {
+        const char *name;
+        cpuid_feature_t feature;
+    } aliases[] = {
+        { "sse4_1", CPU_FEATURE_SSE4_1 },
+        { "bmi", CPU_FEATURE_BMI1 },
+        { "sgx_lc", CPU_FEATURE_SGX_LC },
+        { "AVX2", CPU_FEATURE_AVX2 },
+        { "nope", NUM_CPU_FEATURES },
+        { "avx512_this_name_is_far_too_long_to_exist", NUM_CPU_FEATURES },
+        { "", NUM_CPU_FEATURES },
+    };
+    const char *name;
+    uint32_t i;
+
+    for (i = 0; i < NUM_CPU_FEATURES; i++) {
+        name = cpu_feature_str((cpuid_feature_t)i);
+        if (name[0] != '\0' && cpu_feature_from_str(name) != (cpuid_feature_t)i) {
+            _eprintf("ERROR: %s does not map back to itself\n", name);
+            return -1;
+        }
+    }
+    for (i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+        if (cpu_feature_from_str(aliases[i].name) != aliases[i].feature) {
+            _eprintf("ERROR: %s maps to the wrong feature\n", aliases[i].name);
+            return -1;
+        }
+    }
+    if (cpu_feature_from_str(NULL) != NUM_CPU_FEATURES) {
+        _eprintf("ERROR: %s\n", "NULL feature name accepted");
+        return -1;
+    }
+
+    return 0;
+}
+
 static void usage(void)
 {
     printf("usage: icuid_test [option]\n");
     printf(" --generate_test <file>\n");
     printf(" --run_test <file>\n");
+    printf(" --check_lazy\n");
+    printf(" --check_cached\n");
+    printf(" --check_system\n");
+    printf(" --check_affinity\n");
+    printf(" --check_clock\n");
+    printf(" --check_flags\n");
+    printf(" --check_vector\n");
+    printf(" --check_feature_names\n");
+    printf(" --check_parse <file>\n");
+    printf(" --check_binary <file>\n");
+    printf(" --check_archive <file>\n");
+    printf(" --check_batch <file>\n");
+    printf(" --check_codedb <codenames.txt> <file>\n");
 }
 
 int main(int argc, char **argv)
@@ -343,11 +1420,39 @@ int main(int argc, char **argv)
     cpuid_raw_data_t raw;
     cpuid_data_t data;
 
+    if (argc == 2 && strcmp("--check_lazy", argv[1]) == 0)
+        return check_lazy();
+    if (argc == 2 && strcmp("--check_cached", argv[1]) == 0)
+        return check_cached();
+    if (argc == 2 && strcmp("--check_system", argv[1]) == 0)
+        return check_system();
+    if (argc == 2 && strcmp("--check_affinity", argv[1]) == 0)
+        return check_affinity();
+    if (argc == 2 && strcmp("--check_clock", argv[1]) == 0)
+        return check_clock();
+    if (argc == 2 && strcmp("--check_flags", argv[1]) == 0)
+        return check_flags();
+    if (argc == 2 && strcmp("--check_vector", argv[1]) == 0)
+        return check_vector();
+    if (argc == 2 && strcmp("--check_feature_names", argv[1]) == 0)
+        return check_feature_names();
+
     if (argc < 3) {
         usage();
         return ret;
     }
 
+    if (strcmp("--check_parse", argv[1]) == 0)
+        return check_parse(argv[2]);
+    if (strcmp("--check_binary", argv[1]) == 0)
+        return check_binary(argv[2]);
+    if (strcmp("--check_archive", argv[1]) == 0)
+        return check_archive(argv[2]);
+    if (strcmp("--check_batch", argv[1]) == 0)
+        return check_batch(argv[2]);
+    if (strcmp("--check_codedb", argv[1]) == 0 && argc > 3)
+        return check_codedb(argv[2], argv[3]);
+
     if (strcmp("--generate_test", argv[1]) == 0) {
         ret = cpuid_deserialize_raw_data(&raw, argv[2]);
         if (ret != ICUID_OK) {
@@ -371,7 +1476,7 @@ int main(int argc, char **argv)
             _eprintf("%s\n", icuid_errorstr(ret));
             return ret;
         }
-        ret = run_test(&data, argv[2]);
+        ret = run_test(&raw, &data, argv[2]);
     } else {
         _eprintf("Invalid option %s\n", argv[1]);
         usage();
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Compiles a text codename database, see tool/codenames.txt, into the file
+ * format read by icuid_codename_db_load().
+ */
+
+#include <stdio.h>
+
+#include <icuid/icuid.h>
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: icuid_codedb <codenames.txt> <codenames.icdb>\n");
+        return -1;
+    }
+
+    ret = icuid_codename_db_compile(argv[1], argv[2]);
+    if (ret != ICUID_OK) {
+        fprintf(stderr, "%s: %s\n", argv[1], icuid_errorstr(ret));
+        return -1;
+    }
+
+    return 0;
+}
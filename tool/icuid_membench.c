@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2015 - 2019, Kurt Cancemi (kurt@x64architecture.com)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Measures load latency with pointer chasing and read bandwidth with a
+ * streaming kernel at working-set sizes around the cache sizes reported
+ * by icuid_identify(), and flags levels whose measured knee disagrees
+ * with the reported size, e.g. a VM reporting the host's L3.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <icuid/icuid.h>
+
+#include "opt.h"
+
+#define DEFAULT_MAX_MB  256
+#define MIN_SIZE        (4 * 1024)
+#define MAX_POINTS      64
+/* Latency must grow by this much from one working set to the next for a knee */
+#define KNEE_RATIO      1.2
+#define BW_BYTES        (256 * 1024 * 1024)
+#define RUNS            3
+
+static FILE *out;
+
+static struct {
+    char *out;
+    char *max;
+    int help;
+} membench_opts;
+
+#if !defined(_MSC_VER) || (_MSC_VER >= 1800)
+#define HAVE_DESIGNATED_INITIALIZERS
+#endif
+#ifdef HAVE_DESIGNATED_INITIALIZERS
+#define DINIT(x, ...) x = __VA_ARGS__
+#else
+#define DINIT(x, ...) __VA_ARGS__
+#endif
+
+static struct OPTION membench_options[] = {
+    {
+      DINIT(.name,      "help"),
+      DINIT(.argname,   NULL),
+      DINIT(.desc,      "Print this help message"),
+      DINIT(.type,      OPTION_FLAG),
+      DINIT(.arg,       NULL),
+      DINIT(.flag,      &membench_opts.help),
+    },
+    {
+      DINIT(.name,      "output"),
+      DINIT(.argname,   "<file>"),
+      DINIT(.desc,      "Redirect output to file"),
+      DINIT(.type,      OPTION_ARG),
+      DINIT(.arg,       &membench_opts.out),
+      DINIT(.flag,      NULL),
+    },
+    {
+      DINIT(.name,      "max"),
+      DINIT(.argname,   "<MB>"),
+      DINIT(.desc,      "Largest working set in MB (default 256)"),
+      DINIT(.type,      OPTION_ARG),
+      DINIT(.arg,       &membench_opts.max),
+      DINIT(.flag,      NULL),
+    },
+    {
+      DINIT(.name,      NULL),
+      DINIT(.argname,   NULL),
+      DINIT(.desc,      NULL),
+      DINIT(.type,      0),
+      DINIT(.arg,       NULL),
+      DINIT(.flag,      NULL),
+    },
+};
+
+static icuid_clock_t clk;
+static double ticks_per_ns;
+
+static struct {
+    size_t size;
+    double latency; /* ns */
+} points[MAX_POINTS];
+static int num_points;
+
+/* Keeps the compiler from dropping the kernels' results */
+static volatile uint64_t sink;
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: icuid_membench [options]\n");
+    options_usage(membench_options);
+
+    return 0;
+}
+
+/* Falls back to timing the TSC against clock() if its frequency is unknown */
+static void calibrate_tsc(void)
+{
+    clock_t start, now;
+    uint64_t begin, end;
+
+    if (clk.frequency != 0) {
+        ticks_per_ns = clk.frequency / 1e9;
+        return;
+    }
+
+    start = clock();
+    while ((now = clock()) == start)
+        ;
+    begin = icuid_clock_begin(&clk);
+    while (clock() - now < CLOCKS_PER_SEC / 10)
+        ;
+    end = icuid_clock_end(&clk);
+    ticks_per_ns = (double)(end - begin) / (1e9 / 10);
+}
+
+static uint32_t xorshift(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+/*
+ * Links the |size| / |line| lines of |buf| into a single random cycle
+ * (Sattolo's algorithm), so the hardware prefetchers can't follow it
+ */
+static void **build_chain(char *buf, uint32_t *order, size_t size,
+                          size_t line)
+{
+    uint32_t n = (uint32_t)(size / line), i, j, tmp, seed = 0x9E3779B9;
+
+    for (i = 0; i < n; i++)
+        order[i] = i;
+    for (i = n - 1; i > 0; i--) {
+        j = xorshift(&seed) % i;
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (i = 0; i < n; i++)
+        *(void **)(buf + (size_t)i * line) = buf + (size_t)order[i] * line;
+
+    return (void **)buf;
+}
+
+static void **chase(void **p, uint32_t steps)
+{
+    for (; steps >= 8; steps -= 8) {
+        p = (void **)*p; p = (void **)*p; p = (void **)*p; p = (void **)*p;
+        p = (void **)*p; p = (void **)*p; p = (void **)*p; p = (void **)*p;
+    }
+    while (steps--)
+        p = (void **)*p;
+
+    return p;
+}
+
+/* Load-to-use latency in ns, with |size| bytes of |buf| as working set */
+static double measure_latency(char *buf, uint32_t *order, size_t size,
+                              size_t line)
+{
+    uint64_t begin, ticks, best = 0;
+    uint32_t steps, i;
+    void **p;
+
+    p = build_chain(buf, order, size, line);
+    steps = (uint32_t)(size / line);
+    if (steps < (1U << 20))
+        steps = 1U << 20;
+
+    p = chase(p, (uint32_t)(size / line)); /* warm up */
+    for (i = 0; i < RUNS; i++) {
+        begin = icuid_clock_begin(&clk);
+        p = chase(p, steps);
+        ticks = icuid_clock_end(&clk) - begin;
+        if (best == 0 || ticks < best)
+            best = ticks;
+    }
+    sink = (uint64_t)(size_t)p;
+
+    return best / ticks_per_ns / steps;
+}
+
+/* Read bandwidth in GB/s, streaming over |size| bytes of |buf| */
+static double measure_bandwidth(char *buf, size_t size)
+{
+    const uint64_t *words = (const uint64_t *)buf;
+    uint64_t begin, ticks, best = 0, s0, s1, s2, s3;
+    size_t n = size / sizeof(uint64_t), passes, pass, i;
+    uint32_t run;
+
+    passes = BW_BYTES / size;
+    if (passes == 0)
+        passes = 1;
+
+    s0 = s1 = s2 = s3 = 0;
+    for (run = 0; run <= RUNS; run++) {
+        begin = icuid_clock_begin(&clk);
+        for (pass = 0; pass < passes; pass++) {
+            for (i = 0; i + 4 <= n; i += 4) {
+                s0 += words[i];
+                s1 += words[i + 1];
+                s2 += words[i + 2];
+                s3 += words[i + 3];
+            }
+        }
+        ticks = icuid_clock_end(&clk) - begin;
+        /* The first run only warms the working set up */
+        if (run > 0 && (best == 0 || ticks < best))
+            best = ticks;
+    }
+    sink = s0 + s1 + s2 + s3;
+
+    return (double)size * passes / (best / ticks_per_ns);
+}
+
+static void sweep(char *buf, uint32_t *order, size_t max, size_t line)
+{
+    size_t size;
+    int i;
+
+    fprintf(out, "Working set   Latency\n");
+    for (i = 0; num_points < MAX_POINTS; i++) {
+        /* 4 KB, 6 KB, 8 KB, 12 KB, ... */
+        size = (size_t)MIN_SIZE << (i / 2);
+        if (i & 1)
+            size += size / 2;
+        if (size > max)
+            break;
+        points[num_points].size = size;
+        points[num_points].latency = measure_latency(buf, order, size, line);
+        fprintf(out, " %8lu KB  %7.1f ns\n", (unsigned long)(size / 1024),
+                points[num_points].latency);
+        num_points++;
+    }
+}
+
+static double latency_at(size_t size)
+{
+    int i;
+
+    for (i = num_points - 1; i > 0; i--) {
+        if (points[i].size <= size)
+            break;
+    }
+
+    return points[i].latency;
+}
+
+static double step_ratio(int i)
+{
+    return points[i + 1].latency / points[i].latency;
+}
+
+/*
+ * Returns the working set of the knee closest to |size| within a factor
+ * of 2 of it, or 0, and in |below| the largest knee under that range. A
+ * knee is a point after which latency jumps by KNEE_RATIO or more, more
+ * steeply than around it.
+ */
+static size_t find_knee(size_t size, size_t *below)
+{
+    size_t knee, found = 0;
+    double r;
+    int i;
+
+    *below = 0;
+    for (i = 0; i + 1 < num_points; i++) {
+        r = step_ratio(i);
+        if (r < KNEE_RATIO || (i > 0 && step_ratio(i - 1) > r) ||
+            (i + 2 < num_points && step_ratio(i + 1) >= r))
+            continue;
+
+        knee = points[i].size;
+        if (knee >= size / 2 && knee <= size * 2) {
+            if (found == 0 ||
+                (knee > size ? knee - size : size - knee) <
+                (found > size ? found - size : size - found))
+                found = knee;
+        } else if (knee < size / 2) {
+            *below = knee;
+        }
+    }
+
+    return found;
+}
+
+static int check_level(char *buf, const char *name, uint32_t kb,
+                       size_t max)
+{
+    size_t size = (size_t)kb * 1024, knee, below;
+
+    if (kb == 0)
+        return 0;
+
+    knee = find_knee(size, &below);
+    fprintf(out, "%-4s %9u KB", name, kb);
+    if (knee != 0)
+        fprintf(out, " %9lu KB", (unsigned long)(knee / 1024));
+    else
+        fprintf(out, " %12s", "-");
+    fprintf(out, " %7.1f ns", latency_at(size / 2));
+    if (size / 2 <= max)
+        fprintf(out, " %7.1f GB/s\n", measure_bandwidth(buf, size / 2));
+    else
+        fprintf(out, " %12s\n", "-");
+
+    if (knee != 0)
+        return 0;
+    if (size / 2 > max)
+        fprintf(out, "WARNING: %s: not tested, use --max to go beyond "
+                "%lu KB\n", name, (unsigned long)(max / 1024));
+    else if (below != 0)
+        fprintf(out, "WARNING: %s: no knee near the reported size, "
+                "the closest smaller one is at %lu KB\n", name,
+                (unsigned long)(below / 1024));
+    else if (size * 2 > max)
+        fprintf(out, "WARNING: %s: no knee up to %lu KB, use --max to "
+                "test beyond the reported size\n", name,
+                (unsigned long)(max / 1024));
+    else
+        fprintf(out, "WARNING: %s: no knee near the reported size\n", name);
+
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const cpuid_data_t *data;
+    size_t max, line;
+    uint32_t *order = NULL;
+    char *buf = NULL;
+    int ret, mismatches = 0;
+
+    memset(&membench_opts, 0, sizeof(membench_opts));
+
+    if (options_parse(argc, argv, membench_options, NULL) != 0) {
+        usage();
+        return -1;
+    }
+
+    if (membench_opts.help) {
+        usage();
+        return 0;
+    }
+
+    max = (size_t)DEFAULT_MAX_MB * 1024 * 1024;
+    if (membench_opts.max != NULL) {
+        max = (size_t)strtoul(membench_opts.max, NULL, 10) * 1024 * 1024;
+        if (max < MIN_SIZE) {
+            usage();
+            return -1;
+        }
+    }
+
+    out = stdout;
+    if (membench_opts.out != NULL) {
+        if ((out = fopen(membench_opts.out, "w")) == NULL) {
+            fprintf(stderr, "Can't open file %s\n", membench_opts.out);
+            return -1;
+        }
+    }
+
+    data = icuid_get();
+    ret = icuid_clock_init(&clk, data);
+    if (ret != ICUID_OK) {
+        fprintf(out, "%s\n", icuid_errorstr(ret));
+        ret = -1;
+        goto out;
+    }
+    calibrate_tsc();
+
+    line = data->l1_cacheline >= sizeof(void *) ? data->l1_cacheline : 64;
+    buf = malloc(max);
+    order = malloc(max / line * sizeof(*order));
+    if (buf == NULL || order == NULL) {
+        fprintf(out, "%s\n", icuid_errorstr(ICUID_ERROR_MEMORY));
+        ret = -1;
+        goto out;
+    }
+
+    sweep(buf, order, max, line);
+
+    fprintf(out, "\nLevel  Reported      Knee  Latency    Bandwidth\n");
+    mismatches += check_level(buf, "L1d", data->l1_data_cache, max);
+    mismatches += check_level(buf, "L2", data->l2_cache, max);
+    mismatches += check_level(buf, "L3", data->l3_cache, max);
+    mismatches += check_level(buf, "L4", data->l4_cache, max);
+    fprintf(out, "DRAM %12s %12s %7.1f ns %7.1f GB/s\n", "", "",
+            points[num_points - 1].latency, measure_bandwidth(buf, max));
+    ret = mismatches != 0;
+
+out:
+    free(buf);
+    free(order);
+    if (membench_opts.out != NULL)
+        fclose(out);
+
+    return ret;
+}
@@ -14,8 +14,18 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include <icuid/icuid.h>
 #include <icuid/icuid_ver.h>
@@ -28,6 +38,13 @@ static struct {
     char *out;
     char *dump;
     char *data;
+    char *binary;
+    char *append;
+    char *batch;
+    char *jobs;
+    char *codedb;
+    int cpus;
+    int vector;
     int help;
 } icuid_opts;
 
@@ -73,6 +90,62 @@ static struct OPTION icuid_options[] = {
       DINIT(.arg,       &icuid_opts.data),
       DINIT(.flag,      NULL),
     },
+    {
+      DINIT(.name,      "binary"),
+      DINIT(.argname,   "<file>"),
+      DINIT(.desc,      "Write raw cpuid data to file in binary form"),
+      DINIT(.type,      OPTION_ARG),
+      DINIT(.arg,       &icuid_opts.binary),
+      DINIT(.flag,      NULL),
+    },
+    {
+      DINIT(.name,      "append"),
+      DINIT(.argname,   "<file>"),
+      DINIT(.desc,      "Append raw cpuid data of every CPU to an archive"),
+      DINIT(.type,      OPTION_ARG),
+      DINIT(.arg,       &icuid_opts.append),
+      DINIT(.flag,      NULL),
+    },
+    {
+      DINIT(.name,      "batch"),
+      DINIT(.argname,   "<dir|archive>"),
+      DINIT(.desc,      "Identify every dump in a directory or archive"),
+      DINIT(.type,      OPTION_ARG),
+      DINIT(.arg,       &icuid_opts.batch),
+      DINIT(.flag,      NULL),
+    },
+    {
+      DINIT(.name,      "jobs"),
+      DINIT(.argname,   "<N>"),
+      DINIT(.desc,      "Threads used by --batch, one per CPU by default"),
+      DINIT(.type,      OPTION_ARG),
+      DINIT(.arg,       &icuid_opts.jobs),
+      DINIT(.flag,      NULL),
+    },
+    {
+      DINIT(.name,      "codedb"),
+      DINIT(.argname,   "<file>"),
+      DINIT(.desc,      "Look codenames up in a codename database first"),
+      DINIT(.type,      OPTION_ARG),
+      DINIT(.arg,       &icuid_opts.codedb),
+      DINIT(.flag,      NULL),
+    },
+    {
+      DINIT(.name,      "cpus"),
+      DINIT(.argname,   NULL),
+      DINIT(.desc,      "List every logical CPU and the leaves that differ"),
+      DINIT(.type,      OPTION_FLAG),
+      DINIT(.arg,       NULL),
+      DINIT(.flag,      &icuid_opts.cpus),
+    },
+    {
+      DINIT(.name,      "vector"),
+      DINIT(.argname,   NULL),
+      DINIT(.desc,      "Measure the throughput of each vector width"),
+      DINIT(.type,      OPTION_FLAG),
+      DINIT(.arg,       NULL),
+      DINIT(.flag,      &icuid_opts.vector),
+    },
     {
       DINIT(.name,      NULL),
       DINIT(.argname,   NULL),
@@ -104,6 +177,8 @@ static int print_summary(cpuid_raw_data_t *raw, cpuid_data_t *data)
     fprintf(out, " Vendor      : %s\n", data->vendor_str);
     fprintf(out, " Vendor ID   : %u\n", data->vendor);
     fprintf(out, " CPU         : %s\n", data->brand_str);
+    fprintf(out, " Hypervisor  : %s\n", data->hypervisor == HYPERVISOR_NONE ?
+            "None" : hypervisor_name(data->hypervisor));
 
     /* fprintf(out, "Cores Info:\n"); */
     fprintf(out, " Cores       : %u\n", data->cores);
@@ -119,6 +194,16 @@ static int print_summary(cpuid_raw_data_t *raw, cpuid_data_t *data)
     fprintf(out, " Ext Model   : %u\n", data->ext_model);
     fprintf(out, " Signature   : 0x%0x\n", data->signature);
 
+    /* fprintf(out, "Frequency Info:\n"); */
+    fprintf(out, " Base Freq.  : %u MHz (%s)\n", data->base_frequency,
+            freq_source_str(data->base_frequency_source));
+    fprintf(out, " Max Freq.   : %u MHz\n", data->max_frequency);
+    fprintf(out, " Bus Freq.   : %u MHz\n", data->bus_frequency);
+    fprintf(out, " TSC Freq.   : %lu.%06lu MHz (%s)\n",
+            (unsigned long)(data->tsc_frequency / 1000000),
+            (unsigned long)(data->tsc_frequency % 1000000),
+            freq_source_str(data->tsc_frequency_source));
+
     /* fprintf(out, "Cache Info:\n"); */
     fprintf(out, " L1 D Cache  : %uKB\n", data->l1_data_cache);
     fprintf(out, " L1 I Cache  : %uKB\n", data->l1_instruction_cache);
@@ -141,17 +226,458 @@ static int print_summary(cpuid_raw_data_t *raw, cpuid_data_t *data)
                                                 "Enabled" : "Disabled"));
     fprintf(out, " AVX State   : %s\n", (data->xfeatures[XFEATURE_AVX] == 1 ?
                                                 "Enabled" : "Disabled"));
+    fprintf(out, " XSAVE Size  : %u bytes (max %u, compacted %u, XSAVES %u)\n",
+            data->xsave_size, data->xsave_max_size, data->xsavec_size,
+            data->xsaves_size);
 
-    fprintf(out, " Features    :");
-    for (i = 0; i < NUM_CPU_FEATURES; i++) {
-        if (data->flags[i])
+    fprintf(out, " x86-64 Level: %s\n", x86_64_level_str(data->x86_64_level));
+    if (data->x86_64_level + 1 < NUM_X86_64_LEVELS) {
+        fprintf(out, " Next Level  :");
+        for (i = icuid_flags_next(&data->x86_64_missing, 0); i < NUM_CPU_FEATURES;
+             i = icuid_flags_next(&data->x86_64_missing, i + 1))
             fprintf(out, " %s", cpu_feature_str(i));
+        if (data->x86_64_missing_xfeatures)
+            fprintf(out, " xstate(0x%x)", data->x86_64_missing_xfeatures);
+        fprintf(out, "\n");
     }
+
+    fprintf(out, " Features    :");
+    for (i = icuid_flags_next(&data->flags, 0); i < NUM_CPU_FEATURES;
+         i = icuid_flags_next(&data->flags, i + 1))
+        fprintf(out, " %s", cpu_feature_str(i));
     fprintf(out, "\n");
 
     return 0;
 }
 
+/* Prints |set| as a list of ranges, e.g. "0-7,16-23" */
+static void print_cpuset(const cpuid_cpuset_t *set)
+{
+    uint32_t first, last;
+    const char *sep = "";
+
+    first = icuid_cpuset_next(set, 0);
+    while (first < MAX_LOGICAL_CPUS) {
+        last = first;
+        while (last + 1 < MAX_LOGICAL_CPUS && icuid_cpuset_test(set, last + 1))
+            last++;
+        if (first == last)
+            fprintf(out, "%s%u", sep, first);
+        else
+            fprintf(out, "%s%u-%u", sep, first, last);
+        sep = ",";
+        first = icuid_cpuset_next(set, last + 1);
+    }
+}
+
+static int print_cpus(void)
+{
+    static const char *regs[4] = { "eax", "ebx", "ecx", "edx" };
+    static const char *cache_types[4] = { "", " Data", " Instr", "" };
+    cpuid_system_raw_t sys;
+    cpuid_system_data_t data;
+    cpuid_core_type_data_t *type;
+    cpuid_cache_domain_t *cache;
+    cpuid_raw_diff_t *d;
+    uint32_t i, j;
+    int ret;
+
+    ret = cpuid_get_system_raw_data(&sys, ICUID_ENUM_AUTO);
+    if (ret == ICUID_OK) {
+        ret = icuid_identify_system(&sys, &data);
+        if (ret != ICUID_OK)
+            cpuid_free_system_raw_data(&sys);
+    }
+    if (ret != ICUID_OK) {
+        fprintf(out, "%s\n", icuid_errorstr(ret));
+        return -1;
+    }
+
+    fprintf(out, " CPU   APIC ID   Signature   Pkg  Die  Tile Mod  Core SMT  Core Type\n");
+    for (i = 0; i < sys.num_cpus; i++) {
+        fprintf(out, " %-5u 0x%-7x 0x%08x  ", sys.cpus[i].cpu,
+                sys.cpus[i].apic_id, sys.cpus[i].raw.cpuid[1][0]);
+        for (j = NUM_TOPO_LEVELS; j-- > 0;)
+            fprintf(out, "%-4u ", data.cpus[i].topo_id[j]);
+        fprintf(out, "%s\n", core_type_str(data.cpus[i].core_type));
+    }
+    fprintf(out, " Topology    : %u packages, %u dies, %u cores, %u logical\n",
+            data.topo_count[TOPO_LEVEL_PACKAGE], data.topo_count[TOPO_LEVEL_DIE],
+            data.topo_count[TOPO_LEVEL_CORE], data.topo_count[TOPO_LEVEL_SMT]);
+
+    for (i = 0; i < data.num_caches; i++) {
+        cache = &data.caches[i];
+        fprintf(out, " L%u%-10s: %uKB, CPUs ", cache->level,
+                cache_types[cache->type], cache->size);
+        print_cpuset(&cache->cpus);
+        fprintf(out, "\n");
+    }
+
+    for (i = 0; i < data.num_core_types; i++) {
+        type = &data.core_types[i];
+        fprintf(out, " Core Type   : %s", type->core_type == CORE_TYPE_UNKNOWN ?
+                "All" : core_type_str(type->core_type));
+        if (type->native_model_id != 0)
+            fprintf(out, " (native model 0x%x)", type->native_model_id);
+        fprintf(out, ", %u cores, %u logical, L1d %uKB, L2 %uKB, L3 %uKB, CPUs ",
+                type->cores, type->logical_cpus, type->data.l1_data_cache,
+                type->data.l2_cache, type->data.l3_cache);
+        print_cpuset(&type->cpus);
+        fprintf(out, "\n");
+    }
+
+    if (sys.num_diffs == 0)
+        fprintf(out, " All CPUs report the same CPUID leaves\n");
+    for (i = 0; i < sys.num_diffs; i++) {
+        d = &sys.diffs[i];
+        fprintf(out, " Differs     : leaf 0x%08x.%u %s mask 0x%08x on %u CPUs"
+                " (first CPU %u)\n", d->leaf, d->subleaf, regs[d->reg],
+                d->mask, d->num_cpus, sys.cpus[d->first_cpu].cpu);
+    }
+
+    icuid_free_system_data(&data);
+    cpuid_free_system_raw_data(&sys);
+
+    return 0;
+}
+
+static int print_vector(void)
+{
+    static const char *names[NUM_VECTOR_WIDTHS] = { "128", "256", "512" };
+    const cpuid_vector_width_info_t *info;
+    cpuid_vector_probe_t probe;
+    int i, ret;
+
+    ret = icuid_probe_vector_width(&probe, NULL);
+    if (ret != ICUID_OK) {
+        fprintf(out, "%s\n", icuid_errorstr(ret));
+        return -1;
+    }
+
+    fprintf(out, "Scalar      : %u MHz\n", probe.scalar_frequency);
+    for (i = 0; i < NUM_VECTOR_WIDTHS; i++) {
+        info = &probe.widths[i];
+        if (!info->supported) {
+            fprintf(out, "%s-bit     : not supported\n", names[i]);
+            continue;
+        }
+        fprintf(out, "%s-bit     : %.1f int/cycle, %.1f fma/cycle, "
+                "%u MHz (%.0f%%)\n", names[i], info->int_per_cycle,
+                info->fma_per_cycle, info->frequency,
+                info->frequency_ratio * 100);
+    }
+    fprintf(out, "Preferred   : %u-bit\n", probe.preferred_width);
+
+    return 0;
+}
+
+/* Reads a text or binary dump, telling them apart by the binary magic */
+static int read_data(cpuid_raw_data_t *raw, const char *file)
+{
+    char *buf;
+    long len;
+    FILE *fp;
+    int ret;
+
+    if ((fp = fopen(file, "rb")) == NULL)
+        return ICUID_ERROR_OPEN;
+    if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return ICUID_ERROR_OPEN;
+    }
+    if ((buf = malloc(len > 0 ? len : 1)) == NULL) {
+        fclose(fp);
+        return ICUID_ERROR_MEMORY;
+    }
+    len = (long)fread(buf, 1, len, fp);
+    fclose(fp);
+
+    if (len >= 4 && memcmp(buf, ICUID_BINARY_MAGIC, 4) == 0)
+        ret = icuid_raw_from_binary(buf, len, raw);
+    else
+        ret = icuid_parse_raw_buffer(buf, len, raw);
+    free(buf);
+
+    return ret;
+}
+
+static int write_binary(const cpuid_raw_data_t *raw, const char *file)
+{
+    size_t size;
+    void *buf;
+    FILE *fp;
+    int ret;
+
+    ret = icuid_raw_to_binary(raw, NULL, &size);
+    if (ret != ICUID_OK)
+        return ret;
+    if ((buf = malloc(size)) == NULL)
+        return ICUID_ERROR_MEMORY;
+    ret = icuid_raw_to_binary(raw, buf, &size);
+    if (ret == ICUID_OK) {
+        if ((fp = fopen(file, "wb")) == NULL) {
+            ret = ICUID_ERROR_OPEN;
+        } else {
+            if (fwrite(buf, 1, size, fp) != size)
+                ret = ICUID_ERROR_OPEN;
+            fclose(fp);
+        }
+    }
+    free(buf);
+
+    return ret;
+}
+
+/* Appends one record per logical CPU of this machine to an archive */
+static int append_archive(const char *file)
+{
+    icuid_archive_entry_t *meta;
+    cpuid_raw_data_t *raws;
+    cpuid_system_raw_t sys;
+    char hostname[ICUID_HOSTNAME_LEN];
+    uint64_t now;
+    uint32_t i;
+    int ret;
+#if defined(_WIN32)
+    DWORD len = sizeof(hostname);
+
+    if (!GetComputerNameA(hostname, &len))
+        strcpy(hostname, "localhost");
+#else
+    if (gethostname(hostname, sizeof(hostname)) != 0)
+        strcpy(hostname, "localhost");
+    hostname[sizeof(hostname) - 1] = '\0';
+#endif
+    now = (uint64_t)time(NULL);
+
+    ret = cpuid_get_system_raw_data(&sys, ICUID_ENUM_AUTO);
+    if (ret != ICUID_OK)
+        return ret;
+    meta = calloc(sys.num_cpus, sizeof(*meta));
+    raws = malloc(sys.num_cpus * sizeof(*raws));
+    if (meta == NULL || raws == NULL) {
+        ret = ICUID_ERROR_MEMORY;
+        goto out;
+    }
+    for (i = 0; i < sys.num_cpus; i++) {
+        strcpy(meta[i].hostname, hostname);
+        meta[i].timestamp = now;
+        meta[i].cpu = sys.cpus[i].cpu;
+        raws[i] = sys.cpus[i].raw;
+    }
+    ret = icuid_archive_append(file, meta, raws, sys.num_cpus);
+
+out:
+    free(meta);
+    free(raws);
+    cpuid_free_system_raw_data(&sys);
+
+    return ret;
+}
+
+/* Records identified at once by --batch */
+#define BATCH_SIZE 1024
+#define BATCH_NAME_LEN 256
+
+static struct {
+    cpuid_raw_data_t *raw;
+    cpuid_data_t *data;
+    int *status;
+    char (*names)[BATCH_NAME_LEN];
+    uint32_t n;
+    uint32_t jobs;
+    int ret; /* First error of the run */
+} batch;
+
+/* Remembers the first error of the run for the exit code */
+static void batch_error(const char *name, int ret)
+{
+    fprintf(out, "%s\t%s\n", name, icuid_errorstr(ret));
+    if (batch.ret == ICUID_OK)
+        batch.ret = ret;
+}
+
+static void batch_flush(void)
+{
+    cpuid_data_t *data;
+    uint32_t i;
+
+    icuid_identify_batch(batch.raw, batch.data, batch.status, batch.n,
+                         batch.jobs);
+    for (i = 0; i < batch.n; i++) {
+        data = &batch.data[i];
+        if (batch.status[i] != ICUID_OK)
+            batch_error(batch.names[i], batch.status[i]);
+        else
+            fprintf(out, "%s\t%s\t%s\t0x%08x\t%s\n", batch.names[i],
+                    data->vendor_str,
+                    data->codename != NULL ? data->codename : "Unknown",
+                    data->signature,
+                    data->brand_str);
+    }
+    batch.n = 0;
+}
+
+static void batch_add(const char *name, const cpuid_raw_data_t *raw)
+{
+    strncpy(batch.names[batch.n], name, BATCH_NAME_LEN - 1);
+    batch.names[batch.n][BATCH_NAME_LEN - 1] = '\0';
+    batch.raw[batch.n] = *raw;
+    if (++batch.n == BATCH_SIZE)
+        batch_flush();
+}
+
+/* Queues every record of an archive, or the file itself if it is a dump */
+static void batch_file(const char *file)
+{
+    char name[BATCH_NAME_LEN];
+    icuid_archive_entry_t meta;
+    cpuid_raw_data_t raw;
+    icuid_archive_t ar;
+    int ret;
+
+    if (icuid_archive_open(&ar, file) == ICUID_OK) {
+        while ((ret = icuid_archive_next(&ar, &meta, &raw)) == ICUID_OK) {
+            sprintf(name, "%.*s:%.64s/cpu%u@%llu", BATCH_NAME_LEN / 2, file,
+                    meta.hostname, meta.cpu,
+                    (unsigned long long)meta.timestamp);
+            batch_add(name, &raw);
+        }
+        if (ret != ICUID_ERROR_NOT_FOUND)
+            batch_error(file, ret);
+        icuid_archive_close(&ar);
+        return;
+    }
+
+    ret = read_data(&raw, file);
+    if (ret != ICUID_OK) {
+        batch_error(file, ret);
+        return;
+    }
+    batch_add(file, &raw);
+}
+
+/* Sets |child| to path/name, returns 0 if it doesn't fit */
+static int join_path(char *child, const char *path, const char *name)
+{
+    size_t len = strlen(path), n = strlen(name);
+
+    if (len + n + 2 > BATCH_NAME_LEN)
+        return 0;
+    memcpy(child, path, len);
+#if defined(_WIN32)
+    child[len] = '\\';
+#else
+    child[len] = '/';
+#endif
+    memcpy(child + len + 1, name, n + 1);
+
+    return 1;
+}
+
+/*
+ * Walks |path| depth first, queueing every file. Symbolic links to
+ * directories below |path| are not followed, they could loop back to it.
+ */
+static void batch_walk(const char *path)
+{
+    char child[BATCH_NAME_LEN];
+#if defined(_WIN32)
+    WIN32_FIND_DATAA find;
+    HANDLE h;
+    DWORD attr;
+
+    attr = GetFileAttributesA(path);
+    if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY)) {
+        batch_file(path);
+        return;
+    }
+    if (!join_path(child, path, "*"))
+        return;
+    if ((h = FindFirstFileA(child, &find)) == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        if (strcmp(find.cFileName, ".") == 0 ||
+            strcmp(find.cFileName, "..") == 0)
+            continue;
+        if ((find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+            (find.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            continue;
+        if (join_path(child, path, find.cFileName))
+            batch_walk(child);
+    } while (FindNextFileA(h, &find));
+    FindClose(h);
+#else
+    struct dirent *ent;
+    struct stat st;
+    DIR *dir;
+
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        batch_file(path);
+        return;
+    }
+    if ((dir = opendir(path)) == NULL)
+        return;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        if (!join_path(child, path, ent->d_name))
+            continue;
+        if (lstat(child, &st) == 0 && S_ISLNK(st.st_mode) &&
+            stat(child, &st) == 0 && S_ISDIR(st.st_mode))
+            continue;
+        batch_walk(child);
+    }
+    closedir(dir);
+#endif
+}
+
+/* Identifies every dump under |path|, one line per dump or error */
+static int run_batch(const char *path, const char *jobs)
+{
+    unsigned long n = 0;
+    char *end;
+    int ret = ICUID_OK;
+
+    /* A positive number of threads, or one per CPU if not given */
+    if (jobs != NULL) {
+        n = strtoul(jobs, &end, 10);
+        if (!isdigit((unsigned char)jobs[0]) || *end != '\0' || n == 0 ||
+            n > BATCH_SIZE) {
+            fprintf(stderr, "Invalid number of jobs %s\n", jobs);
+            return ICUID_ERROR_INVALID;
+        }
+    }
+
+    batch.raw = malloc(BATCH_SIZE * sizeof(*batch.raw));
+    batch.data = malloc(BATCH_SIZE * sizeof(*batch.data));
+    batch.status = malloc(BATCH_SIZE * sizeof(*batch.status));
+    batch.names = malloc(BATCH_SIZE * sizeof(*batch.names));
+    batch.n = 0;
+    batch.jobs = (uint32_t)n;
+    batch.ret = ICUID_OK;
+    if (batch.raw == NULL || batch.data == NULL || batch.status == NULL ||
+        batch.names == NULL) {
+        ret = ICUID_ERROR_MEMORY;
+        fprintf(out, "%s\n", icuid_errorstr(ret));
+        goto out;
+    }
+
+    batch_walk(path);
+    if (batch.n > 0)
+        batch_flush();
+    ret = batch.ret;
+
+out:
+    free(batch.raw);
+    free(batch.data);
+    free(batch.status);
+    free(batch.names);
+
+    return ret;
+}
+
 int main(int argc, char **argv)
 {
     int ret = -1;
@@ -178,6 +704,14 @@ int main(int argc, char **argv)
         }
     }
 
+    if (icuid_opts.codedb != NULL) {
+        ret = icuid_codename_db_load(icuid_opts.codedb);
+        if (ret != ICUID_OK) {
+            fprintf(out, "%s: %s\n", icuid_opts.codedb, icuid_errorstr(ret));
+            return -1;
+        }
+    }
+
     if (icuid_opts.dump != NULL) {
         ret = cpuid_deserialize_raw_data(&raw, icuid_opts.dump);
         if (ret != ICUID_OK) {
@@ -187,8 +721,39 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    if (icuid_opts.append != NULL) {
+        ret = append_archive(icuid_opts.append);
+        if (ret != ICUID_OK)
+            fprintf(out, "%s\n", icuid_errorstr(ret));
+        if (icuid_opts.out != NULL)
+            fclose(out);
+        return ret == ICUID_OK ? 0 : -1;
+    }
+
+    if (icuid_opts.batch != NULL) {
+        /* Errors are reported per file */
+        ret = run_batch(icuid_opts.batch, icuid_opts.jobs);
+        if (icuid_opts.out != NULL)
+            fclose(out);
+        return ret == ICUID_OK ? 0 : -1;
+    }
+
+    if (icuid_opts.cpus) {
+        ret = print_cpus();
+        if (icuid_opts.out != NULL)
+            fclose(out);
+        return ret;
+    }
+
+    if (icuid_opts.vector) {
+        ret = print_vector();
+        if (icuid_opts.out != NULL)
+            fclose(out);
+        return ret;
+    }
+
     if (icuid_opts.data != NULL) {
-        ret = cpuid_serialize_raw_data(&raw, icuid_opts.data);
+        ret = read_data(&raw, icuid_opts.data);
         if (ret != ICUID_OK) {
             fprintf(out, "%s\n", icuid_errorstr(ret));
             return -1;
@@ -201,6 +766,15 @@ int main(int argc, char **argv)
         }
     }
 
+    if (icuid_opts.binary != NULL) {
+        ret = write_binary(&raw, icuid_opts.binary);
+        if (ret != ICUID_OK)
+            fprintf(out, "%s\n", icuid_errorstr(ret));
+        if (icuid_opts.out != NULL)
+            fclose(out);
+        return ret == ICUID_OK ? 0 : -1;
+    }
+
     ret = print_summary(&raw, &data);
 
     if (icuid_opts.out != NULL)